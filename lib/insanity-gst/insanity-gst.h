@@ -26,6 +26,7 @@
 #include <insanity/insanitydefs.h>
 #include <insanity-gst/insanitygsttest.h>
 #include <insanity-gst/insanitygstpipelinetest.h>
+#include <insanity-gst/insanitygststepsequencer.h>
 
 #endif
 
@@ -32,6 +32,15 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <time.h>
+#endif
 #include <gst/gst.h>
 
 #include <insanity-gst/insanitygstpipelinetest.h>
@@ -68,9 +77,81 @@ struct _InsanityGstPipelineTestPrivateData
 
   GHashTable *elements_used;
 
+  /* Every buffering message, for the QoE numbers */
+  GArray *buffering_log;
+  GstClockTime start_time;
+
+  /* Pending waits, under the waits lock */
+  GList *waits;
+  guint next_wait_id;
+
+  /* Stall diagnostics */
+  gboolean stall_diagnostics;
+  gint stall_timeout;
+  guint stall_watchdog_id;
+  gint64 idle_since;
+  gboolean stalled;
+  guint stall_count;
+  GPtrArray *pad_activity;
+#ifdef HAVE_EXECINFO_H
+  GList *streaming_threads;
+  gulong sync_message_id;
+#endif
+
   gboolean done;
 };
 
+typedef struct
+{
+  GstClockTime time;            /* Since the test started */
+  gint percent;                 /* Or BUFFERING_SEEK */
+} BufferingEntry;
+
+/* Marks a flushing seek in the buffering log */
+#define BUFFERING_SEEK -1
+
+typedef enum
+{
+  WAIT_STATE,
+  WAIT_ASYNC_DONE,
+  WAIT_SEGMENT,
+  WAIT_PLAYBACK,
+} WaitType;
+
+/* A condition a test waits on. Pad probes hold references to it, as they
+ * may still run in streaming threads when it is cancelled */
+typedef struct
+{
+  volatile gint refcount;
+  guint id;
+  WaitType type;
+  GstState state;
+  GstClockTime duration;
+  InsanityGstPipelineTest *ptest;
+  InsanityGstWaitFunction func;
+  gpointer user_data;
+
+  /* The following are protected by the waits lock */
+  GSource *timeout_source;
+  GSource *dispatch_source;
+  GPtrArray *pads;
+  gboolean finished;
+  gboolean met;
+} Wait;
+
+typedef struct
+{
+  Wait *wait;
+  GstPad *pad;
+  gulong probe_id;
+
+  /* Only used from the streaming thread of the pad */
+  GstSegment segment;
+  GstClockTime start;
+} WaitPad;
+
+G_LOCK_DEFINE_STATIC (waits);
+
 static const GstFormat duration_query_formats[] =
     { GST_FORMAT_BYTES, GST_FORMAT_TIME, GST_FORMAT_DEFAULT };
 
@@ -155,6 +236,435 @@ send_error (InsanityGstPipelineTest * ptest, const GError * error,
   }
 }
 
+/* Pad activity, for the stall diagnostics */
+typedef struct
+{
+  GstPad *pad;
+  gulong probe_id;
+
+  /* Not locked: the probe must stay cheap and the stall diagnostics must
+   * not block on a wedged streaming thread. A 64 bit value may read torn
+   * on some 32 bit platforms, which a snapshot can live with */
+  gint64 last_activity;         /* Monotonic time, 0 if none yet */
+  volatile guint buffers;       /* Atomic */
+  GstClockTime last_pts;
+  volatile gint last_event;     /* Atomic GstEventType */
+} PadActivity;
+
+/* Protects the pad_activity array */
+G_LOCK_DEFINE_STATIC (activity);
+
+static GstPadProbeReturn
+activity_probe (GstPad * pad, GstPadProbeInfo * info, gpointer userdata)
+{
+  PadActivity *activity = userdata;
+  GstBuffer *buffer;
+
+  activity->last_activity = g_get_monotonic_time ();
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER) {
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    if (GST_BUFFER_PTS_IS_VALID (buffer))
+      activity->last_pts = GST_BUFFER_PTS (buffer);
+    g_atomic_int_inc ((volatile gint *) &activity->buffers);
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+    g_atomic_int_add ((volatile gint *) &activity->buffers,
+        gst_buffer_list_length (GST_PAD_PROBE_INFO_BUFFER_LIST (info)));
+  } else if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_BOTH) {
+    g_atomic_int_set (&activity->last_event,
+        GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)));
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+track_pad (InsanityGstPipelineTest * ptest, GstPad * pad)
+{
+  PadActivity *activity = g_slice_new0 (PadActivity);
+
+  activity->pad = gst_object_ref (pad);
+  activity->last_pts = GST_CLOCK_TIME_NONE;
+  activity->probe_id = gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST |
+      GST_PAD_PROBE_TYPE_EVENT_BOTH, activity_probe, activity, NULL);
+
+  G_LOCK (activity);
+  g_ptr_array_add (ptest->priv->pad_activity, activity);
+  G_UNLOCK (activity);
+}
+
+static void
+on_pad_added (GstElement * element, GstPad * pad,
+    InsanityGstPipelineTest * ptest)
+{
+  track_pad (ptest, pad);
+}
+
+static void
+track_element (InsanityGstPipelineTest * ptest, GstElement * element)
+{
+  GstIterator *it;
+  gboolean done = FALSE;
+  GValue data = { 0, };
+
+  if (!ptest->priv->stall_diagnostics)
+    return;
+
+  it = gst_element_iterate_pads (element);
+  while (!done) {
+    switch (gst_iterator_next (it, &data)) {
+      case GST_ITERATOR_OK:
+        track_pad (ptest, GST_PAD_CAST (g_value_get_object (&data)));
+        g_value_reset (&data);
+        break;
+      case GST_ITERATOR_RESYNC:
+        /* Pads seen already would be tracked twice, which is harmless */
+        gst_iterator_resync (it);
+        break;
+      case GST_ITERATOR_DONE:
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+  g_value_unset (&data);
+  gst_iterator_free (it);
+
+  g_signal_connect (element, "pad-added", (GCallback) on_pad_added, ptest);
+}
+
+static void
+free_pad_activity (gpointer data)
+{
+  PadActivity *activity = data;
+
+  gst_pad_remove_probe (activity->pad, activity->probe_id);
+  gst_object_unref (activity->pad);
+  g_slice_free (PadActivity, activity);
+}
+
+static gint64
+latest_activity (InsanityGstPipelineTest * ptest)
+{
+  GPtrArray *pad_activity = ptest->priv->pad_activity;
+  PadActivity *activity;
+  gint64 latest = 0;
+  guint n;
+
+  G_LOCK (activity);
+  for (n = 0; n < pad_activity->len; n++) {
+    activity = g_ptr_array_index (pad_activity, n);
+    latest = MAX (latest, activity->last_activity);
+  }
+  G_UNLOCK (activity);
+
+  return latest;
+}
+
+#ifdef HAVE_EXECINFO_H
+/* Streaming threads, between their stream-status enter and leave messages,
+ * which are posted from the threads themselves */
+typedef struct
+{
+  pthread_t thread;
+  char *owner;
+} StreamingThread;
+
+G_LOCK_DEFINE_STATIC (threads);
+
+#define MAX_BACKTRACE_DEPTH 64
+
+/* Only one thread is asked for its backtrace at a time */
+static sem_t backtrace_done;
+static void *backtrace_frames[MAX_BACKTRACE_DEPTH];
+static volatile sig_atomic_t backtrace_depth;
+
+static void
+on_sync_message (GstBus * bus, GstMessage * message,
+    InsanityGstPipelineTest * ptest)
+{
+  InsanityGstPipelineTestPrivateData *priv = ptest->priv;
+  GstStreamStatusType type;
+  GstElement *owner;
+  StreamingThread *st;
+  GList *l;
+
+  if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_STREAM_STATUS)
+    return;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+  G_LOCK (threads);
+  if (type == GST_STREAM_STATUS_TYPE_ENTER) {
+    st = g_slice_new (StreamingThread);
+    st->thread = pthread_self ();
+    st->owner = gst_object_get_name (GST_OBJECT (owner));
+    priv->streaming_threads = g_list_prepend (priv->streaming_threads, st);
+  } else if (type == GST_STREAM_STATUS_TYPE_LEAVE) {
+    for (l = priv->streaming_threads; l; l = l->next) {
+      st = l->data;
+      if (pthread_equal (st->thread, pthread_self ())) {
+        priv->streaming_threads =
+            g_list_delete_link (priv->streaming_threads, l);
+        g_free (st->owner);
+        g_slice_free (StreamingThread, st);
+        break;
+      }
+    }
+  }
+  G_UNLOCK (threads);
+}
+
+static void
+backtrace_handler (int sig)
+{
+  backtrace_depth = backtrace (backtrace_frames, MAX_BACKTRACE_DEPTH);
+  sem_post (&backtrace_done);
+}
+
+static gboolean
+install_backtrace_handler (void)
+{
+  static gboolean installed = FALSE;
+  struct sigaction action;
+  void *frame;
+
+  if (installed)
+    return TRUE;
+
+  /* backtrace may allocate when first called, not in the handler then */
+  backtrace (&frame, 1);
+
+  if (sem_init (&backtrace_done, 0, 0) < 0)
+    return FALSE;
+  memset (&action, 0, sizeof (action));
+  action.sa_handler = &backtrace_handler;
+  sigemptyset (&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  /* Kept once installed, a late answer must not kill the test */
+  if (sigaction (SIGUSR2, &action, NULL) < 0)
+    return FALSE;
+
+  installed = TRUE;
+  return TRUE;
+}
+
+static void
+dump_backtraces (InsanityGstPipelineTest * ptest, FILE * f)
+{
+  StreamingThread *st;
+  struct timespec deadline;
+  GList *l;
+  int res;
+
+  fprintf (f, "\nStreaming threads:\n");
+  if (!install_backtrace_handler ()) {
+    fprintf (f, "  Failed to install the backtrace handler: %s\n",
+        g_strerror (errno));
+    return;
+  }
+
+  /* Drop any late answer from a previous dump */
+  while (sem_trywait (&backtrace_done) == 0)
+    continue;
+
+  /* Threads can not leave, and be gone, while we hold the lock */
+  G_LOCK (threads);
+  for (l = ptest->priv->streaming_threads; l; l = l->next) {
+    st = l->data;
+    fprintf (f, "  Thread of %s:\n", st->owner);
+    fflush (f);
+
+    backtrace_depth = 0;
+    if (pthread_kill (st->thread, SIGUSR2) != 0) {
+      fprintf (f, "    Failed to signal the thread\n");
+      continue;
+    }
+    clock_gettime (CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += 1;
+    do {
+      res = sem_timedwait (&backtrace_done, &deadline);
+    } while (res < 0 && errno == EINTR);
+    if (res < 0) {
+      /* Its answer could come late, and mix with the next ones */
+      fprintf (f, "    No answer, giving up on backtraces\n");
+      break;
+    }
+    backtrace_symbols_fd (backtrace_frames, (int) backtrace_depth, fileno (f));
+  }
+  G_UNLOCK (threads);
+}
+
+static void
+free_streaming_threads (InsanityGstPipelineTest * ptest)
+{
+  StreamingThread *st;
+
+  G_LOCK (threads);
+  while (ptest->priv->streaming_threads) {
+    st = ptest->priv->streaming_threads->data;
+    g_free (st->owner);
+    g_slice_free (StreamingThread, st);
+    ptest->priv->streaming_threads =
+        g_list_delete_link (ptest->priv->streaming_threads,
+        ptest->priv->streaming_threads);
+  }
+  G_UNLOCK (threads);
+}
+#else
+static void
+dump_backtraces (InsanityGstPipelineTest * ptest, FILE * f)
+{
+  fprintf (f, "\nStreaming threads: backtraces not supported here\n");
+}
+#endif
+
+static void
+untrack_pipeline (InsanityGstPipelineTest * ptest)
+{
+  InsanityGstPipelineTestPrivateData *priv = ptest->priv;
+
+#ifdef HAVE_EXECINFO_H
+  if (priv->sync_message_id) {
+    g_signal_handler_disconnect (priv->bus, priv->sync_message_id);
+    gst_bus_disable_sync_message_emission (priv->bus);
+    priv->sync_message_id = 0;
+  }
+  free_streaming_threads (ptest);
+#endif
+  /* The pipeline is stopped, no probe can be running */
+  g_ptr_array_remove_range (priv->pad_activity, 0, priv->pad_activity->len);
+}
+
+static void
+dump_pad_activity (InsanityGstPipelineTest * ptest, FILE * f)
+{
+  GPtrArray *pad_activity = ptest->priv->pad_activity;
+  PadActivity *activity;
+  gint64 now = g_get_monotonic_time ();
+  guint n;
+
+  fprintf (f, "\nPads:\n");
+  G_LOCK (activity);
+  for (n = 0; n < pad_activity->len; n++) {
+    gint64 last_activity;
+    GstEventType last_event;
+
+    activity = g_ptr_array_index (pad_activity, n);
+    last_activity = activity->last_activity;
+    last_event = g_atomic_int_get (&activity->last_event);
+
+    fprintf (f, "  %s:%s: ", GST_DEBUG_PAD_NAME (activity->pad));
+    if (last_activity > 0)
+      fprintf (f, "last active %" G_GINT64_FORMAT " ms ago",
+          (now - last_activity) / 1000);
+    else
+      fprintf (f, "never active");
+    fprintf (f, ", %u buffers, last pts %" GST_TIME_FORMAT
+        ", last event %s\n",
+        (guint) g_atomic_int_get ((volatile gint *) &activity->buffers),
+        GST_TIME_ARGS (activity->last_pts),
+        last_event ? gst_event_type_get_name (last_event) : "none");
+  }
+  G_UNLOCK (activity);
+}
+
+static void
+dump_element (GstElement * element, FILE * f, gboolean levels)
+{
+  GObjectClass *klass = G_OBJECT_GET_CLASS (element);
+  guint buffers, bytes, max_buffers, max_bytes;
+  guint64 time, max_time;
+
+  if (!levels) {
+    /* Not locking, a stuck element may hold its lock */
+    fprintf (f, "  %s: %s", GST_OBJECT_NAME (element),
+        gst_element_state_get_name (GST_STATE (element)));
+    if (GST_STATE_PENDING (element) != GST_STATE_VOID_PENDING)
+      fprintf (f, " (pending %s)",
+          gst_element_state_get_name (GST_STATE_PENDING (element)));
+    fprintf (f, "\n");
+    return;
+  }
+
+  /* queue, queue2, and multiqueue which only tells its limits */
+  if (!g_object_class_find_property (klass, "max-size-buffers"))
+    return;
+
+  g_object_get (element, "max-size-buffers", &max_buffers, "max-size-bytes",
+      &max_bytes, "max-size-time", &max_time, NULL);
+  fprintf (f, "  %s: ", GST_OBJECT_NAME (element));
+  if (g_object_class_find_property (klass, "current-level-buffers")) {
+    g_object_get (element, "current-level-buffers", &buffers,
+        "current-level-bytes", &bytes, "current-level-time", &time, NULL);
+    fprintf (f, "%u/%u buffers, %u/%u bytes, %" GST_TIME_FORMAT "/%"
+        GST_TIME_FORMAT "\n", buffers, max_buffers, bytes, max_bytes,
+        GST_TIME_ARGS (time), GST_TIME_ARGS (max_time));
+  } else {
+    fprintf (f, "levels unknown, max %u buffers, %u bytes, %" GST_TIME_FORMAT
+        "\n", max_buffers, max_bytes, GST_TIME_ARGS (max_time));
+  }
+}
+
+static void
+dump_elements (InsanityGstPipelineTest * ptest, FILE * f, gboolean levels)
+{
+  GstIterator *it;
+  gboolean done = FALSE;
+  GValue data = { 0, };
+
+  fprintf (f, levels ? "\nQueues:\n" : "\nElements:\n");
+  it = gst_bin_iterate_recurse (GST_BIN (ptest->priv->pipeline));
+  while (!done) {
+    switch (gst_iterator_next (it, &data)) {
+      case GST_ITERATOR_OK:
+        dump_element (GST_ELEMENT_CAST (g_value_get_object (&data)), f, levels);
+        g_value_reset (&data);
+        break;
+      case GST_ITERATOR_RESYNC:
+        fprintf (f, "  (pipeline changed, starting over)\n");
+        gst_iterator_resync (it);
+        break;
+      case GST_ITERATOR_DONE:
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+  g_value_unset (&data);
+  gst_iterator_free (it);
+}
+
+static gboolean
+stall_watchdog (gpointer data)
+{
+  InsanityGstPipelineTest *ptest = data;
+  InsanityGstPipelineTestPrivateData *priv = ptest->priv;
+  GstElement *pipeline = GST_ELEMENT (priv->pipeline);
+  gint64 now = g_get_monotonic_time (), latest;
+
+  /* Only a playing pipeline is expected to move data */
+  if (GST_STATE (pipeline) != GST_STATE_PLAYING
+      || GST_STATE_PENDING (pipeline) != GST_STATE_VOID_PENDING) {
+    priv->idle_since = now;
+    priv->stalled = FALSE;
+    return TRUE;
+  }
+
+  latest = latest_activity (ptest);
+  if (latest > priv->idle_since) {
+    priv->idle_since = latest;
+    priv->stalled = FALSE;
+  }
+
+  if (!priv->stalled && now - priv->idle_since >= priv->stall_timeout * 1000) {
+    priv->stalled = TRUE;
+    insanity_gst_pipeline_test_dump_stall_diagnostics (ptest,
+        "No data seen on any pad for stall-timeout");
+  }
+
+  return TRUE;
+}
+
 static void on_element_added (GstElement * bin, GstElement * element,
     InsanityGstPipelineTest * ptest);
 
@@ -172,6 +682,7 @@ watch_container (InsanityGstPipelineTest * ptest, GstBin * bin)
       case GST_ITERATOR_OK:
         e = GST_ELEMENT_CAST (g_value_get_object (&data));
         add_element_used (ptest, e);
+        track_element (ptest, e);
         if (GST_IS_BIN (e)) {
           watch_container (ptest, GST_BIN (e));
         }
@@ -198,6 +709,7 @@ on_element_added (GstElement * bin, GstElement * element,
     InsanityGstPipelineTest * ptest)
 {
   add_element_used (ptest, element);
+  track_element (ptest, element);
   if (GST_IS_BIN (element))
     watch_container (ptest, GST_BIN (element));
 }
@@ -306,11 +818,437 @@ insanity_gst_pipeline_test_query_duration (InsanityGstPipelineTest * ptest,
   }
 }
 
+static void
+record_buffering (InsanityGstPipelineTest * ptest, GstMessage * message)
+{
+  BufferingEntry entry;
+
+  gst_message_parse_buffering (message, &entry.percent);
+  entry.time = gst_util_get_timestamp () - ptest->priv->start_time;
+  g_array_append_val (ptest->priv->buffering_log, entry);
+}
+
+/* Derives from the buffering messages the numbers player analytics
+ * usually collect: the startup buffering, from the first message to the
+ * first 100%, then every later drop below 100% is a rebuffer, stalling
+ * playback until the next 100%. Buffering again after a flushing seek is
+ * what the seek costs rather than a stall, it is accounted on its own */
+static void
+buffering_report (InsanityGstPipelineTest * ptest)
+{
+  InsanityTest *test = INSANITY_TEST (ptest);
+  GArray *log = ptest->priv->buffering_log;
+  GstClockTime now, play_start = GST_CLOCK_TIME_NONE, stall_start = 0;
+  GstClockTime stall_time = 0, seek_start = 0, seek_time = 0;
+  BufferingEntry *entry;
+  guint i, rebuffers = 0;
+  gboolean stalling = FALSE, seeking = FALSE;
+  gdouble ratio;
+  gint max;
+  GValue v = { 0 };
+
+  now = gst_util_get_timestamp () - ptest->priv->start_time;
+
+  for (i = 0; i < log->len; i++) {
+    entry = &g_array_index (log, BufferingEntry, i);
+
+    if (entry->percent == BUFFERING_SEEK) {
+      /* Before playback started, it is all startup buffering */
+      if (!GST_CLOCK_TIME_IS_VALID (play_start))
+        continue;
+
+      if (stalling) {
+        stalling = FALSE;
+        stall_time += entry->time - stall_start;
+      }
+      if (!seeking) {
+        seeking = TRUE;
+        seek_start = entry->time;
+      }
+    } else if (!GST_CLOCK_TIME_IS_VALID (play_start)) {
+      if (entry->percent == 100)
+        play_start = entry->time;
+    } else if (seeking) {
+      if (entry->percent == 100) {
+        seeking = FALSE;
+        seek_time += entry->time - seek_start;
+      }
+    } else if (entry->percent < 100 && !stalling) {
+      stalling = TRUE;
+      stall_start = entry->time;
+      rebuffers++;
+    } else if (entry->percent == 100 && stalling) {
+      stalling = FALSE;
+      stall_time += entry->time - stall_start;
+    }
+  }
+  if (stalling)
+    stall_time += now - stall_start;
+  if (seeking)
+    seek_time += now - seek_start;
+
+  /* Nothing to tell if playback never started, or never buffered */
+  if (!GST_CLOCK_TIME_IS_VALID (play_start))
+    return;
+
+  g_value_init (&v, G_TYPE_UINT64);
+  g_value_set_uint64 (&v, play_start - g_array_index (log, BufferingEntry,
+          0).time);
+  insanity_test_set_extra_info (test, "startup-buffering-time", &v);
+  g_value_set_uint64 (&v, stall_time);
+  insanity_test_set_extra_info (test, "stall-time", &v);
+  g_value_set_uint64 (&v, seek_time);
+  insanity_test_set_extra_info (test, "seek-buffering-time", &v);
+  g_value_unset (&v);
+
+  g_value_init (&v, G_TYPE_UINT);
+  g_value_set_uint (&v, rebuffers);
+  insanity_test_set_extra_info (test, "rebuffers", &v);
+  g_value_unset (&v);
+
+  /* Out of the time spent playing, seeks excluded */
+  now -= seek_time;
+  ratio = now > play_start ? (gdouble) stall_time / (now - play_start) : 0;
+  g_value_init (&v, G_TYPE_DOUBLE);
+  g_value_set_double (&v, ratio);
+  insanity_test_set_extra_info (test, "stall-ratio", &v);
+  g_value_unset (&v);
+
+  /* Only checked when asked for */
+  insanity_test_get_int_argument (test, "max-startup-buffering-time", &max);
+  if (max >= 0) {
+    insanity_test_validate_checklist_item (test, "startup-buffering-acceptable",
+        play_start - g_array_index (log, BufferingEntry, 0).time <=
+        max * GST_MSECOND, NULL);
+  }
+  insanity_test_get_int_argument (test, "max-rebuffers", &max);
+  if (max >= 0) {
+    insanity_test_validate_checklist_item (test, "rebuffers-acceptable",
+        rebuffers <= (guint) max, NULL);
+  }
+  insanity_test_get_int_argument (test, "max-stall-percent", &max);
+  if (max >= 0) {
+    insanity_test_validate_checklist_item (test, "stall-ratio-acceptable",
+        ratio * 100 <= max, NULL);
+  }
+}
+
+static Wait *
+wait_ref (Wait * wait)
+{
+  g_atomic_int_inc (&wait->refcount);
+  return wait;
+}
+
+static void
+wait_unref (Wait * wait)
+{
+  WaitPad *wpad;
+  guint i;
+
+  if (!g_atomic_int_dec_and_test (&wait->refcount))
+    return;
+
+  for (i = 0; i < wait->pads->len; i++) {
+    wpad = g_ptr_array_index (wait->pads, i);
+    gst_object_unref (wpad->pad);
+    g_slice_free (WaitPad, wpad);
+  }
+  g_ptr_array_free (wait->pads, TRUE);
+  if (wait->timeout_source)
+    g_source_unref (wait->timeout_source);
+  if (wait->dispatch_source)
+    g_source_unref (wait->dispatch_source);
+  g_slice_free (Wait, wait);
+}
+
+/* Must be called with the waits lock held */
+static void
+wait_disarm (Wait * wait)
+{
+  WaitPad *wpad;
+  guint i;
+
+  if (wait->timeout_source)
+    g_source_destroy (wait->timeout_source);
+  for (i = 0; i < wait->pads->len; i++) {
+    wpad = g_ptr_array_index (wait->pads, i);
+    if (wpad->probe_id) {
+      gst_pad_remove_probe (wpad->pad, wpad->probe_id);
+      wpad->probe_id = 0;
+    }
+  }
+}
+
+static gboolean
+wait_dispatch (gpointer data)
+{
+  Wait *wait = data;
+  InsanityGstPipelineTest *ptest = wait->ptest;
+
+  G_LOCK (waits);
+  ptest->priv->waits = g_list_remove (ptest->priv->waits, wait);
+  G_UNLOCK (waits);
+
+  (*wait->func) (ptest, wait->met, wait->user_data);
+  wait_unref (wait);
+
+  return FALSE;
+}
+
+/* Must be called with the waits lock held. The test is called back from
+ * the main loop, whichever thread met the condition */
+static void
+wait_finish (Wait * wait, gboolean met)
+{
+  if (wait->finished)
+    return;
+  wait->finished = TRUE;
+  wait->met = met;
+  wait_disarm (wait);
+
+  wait->dispatch_source = g_idle_source_new ();
+  g_source_set_callback (wait->dispatch_source, wait_dispatch,
+      wait_ref (wait), (GDestroyNotify) wait_unref);
+  g_source_attach (wait->dispatch_source, NULL);
+}
+
+static gboolean
+wait_timeout (gpointer data)
+{
+  G_LOCK (waits);
+  wait_finish (data, FALSE);
+  G_UNLOCK (waits);
+
+  return FALSE;
+}
+
+static Wait *
+wait_new (InsanityGstPipelineTest * ptest, WaitType type,
+    InsanityGstWaitFunction func, gpointer user_data)
+{
+  Wait *wait = g_slice_new0 (Wait);
+
+  wait->refcount = 1;
+  wait->type = type;
+  wait->ptest = ptest;
+  wait->func = func;
+  wait->user_data = user_data;
+  wait->pads = g_ptr_array_new ();
+
+  return wait;
+}
+
+/* Makes the wait pending, the caller keeping its reference while it
+ * finishes setting it up */
+static guint
+wait_start (Wait * wait, guint timeout)
+{
+  InsanityGstPipelineTestPrivateData *priv = wait->ptest->priv;
+
+  G_LOCK (waits);
+  wait->id = ++priv->next_wait_id;
+  priv->waits = g_list_append (priv->waits, wait_ref (wait));
+  if (timeout) {
+    wait->timeout_source = g_timeout_source_new (timeout);
+    g_source_set_callback (wait->timeout_source, wait_timeout,
+        wait_ref (wait), (GDestroyNotify) wait_unref);
+    g_source_attach (wait->timeout_source, NULL);
+  }
+  G_UNLOCK (waits);
+
+  return wait->id;
+}
+
+static void
+wait_check_message (InsanityGstPipelineTest * ptest, GstMessage * message)
+{
+  GstState newstate, pending;
+  GList *l;
+  Wait *wait;
+
+  if (GST_MESSAGE_SRC (message) != GST_OBJECT (ptest->priv->pipeline))
+    return;
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_STATE_CHANGED)
+    gst_message_parse_state_changed (message, NULL, &newstate, &pending);
+  else if (GST_MESSAGE_TYPE (message) != GST_MESSAGE_ASYNC_DONE)
+    return;
+
+  G_LOCK (waits);
+  for (l = ptest->priv->waits; l; l = l->next) {
+    wait = l->data;
+    if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_ASYNC_DONE) {
+      if (wait->type == WAIT_ASYNC_DONE)
+        wait_finish (wait, TRUE);
+    } else if (wait->type == WAIT_STATE && newstate == wait->state
+        && pending == GST_STATE_VOID_PENDING) {
+      wait_finish (wait, TRUE);
+    }
+  }
+  G_UNLOCK (waits);
+}
+
+static GstPadProbeReturn
+wait_probe (GstPad * pad, GstPadProbeInfo * info, gpointer userdata)
+{
+  WaitPad *wpad = userdata;
+  Wait *wait = wpad->wait;
+  GstBuffer *buffer;
+  GstEvent *event;
+  GstClockTime running_time;
+  gboolean met = FALSE;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & (GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+          GST_PAD_PROBE_TYPE_EVENT_FLUSH)) {
+    event = GST_PAD_PROBE_INFO_EVENT (info);
+    if (GST_EVENT_TYPE (event) == GST_EVENT_SEGMENT) {
+      gst_event_copy_segment (event, &wpad->segment);
+      met = wait->type == WAIT_SEGMENT;
+    } else if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP) {
+      /* Running time starts again from zero */
+      wpad->start = GST_CLOCK_TIME_NONE;
+    }
+  } else if (wpad->segment.format == GST_FORMAT_TIME) {
+    buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+    running_time = gst_segment_to_running_time (&wpad->segment,
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    if (!GST_CLOCK_TIME_IS_VALID (running_time)) {
+      /* Outside of the segment, or no timestamp */
+    } else if (!GST_CLOCK_TIME_IS_VALID (wpad->start)) {
+      wpad->start = running_time;
+    } else if (running_time >= wpad->start + wait->duration) {
+      met = TRUE;
+    }
+  }
+
+  if (!met)
+    return GST_PAD_PROBE_OK;
+
+  G_LOCK (waits);
+  if (wait->finished || wpad->probe_id == 0) {
+    G_UNLOCK (waits);
+    return GST_PAD_PROBE_OK;
+  }
+  /* Removed by our return value */
+  wpad->probe_id = 0;
+  wait_finish (wait, TRUE);
+  G_UNLOCK (waits);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+wait_add_pad (Wait * wait, GstPad * pad)
+{
+  /* Flush events are only seen by probes asking for them */
+  GstPadProbeType mask = GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM |
+      GST_PAD_PROBE_TYPE_EVENT_FLUSH;
+  GstEvent *event;
+  WaitPad *wpad;
+
+  if (wait->type == WAIT_PLAYBACK)
+    mask |= GST_PAD_PROBE_TYPE_BUFFER;
+
+  wpad = g_slice_new0 (WaitPad);
+  wpad->wait = wait;
+  wpad->pad = gst_object_ref (pad);
+  wpad->start = GST_CLOCK_TIME_NONE;
+  gst_segment_init (&wpad->segment, GST_FORMAT_UNDEFINED);
+
+  /* The segment in use, as we may be added mid stream */
+  event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+  if (event) {
+    gst_event_copy_segment (event, &wpad->segment);
+    gst_event_unref (event);
+  }
+
+  G_LOCK (waits);
+  g_ptr_array_add (wait->pads, wpad);
+  if (!wait->finished) {
+    wpad->probe_id = gst_pad_add_probe (pad, mask, wait_probe, wpad,
+        (GDestroyNotify) wait_unref);
+    if (wpad->probe_id)
+      wait_ref (wait);
+  }
+  G_UNLOCK (waits);
+}
+
+/* Without a pad, the sink pads of all the sinks in the pipeline are
+ * watched, and the first one to meet the condition wins */
+static void
+wait_add_pads (Wait * wait, GstPad * pad)
+{
+  GstIterator *sinks, *pads;
+  GValue sink = { 0 }, sinkpad = { 0 };
+  gboolean done = FALSE;
+
+  if (pad) {
+    wait_add_pad (wait, pad);
+    return;
+  }
+
+  sinks = gst_bin_iterate_sinks (GST_BIN (wait->ptest->priv->pipeline));
+  while (!done) {
+    switch (gst_iterator_next (sinks, &sink)) {
+      case GST_ITERATOR_OK:
+        pads = gst_element_iterate_sink_pads (g_value_get_object (&sink));
+        while (gst_iterator_next (pads, &sinkpad) == GST_ITERATOR_OK) {
+          wait_add_pad (wait, g_value_get_object (&sinkpad));
+          g_value_reset (&sinkpad);
+        }
+        g_value_unset (&sinkpad);
+        gst_iterator_free (pads);
+        g_value_reset (&sink);
+        break;
+      case GST_ITERATOR_RESYNC:
+        gst_iterator_resync (sinks);
+        break;
+      default:
+        done = TRUE;
+        break;
+    }
+  }
+  g_value_unset (&sink);
+  gst_iterator_free (sinks);
+
+  /* Nothing to wait on */
+  if (wait->pads->len == 0) {
+    G_LOCK (waits);
+    wait_finish (wait, FALSE);
+    G_UNLOCK (waits);
+  }
+}
+
+static void
+cancel_waits (InsanityGstPipelineTest * ptest)
+{
+  GList *waits;
+  Wait *wait;
+
+  G_LOCK (waits);
+  waits = ptest->priv->waits;
+  ptest->priv->waits = NULL;
+  for (; waits; waits = g_list_delete_link (waits, waits)) {
+    wait = waits->data;
+    wait_disarm (wait);
+    if (wait->dispatch_source)
+      g_source_destroy (wait->dispatch_source);
+    wait->finished = TRUE;
+    wait_unref (wait);
+  }
+  G_UNLOCK (waits);
+}
+
 static gboolean
 handle_message (InsanityGstPipelineTest * ptest, GstMessage * message)
 {
   gboolean ret = FALSE, done = FALSE;
 
+  /* Recorded even when the test code handles them */
+  if (GST_MESSAGE_TYPE (message) == GST_MESSAGE_BUFFERING)
+    record_buffering (ptest, message);
+  wait_check_message (ptest, message);
+
   /* Allow the test code to handle the message instead */
   g_signal_emit (ptest, bus_message_signal, 0, message, &ret);
   if (!ret)
@@ -468,6 +1406,14 @@ create_pipeline (InsanityGstPipelineTest * ptest)
 
   priv->bus = gst_element_get_bus (GST_ELEMENT (priv->pipeline));
 
+#ifdef HAVE_EXECINFO_H
+  if (priv->stall_diagnostics) {
+    gst_bus_enable_sync_message_emission (priv->bus);
+    priv->sync_message_id = g_signal_connect (priv->bus, "sync-message",
+        (GCallback) on_sync_message, ptest);
+  }
+#endif
+
   return TRUE;
 }
 
@@ -483,6 +1429,12 @@ insanity_gst_pipeline_test_setup (InsanityTest * test)
 
   priv->elements_used =
       g_hash_table_new_full (&g_str_hash, &g_str_equal, &g_free, &g_free);
+  insanity_test_get_boolean_argument (test, "stall-diagnostics",
+      &priv->stall_diagnostics);
+  insanity_test_get_int_argument (test, "stall-timeout", &priv->stall_timeout);
+  /* Watching for stalls is pointless without the pad activity */
+  if (priv->stall_timeout > 0)
+    priv->stall_diagnostics = TRUE;
 
   if (!priv->create_pipeline_in_start)
     return create_pipeline (ptest);
@@ -517,6 +1469,10 @@ insanity_gst_pipeline_test_start (InsanityTest * test)
   priv->buffering = FALSE;
   priv->enable_buffering = TRUE;
   priv->done = FALSE;
+  g_array_set_size (priv->buffering_log, 0);
+  priv->start_time = gst_util_get_timestamp ();
+  priv->stall_count = 0;
+  priv->stalled = FALSE;
 
   add_element_used (ptest, GST_ELEMENT (ptest->priv->pipeline));
 
@@ -532,11 +1488,17 @@ insanity_gst_pipeline_test_stop (InsanityTest * test)
 
   insanity_test_validate_checklist_item (test, "no-errors-seen",
       priv->error_count == 0, NULL);
+  buffering_report (INSANITY_GST_PIPELINE_TEST (test));
+  cancel_waits (INSANITY_GST_PIPELINE_TEST (test));
 
   if (priv->wait_timeout_id) {
     g_source_remove (priv->wait_timeout_id);
     priv->wait_timeout_id = 0;
   }
+  if (priv->stall_watchdog_id) {
+    g_source_remove (priv->stall_watchdog_id);
+    priv->stall_watchdog_id = 0;
+  }
 
   if (priv->pipeline) {
     gst_element_set_state (GST_ELEMENT (priv->pipeline), GST_STATE_NULL);
@@ -546,6 +1508,7 @@ insanity_gst_pipeline_test_stop (InsanityTest * test)
 
   if (priv->create_pipeline_in_start) {
     if (priv->bus) {
+      untrack_pipeline (INSANITY_GST_PIPELINE_TEST (test));
       gst_object_unref (priv->bus);
       priv->bus = NULL;
     }
@@ -577,6 +1540,7 @@ insanity_gst_pipeline_test_teardown (InsanityTest * test)
   InsanityGstPipelineTestPrivateData *priv = ptest->priv;
 
   if (priv->bus) {
+    untrack_pipeline (ptest);
     gst_object_unref (priv->bus);
     priv->bus = NULL;
   }
@@ -616,6 +1580,13 @@ insanity_gst_pipeline_test_test (InsanityThreadedTest * test)
   gst_bus_add_signal_watch (ptest->priv->bus);
   id = g_signal_connect (G_OBJECT (ptest->priv->bus), "message",
       (GCallback) & on_message, ptest);
+
+  if (ptest->priv->stall_timeout > 0) {
+    ptest->priv->idle_since = g_get_monotonic_time ();
+    ptest->priv->stall_watchdog_id =
+        g_timeout_add (MIN (ptest->priv->stall_timeout, 1000),
+        &stall_watchdog, ptest);
+  }
   g_main_loop_run (ptest->priv->loop);
 
   if (ptest->priv->bus)
@@ -676,6 +1647,21 @@ insanity_gst_pipeline_test_init (InsanityGstPipelineTest * gsttest)
   priv->create_pipeline_user_data = NULL;
   priv->create_pipeline_destroy_notify = NULL;
   priv->done = FALSE;
+  priv->buffering_log = g_array_new (FALSE, FALSE, sizeof (BufferingEntry));
+  priv->start_time = 0;
+  priv->waits = NULL;
+  priv->next_wait_id = 0;
+  priv->stall_diagnostics = FALSE;
+  priv->stall_timeout = 0;
+  priv->stall_watchdog_id = 0;
+  priv->idle_since = 0;
+  priv->stalled = FALSE;
+  priv->stall_count = 0;
+  priv->pad_activity = g_ptr_array_new_with_free_func (&free_pad_activity);
+#ifdef HAVE_EXECINFO_H
+  priv->streaming_threads = NULL;
+  priv->sync_message_id = 0;
+#endif
 
   /* Add our own items, etc */
   insanity_test_add_checklist_item (test, "valid-pipeline",
@@ -686,12 +1672,60 @@ insanity_gst_pipeline_test_init (InsanityGstPipelineTest * gsttest)
       "The pipeline reached the initial GstElementState", NULL, TRUE);
   insanity_test_add_checklist_item (test, "no-errors-seen",
       "No errors were emitted from the pipeline", NULL, FALSE);
+  insanity_test_add_checklist_item (test, "startup-buffering-acceptable",
+      "Initial buffering took no longer than max-startup-buffering-time",
+      NULL, FALSE);
+  insanity_test_add_checklist_item (test, "rebuffers-acceptable",
+      "Playback did not buffer again more than max-rebuffers times", NULL,
+      FALSE);
+  insanity_test_add_checklist_item (test, "stall-ratio-acceptable",
+      "Playback did not stall for more than max-stall-percent of the time",
+      NULL, FALSE);
+
+  insanity_test_add_int_argument (test, "max-startup-buffering-time",
+      "Longest acceptable initial buffering, in milliseconds",
+      "-1 means not to check it", FALSE, -1);
+  insanity_test_add_int_argument (test, "max-rebuffers",
+      "Largest acceptable number of times to buffer again after starting",
+      "-1 means not to check it", FALSE, -1);
+  insanity_test_add_int_argument (test, "max-stall-percent",
+      "Largest acceptable share of the playback time spent buffering again",
+      "-1 means not to check it", FALSE, -1);
+  insanity_test_add_boolean_argument (test, "stall-diagnostics",
+      "Track pad activity and streaming threads for stall diagnostics",
+      "Adds a probe on every pad and a signal handler, which changes the "
+      "timing of the test, so it is off unless stall-timeout is set",
+      TRUE, FALSE);
+  insanity_test_add_int_argument (test, "stall-timeout",
+      "Save stall diagnostics when no data was seen for this long while "
+      "playing, in milliseconds",
+      "0 means only when the test asks for them, a positive value turns on "
+      "stall-diagnostics", FALSE, 0);
+
+  insanity_test_add_output_file (test, "stall-report",
+      "Pad activity, streaming thread backtraces, element states and "
+      "queue levels, saved when the pipeline stalled", FALSE);
+  insanity_test_add_output_file (test, "stall-pipeline",
+      "DOT graph of the pipeline when it first stalled", FALSE);
 
   insanity_test_add_extra_info (test, "errors",
       "List of errors emitted by the pipeline");
   insanity_test_add_extra_info (test, "tags",
       "List of tags emitted by the pipeline");
   insanity_test_add_extra_info (test, "elements-used", "List of elements used");
+  insanity_test_add_extra_info (test, "startup-buffering-time",
+      "Time from the first buffering message to the first 100% one "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "rebuffers",
+      "Number of times playback had to buffer again after starting");
+  insanity_test_add_extra_info (test, "stall-time",
+      "Total time spent buffering again after starting (in nanoseconds)");
+  insanity_test_add_extra_info (test, "seek-buffering-time",
+      "Total time spent buffering after flushing seeks (in nanoseconds)");
+  insanity_test_add_extra_info (test, "stall-ratio",
+      "Share of the time since playback started spent buffering again");
+  insanity_test_add_extra_info (test, "stalls",
+      "Number of times stall diagnostics were saved");
 }
 
 static void
@@ -701,6 +1735,8 @@ insanity_gst_pipeline_test_finalize (GObject * gobject)
 
   insanity_gst_pipeline_test_set_create_pipeline_function (gtest, NULL, NULL,
       NULL);
+  g_array_free (gtest->priv->buffering_log, TRUE);
+  g_ptr_array_free (gtest->priv->pad_activity, TRUE);
 
   G_OBJECT_CLASS (insanity_gst_pipeline_test_parent_class)->finalize (gobject);
 }
@@ -891,3 +1927,302 @@ insanity_gst_pipeline_test_set_create_pipeline_in_start (InsanityGstPipelineTest
 
   test->priv->create_pipeline_in_start = create_pipeline_in_start;
 }
+
+/**
+ * InsanityGstWaitFunction:
+ * @test: the #InsanityGstPipelineTest that waited
+ * @met: %TRUE if the condition was met, %FALSE if the wait timed out
+ * @userdata: the data passed when starting to wait
+ *
+ * Called from the main loop of the test when a wait ends.
+ */
+
+/**
+ * insanity_gst_pipeline_test_send_seek:
+ * @test: the #InsanityGstPipelineTest to seek
+ * @event: (transfer full): the seek #GstEvent to send to the pipeline
+ *
+ * Sends @event to the pipeline. Seeks should go through here so that,
+ * when flushing, the buffering that follows is counted as the cost of the
+ * seek instead of a rebuffer.
+ *
+ * Returns: %TRUE if the seek was handled by the pipeline.
+ */
+gboolean
+insanity_gst_pipeline_test_send_seek (InsanityGstPipelineTest * test,
+    GstEvent * event)
+{
+  GstSeekFlags flags;
+
+  g_return_val_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test), FALSE);
+  g_return_val_if_fail (GST_EVENT_TYPE (event) == GST_EVENT_SEEK, FALSE);
+
+  gst_event_parse_seek (event, NULL, NULL, &flags, NULL, NULL, NULL, NULL);
+  if (flags & GST_SEEK_FLAG_FLUSH) {
+    BufferingEntry entry;
+
+    entry.time = gst_util_get_timestamp () - test->priv->start_time;
+    entry.percent = BUFFERING_SEEK;
+    g_array_append_val (test->priv->buffering_log, entry);
+  }
+
+  return gst_element_send_event (GST_ELEMENT (test->priv->pipeline), event);
+}
+
+/**
+ * insanity_gst_pipeline_test_wait_for_state:
+ * @test: the #InsanityGstPipelineTest to wait on
+ * @state: the #GstState the pipeline should reach
+ * @timeout: the time to give up after, in milliseconds, or 0 for none
+ * @func: the function to call when done waiting
+ * @userdata: whatever data the user wants passed to the function
+ *
+ * Calls @func once the pipeline reached @state with no state change
+ * pending, right away if it already did.
+ *
+ * Returns: an identifier for insanity_gst_pipeline_test_cancel_wait().
+ */
+guint
+insanity_gst_pipeline_test_wait_for_state (InsanityGstPipelineTest * test,
+    GstState state, guint timeout, InsanityGstWaitFunction func,
+    gpointer userdata)
+{
+  GstState current, pending;
+  Wait *wait;
+  guint id;
+
+  g_return_val_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  wait = wait_new (test, WAIT_STATE, func, userdata);
+  wait->state = state;
+  id = wait_start (wait, timeout);
+
+  if (gst_element_get_state (GST_ELEMENT (test->priv->pipeline), &current,
+          &pending, 0) == GST_STATE_CHANGE_SUCCESS && current == state
+      && pending == GST_STATE_VOID_PENDING) {
+    G_LOCK (waits);
+    wait_finish (wait, TRUE);
+    G_UNLOCK (waits);
+  }
+  wait_unref (wait);
+
+  return id;
+}
+
+/**
+ * insanity_gst_pipeline_test_wait_for_async_done:
+ * @test: the #InsanityGstPipelineTest to wait on
+ * @timeout: the time to give up after, in milliseconds, or 0 for none
+ * @func: the function to call when done waiting
+ * @userdata: whatever data the user wants passed to the function
+ *
+ * Calls @func once the pipeline posts its next ASYNC_DONE message, as
+ * when done prerolling after a flushing seek.
+ *
+ * Returns: an identifier for insanity_gst_pipeline_test_cancel_wait().
+ */
+guint
+insanity_gst_pipeline_test_wait_for_async_done (InsanityGstPipelineTest *
+    test, guint timeout, InsanityGstWaitFunction func, gpointer userdata)
+{
+  Wait *wait;
+  guint id;
+
+  g_return_val_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  wait = wait_new (test, WAIT_ASYNC_DONE, func, userdata);
+  id = wait_start (wait, timeout);
+  wait_unref (wait);
+
+  return id;
+}
+
+/**
+ * insanity_gst_pipeline_test_wait_for_segment:
+ * @test: the #InsanityGstPipelineTest to wait on
+ * @pad: (allow-none): the #GstPad to watch, or %NULL for all sinks
+ * @timeout: the time to give up after, in milliseconds, or 0 for none
+ * @func: the function to call when done waiting
+ * @userdata: whatever data the user wants passed to the function
+ *
+ * Calls @func once the next segment event goes through @pad, or through
+ * the sink pad of any sink of the pipeline if @pad is %NULL.
+ *
+ * Returns: an identifier for insanity_gst_pipeline_test_cancel_wait().
+ */
+guint
+insanity_gst_pipeline_test_wait_for_segment (InsanityGstPipelineTest * test,
+    GstPad * pad, guint timeout, InsanityGstWaitFunction func,
+    gpointer userdata)
+{
+  Wait *wait;
+  guint id;
+
+  g_return_val_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test), 0);
+  g_return_val_if_fail (pad == NULL || GST_IS_PAD (pad), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  wait = wait_new (test, WAIT_SEGMENT, func, userdata);
+  id = wait_start (wait, timeout);
+  wait_add_pads (wait, pad);
+  wait_unref (wait);
+
+  return id;
+}
+
+/**
+ * insanity_gst_pipeline_test_wait_for_playback:
+ * @test: the #InsanityGstPipelineTest to wait on
+ * @pad: (allow-none): the #GstPad to watch, or %NULL for all sinks
+ * @duration: the running time to wait for
+ * @timeout: the time to give up after, in milliseconds, or 0 for none
+ * @func: the function to call when done waiting
+ * @userdata: whatever data the user wants passed to the function
+ *
+ * Calls @func once buffers spanning @duration of running time went
+ * through @pad, or through the sink pad of any sink of the pipeline if
+ * @pad is %NULL. A flushing seek starts counting again.
+ *
+ * This replaces polling the position until it gets far enough.
+ *
+ * Returns: an identifier for insanity_gst_pipeline_test_cancel_wait().
+ */
+guint
+insanity_gst_pipeline_test_wait_for_playback (InsanityGstPipelineTest * test,
+    GstPad * pad, GstClockTime duration, guint timeout,
+    InsanityGstWaitFunction func, gpointer userdata)
+{
+  Wait *wait;
+  guint id;
+
+  g_return_val_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test), 0);
+  g_return_val_if_fail (pad == NULL || GST_IS_PAD (pad), 0);
+  g_return_val_if_fail (GST_CLOCK_TIME_IS_VALID (duration), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  wait = wait_new (test, WAIT_PLAYBACK, func, userdata);
+  wait->duration = duration;
+  id = wait_start (wait, timeout);
+  wait_add_pads (wait, pad);
+  wait_unref (wait);
+
+  return id;
+}
+
+/**
+ * insanity_gst_pipeline_test_cancel_wait:
+ * @test: the #InsanityGstPipelineTest waiting
+ * @id: the identifier of the wait
+ *
+ * Stops waiting, without calling the wait function. Pending waits are
+ * cancelled when the test stops.
+ */
+void
+insanity_gst_pipeline_test_cancel_wait (InsanityGstPipelineTest * test,
+    guint id)
+{
+  Wait *wait = NULL;
+  GList *l;
+
+  g_return_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test));
+
+  G_LOCK (waits);
+  for (l = test->priv->waits; l; l = l->next) {
+    if (((Wait *) l->data)->id == id) {
+      wait = l->data;
+      test->priv->waits = g_list_delete_link (test->priv->waits, l);
+      break;
+    }
+  }
+  if (wait) {
+    wait_disarm (wait);
+    if (wait->dispatch_source)
+      g_source_destroy (wait->dispatch_source);
+    wait->finished = TRUE;
+  }
+  G_UNLOCK (waits);
+
+  if (wait)
+    wait_unref (wait);
+}
+
+/**
+ * insanity_gst_pipeline_test_dump_stall_diagnostics:
+ * @test: the #InsanityGstPipelineTest whose pipeline stalled
+ * @reason: (allow-none): a short description of the stall
+ *
+ * Saves a snapshot of the pipeline to the "stall-report" output file:
+ * the last activity, buffer timestamp and event of every pad, the
+ * backtraces of the streaming threads, the state of every element, and
+ * the levels of every queue. The first snapshot of a run also saves a
+ * DOT graph of the pipeline to the "stall-pipeline" output file.
+ *
+ * Tests detecting stalls themselves call this before moving on; the
+ * "stall-timeout" argument also has it called when no data was seen for
+ * that long while playing. It must be called from the main loop.
+ *
+ * Pad activity and backtraces need the "stall-diagnostics" argument, or
+ * a "stall-timeout" one.
+ */
+void
+insanity_gst_pipeline_test_dump_stall_diagnostics (InsanityGstPipelineTest *
+    test, const char *reason)
+{
+  InsanityGstPipelineTestPrivateData *priv;
+  InsanityTest *itest;
+  const char *filename;
+  GValue v = { 0 };
+  FILE *f;
+  char *dot;
+
+  g_return_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test));
+
+  priv = test->priv;
+  itest = INSANITY_TEST (test);
+  if (!priv->pipeline)
+    return;
+
+  filename = insanity_test_get_output_filename (itest, "stall-report");
+  f = filename ? fopen (filename, priv->stall_count ? "a" : "w") : NULL;
+  if (!f) {
+    insanity_test_printf (itest, "Failed to save stall diagnostics\n");
+    return;
+  }
+  priv->stall_count++;
+  insanity_test_printf (itest, "Stalled (%s), saving diagnostics to %s\n",
+      reason ? reason : "unknown reason", filename);
+
+  fprintf (f, "Stall %u: %s\n", priv->stall_count,
+      reason ? reason : "unknown reason");
+  fprintf (f, "Time since start: %" GST_TIME_FORMAT "\n",
+      GST_TIME_ARGS (gst_util_get_timestamp () - priv->start_time));
+
+  /* From what can not block to what could, should an element be
+   * deadlocked holding its lock */
+  if (priv->stall_diagnostics) {
+    dump_pad_activity (test, f);
+    dump_backtraces (test, f);
+  }
+  dump_elements (test, f, FALSE);
+  fflush (f);
+
+  if (priv->stall_count == 1) {
+    dot = gst_debug_bin_to_dot_data (GST_BIN (priv->pipeline),
+        GST_DEBUG_GRAPH_SHOW_ALL);
+    filename = insanity_test_get_output_filename (itest, "stall-pipeline");
+    if (!filename || !g_file_set_contents (filename, dot, -1, NULL))
+      fprintf (f, "\nFailed to save the pipeline graph\n");
+    g_free (dot);
+  }
+
+  dump_elements (test, f, TRUE);
+  fprintf (f, "\n");
+  fclose (f);
+
+  g_value_init (&v, G_TYPE_UINT);
+  g_value_set_uint (&v, priv->stall_count);
+  insanity_test_set_extra_info (itest, "stalls", &v);
+  g_value_unset (&v);
+}
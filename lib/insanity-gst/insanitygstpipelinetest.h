@@ -34,6 +34,7 @@ typedef struct _InsanityGstPipelineTest InsanityGstPipelineTest;
 typedef struct _InsanityGstPipelineTestClass InsanityGstPipelineTestClass;
 typedef struct _InsanityGstPipelineTestPrivateData InsanityGstPipelineTestPrivateData;
 typedef GstPipeline *(*InsanityGstCreatePipelineFunction) (InsanityGstPipelineTest*, gpointer userdata);
+typedef void (*InsanityGstWaitFunction) (InsanityGstPipelineTest*, gboolean met, gpointer userdata);
 
 /**
  * InsanityGstPipelineTest:
@@ -78,8 +79,17 @@ void insanity_gst_pipeline_test_set_live (InsanityGstPipelineTest *test, gboolea
 void insanity_gst_pipeline_test_enable_buffering (InsanityGstPipelineTest *test, gboolean buffering);
 void insanity_gst_pipeline_test_set_create_pipeline_function (InsanityGstPipelineTest *test, InsanityGstCreatePipelineFunction func, gpointer userdata, GDestroyNotify dnotify);
 gboolean insanity_gst_pipeline_test_query_duration(InsanityGstPipelineTest *test, GstFormat fmt, gint64 *duration);
+gboolean insanity_gst_pipeline_test_send_seek (InsanityGstPipelineTest *test, GstEvent *event);
 void insanity_gst_pipeline_test_set_create_pipeline_in_start (InsanityGstPipelineTest *test, gboolean create_pipeline_in_start);
 
+guint insanity_gst_pipeline_test_wait_for_state (InsanityGstPipelineTest *test, GstState state, guint timeout, InsanityGstWaitFunction func, gpointer userdata);
+guint insanity_gst_pipeline_test_wait_for_async_done (InsanityGstPipelineTest *test, guint timeout, InsanityGstWaitFunction func, gpointer userdata);
+guint insanity_gst_pipeline_test_wait_for_segment (InsanityGstPipelineTest *test, GstPad *pad, guint timeout, InsanityGstWaitFunction func, gpointer userdata);
+guint insanity_gst_pipeline_test_wait_for_playback (InsanityGstPipelineTest *test, GstPad *pad, GstClockTime duration, guint timeout, InsanityGstWaitFunction func, gpointer userdata);
+void insanity_gst_pipeline_test_cancel_wait (InsanityGstPipelineTest *test, guint id);
+
+void insanity_gst_pipeline_test_dump_stall_diagnostics (InsanityGstPipelineTest *test, const char *reason);
+
 /* Handy macros */
 #define INSANITY_TYPE_GST_PIPELINE_TEST                (insanity_gst_pipeline_test_get_type ())
 #define INSANITY_GST_PIPELINE_TEST(obj)                (G_TYPE_CHECK_INSTANCE_CAST ((obj), INSANITY_TYPE_GST_PIPELINE_TEST, InsanityGstPipelineTest))
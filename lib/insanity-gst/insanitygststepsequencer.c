@@ -0,0 +1,641 @@
+/* Insanity QA system
+
+       insanitygststepsequencer.c
+
+ Copyright (c) 2012, Collabora Ltd
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this program; if not, write to the
+ Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*/
+/**
+ * SECTION:insanitygststepsequencer
+ * @short_description: GStreamer Test Step Sequencer
+ * @see_also: #InsanityGstPipelineTest
+ *
+ * Runs an ordered table of #InsanityGstStep against an
+ * #InsanityGstPipelineTest, moving from one step to the next as the
+ * steps ask, usually once the pipeline reached a given state.
+ *
+ * The start and end of each step are recorded, along with the time the
+ * pipeline took to reach the state the step waited for and to preroll,
+ * and reported as the "steps" extra-info when the sequencer is stopped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <gst/gst.h>
+
+#include <insanity-gst/insanitygststepsequencer.h>
+
+G_DEFINE_TYPE (InsanityGstStepSequencer, insanity_gst_step_sequencer,
+    G_TYPE_OBJECT);
+
+/* how long a step may wait for a state when it is not told, in ms */
+#define DEFAULT_STATE_TIMEOUT 0
+
+/* how often steps asking to be restarted soon are, in ms */
+#define RESTART_SOON_DELAY 100
+
+/* how much longer than the settle time to wait for it, in ms */
+#define SETTLE_TIMEOUT_MARGIN 5000
+
+typedef struct
+{
+  guint step;
+  GstClockTime start;
+  GstClockTime end;
+  GstClockTime state_latency;
+  GstClockTime preroll_latency;
+  gboolean timed_out;
+} StepTiming;
+
+struct _InsanityGstStepSequencerPrivateData
+{
+  InsanityGstPipelineTest *test;
+  const InsanityGstStep *steps;
+  guint n_steps;
+  gulong bus_message_id;
+
+  guint state_timeout;
+  guint step_timeout;
+  GstClockTime settle_time;
+
+  gboolean running;
+  guint current;
+  GstState waiting_on_state;
+  gboolean restart;
+  guint next_id;
+  guint timeout_id;
+  guint settle_id;
+
+  GstClockTime origin;
+  GstClockTime call_time;
+  GArray *timings;
+  gint timing;                  /* Of the current step, or -1 */
+};
+
+static gboolean run_step (InsanityGstStepSequencer * sequencer);
+
+static GstClockTime
+sequencer_now (InsanityGstStepSequencer * sequencer)
+{
+  return gst_util_get_timestamp () - sequencer->priv->origin;
+}
+
+static StepTiming *
+current_timing (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+
+  if (priv->timing < 0)
+    return NULL;
+  return &g_array_index (priv->timings, StepTiming, priv->timing);
+}
+
+static void
+schedule_step (InsanityGstStepSequencer * sequencer, guint delay)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+
+  if (priv->next_id)
+    g_source_remove (priv->next_id);
+  if (delay)
+    priv->next_id = g_timeout_add (delay, (GSourceFunc) run_step, sequencer);
+  else
+    priv->next_id = g_idle_add ((GSourceFunc) run_step, sequencer);
+}
+
+static void
+end_step (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+  StepTiming *timing = current_timing (sequencer);
+
+  if (timing)
+    timing->end = sequencer_now (sequencer);
+  priv->timing = -1;
+  priv->current++;
+}
+
+static void
+on_settled (InsanityGstPipelineTest * test, gboolean met, gpointer data)
+{
+  InsanityGstStepSequencer *sequencer = data;
+
+  sequencer->priv->settle_id = 0;
+  schedule_step (sequencer, 0);
+}
+
+/* Moves on after the step got the state it waited for, letting the
+ * pipeline play for the settle time first if asked to */
+static void
+state_reached (InsanityGstStepSequencer * sequencer, gboolean timed_out)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+  InsanityTest *test = INSANITY_TEST (priv->test);
+  StepTiming *timing = current_timing (sequencer);
+  GstState state = priv->waiting_on_state;
+
+  if (priv->timeout_id) {
+    g_source_remove (priv->timeout_id);
+    priv->timeout_id = 0;
+  }
+  priv->waiting_on_state = GST_STATE_VOID_PENDING;
+
+  if (timing) {
+    if (timed_out)
+      timing->timed_out = TRUE;
+    else
+      timing->state_latency = sequencer_now (sequencer) - priv->call_time;
+  }
+
+  /* A step timing out is not validated, the test decides */
+  if (timing && !priv->restart) {
+    if (!timed_out)
+      insanity_test_validate_checklist_item (test,
+          priv->steps[priv->current].step, TRUE, NULL);
+    end_step (sequencer);
+  }
+
+  insanity_test_printf (test, "Got %s, going to next step\n",
+      timed_out ? "timeout" : gst_element_state_get_name (state));
+
+  if (priv->settle_time > 0) {
+    priv->settle_id = insanity_gst_pipeline_test_wait_for_playback (priv->test,
+        NULL, priv->settle_time,
+        priv->settle_time / GST_MSECOND + SETTLE_TIMEOUT_MARGIN, on_settled,
+        sequencer);
+  } else {
+    schedule_step (sequencer, 0);
+  }
+}
+
+static gboolean
+state_timeout (InsanityGstStepSequencer * sequencer)
+{
+  sequencer->priv->timeout_id = 0;
+  state_reached (sequencer, TRUE);
+
+  return FALSE;
+}
+
+static void
+wait_on_state (InsanityGstStepSequencer * sequencer, GstState state,
+    gboolean restart)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+
+  priv->waiting_on_state = state;
+  priv->restart = restart;
+  if (priv->step_timeout)
+    priv->timeout_id = g_timeout_add (priv->step_timeout,
+        (GSourceFunc) state_timeout, sequencer);
+}
+
+static gboolean
+run_step (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+  InsanityTest *test = INSANITY_TEST (priv->test);
+  const InsanityGstStep *step;
+  StepTiming timing;
+
+  priv->next_id = 0;
+
+  /* When out of steps to perform, end the test */
+  if (priv->current == priv->n_steps) {
+    insanity_test_done (test);
+    return FALSE;
+  }
+
+  step = &priv->steps[priv->current];
+
+  /* Restarted steps keep timing from their first call */
+  if (priv->timing < 0) {
+    timing.step = priv->current;
+    timing.start = sequencer_now (sequencer);
+    timing.end = GST_CLOCK_TIME_NONE;
+    timing.state_latency = GST_CLOCK_TIME_NONE;
+    timing.preroll_latency = GST_CLOCK_TIME_NONE;
+    timing.timed_out = FALSE;
+    g_array_append_val (priv->timings, timing);
+    priv->timing = priv->timings->len - 1;
+  }
+
+  insanity_test_printf (test, "Calling step %u/%u (%s, data %lu)\n",
+      priv->current + 1, priv->n_steps, step->step, (gulong) step->data);
+  priv->step_timeout = priv->state_timeout;
+  priv->call_time = sequencer_now (sequencer);
+
+  switch ((*step->func) (priv->test, step->step, step->data)) {
+    default:
+      g_assert_not_reached ();
+      /* fall through */
+    case INSANITY_GST_STEP_NEXT_NOW:
+      end_step (sequencer);
+      schedule_step (sequencer, 0);
+      break;
+    case INSANITY_GST_STEP_NEXT_ON_PLAYING:
+      wait_on_state (sequencer, GST_STATE_PLAYING, FALSE);
+      break;
+    case INSANITY_GST_STEP_NEXT_ON_PAUSED:
+      wait_on_state (sequencer, GST_STATE_PAUSED, FALSE);
+      break;
+    case INSANITY_GST_STEP_RESTART_ON_PLAYING:
+      wait_on_state (sequencer, GST_STATE_PLAYING, TRUE);
+      break;
+    case INSANITY_GST_STEP_RESTART_SOON:
+      schedule_step (sequencer, RESTART_SOON_DELAY);
+      break;
+    case INSANITY_GST_STEP_NEXT_ON_DONE:
+      /* insanity_gst_step_sequencer_step_done moves on */
+      break;
+  }
+
+  return FALSE;
+}
+
+static gboolean
+on_bus_message (InsanityGstPipelineTest * test, GstMessage * msg,
+    InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+  GstObject *src = GST_MESSAGE_SRC (msg);
+  StepTiming *timing;
+  GstState newstate, pending;
+
+  /* Only the pipeline itself matters */
+  if (!priv->running || !GST_IS_PIPELINE (src) || GST_OBJECT_PARENT (src))
+    return TRUE;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ASYNC_DONE:
+      timing = current_timing (sequencer);
+      if (timing && !GST_CLOCK_TIME_IS_VALID (timing->preroll_latency))
+        timing->preroll_latency = sequencer_now (sequencer) - priv->call_time;
+      break;
+    case GST_MESSAGE_STATE_CHANGED:
+      gst_message_parse_state_changed (msg, NULL, &newstate, &pending);
+      if (priv->waiting_on_state != GST_STATE_VOID_PENDING
+          && newstate == priv->waiting_on_state
+          && pending == GST_STATE_VOID_PENDING)
+        state_reached (sequencer, FALSE);
+      break;
+    default:
+      break;
+  }
+
+  /* We only watch, the test still handles the message */
+  return TRUE;
+}
+
+static void
+set_time_info (InsanityTest * test, guint n, const char *name,
+    GstClockTime t)
+{
+  GValue v = { 0 };
+  char label[64];
+
+  if (!GST_CLOCK_TIME_IS_VALID (t))
+    return;
+
+  snprintf (label, sizeof (label), "steps.%u.%s", n, name);
+  g_value_init (&v, G_TYPE_UINT64);
+  g_value_set_uint64 (&v, t);
+  insanity_test_set_extra_info (test, label, &v);
+  g_value_unset (&v);
+}
+
+static void
+report_timings (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+  InsanityTest *test = INSANITY_TEST (priv->test);
+  GValue v = { 0 };
+  StepTiming *timing;
+  GstClockTime duration;
+  char label[64];
+  guint i;
+
+  if (priv->timings->len == 0)
+    return;
+
+  insanity_test_printf (test, "Step timings:\n");
+  for (i = 0; i < priv->timings->len; i++) {
+    timing = &g_array_index (priv->timings, StepTiming, i);
+    duration = GST_CLOCK_TIME_IS_VALID (timing->end) ?
+        timing->end - timing->start : GST_CLOCK_TIME_NONE;
+
+    insanity_test_printf (test, "  %2u %-24s start %" GST_TIME_FORMAT
+        " duration %" GST_TIME_FORMAT " state %" GST_TIME_FORMAT " preroll %"
+        GST_TIME_FORMAT "%s\n", i + 1, priv->steps[timing->step].step,
+        GST_TIME_ARGS (timing->start), GST_TIME_ARGS (duration),
+        GST_TIME_ARGS (timing->state_latency),
+        GST_TIME_ARGS (timing->preroll_latency),
+        timing->timed_out ? " (timed out)" : "");
+
+    g_value_init (&v, G_TYPE_STRING);
+    g_value_set_string (&v, priv->steps[timing->step].step);
+    snprintf (label, sizeof (label), "steps.%u.name", i + 1);
+    insanity_test_set_extra_info (test, label, &v);
+    g_value_unset (&v);
+
+    set_time_info (test, i + 1, "start", timing->start);
+    set_time_info (test, i + 1, "duration", duration);
+    set_time_info (test, i + 1, "state-latency", timing->state_latency);
+    set_time_info (test, i + 1, "preroll-latency", timing->preroll_latency);
+
+    if (timing->timed_out) {
+      g_value_init (&v, G_TYPE_BOOLEAN);
+      g_value_set_boolean (&v, TRUE);
+      snprintf (label, sizeof (label), "steps.%u.timed-out", i + 1);
+      insanity_test_set_extra_info (test, label, &v);
+      g_value_unset (&v);
+    }
+  }
+}
+
+static void
+clear_sources (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+
+  if (priv->next_id) {
+    g_source_remove (priv->next_id);
+    priv->next_id = 0;
+  }
+  if (priv->timeout_id) {
+    g_source_remove (priv->timeout_id);
+    priv->timeout_id = 0;
+  }
+  if (priv->settle_id) {
+    insanity_gst_pipeline_test_cancel_wait (priv->test, priv->settle_id);
+    priv->settle_id = 0;
+  }
+}
+
+static void
+insanity_gst_step_sequencer_init (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv =
+      G_TYPE_INSTANCE_GET_PRIVATE (sequencer,
+      INSANITY_TYPE_GST_STEP_SEQUENCER, InsanityGstStepSequencerPrivateData);
+
+  sequencer->priv = priv;
+
+  priv->test = NULL;
+  priv->steps = NULL;
+  priv->n_steps = 0;
+  priv->bus_message_id = 0;
+  priv->state_timeout = DEFAULT_STATE_TIMEOUT;
+  priv->step_timeout = DEFAULT_STATE_TIMEOUT;
+  priv->settle_time = 0;
+  priv->running = FALSE;
+  priv->current = 0;
+  priv->waiting_on_state = GST_STATE_VOID_PENDING;
+  priv->restart = FALSE;
+  priv->next_id = 0;
+  priv->timeout_id = 0;
+  priv->settle_id = 0;
+  priv->timings = g_array_new (FALSE, FALSE, sizeof (StepTiming));
+  priv->timing = -1;
+}
+
+static void
+insanity_gst_step_sequencer_dispose (GObject * gobject)
+{
+  InsanityGstStepSequencer *sequencer = (InsanityGstStepSequencer *) gobject;
+  InsanityGstStepSequencerPrivateData *priv = sequencer->priv;
+
+  if (priv->test) {
+    clear_sources (sequencer);
+    g_signal_handler_disconnect (priv->test, priv->bus_message_id);
+    g_object_unref (priv->test);
+    priv->test = NULL;
+  }
+
+  G_OBJECT_CLASS (insanity_gst_step_sequencer_parent_class)->dispose (gobject);
+}
+
+static void
+insanity_gst_step_sequencer_finalize (GObject * gobject)
+{
+  InsanityGstStepSequencer *sequencer = (InsanityGstStepSequencer *) gobject;
+
+  g_array_free (sequencer->priv->timings, TRUE);
+
+  G_OBJECT_CLASS (insanity_gst_step_sequencer_parent_class)->finalize
+      (gobject);
+}
+
+static void
+insanity_gst_step_sequencer_class_init (InsanityGstStepSequencerClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+  gobject_class->dispose = &insanity_gst_step_sequencer_dispose;
+  gobject_class->finalize = &insanity_gst_step_sequencer_finalize;
+
+  g_type_class_add_private (klass,
+      sizeof (InsanityGstStepSequencerPrivateData));
+}
+
+/**
+ * insanity_gst_step_sequencer_new:
+ * @test: the #InsanityGstPipelineTest to run the steps against
+ * @steps: (array length=n_steps): the ordered table of steps, which must
+ *  stay valid while the sequencer is used
+ * @n_steps: the number of steps in @steps
+ *
+ * This function creates a new sequencer for the given steps. It must be
+ * created before the test is run, as it registers the "steps" extra-info.
+ *
+ * Returns: (transfer full): a new #InsanityGstStepSequencer instance.
+ */
+InsanityGstStepSequencer *
+insanity_gst_step_sequencer_new (InsanityGstPipelineTest * test,
+    const InsanityGstStep * steps, guint n_steps)
+{
+  InsanityGstStepSequencer *sequencer;
+  InsanityGstStepSequencerPrivateData *priv;
+
+  g_return_val_if_fail (INSANITY_IS_GST_PIPELINE_TEST (test), NULL);
+  g_return_val_if_fail (steps != NULL || n_steps == 0, NULL);
+
+  sequencer = g_object_new (INSANITY_TYPE_GST_STEP_SEQUENCER, NULL);
+  priv = sequencer->priv;
+  priv->test = g_object_ref (test);
+  priv->steps = steps;
+  priv->n_steps = n_steps;
+  priv->bus_message_id = g_signal_connect (test, "bus-message",
+      G_CALLBACK (&on_bus_message), sequencer);
+
+  insanity_test_add_extra_info (INSANITY_TEST (test), "steps",
+      "Timing of each step: its start and duration, and how long the "
+      "pipeline took to reach the state it waited for and to preroll "
+      "(in nanoseconds)");
+
+  return sequencer;
+}
+
+/**
+ * insanity_gst_step_sequencer_set_state_timeout:
+ * @sequencer: the #InsanityGstStepSequencer to change
+ * @timeout: the time to wait for in milliseconds, or 0 to wait forever
+ *
+ * Sets how long steps may wait for the pipeline to reach a state before
+ * moving on anyway. A step timing out has its checklist item left for the
+ * test to validate. By default, steps wait forever.
+ */
+void
+insanity_gst_step_sequencer_set_state_timeout (InsanityGstStepSequencer *
+    sequencer, guint timeout)
+{
+  g_return_if_fail (INSANITY_IS_GST_STEP_SEQUENCER (sequencer));
+
+  sequencer->priv->state_timeout = timeout;
+}
+
+/**
+ * insanity_gst_step_sequencer_set_step_timeout:
+ * @sequencer: the #InsanityGstStepSequencer to change
+ * @timeout: the time to wait for in milliseconds, or 0 to wait forever
+ *
+ * Like insanity_gst_step_sequencer_set_state_timeout(), but only for the
+ * step being run. To be called from the step function.
+ */
+void
+insanity_gst_step_sequencer_set_step_timeout (InsanityGstStepSequencer *
+    sequencer, guint timeout)
+{
+  g_return_if_fail (INSANITY_IS_GST_STEP_SEQUENCER (sequencer));
+
+  sequencer->priv->step_timeout = timeout;
+}
+
+/**
+ * insanity_gst_step_sequencer_set_settle_time:
+ * @sequencer: the #InsanityGstStepSequencer to change
+ * @settle_time: the running time to play for, or 0
+ *
+ * Sets how long the pipeline should play after reaching the state a step
+ * waited for, before the next step is run.
+ */
+void
+insanity_gst_step_sequencer_set_settle_time (InsanityGstStepSequencer *
+    sequencer, GstClockTime settle_time)
+{
+  g_return_if_fail (INSANITY_IS_GST_STEP_SEQUENCER (sequencer));
+  g_return_if_fail (GST_CLOCK_TIME_IS_VALID (settle_time));
+
+  sequencer->priv->settle_time = settle_time;
+}
+
+/**
+ * insanity_gst_step_sequencer_start:
+ * @sequencer: the #InsanityGstStepSequencer to start
+ * @state: the #GstState to wait for before the first step, or
+ *  GST_STATE_VOID_PENDING to start right away
+ *
+ * Starts running the steps from the first one. The test is done once
+ * the last step is.
+ */
+void
+insanity_gst_step_sequencer_start (InsanityGstStepSequencer * sequencer,
+    GstState state)
+{
+  InsanityGstStepSequencerPrivateData *priv;
+
+  g_return_if_fail (INSANITY_IS_GST_STEP_SEQUENCER (sequencer));
+
+  priv = sequencer->priv;
+  clear_sources (sequencer);
+  g_array_set_size (priv->timings, 0);
+  priv->timing = -1;
+  priv->current = 0;
+  priv->restart = TRUE;
+  /* Waiting for the first state is bound like any other */
+  priv->step_timeout = priv->state_timeout;
+  priv->waiting_on_state = GST_STATE_VOID_PENDING;
+  priv->origin = gst_util_get_timestamp ();
+  priv->call_time = 0;
+  priv->running = TRUE;
+
+  if (state == GST_STATE_VOID_PENDING)
+    schedule_step (sequencer, 0);
+  else
+    wait_on_state (sequencer, state, TRUE);
+}
+
+/**
+ * insanity_gst_step_sequencer_step_done:
+ * @sequencer: the #InsanityGstStepSequencer running the step
+ * @success: whether the step succeeded
+ * @message: (allow-none): a message to validate its checklist item with
+ *
+ * Ends a step that returned %INSANITY_GST_STEP_NEXT_ON_DONE, validating
+ * its checklist item, and moves on to the next one.
+ */
+void
+insanity_gst_step_sequencer_step_done (InsanityGstStepSequencer * sequencer,
+    gboolean success, const char *message)
+{
+  InsanityGstStepSequencerPrivateData *priv;
+
+  g_return_if_fail (INSANITY_IS_GST_STEP_SEQUENCER (sequencer));
+
+  priv = sequencer->priv;
+  if (!priv->running || priv->current == priv->n_steps)
+    return;
+
+  insanity_test_validate_checklist_item (INSANITY_TEST (priv->test),
+      priv->steps[priv->current].step, success, message);
+  end_step (sequencer);
+  schedule_step (sequencer, 0);
+}
+
+/**
+ * insanity_gst_step_sequencer_stop:
+ * @sequencer: the #InsanityGstStepSequencer to stop
+ *
+ * Stops running steps, and reports the timing of those which ran.
+ */
+void
+insanity_gst_step_sequencer_stop (InsanityGstStepSequencer * sequencer)
+{
+  InsanityGstStepSequencerPrivateData *priv;
+  StepTiming *timing;
+
+  g_return_if_fail (INSANITY_IS_GST_STEP_SEQUENCER (sequencer));
+
+  priv = sequencer->priv;
+  if (!priv->running)
+    return;
+
+  clear_sources (sequencer);
+  priv->running = FALSE;
+  priv->waiting_on_state = GST_STATE_VOID_PENDING;
+
+  /* A step interrupted still tells how long it ran for */
+  timing = current_timing (sequencer);
+  if (timing)
+    timing->end = sequencer_now (sequencer);
+  priv->timing = -1;
+
+  report_timings (sequencer);
+}
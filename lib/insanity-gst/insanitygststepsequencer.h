@@ -0,0 +1,126 @@
+/* Insanity QA system
+
+       insanitygststepsequencer.h
+
+ Copyright (c) 2012, Collabora Ltd
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this program; if not, write to the
+ Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*/
+
+#ifndef INSANITY_GST_STEP_SEQUENCER_H_GUARD
+#define INSANITY_GST_STEP_SEQUENCER_H_GUARD
+
+#include <glib.h>
+#include <glib-object.h>
+#include <gst/gst.h>
+
+#include <insanity/insanitydefs.h>
+#include <insanity-gst/insanitygstpipelinetest.h>
+
+typedef struct _InsanityGstStepSequencer InsanityGstStepSequencer;
+typedef struct _InsanityGstStepSequencerClass InsanityGstStepSequencerClass;
+typedef struct _InsanityGstStepSequencerPrivateData InsanityGstStepSequencerPrivateData;
+
+/**
+ * InsanityGstStepTrigger:
+ * @INSANITY_GST_STEP_NEXT_NOW: the step is done, and validated its checklist
+ *  item itself
+ * @INSANITY_GST_STEP_NEXT_ON_PLAYING: the step is done once the pipeline
+ *  gets to PLAYING, its checklist item is then validated
+ * @INSANITY_GST_STEP_NEXT_ON_PAUSED: the step is done once the pipeline
+ *  gets to PAUSED, its checklist item is then validated
+ * @INSANITY_GST_STEP_RESTART_ON_PLAYING: the step is called again once the
+ *  pipeline gets to PLAYING
+ * @INSANITY_GST_STEP_RESTART_SOON: the step is called again shortly
+ * @INSANITY_GST_STEP_NEXT_ON_DONE: the step tells when it is done with
+ *  insanity_gst_step_sequencer_step_done()
+ *
+ * What a step function asks the sequencer to do next.
+ */
+typedef enum {
+  INSANITY_GST_STEP_NEXT_NOW,
+  INSANITY_GST_STEP_NEXT_ON_PLAYING,
+  INSANITY_GST_STEP_NEXT_ON_PAUSED,
+  INSANITY_GST_STEP_RESTART_ON_PLAYING,
+  INSANITY_GST_STEP_RESTART_SOON,
+  INSANITY_GST_STEP_NEXT_ON_DONE,
+} InsanityGstStepTrigger;
+
+typedef InsanityGstStepTrigger (*InsanityGstStepFunction) (InsanityGstPipelineTest *test, const char *step, guintptr data);
+
+/**
+ * InsanityGstStep:
+ * @step: the name of the step, also its checklist item
+ * @func: the function performing the step
+ * @data: passed to @func
+ *
+ * An entry of the step table run by an #InsanityGstStepSequencer.
+ */
+typedef struct {
+  const char *step;
+  InsanityGstStepFunction func;
+  guintptr data;
+} InsanityGstStep;
+
+/**
+ * InsanityGstStepSequencer:
+ *
+ * The opaque #InsanityGstStepSequencer data structure.
+ */
+struct _InsanityGstStepSequencer {
+  GObject parent;
+
+  /*< private >*/
+  InsanityGstStepSequencerPrivateData *priv;
+
+  gpointer _insanity_reserved[INSANITY_PADDING];
+};
+
+/**
+ * InsanityGstStepSequencerClass:
+ * @parent_class: the parent class structure
+ *
+ * Insanity GStreamer step sequencer class.
+ */
+struct _InsanityGstStepSequencerClass
+{
+  GObjectClass parent_class;
+
+  /*< private >*/
+  gpointer _insanity_reserved[INSANITY_PADDING];
+};
+
+InsanityGstStepSequencer *insanity_gst_step_sequencer_new (InsanityGstPipelineTest *test, const InsanityGstStep *steps, guint n_steps);
+
+void insanity_gst_step_sequencer_set_state_timeout (InsanityGstStepSequencer *sequencer, guint timeout);
+void insanity_gst_step_sequencer_set_step_timeout (InsanityGstStepSequencer *sequencer, guint timeout);
+void insanity_gst_step_sequencer_set_settle_time (InsanityGstStepSequencer *sequencer, GstClockTime settle_time);
+
+void insanity_gst_step_sequencer_start (InsanityGstStepSequencer *sequencer, GstState state);
+void insanity_gst_step_sequencer_step_done (InsanityGstStepSequencer *sequencer, gboolean success, const char *message);
+void insanity_gst_step_sequencer_stop (InsanityGstStepSequencer *sequencer);
+
+/* Handy macros */
+#define INSANITY_TYPE_GST_STEP_SEQUENCER                (insanity_gst_step_sequencer_get_type ())
+#define INSANITY_GST_STEP_SEQUENCER(obj)                (G_TYPE_CHECK_INSTANCE_CAST ((obj), INSANITY_TYPE_GST_STEP_SEQUENCER, InsanityGstStepSequencer))
+#define INSANITY_GST_STEP_SEQUENCER_CLASS(c)            (G_TYPE_CHECK_CLASS_CAST ((c), INSANITY_TYPE_GST_STEP_SEQUENCER, InsanityGstStepSequencerClass))
+#define INSANITY_IS_GST_STEP_SEQUENCER(obj)             (G_TYPE_CHECK_INSTANCE_TYPE ((obj), INSANITY_TYPE_GST_STEP_SEQUENCER))
+#define INSANITY_IS_GST_STEP_SEQUENCER_CLASS(c)         (G_TYPE_CHECK_CLASS_TYPE ((c), INSANITY_TYPE_GST_STEP_SEQUENCER))
+#define INSANITY_GST_STEP_SEQUENCER_GET_CLASS(obj)      (G_TYPE_INSTANCE_GET_CLASS ((obj), INSANITY_TYPE_GST_STEP_SEQUENCER, InsanityGstStepSequencerClass))
+
+GType insanity_gst_step_sequencer_get_type (void);
+
+#endif
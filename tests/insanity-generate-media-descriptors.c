@@ -0,0 +1,500 @@
+/**
+ * Gstreamer
+ *
+ * Copyright (c) 2012, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Generates the media descriptors used by insanity-test-gst-demuxer for
+ * all the files of a directory tree. Each file is demuxed as fast as
+ * possible in its own pipeline, several files being processed at once. */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+#include "media-descriptor-writer.h"
+
+#ifdef USE_NEW_GLIB_MUTEX_API
+#define JOB_LOCK(job) g_mutex_lock(&(job)->lock)
+#define JOB_UNLOCK(job) g_mutex_unlock(&(job)->lock)
+#else
+#define JOB_LOCK(job) g_mutex_lock((job)->lock)
+#define JOB_UNLOCK(job) g_mutex_unlock((job)->lock)
+#endif
+
+/* Files that are never media files */
+static const gchar *ignored_suffixes[] = {
+  ".xml", ".discoverer-expected", ".discoverer-timing", ".mdcache",
+  ".dccache", NULL
+};
+
+static gint jobs = 0;
+static gint timeout = 600;
+static gboolean force = FALSE;
+static gboolean checksum_frames = FALSE;
+
+static GOptionEntry options[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Number of files to process at once (default: number of cores)", "N"},
+  {"timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+      "Seconds after which a file is given up on (default: 600)", "S"},
+  {"force", 'f', 0, G_OPTION_ARG_NONE, &force,
+      "Regenerate descriptors even if they are up to date", NULL},
+  {"checksum-frames", 'c', 0, G_OPTION_ARG_NONE, &checksum_frames,
+      "Store a checksum of each frame payload", NULL},
+  {NULL}
+};
+
+/* Shared between the workers, read only once they started */
+static GList *demuxer_factories = NULL;
+static guint n_files = 0;
+static gint64 start_time = 0;
+
+/* Statistics */
+G_LOCK_DEFINE_STATIC (stats);
+static guint n_done = 0;
+static guint n_generated = 0;
+static guint n_skipped = 0;
+static guint n_failed = 0;
+static guint64 bytes_processed = 0;
+
+typedef struct
+{
+  const gchar *location;
+  MediaDescriptorWriter *writer;
+#ifdef USE_NEW_GLIB_MUTEX_API
+  GMutex lock;
+#else
+  GMutex *lock;
+#endif
+} Job;
+
+static gboolean
+is_ignored (const gchar * name)
+{
+  guint i;
+
+  if (name[0] == '.')
+    return TRUE;
+
+  for (i = 0; ignored_suffixes[i]; i++) {
+    if (g_str_has_suffix (name, ignored_suffixes[i]))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+collect_files (const gchar * path, GPtrArray * files)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL) {
+    if (g_file_test (path, G_FILE_TEST_IS_REGULAR))
+      g_ptr_array_add (files, g_strdup (path));
+
+    return;
+  }
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *child;
+
+    if (is_ignored (name))
+      continue;
+
+    child = g_build_filename (path, name, NULL);
+    if (g_file_test (child, G_FILE_TEST_IS_DIR))
+      collect_files (child, files);
+    else if (g_file_test (child, G_FILE_TEST_IS_REGULAR))
+      g_ptr_array_add (files, g_strdup (child));
+    g_free (child);
+  }
+
+  g_dir_close (dir);
+}
+
+static gboolean
+descriptor_is_up_to_date (const gchar * location, const gchar * xmllocation)
+{
+  GStatBuf media_st, xml_st;
+
+  if (g_stat (location, &media_st) != 0 || g_stat (xmllocation, &xml_st) != 0)
+    return FALSE;
+
+  return xml_st.st_mtime >= media_st.st_mtime;
+}
+
+static GstElementFactory *
+find_demuxer (GstCaps * caps)
+{
+  GList *demuxers;
+  GstElementFactory *factory = NULL;
+
+  demuxers = gst_element_factory_list_filter (demuxer_factories, caps,
+      GST_PAD_SINK, FALSE);
+  if (demuxers)
+    factory = gst_object_ref (demuxers->data);
+  gst_plugin_feature_list_free (demuxers);
+
+  return factory;
+}
+
+static GstPadProbeReturn
+buffer_probe_cb (GstPad * pad, GstPadProbeInfo * info, Job * job)
+{
+  JOB_LOCK (job);
+  media_descriptor_writer_add_frame (job->writer, pad,
+      GST_PAD_PROBE_INFO_BUFFER (info));
+  JOB_UNLOCK (job);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+pad_added_cb (GstElement * demuxer, GstPad * pad, Job * job)
+{
+  GstPad *sinkpad;
+  GstElement *fakesink, *pipeline;
+
+  /* We only want to go as fast as possible, and not to wait for the other
+   * streams to preroll as the demuxer might be pushing from a single thread */
+  fakesink = gst_element_factory_make ("fakesink", NULL);
+  g_object_set (fakesink, "sync", FALSE, "async", FALSE,
+      "enable-last-sample", FALSE, NULL);
+
+  pipeline = GST_ELEMENT (gst_element_get_parent (demuxer));
+  gst_bin_add (GST_BIN (pipeline), fakesink);
+  gst_object_unref (pipeline);
+
+  sinkpad = gst_element_get_static_pad (fakesink, "sink");
+  gst_pad_link (pad, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_element_sync_state_with_parent (fakesink);
+
+  JOB_LOCK (job);
+  media_descriptor_writer_add_stream (job->writer, pad);
+  JOB_UNLOCK (job);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) buffer_probe_cb, job, NULL);
+}
+
+static gboolean
+run_pipeline (Job * job, GstElementFactory * factory, gchar ** errmsg)
+{
+  GstBus *bus;
+  GstMessage *msg;
+  GstElement *pipeline, *src, *demuxer;
+  gboolean ret = FALSE, finished = FALSE;
+  GstClockTime deadline = g_get_monotonic_time () * GST_USECOND +
+      timeout * GST_SECOND;
+
+  pipeline = gst_pipeline_new (NULL);
+  src = gst_element_factory_make ("filesrc", NULL);
+  demuxer = gst_element_factory_create (factory, NULL);
+  if (src == NULL || demuxer == NULL) {
+    *errmsg = g_strdup ("Could not create the pipeline elements");
+    if (src)
+      gst_object_unref (src);
+    if (demuxer)
+      gst_object_unref (demuxer);
+    gst_object_unref (pipeline);
+    return FALSE;
+  }
+
+  g_object_set (src, "location", job->location, NULL);
+  g_signal_connect (demuxer, "pad-added", G_CALLBACK (pad_added_cb), job);
+  gst_bin_add_many (GST_BIN (pipeline), src, demuxer, NULL);
+  gst_element_link (src, demuxer);
+
+  bus = gst_element_get_bus (pipeline);
+  if (gst_element_set_state (pipeline,
+          GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    *errmsg = g_strdup ("Could not set the pipeline to PLAYING");
+    goto done;
+  }
+
+  while (finished == FALSE) {
+    GstClockTime now = g_get_monotonic_time () * GST_USECOND;
+
+    if (now >= deadline) {
+      *errmsg = g_strdup ("Timed out");
+      break;
+    }
+
+    msg = gst_bus_timed_pop_filtered (bus, deadline - now,
+        GST_MESSAGE_EOS | GST_MESSAGE_ERROR | GST_MESSAGE_TAG);
+    if (msg == NULL)
+      continue;
+
+    switch (GST_MESSAGE_TYPE (msg)) {
+      case GST_MESSAGE_EOS:
+        ret = finished = TRUE;
+        break;
+      case GST_MESSAGE_ERROR:
+      {
+        GError *err = NULL;
+
+        gst_message_parse_error (msg, &err, NULL);
+        *errmsg = g_strdup (err->message);
+        g_clear_error (&err);
+        finished = TRUE;
+        break;
+      }
+      case GST_MESSAGE_TAG:
+      {
+        GstTagList *taglist = NULL;
+
+        gst_message_parse_tag (msg, &taglist);
+        JOB_LOCK (job);
+        media_descriptor_writer_add_taglist (job->writer, taglist);
+        JOB_UNLOCK (job);
+        gst_tag_list_unref (taglist);
+        break;
+      }
+      default:
+        break;
+    }
+    gst_message_unref (msg);
+  }
+
+done:
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (bus);
+  gst_object_unref (pipeline);
+
+  return ret;
+}
+
+/* Must be called with the stats lock taken */
+static void
+report (const gchar * location, const gchar * status, const gchar * details)
+{
+  gdouble elapsed = (g_get_monotonic_time () - start_time) / (gdouble)
+      G_USEC_PER_SEC;
+
+  n_done++;
+  g_print ("[%u/%u] %s: %s%s%s (%.2f files/s, %.2f MB/s)\n", n_done, n_files,
+      location, status, details ? ", " : "", details ? details : "",
+      elapsed > 0 ? n_done / elapsed : 0,
+      elapsed > 0 ? bytes_processed / (1024. * 1024.) / elapsed : 0);
+}
+
+static void
+generate_descriptor (gchar * location, gpointer unused)
+{
+  Job job;
+  GStatBuf st;
+  GError *err = NULL;
+  gchar *uri = NULL, *xmllocation, *errmsg = NULL;
+  GstCaps *caps = NULL;
+  GstDiscoverer *discoverer = NULL;
+  GstDiscovererInfo *info = NULL;
+  GstDiscovererStreamInfo *sinfo = NULL;
+  GstElementFactory *factory = NULL;
+
+  memset (&job, 0, sizeof (job));
+  job.location = location;
+#ifdef USE_NEW_GLIB_MUTEX_API
+  g_mutex_init (&job.lock);
+#else
+  job.lock = g_mutex_new ();
+#endif
+
+  xmllocation = g_strconcat (location, ".xml", NULL);
+  if (force == FALSE && descriptor_is_up_to_date (location, xmllocation)) {
+    G_LOCK (stats);
+    n_skipped++;
+    report (location, "up to date", NULL);
+    G_UNLOCK (stats);
+    goto done;
+  }
+
+  uri = gst_filename_to_uri (location, &err);
+  if (uri == NULL)
+    goto failed;
+
+  discoverer = gst_discoverer_new (10 * GST_SECOND, &err);
+  if (discoverer == NULL)
+    goto failed;
+
+  info = gst_discoverer_discover_uri (discoverer, uri, &err);
+  if (info == NULL)
+    goto failed;
+
+  sinfo = gst_discoverer_info_get_stream_info (info);
+  if (sinfo == NULL || GST_IS_DISCOVERER_CONTAINER_INFO (sinfo) == FALSE) {
+    G_LOCK (stats);
+    n_skipped++;
+    report (location, "not a container", NULL);
+    G_UNLOCK (stats);
+    goto done;
+  }
+
+  caps = gst_discoverer_stream_info_get_caps (sinfo);
+  factory = find_demuxer (caps);
+  if (factory == NULL) {
+    errmsg = g_strdup ("No demuxer found");
+    goto failed;
+  }
+
+  job.writer = media_descriptor_writer_new (NULL, location,
+      gst_discoverer_info_get_duration (info),
+      gst_discoverer_info_get_seekable (info));
+  media_descriptor_writer_set_checksum_frames (job.writer, checksum_frames);
+
+  if (run_pipeline (&job, factory, &errmsg) == FALSE)
+    goto failed;
+
+  if (media_descriptor_writer_write (job.writer, xmllocation) == FALSE) {
+    errmsg = g_strdup_printf ("Could not write %s", xmllocation);
+    goto failed;
+  }
+
+  G_LOCK (stats);
+  if (g_stat (location, &st) == 0)
+    bytes_processed += st.st_size;
+  n_generated++;
+  report (location, "generated", GST_OBJECT_NAME (factory));
+  G_UNLOCK (stats);
+
+done:
+  g_free (uri);
+  g_free (xmllocation);
+  g_free (errmsg);
+  g_free (location);
+
+  if (caps)
+    gst_caps_unref (caps);
+  if (factory)
+    gst_object_unref (factory);
+  if (sinfo)
+    gst_discoverer_stream_info_unref (sinfo);
+  if (info)
+    gst_discoverer_info_unref (info);
+  if (discoverer)
+    g_object_unref (discoverer);
+  if (job.writer)
+    g_object_unref (job.writer);
+
+#ifdef USE_NEW_GLIB_MUTEX_API
+  g_mutex_clear (&job.lock);
+#else
+  g_mutex_free (job.lock);
+#endif
+  return;
+
+failed:
+  G_LOCK (stats);
+  n_failed++;
+  report (location, "failed", err ? err->message : errmsg);
+  G_UNLOCK (stats);
+  g_clear_error (&err);
+
+  goto done;
+}
+
+static gint
+get_n_processors (void)
+{
+#if GLIB_CHECK_VERSION (2, 36, 0)
+  return g_get_num_processors ();
+#else
+  glong n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? n : 1;
+#endif
+}
+
+int
+main (int argc, char **argv)
+{
+  guint i;
+  gdouble elapsed;
+  GError *err = NULL;
+  GPtrArray *files;
+  GThreadPool *pool;
+  GOptionContext *ctx;
+  GList *factories;
+
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  g_thread_init (NULL);
+#endif
+
+  ctx = g_option_context_new ("DIRECTORY... - generate media descriptors");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_option_context_free (ctx);
+    g_clear_error (&err);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (argc < 2) {
+    g_printerr ("Usage: %s [OPTION...] DIRECTORY...\n", argv[0]);
+    return 1;
+  }
+
+  if (jobs <= 0)
+    jobs = get_n_processors ();
+
+  /* Highest ranked first so gst_element_factory_list_filter picks the one
+   * decodebin would have used */
+  factories =
+      gst_element_factory_list_get_elements (GST_ELEMENT_FACTORY_TYPE_DEMUXER,
+      GST_RANK_MARGINAL);
+  demuxer_factories = g_list_sort (factories,
+      (GCompareFunc) gst_plugin_feature_rank_compare_func);
+
+  files = g_ptr_array_new ();
+  for (i = 1; i < argc; i++)
+    collect_files (argv[i], files);
+  n_files = files->len;
+
+  g_print ("Generating media descriptors for %u files, %d at once\n",
+      n_files, jobs);
+
+  start_time = g_get_monotonic_time ();
+  pool = g_thread_pool_new ((GFunc) generate_descriptor, NULL, jobs, TRUE,
+      NULL);
+  for (i = 0; i < files->len; i++)
+    g_thread_pool_push (pool, g_ptr_array_index (files, i), NULL);
+
+  /* Waits for all the files to be processed */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_ptr_array_free (files, TRUE);
+  gst_plugin_feature_list_free (demuxer_factories);
+
+  elapsed = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+  g_print ("%u generated, %u skipped, %u failed in %.1fs "
+      "(%.2f files/s, %.2f MB/s)\n", n_generated, n_skipped, n_failed,
+      elapsed, elapsed > 0 ? n_files / elapsed : 0,
+      elapsed > 0 ? bytes_processed / (1024. * 1024.) / elapsed : 0);
+
+  return n_failed ? 1 : 0;
+}
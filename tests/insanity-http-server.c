@@ -34,6 +34,8 @@
 #include "insanity-http-server.h"
 
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <libsoup/soup-address.h>
 #include <libsoup/soup-message.h>
@@ -41,8 +43,26 @@
 #include <libsoup/soup-auth-domain.h>
 #include <libsoup/soup-auth-domain-basic.h>
 #include <libsoup/soup-auth-domain-digest.h>
+#include <libsoup/soup-socket.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+#if defined (_POSIX_THREAD_CPUTIME) && _POSIX_THREAD_CPUTIME >= 0
+#define HAVE_THREAD_CPU_CLOCK 1
+#include <pthread.h>
+#include <time.h>
+#endif
+/* POSIX.1-2008 made struct stat timestamps struct timespec */
+#if defined (_POSIX_VERSION) && _POSIX_VERSION >= 200809L
+#define HAVE_STAT_MTIM 1
+#endif
 
 #define DEFAULT_CHUNKS_SIZE 4096
+#define DEFAULT_FILE_CACHE_SIZE (64 * 1024 * 1024)
+#define DEFAULT_BANDWIDTH_BURST (64 * 1024)
+#define DEFAULT_WORKERS 1
+#define DEFAULT_ACCESS_LOG_SIZE 1024
+#define MAX_WORKERS 64
 #define LOG(format, args...) \
   INSANITY_LOG (test, "httpserver", INSANITY_LOG_LEVEL_DEBUG, format, ##args)
 
@@ -51,6 +71,24 @@ enum
   PROP_0,
   PROP_TEST,
   PROP_CHUNKS_SIZE,
+  PROP_BYTES_SENT,
+  PROP_BYTES_REQUESTED,
+  PROP_FILE_CACHE_SIZE,
+  PROP_FILE_CACHE_HITS,
+  PROP_FILE_CACHE_MISSES,
+  PROP_MAX_BANDWIDTH,
+  PROP_CONNECTION_MAX_BANDWIDTH,
+  PROP_BANDWIDTH_BURST,
+  PROP_BANDWIDTH_PROFILE,
+  PROP_FIRST_BYTE_DELAY,
+  PROP_FIRST_BYTE_DELAY_JITTER,
+  PROP_FAULT_SCRIPT,
+  PROP_WORKERS,
+  PROP_ACCESS_LOG_SIZE,
+  PROP_CPU_TIME,
+  PROP_LIVE_WINDOW,
+  PROP_LIVE_SPEED,
+  PROP_LIVE_TARGET_DURATION,
   N_PROPERTIES
 };
 
@@ -60,6 +98,11 @@ enum
   SIGNAL_GET_CONTENT,
   SIGNAL_WRITING_CHUNK,
   SIGNAL_WRITING_DONE,
+  SIGNAL_REQUEST_DONE,
+  SIGNAL_FAULT_INJECTED,
+  SIGNAL_LIVE_SEGMENT_REQUESTED,
+  SIGNAL_REQUEST_STARTED,
+  SIGNAL_BANDWIDTH_CHANGED,
   SIGNAL_LAST
 };
 
@@ -72,6 +115,89 @@ const char *basic_auth_path = "/basic_auth";
 const char *digest_auth_path = "/digest_auth";
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+typedef struct
+{
+  gdouble tokens;               /* Bytes that can be sent, < 0 when in debt */
+  gint64 last;                  /* Monotonic time of the last refill */
+} TokenBucket;
+
+typedef struct
+{
+  gint64 time;                  /* From the start of the profile, in us */
+  guint64 rate;                 /* In bytes per second, 0 for unlimited */
+} BandwidthStep;
+
+/* Timing of a request, until it is stored in the access log */
+typedef struct
+{
+  InsanityHttpServer *srv;
+  gint64 accept_time;           /* Of the connection, 0 if reused */
+  gint64 start_time;
+  gint64 first_byte_time;
+  guint64 bytes_served;
+  gboolean reused_connection;
+} AccessLogRequest;
+
+typedef struct
+{
+  gchar *content_type;
+  gchar *contents;
+} ServerDocument;
+
+/* Live HLS emulation: media playlists are served as a window sliding over
+ * their segments, which are looped forever */
+typedef struct
+{
+  gchar *uri;                   /* As written in the playlist */
+  gchar *path;                  /* From the root of the server, NULL if the
+                                 * segment is not served by us */
+  GstClockTime start;           /* From the start of the playlist */
+  GstClockTime duration;
+} LiveSegment;
+
+typedef struct
+{
+  GString *tags;                /* Kept from the original playlist */
+  GArray *segments;
+  GstClockTime duration;        /* Of all the segments */
+  guint target_duration;        /* In seconds */
+} LivePlaylist;
+
+#ifdef HAVE_THREAD_CPU_CLOCK
+typedef struct
+{
+  GThread *thread;
+  clockid_t clock;
+} ServerThreadClock;
+#endif
+
+/* Runs a plain HTTP server on a context and thread of its own */
+typedef struct
+{
+  InsanityHttpServer *srv;
+  GThread *thread;
+  GMainContext *context;
+  SoupServer *server;
+  gboolean running;
+} HttpWorker;
+
+typedef enum
+{
+  FAULT_STALL,
+  FAULT_CLOSE,
+  FAULT_ERROR,
+  FAULT_TRUNCATE
+} HttpFaultType;
+
+typedef struct
+{
+  HttpFaultType type;
+  guint64 offset;               /* In the body, or length for truncate */
+  guint duration;               /* How long a stall lasts, in ms */
+  gchar *pattern;               /* Paths the fault applies to, or NULL */
+  gchar *description;
+} HttpFault;
 static guint signals[SIGNAL_LAST] = { 0, };
 
 struct _InsanityHttpServerPrivate
@@ -94,47 +220,733 @@ struct _InsanityHttpServerPrivate
 #ifdef USE_NEW_GLIB_MUTEX_API
   GMutex lock;
   GCond cond;
+  GMutex stats_lock;
+  GMutex cache_lock;
 #else
   GMutex *lock;
   GCond *cond;
+  GMutex *stats_lock;
+  GMutex *cache_lock;
 #endif
 
+  /* Statistics, protected by stats_lock */
+  guint64 bytes_sent;
+  guint64 bytes_requested;
+
+  /* Mapped files kept around between requests, protected by cache_lock so
+   * that looking files up does not contend with the statistics updated for
+   * each chunk. The queue is ordered from the most to the least recently
+   * used file */
+  guint64 file_cache_hits;
+  guint64 file_cache_misses;
+  GHashTable *file_cache;
+  GQueue file_cache_lru;
+  guint64 file_cache_used;
+  guint64 file_cache_size;
+
+  /* Live HLS emulation, protected by cache_lock. Playlists are parsed once
+   * and the live stream starts when the first one is served, with a full
+   * window */
+  guint live_window;            /* In segments, 0 to serve playlists as is */
+  gdouble live_speed;
+  guint live_target_duration;   /* In seconds, 0 to keep the original one */
+  gint64 live_start;
+  GHashTable *live_playlists;   /* Path -> LivePlaylist, NULL if not media */
+  GHashTable *live_segments;    /* Path -> LivePlaylist referencing it */
+  LivePlaylist *live_last;      /* The last one served */
+
+  /* Path -> ServerDocument, served instead of the source folder, protected
+   * by cache_lock */
+  GHashTable *documents;
+
+  /* Traffic shaping, protected by stats_lock. Rates are in bytes per
+   * second, 0 meaning unlimited, delays in milliseconds */
+  guint64 max_bandwidth;
+  guint64 connection_max_bandwidth;
+  guint64 bandwidth_burst;
+  TokenBucket bucket;
+  gchar *bandwidth_profile;
+  GArray *bandwidth_steps;
+  gint64 bandwidth_profile_start;
+  GSource *bandwidth_step_source;       /* Fires on the next step */
+  guint first_byte_delay;
+  guint first_byte_delay_jitter;
+
+  /* Faults still to be injected, protected by stats_lock */
+  gchar *fault_script;
+  GQueue faults;
+
+  /* Last requests answered, protected by stats_lock. The ring is allocated
+   * once, access_log_next being where the next request is stored */
+  InsanityHttpAccessLogEntry *access_log;
+  guint access_log_size;
+  guint access_log_next;
+  guint access_log_length;
+
+  /* CPU clocks of the threads running servers, and CPU time used by the
+   * ones which exited, protected by stats_lock */
+  GArray *cpu_clocks;
+  guint64 cpu_time_done;
+
   guint port;
   guint ssl_port;
   char *source_folder;
   SoupServer *server;
   SoupServer *ssl_server;
+
+  /* Plain HTTP servers running next to the main one, each on its own port */
+  guint n_workers;
+  GPtrArray *workers;
+  guint next_worker;
 };
 
 #ifdef USE_NEW_GLIB_MUTEX_API
 #define LOCK(srv) g_mutex_lock(&(srv)->priv->lock)
 #define UNLOCK(srv) g_mutex_unlock(&(srv)->priv->lock)
 #define SIGNAL(srv) g_cond_signal(&(srv)->priv->cond)
+#define STATS_LOCK(srv) g_mutex_lock(&(srv)->priv->stats_lock)
+#define STATS_UNLOCK(srv) g_mutex_unlock(&(srv)->priv->stats_lock)
+#define CACHE_LOCK(srv) g_mutex_lock(&(srv)->priv->cache_lock)
+#define CACHE_UNLOCK(srv) g_mutex_unlock(&(srv)->priv->cache_lock)
 #else
 #define LOCK(srv) g_mutex_lock((srv)->priv->lock)
 #define UNLOCK(srv) g_mutex_unlock((srv)->priv->lock)
 #define SIGNAL(srv) g_cond_signal((srv)->priv->cond)
+#define STATS_LOCK(srv) g_mutex_lock((srv)->priv->stats_lock)
+#define STATS_UNLOCK(srv) g_mutex_unlock((srv)->priv->stats_lock)
+#define CACHE_LOCK(srv) g_mutex_lock((srv)->priv->cache_lock)
+#define CACHE_UNLOCK(srv) g_mutex_unlock((srv)->priv->cache_lock)
 #endif
 
 typedef struct
 {
+  /* The chunks handed to soup point into the content, so they each hold a
+   * reference on the transmitter */
+  volatile gint refcount;
+
   /* Context fields */
   InsanityHttpServer *srv;
   SoupServer *server;
+  SoupMessage *msg;
+  GMainContext *context;        /* Where soup handles the message */
   gchar *path;
 
+  /* Traffic shaping and fault injection */
+  HttpFault *fault;
+  SoupSocket *sock;
+  TokenBucket *connection_bucket;
+  gint64 first_byte_time;
+  GSource *delay_source;
+
   /* Content fields */
   GMappedFile *f;
   GstBuffer *buf;
-  gsize size;
   const char *contents;
-  const char *ptr;
 
   GstMapInfo minfo;
+
+  /* What makes up the body: the requested ranges of the content and, for
+   * multi-range responses, the part headers between them, owned by
+   * @strings */
+  GArray *spans;
+  GPtrArray *strings;
+  guint current;                /* Span being written */
+  gsize offset;                 /* Position in the current span */
+  gsize length;                 /* Sum of the spans sizes */
+
+  /* Bytes of content asked by the client, and bytes of body sent so far */
+  guint64 requested;
+  guint64 served;
 } ChunkedTransmitter;
 
+typedef struct
+{
+  const char *data;
+  gsize size;
+} TransmitterSpan;
+
+typedef struct
+{
+  gchar *path;
+  GMappedFile *f;
+
+  /* What the file looked like when it was mapped */
+  gint64 size;
+  gint64 mtime;
+  glong mtime_nsec;
+  guint64 inode;
+
+  GList *link;                  /* In file_cache_lru */
+} FileCacheEntry;
+
 G_DEFINE_TYPE (InsanityHttpServer, insanity_http_server, G_TYPE_OBJECT);
 
+static void
+file_cache_entry_free (FileCacheEntry * entry)
+{
+  g_mapped_file_unref (entry->f);
+  g_free (entry->path);
+  g_slice_free (FileCacheEntry, entry);
+}
+
+/* Must be called with cache_lock held */
+static void
+file_cache_remove (InsanityHttpServer * srv, FileCacheEntry * entry)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+
+  g_queue_delete_link (&priv->file_cache_lru, entry->link);
+  priv->file_cache_used -= entry->size;
+  g_hash_table_remove (priv->file_cache, entry->path);
+}
+
+/* Must be called with cache_lock held */
+static void
+file_cache_trim (InsanityHttpServer * srv, guint64 budget)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+
+  while (priv->file_cache_used > budget)
+    file_cache_remove (srv, g_queue_peek_tail (&priv->file_cache_lru));
+}
+
+/* Sub-second part of the mtime, files rewritten within the same second
+ * would otherwise look unchanged */
+static glong
+stat_get_mtime_nsec (GStatBuf * st)
+{
+#ifdef HAVE_STAT_MTIM
+  return st->st_mtim.tv_nsec;
+#else
+  return 0;
+#endif
+}
+
+/* Returns a new reference to the mapping of @path, reusing the cached one
+ * as long as the file did not change on disk since it was mapped */
+static GMappedFile *
+file_cache_get (InsanityHttpServer * srv, const gchar * path)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+  FileCacheEntry *entry;
+  GMappedFile *f = NULL;
+  GStatBuf st;
+
+  if (g_stat (path, &st) < 0 || !S_ISREG (st.st_mode)) {
+    /* Gone, make sure we do not keep serving it */
+    CACHE_LOCK (srv);
+    entry = g_hash_table_lookup (priv->file_cache, path);
+    if (entry)
+      file_cache_remove (srv, entry);
+    CACHE_UNLOCK (srv);
+
+    return NULL;
+  }
+
+  CACHE_LOCK (srv);
+  entry = g_hash_table_lookup (priv->file_cache, path);
+  if (entry) {
+    if (entry->size == st.st_size && entry->mtime == st.st_mtime
+        && entry->mtime_nsec == stat_get_mtime_nsec (&st)
+        && entry->inode == st.st_ino) {
+      priv->file_cache_hits++;
+      g_queue_unlink (&priv->file_cache_lru, entry->link);
+      g_queue_push_head_link (&priv->file_cache_lru, entry->link);
+      f = g_mapped_file_ref (entry->f);
+      CACHE_UNLOCK (srv);
+
+      return f;
+    }
+
+    /* Modified since it was mapped */
+    file_cache_remove (srv, entry);
+  }
+  priv->file_cache_misses++;
+  CACHE_UNLOCK (srv);
+
+  if ((f = g_mapped_file_new (path, FALSE, NULL)) == NULL)
+    return NULL;
+
+  CACHE_LOCK (srv);
+  /* Files bigger than the whole cache are never kept, and another request
+   * may have mapped the same file while we were not holding the lock */
+  if (st.st_size <= priv->file_cache_size
+      && !g_hash_table_lookup (priv->file_cache, path)) {
+    file_cache_trim (srv, priv->file_cache_size - st.st_size);
+
+    entry = g_slice_new0 (FileCacheEntry);
+    entry->path = g_strdup (path);
+    entry->f = g_mapped_file_ref (f);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtime;
+    entry->mtime_nsec = stat_get_mtime_nsec (&st);
+    entry->inode = st.st_ino;
+    g_queue_push_head (&priv->file_cache_lru, entry);
+    entry->link = g_queue_peek_head_link (&priv->file_cache_lru);
+    priv->file_cache_used += entry->size;
+    g_hash_table_insert (priv->file_cache, entry->path, entry);
+  }
+  CACHE_UNLOCK (srv);
+
+  return f;
+}
+
+/* A bandwidth profile has one "<seconds> <bytes per second>" line per step,
+ * each rate applying from its time on. Empty lines and lines starting with
+ * '#' are ignored */
+static GArray *
+load_bandwidth_profile (const gchar * filename, GError ** error)
+{
+  gchar *contents, **lines, **line, *str, *end;
+  GArray *steps;
+  BandwidthStep step;
+  gdouble secs;
+
+  if (!g_file_get_contents (filename, &contents, NULL, error))
+    return NULL;
+
+  steps = g_array_new (FALSE, FALSE, sizeof (BandwidthStep));
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (line = lines; *line; line++) {
+    str = g_strstrip (*line);
+    if (*str == '\0' || *str == '#')
+      continue;
+
+    secs = g_ascii_strtod (str, &end);
+    if (end == str || secs < 0)
+      goto invalid;
+
+    str = end;
+    step.rate = g_ascii_strtoull (str, &end, 10);
+    if (end == str || *end != '\0')
+      goto invalid;
+
+    step.time = secs * G_USEC_PER_SEC;
+    if (steps->len > 0
+        && step.time < g_array_index (steps, BandwidthStep,
+            steps->len - 1).time)
+      goto invalid;
+
+    g_array_append_val (steps, step);
+  }
+
+  g_strfreev (lines);
+
+  return steps;
+
+invalid:
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+      "Invalid line in bandwidth profile %s: \"%s\"", filename, *line);
+  g_strfreev (lines);
+  g_array_free (steps, TRUE);
+
+  return NULL;
+}
+
+/* Must be called with stats_lock held */
+static guint64
+get_max_bandwidth (InsanityHttpServer * srv, gint64 now)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+  guint64 rate = priv->max_bandwidth;
+  BandwidthStep *step;
+  guint i;
+
+  /* The profile takes over once its first step is reached */
+  if (priv->bandwidth_steps) {
+    for (i = 0; i < priv->bandwidth_steps->len; i++) {
+      step = &g_array_index (priv->bandwidth_steps, BandwidthStep, i);
+      if (step->time > now - priv->bandwidth_profile_start)
+        break;
+      rate = step->rate;
+    }
+  }
+
+  return rate;
+}
+
+static void schedule_bandwidth_step (InsanityHttpServer * srv);
+
+static gboolean
+bandwidth_step_reached (gpointer data)
+{
+  InsanityHttpServer *srv = data;
+  guint64 rate;
+
+  STATS_LOCK (srv);
+  rate = get_max_bandwidth (srv, g_get_monotonic_time ());
+  STATS_UNLOCK (srv);
+
+  g_signal_emit (srv, signals[SIGNAL_BANDWIDTH_CHANGED], 0, rate);
+  schedule_bandwidth_step (srv);
+
+  return FALSE;
+}
+
+/* Announces the next step of the bandwidth profile when it is reached,
+ * from the server thread. Must be called with stats_lock held */
+static void
+schedule_bandwidth_step_unlocked (InsanityHttpServer * srv)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+  BandwidthStep *step;
+  gint64 elapsed;
+  guint i;
+
+  if (priv->bandwidth_step_source) {
+    g_source_destroy (priv->bandwidth_step_source);
+    g_source_unref (priv->bandwidth_step_source);
+    priv->bandwidth_step_source = NULL;
+  }
+
+  if (priv->bandwidth_steps == NULL || priv->mcontext == NULL)
+    return;
+
+  elapsed = g_get_monotonic_time () - priv->bandwidth_profile_start;
+  for (i = 0; i < priv->bandwidth_steps->len; i++) {
+    step = &g_array_index (priv->bandwidth_steps, BandwidthStep, i);
+    if (step->time >= elapsed) {
+      priv->bandwidth_step_source =
+          g_timeout_source_new ((step->time - elapsed) / 1000 + 1);
+      g_source_set_callback (priv->bandwidth_step_source,
+          bandwidth_step_reached, srv, NULL);
+      g_source_attach (priv->bandwidth_step_source, priv->mcontext);
+      break;
+    }
+  }
+}
+
+static void
+schedule_bandwidth_step (InsanityHttpServer * srv)
+{
+  STATS_LOCK (srv);
+  schedule_bandwidth_step_unlocked (srv);
+  STATS_UNLOCK (srv);
+}
+
+/* Refills @bucket at @rate and returns how long to wait, in microseconds,
+ * before it is out of debt. Sending is what puts the bucket in debt, so
+ * chunks bigger than the burst still get through */
+static gint64
+token_bucket_refill (TokenBucket * bucket, guint64 rate, guint64 burst,
+    gint64 now)
+{
+  if (rate == 0 || bucket->last == 0)
+    bucket->tokens = burst;
+  else
+    bucket->tokens = MIN (bucket->tokens +
+        (gdouble) (now - bucket->last) * rate / G_USEC_PER_SEC,
+        (gdouble) burst);
+  bucket->last = now;
+
+  if (bucket->tokens >= 0)
+    return 0;
+
+  return (gint64) (-bucket->tokens * G_USEC_PER_SEC / rate) + 1;
+}
+
+static void
+http_fault_free (HttpFault * fault)
+{
+  g_free (fault->pattern);
+  g_free (fault->description);
+  g_slice_free (HttpFault, fault);
+}
+
+static void
+server_document_free (ServerDocument * doc)
+{
+  g_free (doc->content_type);
+  g_free (doc->contents);
+  g_slice_free (ServerDocument, doc);
+}
+
+static void
+live_playlist_free (LivePlaylist * pl)
+{
+  LiveSegment *seg;
+  guint i;
+
+  if (pl == NULL)
+    return;
+
+  for (i = 0; i < pl->segments->len; i++) {
+    seg = &g_array_index (pl->segments, LiveSegment, i);
+    g_free (seg->uri);
+    g_free (seg->path);
+  }
+  g_array_free (pl->segments, TRUE);
+  g_string_free (pl->tags, TRUE);
+  g_slice_free (LivePlaylist, pl);
+}
+
+static gboolean
+parse_uint64 (const gchar * str, guint64 * value)
+{
+  gchar *end;
+
+  *value = g_ascii_strtoull (str, &end, 10);
+
+  return end != str && *end == '\0';
+}
+
+/* A fault script is a list of faults separated by newlines or ';'. They are
+ * injected in order, each into the next GET request whose path matches the
+ * optional glob pattern ending the fault:
+ *   stall <offset> <milliseconds> [<pattern>]
+ *   close <offset> [<pattern>]
+ *   error <count> [<pattern>]      answers 503 to <count> requests
+ *   truncate <length> [<pattern>]  cuts the Content-Length and the body
+ */
+static gboolean
+parse_fault_script (const gchar * script, GQueue * faults, GError ** error)
+{
+  gchar **lines, **line, **tokens, **token;
+  GPtrArray *args;
+  HttpFault *fault;
+  guint64 value, count = 1;
+  guint nargs;
+
+  lines = g_strsplit_set (script, ";\n", -1);
+  for (line = lines; *line; line++) {
+    g_strstrip (*line);
+
+    /* Tokens are separated by any amount of blanks */
+    tokens = g_strsplit_set (*line, " \t", -1);
+    args = g_ptr_array_new ();
+    for (token = tokens; *token; token++) {
+      if (**token)
+        g_ptr_array_add (args, *token);
+    }
+
+    if (args->len == 0) {
+      g_ptr_array_free (args, TRUE);
+      g_strfreev (tokens);
+      continue;
+    }
+
+    fault = g_slice_new0 (HttpFault);
+    nargs = 1;
+    if (!strcmp (args->pdata[0], "stall")) {
+      fault->type = FAULT_STALL;
+      nargs = 2;
+    } else if (!strcmp (args->pdata[0], "close")) {
+      fault->type = FAULT_CLOSE;
+    } else if (!strcmp (args->pdata[0], "error")) {
+      fault->type = FAULT_ERROR;
+    } else if (!strcmp (args->pdata[0], "truncate")) {
+      fault->type = FAULT_TRUNCATE;
+    } else {
+      goto invalid;
+    }
+
+    if (args->len < nargs + 1 || args->len > nargs + 2
+        || !parse_uint64 (args->pdata[1], &value))
+      goto invalid;
+
+    if (fault->type == FAULT_ERROR)
+      count = value;
+    else
+      fault->offset = value;
+
+    if (fault->type == FAULT_STALL) {
+      if (!parse_uint64 (args->pdata[2], &value) || value > G_MAXUINT)
+        goto invalid;
+      fault->duration = value;
+    }
+
+    if (args->len == nargs + 2)
+      fault->pattern = g_strdup (args->pdata[nargs + 1]);
+    fault->description = g_strdup (*line);
+
+    /* Each request answered with an error is a fault of its own */
+    for (; count > 1; count--) {
+      HttpFault *copy = g_slice_dup (HttpFault, fault);
+
+      copy->pattern = g_strdup (fault->pattern);
+      copy->description = g_strdup (fault->description);
+      g_queue_push_tail (faults, copy);
+    }
+    if (count == 1)
+      g_queue_push_tail (faults, fault);
+    else
+      http_fault_free (fault);
+    count = 1;
+
+    g_ptr_array_free (args, TRUE);
+    g_strfreev (tokens);
+  }
+
+  g_strfreev (lines);
+
+  return TRUE;
+
+invalid:
+  g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+      "Invalid fault: \"%s\"", *line);
+  http_fault_free (fault);
+  g_ptr_array_free (args, TRUE);
+  g_strfreev (tokens);
+  g_strfreev (lines);
+
+  return FALSE;
+}
+
+/* Must be called with stats_lock held */
+static HttpFault *
+take_fault (InsanityHttpServer * srv, const gchar * path)
+{
+  GList *l;
+  HttpFault *fault;
+
+  for (l = srv->priv->faults.head; l; l = l->next) {
+    fault = l->data;
+    if (fault->pattern == NULL
+        || g_pattern_match_simple (fault->pattern, path)) {
+      g_queue_delete_link (&srv->priv->faults, l);
+      return fault;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+emit_fault (InsanityHttpServer * srv, const gchar * path, HttpFault * fault)
+{
+  InsanityTest *test = srv->priv->test;
+
+  LOG ("Injecting fault \"%s\" into %s\n", fault->description, path);
+  g_signal_emit (srv, signals[SIGNAL_FAULT_INJECTED], 0, path,
+      fault->description);
+}
+
+#ifdef HAVE_THREAD_CPU_CLOCK
+static guint64
+thread_cpu_time (clockid_t clock)
+{
+  struct timespec ts;
+
+  if (clock_gettime (clock, &ts) != 0)
+    return 0;
+
+  return ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+#endif
+
+/* Server threads register their CPU clock so that the CPU time used by the
+ * server can be read from any thread */
+static void
+server_thread_enter (InsanityHttpServer * srv)
+{
+#ifdef HAVE_THREAD_CPU_CLOCK
+  ServerThreadClock tc;
+
+  tc.thread = g_thread_self ();
+  if (pthread_getcpuclockid (pthread_self (), &tc.clock) != 0)
+    return;
+
+  STATS_LOCK (srv);
+  g_array_append_val (srv->priv->cpu_clocks, tc);
+  STATS_UNLOCK (srv);
+#endif
+}
+
+static void
+server_thread_leave (InsanityHttpServer * srv)
+{
+#ifdef HAVE_THREAD_CPU_CLOCK
+  ServerThreadClock *tc;
+  guint i;
+
+  STATS_LOCK (srv);
+  for (i = 0; i < srv->priv->cpu_clocks->len; i++) {
+    tc = &g_array_index (srv->priv->cpu_clocks, ServerThreadClock, i);
+    if (tc->thread == g_thread_self ()) {
+      srv->priv->cpu_time_done += thread_cpu_time (tc->clock);
+      g_array_remove_index_fast (srv->priv->cpu_clocks, i);
+      break;
+    }
+  }
+  STATS_UNLOCK (srv);
+#endif
+}
+
+/* Must be called with stats_lock held */
+static guint64
+server_cpu_time (InsanityHttpServer * srv)
+{
+  guint64 cpu_time = srv->priv->cpu_time_done;
+#ifdef HAVE_THREAD_CPU_CLOCK
+  guint i;
+
+  for (i = 0; i < srv->priv->cpu_clocks->len; i++)
+    cpu_time += thread_cpu_time (g_array_index (srv->priv->cpu_clocks,
+            ServerThreadClock, i).clock);
+#endif
+
+  return cpu_time;
+}
+
+static gpointer
+http_worker_thread_func (gpointer data)
+{
+  HttpWorker *worker = data;
+
+  server_thread_enter (worker->srv);
+  g_main_context_push_thread_default (worker->context);
+  soup_server_run_async (worker->server);
+
+  while (worker->running)
+    g_main_context_iteration (worker->context, TRUE);
+
+  soup_server_quit (worker->server);
+  g_main_context_pop_thread_default (worker->context);
+  server_thread_leave (worker->srv);
+
+  return NULL;
+}
+
+static gboolean
+http_worker_start (HttpWorker * worker)
+{
+  worker->running = TRUE;
+  worker->thread =
+#if GLIB_CHECK_VERSION(2,31,2)
+      g_thread_new ("insanity_http_worker", http_worker_thread_func, worker);
+#else
+      g_thread_create ((GThreadFunc) http_worker_thread_func, worker, TRUE,
+      NULL);
+#endif
+
+  return worker->thread != NULL;
+}
+
+/* The worker keeps its server and context so it can be started again */
+static void
+http_worker_stop (HttpWorker * worker)
+{
+  if (worker->thread == NULL)
+    return;
+
+  worker->running = FALSE;
+  g_main_context_wakeup (worker->context);
+  g_thread_join (worker->thread);
+  worker->thread = NULL;
+}
+
+static void
+http_worker_free (HttpWorker * worker)
+{
+  http_worker_stop (worker);
+
+  g_object_unref (worker->server);
+  g_main_context_unref (worker->context);
+  g_slice_free (HttpWorker, worker);
+}
+
 static void
 insanity_http_server_dispose_simple (InsanityHttpServer * srv)
 {
@@ -155,6 +967,14 @@ insanity_http_server_dispose_simple (InsanityHttpServer * srv)
     srv->priv->test = NULL;
   }
 
+  STATS_LOCK (srv);
+  if (priv->bandwidth_step_source) {
+    g_source_destroy (priv->bandwidth_step_source);
+    g_source_unref (priv->bandwidth_step_source);
+    priv->bandwidth_step_source = NULL;
+  }
+  STATS_UNLOCK (srv);
+
   if (priv->mcontext) {
     g_main_context_unref (priv->mcontext);
     priv->mcontext = NULL;
@@ -164,6 +984,8 @@ insanity_http_server_dispose_simple (InsanityHttpServer * srv)
     g_main_loop_unref (priv->mloop);
     priv->mloop = NULL;
   }
+
+  g_ptr_array_set_size (priv->workers, 0);
 }
 
 static void
@@ -183,12 +1005,26 @@ insanity_http_server_finalize_simple (InsanityHttpServer * srv)
   g_free (priv->ssl_cert_file);
   g_free (priv->ssl_key_file);
 
+  STATS_LOCK (srv);
+  priv->bucket.last = 0;
+  STATS_UNLOCK (srv);
+
+  CACHE_LOCK (srv);
+  file_cache_trim (srv, 0);
+  priv->file_cache_hits = 0;
+  priv->file_cache_misses = 0;
+  CACHE_UNLOCK (srv);
+
 #ifdef USE_NEW_GLIB_MUTEX_API
   g_mutex_clear (&priv->lock);
   g_cond_clear (&priv->cond);
+  g_mutex_clear (&priv->stats_lock);
+  g_mutex_clear (&priv->cache_lock);
 #else
   g_mutex_free (priv->lock);
   g_cond_free (priv->cond);
+  g_mutex_free (priv->stats_lock);
+  g_mutex_free (priv->cache_lock);
 #endif
 
   priv->ssl_cert_file = NULL;
@@ -204,7 +1040,24 @@ insanity_http_server_finalize_simple (InsanityHttpServer * srv)
 static void
 insanity_http_server_finalize (GObject * gobject)
 {
-  insanity_http_server_finalize_simple (INSANITY_HTTP_SERVER (gobject));
+  InsanityHttpServer *srv = INSANITY_HTTP_SERVER (gobject);
+
+  insanity_http_server_finalize_simple (srv);
+  g_hash_table_unref (srv->priv->file_cache);
+  g_hash_table_unref (srv->priv->live_segments);
+  g_hash_table_unref (srv->priv->live_playlists);
+  g_hash_table_unref (srv->priv->documents);
+  g_ptr_array_free (srv->priv->workers, TRUE);
+  g_free (srv->priv->bandwidth_profile);
+  if (srv->priv->bandwidth_steps)
+    g_array_free (srv->priv->bandwidth_steps, TRUE);
+  g_free (srv->priv->fault_script);
+  g_queue_foreach (&srv->priv->faults, (GFunc) http_fault_free, NULL);
+  g_queue_clear (&srv->priv->faults);
+  g_free (srv->priv->access_log);
+#ifdef HAVE_THREAD_CPU_CLOCK
+  g_array_free (srv->priv->cpu_clocks, TRUE);
+#endif
 
   G_OBJECT_CLASS (insanity_http_server_parent_class)->finalize (gobject);
 }
@@ -222,6 +1075,94 @@ insanity_http_server_get_property (GObject * gobject,
     case PROP_CHUNKS_SIZE:
       g_value_set_ulong (value, srv->priv->chunks_size);
       break;
+    case PROP_BYTES_SENT:
+      STATS_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->bytes_sent);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_BYTES_REQUESTED:
+      STATS_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->bytes_requested);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_FILE_CACHE_SIZE:
+      CACHE_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->file_cache_size);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_FILE_CACHE_HITS:
+      CACHE_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->file_cache_hits);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_FILE_CACHE_MISSES:
+      CACHE_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->file_cache_misses);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_MAX_BANDWIDTH:
+      STATS_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->max_bandwidth);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_CONNECTION_MAX_BANDWIDTH:
+      STATS_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->connection_max_bandwidth);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_BANDWIDTH_BURST:
+      STATS_LOCK (srv);
+      g_value_set_uint64 (value, srv->priv->bandwidth_burst);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_BANDWIDTH_PROFILE:
+      STATS_LOCK (srv);
+      g_value_set_string (value, srv->priv->bandwidth_profile);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_FIRST_BYTE_DELAY:
+      STATS_LOCK (srv);
+      g_value_set_uint (value, srv->priv->first_byte_delay);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_FIRST_BYTE_DELAY_JITTER:
+      STATS_LOCK (srv);
+      g_value_set_uint (value, srv->priv->first_byte_delay_jitter);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_FAULT_SCRIPT:
+      STATS_LOCK (srv);
+      g_value_set_string (value, srv->priv->fault_script);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_WORKERS:
+      g_value_set_uint (value, srv->priv->n_workers);
+      break;
+    case PROP_ACCESS_LOG_SIZE:
+      STATS_LOCK (srv);
+      g_value_set_uint (value, srv->priv->access_log_size);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_CPU_TIME:
+      STATS_LOCK (srv);
+      g_value_set_uint64 (value, server_cpu_time (srv));
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_LIVE_WINDOW:
+      CACHE_LOCK (srv);
+      g_value_set_uint (value, srv->priv->live_window);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_LIVE_SPEED:
+      CACHE_LOCK (srv);
+      g_value_set_double (value, srv->priv->live_speed);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_LIVE_TARGET_DURATION:
+      CACHE_LOCK (srv);
+      g_value_set_uint (value, srv->priv->live_target_duration);
+      CACHE_UNLOCK (srv);
+      break;
     default:
       g_assert_not_reached ();
   }
@@ -240,6 +1181,113 @@ insanity_http_server_set_property (GObject * gobject,
     case PROP_CHUNKS_SIZE:
       srv->priv->chunks_size = g_value_get_ulong (value);
       break;
+    case PROP_FILE_CACHE_SIZE:
+      CACHE_LOCK (srv);
+      srv->priv->file_cache_size = g_value_get_uint64 (value);
+      file_cache_trim (srv, srv->priv->file_cache_size);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_MAX_BANDWIDTH:
+      STATS_LOCK (srv);
+      srv->priv->max_bandwidth = g_value_get_uint64 (value);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_CONNECTION_MAX_BANDWIDTH:
+      STATS_LOCK (srv);
+      srv->priv->connection_max_bandwidth = g_value_get_uint64 (value);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_BANDWIDTH_BURST:
+      STATS_LOCK (srv);
+      srv->priv->bandwidth_burst = g_value_get_uint64 (value);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_BANDWIDTH_PROFILE:{
+      const gchar *filename = g_value_get_string (value);
+      GArray *steps = NULL;
+      GError *error = NULL;
+
+      if (filename && *filename) {
+        steps = load_bandwidth_profile (filename, &error);
+        if (steps == NULL) {
+          g_warning ("Could not load bandwidth profile: %s", error->message);
+          g_error_free (error);
+        }
+      }
+
+      STATS_LOCK (srv);
+      g_free (srv->priv->bandwidth_profile);
+      srv->priv->bandwidth_profile = steps ? g_strdup (filename) : NULL;
+      if (srv->priv->bandwidth_steps)
+        g_array_free (srv->priv->bandwidth_steps, TRUE);
+      srv->priv->bandwidth_steps = steps;
+      srv->priv->bandwidth_profile_start = g_get_monotonic_time ();
+      schedule_bandwidth_step_unlocked (srv);
+      STATS_UNLOCK (srv);
+      break;
+    }
+    case PROP_FIRST_BYTE_DELAY:
+      STATS_LOCK (srv);
+      srv->priv->first_byte_delay = g_value_get_uint (value);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_FIRST_BYTE_DELAY_JITTER:
+      STATS_LOCK (srv);
+      srv->priv->first_byte_delay_jitter = g_value_get_uint (value);
+      STATS_UNLOCK (srv);
+      break;
+    case PROP_FAULT_SCRIPT:{
+      const gchar *script = g_value_get_string (value);
+      GQueue faults = G_QUEUE_INIT;
+      GError *error = NULL;
+
+      if (script && !parse_fault_script (script, &faults, &error)) {
+        g_warning ("Could not parse fault script: %s", error->message);
+        g_error_free (error);
+        g_queue_foreach (&faults, (GFunc) http_fault_free, NULL);
+        g_queue_clear (&faults);
+        script = NULL;
+      }
+
+      /* Replaces whatever was not injected yet */
+      STATS_LOCK (srv);
+      g_free (srv->priv->fault_script);
+      srv->priv->fault_script = g_strdup (script);
+      g_queue_foreach (&srv->priv->faults, (GFunc) http_fault_free, NULL);
+      g_queue_clear (&srv->priv->faults);
+      srv->priv->faults = faults;
+      STATS_UNLOCK (srv);
+      break;
+    }
+    case PROP_WORKERS:
+      srv->priv->n_workers = g_value_get_uint (value);
+      break;
+    case PROP_LIVE_WINDOW:
+      CACHE_LOCK (srv);
+      srv->priv->live_window = g_value_get_uint (value);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_LIVE_SPEED:
+      CACHE_LOCK (srv);
+      srv->priv->live_speed = g_value_get_double (value);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_LIVE_TARGET_DURATION:
+      CACHE_LOCK (srv);
+      srv->priv->live_target_duration = g_value_get_uint (value);
+      CACHE_UNLOCK (srv);
+      break;
+    case PROP_ACCESS_LOG_SIZE:
+      /* The log is emptied */
+      STATS_LOCK (srv);
+      g_free (srv->priv->access_log);
+      srv->priv->access_log_size = g_value_get_uint (value);
+      srv->priv->access_log = g_new0 (InsanityHttpAccessLogEntry,
+          srv->priv->access_log_size);
+      srv->priv->access_log_next = 0;
+      srv->priv->access_log_length = 0;
+      STATS_UNLOCK (srv);
+      break;
     default:
       g_assert_not_reached ();
   }
@@ -263,8 +1311,111 @@ insanity_http_server_class_init (InsanityHttpServerClass * klass)
       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS);
 
   properties[PROP_CHUNKS_SIZE] =
-      g_param_spec_ulong ("chunks-size", "Chunks size", "The size of the chunks"
-      "the severs writes in bytes", 0, G_MAXUINT64, DEFAULT_CHUNKS_SIZE,
+      g_param_spec_ulong ("chunks-size", "Chunks size",
+      "The size of the chunks the severs writes in bytes", 1, G_MAXULONG,
+      DEFAULT_CHUNKS_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_BYTES_SENT] =
+      g_param_spec_uint64 ("bytes-sent", "Bytes sent", "The number of bytes "
+      "of body the server sent so far, including multipart headers", 0,
+      G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_BYTES_REQUESTED] =
+      g_param_spec_uint64 ("bytes-requested", "Bytes requested",
+      "The number of bytes of content the clients asked for so far", 0,
+      G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FILE_CACHE_SIZE] =
+      g_param_spec_uint64 ("file-cache-size", "File cache size",
+      "The maximum number of bytes of mapped files kept between requests, "
+      "0 to map the files again for each request", 0, G_MAXUINT64,
+      DEFAULT_FILE_CACHE_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FILE_CACHE_HITS] =
+      g_param_spec_uint64 ("file-cache-hits", "File cache hits",
+      "The number of requests served from an already mapped file", 0,
+      G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FILE_CACHE_MISSES] =
+      g_param_spec_uint64 ("file-cache-misses", "File cache misses",
+      "The number of requests for which the file had to be mapped", 0,
+      G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_MAX_BANDWIDTH] =
+      g_param_spec_uint64 ("max-bandwidth", "Maximum bandwidth",
+      "The maximum number of bytes per second sent over all the connections, "
+      "0 for unlimited", 0, G_MAXUINT64, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_CONNECTION_MAX_BANDWIDTH] =
+      g_param_spec_uint64 ("connection-max-bandwidth",
+      "Maximum bandwidth per connection", "The maximum number of bytes per "
+      "second sent over each connection, 0 for unlimited", 0, G_MAXUINT64, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_BANDWIDTH_BURST] =
+      g_param_spec_uint64 ("bandwidth-burst", "Bandwidth burst",
+      "The number of bytes that can be sent at once after being idle, "
+      "whatever the bandwidth limits", 0, G_MAXUINT64,
+      DEFAULT_BANDWIDTH_BURST, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_BANDWIDTH_PROFILE] =
+      g_param_spec_string ("bandwidth-profile", "Bandwidth profile",
+      "Path to a file with one \"<seconds> <bytes per second>\" line per "
+      "change of the maximum bandwidth over time, overriding max-bandwidth "
+      "from its first step on", NULL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FIRST_BYTE_DELAY] =
+      g_param_spec_uint ("first-byte-delay", "First byte delay",
+      "The time in milliseconds to wait before answering a GET request", 0,
+      G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FIRST_BYTE_DELAY_JITTER] =
+      g_param_spec_uint ("first-byte-delay-jitter", "First byte delay jitter",
+      "The maximum random time in milliseconds added to first-byte-delay", 0,
+      G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_FAULT_SCRIPT] =
+      g_param_spec_string ("fault-script", "Fault script",
+      "Faults to inject into the next GET requests, separated by ';': "
+      "\"stall <offset> <ms>\", \"close <offset>\", \"error <count>\" or "
+      "\"truncate <length>\", each optionally followed by a path pattern",
+      NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_WORKERS] =
+      g_param_spec_uint ("workers", "Workers",
+      "The number of plain HTTP servers, each running in its own thread on "
+      "its own port, taken into account when the server starts", 1,
+      MAX_WORKERS, DEFAULT_WORKERS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_ACCESS_LOG_SIZE] =
+      g_param_spec_uint ("access-log-size", "Access log size",
+      "The number of requests kept in the access log, 0 to disable it", 0,
+      G_MAXUINT, DEFAULT_ACCESS_LOG_SIZE,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_CPU_TIME] =
+      g_param_spec_uint64 ("cpu-time", "CPU time",
+      "The CPU time used by the threads running the server so far, in "
+      "nanoseconds (0 if the platform cannot tell)", 0, G_MAXUINT64, 0,
+      G_PARAM_READABLE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_LIVE_WINDOW] =
+      g_param_spec_uint ("live-window", "Live window",
+      "The number of segments in the media playlists served as a live "
+      "stream looping over the original segments, 0 to serve them as is",
+      0, G_MAXUINT, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_LIVE_SPEED] =
+      g_param_spec_double ("live-speed", "Live speed",
+      "How fast new segments appear in the live playlists, 1 for real time",
+      0.01, 100, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  properties[PROP_LIVE_TARGET_DURATION] =
+      g_param_spec_uint ("live-target-duration", "Live target duration",
+      "The target duration in seconds announced by the live playlists, 0 "
+      "to keep the one of the original playlist", 0, G_MAXUINT, 0,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
 
   signals[SIGNAL_GET_CONTENT] = g_signal_new ("get-content",
@@ -281,6 +1432,27 @@ insanity_http_server_class_init (InsanityHttpServerClass * klass)
   signals[SIGNAL_WRITING_DONE] = g_signal_new ("writing-done", G_TYPE_FROM_CLASS (gobject_class), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING,      /* Path to file writen */
       NULL);
 
+  signals[SIGNAL_REQUEST_DONE] = g_signal_new ("request-done", G_TYPE_FROM_CLASS (gobject_class), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 3, G_TYPE_STRING,     /* Path to file */
+      G_TYPE_UINT64,            /* Bytes of content requested */
+      G_TYPE_UINT64,            /* Bytes of body served */
+      NULL);
+
+  signals[SIGNAL_FAULT_INJECTED] = g_signal_new ("fault-injected", G_TYPE_FROM_CLASS (gobject_class), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 2, G_TYPE_STRING,   /* Path to file */
+      G_TYPE_STRING,            /* Fault, as written in the script */
+      NULL);
+
+  signals[SIGNAL_LIVE_SEGMENT_REQUESTED] = g_signal_new ("live-segment-requested", G_TYPE_FROM_CLASS (gobject_class), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 4, G_TYPE_STRING,       /* Path to file */
+      G_TYPE_UINT64,            /* Media sequence number of the segment */
+      G_TYPE_UINT64,            /* Start of the segment in the live stream */
+      G_TYPE_UINT64,            /* Duration of the segment */
+      NULL);
+
+  signals[SIGNAL_REQUEST_STARTED] = g_signal_new ("request-started", G_TYPE_FROM_CLASS (gobject_class), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_STRING,   /* Path to file */
+      NULL);
+
+  signals[SIGNAL_BANDWIDTH_CHANGED] = g_signal_new ("bandwidth-changed", G_TYPE_FROM_CLASS (gobject_class), G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS, 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_UINT64, /* Bytes per second, 0 for unlimited */
+      NULL);
+
   g_object_class_install_properties (gobject_class, N_PROPERTIES, properties);
 }
 
@@ -295,9 +1467,13 @@ insanity_http_server_init (InsanityHttpServer * srv)
 #ifdef USE_NEW_GLIB_MUTEX_API
   g_mutex_init (&priv->lock);
   g_cond_init (&priv->cond);
+  g_mutex_init (&priv->stats_lock);
+  g_mutex_init (&priv->cache_lock);
 #else
   priv->lock = g_mutex_new ();
   priv->cond = g_cond_new ();
+  priv->stats_lock = g_mutex_new ();
+  priv->cache_lock = g_mutex_new ();
 #endif
 
   priv->port = 0;
@@ -313,71 +1489,623 @@ insanity_http_server_init (InsanityHttpServer * srv)
   priv->running = FALSE;
   priv->ready = TRUE;
 
-  priv->ssl_cert_file = NULL;
-  priv->ssl_key_file = NULL;
+  priv->ssl_cert_file = NULL;
+  priv->ssl_key_file = NULL;
+
+  priv->file_cache = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) file_cache_entry_free);
+  g_queue_init (&priv->file_cache_lru);
+  priv->file_cache_used = 0;
+  priv->file_cache_size = DEFAULT_FILE_CACHE_SIZE;
+
+  priv->live_window = 0;
+  priv->live_speed = 1;
+  priv->live_target_duration = 0;
+  priv->live_start = 0;
+  priv->live_playlists = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, (GDestroyNotify) live_playlist_free);
+  priv->live_segments = g_hash_table_new_full (g_str_hash, g_str_equal,
+      g_free, NULL);
+  priv->live_last = NULL;
+
+  priv->documents = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) server_document_free);
+
+  priv->max_bandwidth = 0;
+  priv->connection_max_bandwidth = 0;
+  priv->bandwidth_burst = DEFAULT_BANDWIDTH_BURST;
+  priv->bandwidth_profile = NULL;
+  priv->bandwidth_steps = NULL;
+  priv->bandwidth_step_source = NULL;
+  priv->first_byte_delay = 0;
+  priv->first_byte_delay_jitter = 0;
+
+  priv->fault_script = NULL;
+  g_queue_init (&priv->faults);
+
+  priv->n_workers = DEFAULT_WORKERS;
+  priv->workers = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      http_worker_free);
+  priv->next_worker = 0;
+
+  priv->access_log_size = DEFAULT_ACCESS_LOG_SIZE;
+  priv->access_log = g_new0 (InsanityHttpAccessLogEntry,
+      priv->access_log_size);
+  priv->access_log_next = 0;
+  priv->access_log_length = 0;
+
+#ifdef HAVE_THREAD_CPU_CLOCK
+  priv->cpu_clocks = g_array_new (FALSE, FALSE, sizeof (ServerThreadClock));
+#endif
+  priv->cpu_time_done = 0;
+}
+
+static ChunkedTransmitter *
+chunked_transmitter_new (InsanityHttpServer * srv, SoupServer * server,
+    SoupMessage * msg, SoupClientContext * client, const gchar * path)
+{
+  ChunkedTransmitter *ct = g_new0 (ChunkedTransmitter, 1);
+  GMainContext *context = soup_server_get_async_context (server);
+  SoupSocket *sock = soup_client_context_get_socket (client);
+
+  ct->refcount = 1;
+  ct->server = g_object_ref (server);
+  ct->srv = srv;
+  ct->msg = msg;
+  ct->context = context ? g_main_context_ref (context) : NULL;
+  ct->path = g_strdup (path);
+  ct->spans = g_array_new (FALSE, FALSE, sizeof (TransmitterSpan));
+  ct->strings = g_ptr_array_new_with_free_func (g_free);
+
+  /* The connection bucket lives as long as the connection, so that
+   * keep-alive requests share it */
+  if (sock) {
+    ct->sock = g_object_ref (sock);
+    ct->connection_bucket =
+        g_object_get_data (G_OBJECT (sock), "insanity-token-bucket");
+    if (ct->connection_bucket == NULL) {
+      ct->connection_bucket = g_new0 (TokenBucket, 1);
+      g_object_set_data_full (G_OBJECT (sock), "insanity-token-bucket",
+          ct->connection_bucket, g_free);
+    }
+  } else {
+    ct->connection_bucket = g_new0 (TokenBucket, 1);
+  }
+
+  return ct;
+}
+
+static ChunkedTransmitter *
+chunked_transmitter_ref (ChunkedTransmitter * ct)
+{
+  g_atomic_int_inc (&ct->refcount);
+
+  return ct;
+}
+
+static void
+chunked_transmitter_unref (ChunkedTransmitter * ct)
+{
+  if (!g_atomic_int_dec_and_test (&ct->refcount))
+    return;
+
+  g_object_unref (ct->server);
+  if (ct->context)
+    g_main_context_unref (ct->context);
+
+  if (ct->sock)
+    g_object_unref (ct->sock);
+  else
+    g_free (ct->connection_bucket);
+
+  if (ct->fault)
+    http_fault_free (ct->fault);
+
+  if (ct->f)
+    g_mapped_file_unref (ct->f);
+
+  if (ct->buf) {
+    gst_buffer_unmap (ct->buf, &ct->minfo);
+    gst_buffer_unref (ct->buf);
+  }
+
+  g_array_free (ct->spans, TRUE);
+  g_ptr_array_free (ct->strings, TRUE);
+  g_free (ct->path);
+
+  g_free (ct);
+}
+
+static void
+chunked_transmitter_add_span (ChunkedTransmitter * ct, const char *data,
+    gsize size)
+{
+  TransmitterSpan span = { data, size };
+
+  g_array_append_val (ct->spans, span);
+  ct->length += size;
+}
+
+/* Takes ownership of @str */
+static void
+chunked_transmitter_add_string (ChunkedTransmitter * ct, gchar * str)
+{
+  g_ptr_array_add (ct->strings, str);
+  chunked_transmitter_add_span (ct, str, strlen (str));
+}
+
+/* Calls @func from the context of the message after @delay microseconds */
+static void
+chunked_transmitter_delay (ChunkedTransmitter * ct, gint64 delay,
+    GSourceFunc func)
+{
+  ct->delay_source = g_timeout_source_new (MAX (1, (delay + 999) / 1000));
+  g_source_set_callback (ct->delay_source, func, chunked_transmitter_ref (ct),
+      (GDestroyNotify) chunked_transmitter_unref);
+  g_source_attach (ct->delay_source, ct->context);
+}
+
+static gboolean
+send_delayed_headers (gpointer data)
+{
+  ChunkedTransmitter *ct = data;
+
+  g_source_unref (ct->delay_source);
+  ct->delay_source = NULL;
+
+  soup_server_unpause_message (ct->server, ct->msg);
+
+  return FALSE;
+}
+
+static void
+http_message_finished (SoupMessage * msg, gpointer data)
+{
+  ChunkedTransmitter *ct = data;
+  InsanityTest *test = ct->srv->priv->test;
+
+  /* The message is gone, whatever we were waiting for */
+  if (ct->delay_source) {
+    g_source_destroy (ct->delay_source);
+    g_source_unref (ct->delay_source);
+    ct->delay_source = NULL;
+  }
+
+  LOG ("%s: %" G_GUINT64_FORMAT " bytes requested, %" G_GUINT64_FORMAT
+      " bytes served\n", ct->path, ct->requested, ct->served);
+
+  g_signal_emit (ct->srv, signals[SIGNAL_WRITING_DONE], 0, ct->path);
+  g_signal_emit (ct->srv, signals[SIGNAL_REQUEST_DONE], 0, ct->path,
+      ct->requested, ct->served);
+
+  chunked_transmitter_unref (ct);
+}
+
+static gboolean
+close_connection (gpointer data)
+{
+  ChunkedTransmitter *ct = data;
+
+  g_source_unref (ct->delay_source);
+  ct->delay_source = NULL;
+
+  /* Soup finishes the message as the body is incomplete */
+  if (ct->sock)
+    soup_socket_disconnect (ct->sock);
+
+  return FALSE;
+}
+
+static gboolean send_delayed_chunk (gpointer data);
+
+static void
+write_next_chunk (SoupMessage * msg, gpointer data)
+{
+  ChunkedTransmitter *ct = data;
+  InsanityHttpServerPrivate *priv = ct->srv->priv;
+  SoupServer *server;
+  TransmitterSpan *span = NULL;
+  SoupBuffer *chunk;
+  const char *ptr = NULL;
+  gsize size = 0;
+  gint64 now, delay, connection_delay;
+
+  /* The message stays paused until the bandwidth limits let us send more */
+  now = g_get_monotonic_time ();
+  STATS_LOCK (ct->srv);
+  delay = token_bucket_refill (&priv->bucket,
+      get_max_bandwidth (ct->srv, now), priv->bandwidth_burst, now);
+  connection_delay = token_bucket_refill (ct->connection_bucket,
+      priv->connection_max_bandwidth, priv->bandwidth_burst, now);
+  STATS_UNLOCK (ct->srv);
+
+  if (MAX (delay, connection_delay) > 0) {
+    chunked_transmitter_delay (ct, MAX (delay, connection_delay),
+        send_delayed_chunk);
+    return;
+  }
+
+  /* Stalls and closes happen once the body reached their offset */
+  if (ct->fault && ct->served >= ct->fault->offset) {
+    emit_fault (ct->srv, ct->path, ct->fault);
+    if (ct->fault->type == FAULT_STALL)
+      chunked_transmitter_delay (ct,
+          ct->fault->duration * G_GINT64_CONSTANT (1000), send_delayed_chunk);
+    else
+      chunked_transmitter_delay (ct, 0, close_connection);
+
+    http_fault_free (ct->fault);
+    ct->fault = NULL;
+    return;
+  }
+
+  server = g_object_ref (ct->server);
+
+  /* Chunks never go across spans */
+  while (ct->current < ct->spans->len) {
+    span = &g_array_index (ct->spans, TransmitterSpan, ct->current);
+    if (ct->offset < span->size)
+      break;
+
+    ct->current++;
+    ct->offset = 0;
+  }
+
+  if (ct->current < ct->spans->len) {
+    ptr = span->data + ct->offset;
+    size = MIN (span->size - ct->offset, ct->srv->priv->chunks_size);
+    /* The body may have been truncated */
+    size = MIN (size, ct->length - ct->served);
+    if (ct->fault)
+      size = MIN (size, ct->fault->offset - ct->served);
+  }
+
+  g_signal_emit (ct->srv, signals[SIGNAL_WRITING_CHUNK], 0,
+      ct->path, ptr, (guint64) size, (guint64) (ct->length - ct->served));
+
+  /* No copy, the chunk points into the mapped content */
+  if (size > 0) {
+    chunk = soup_buffer_new_with_owner (ptr, size,
+        chunked_transmitter_ref (ct),
+        (GDestroyNotify) chunked_transmitter_unref);
+    soup_message_body_append_buffer (msg->response_body, chunk);
+    soup_buffer_free (chunk);
+
+    ct->offset += size;
+    ct->served += size;
+
+    STATS_LOCK (ct->srv);
+    priv->bytes_sent += size;
+    priv->bucket.tokens -= size;
+    ct->connection_bucket->tokens -= size;
+    STATS_UNLOCK (ct->srv);
+  }
+
+  /* Once everything is written, soup stops by itself as the content length
+   * is reached */
+  soup_server_unpause_message (server, msg);
+  g_object_unref (server);
+}
+
+static gboolean
+send_delayed_chunk (gpointer data)
+{
+  ChunkedTransmitter *ct = data;
+
+  g_source_unref (ct->delay_source);
+  ct->delay_source = NULL;
+
+  write_next_chunk (ct->msg, ct);
+
+  return FALSE;
+}
+
+/* Returns NULL if @contents is not a media playlist. Only the tags found
+ * before the first segment are kept, the ones describing a VOD stream or
+ * the sequence of the segments excepted */
+static LivePlaylist *
+live_playlist_parse (const gchar * path, const gchar * contents, gsize size)
+{
+  LivePlaylist *pl;
+  LiveSegment seg;
+  gchar **lines, *line, *text, *dir;
+  gdouble duration = -1, max_duration = 0;
+  guint i;
+
+  text = g_strndup (contents, size);
+  lines = g_strsplit (text, "\n", -1);
+  g_free (text);
+  dir = g_path_get_dirname (path);
+
+  pl = g_slice_new0 (LivePlaylist);
+  pl->tags = g_string_new (NULL);
+  pl->segments = g_array_new (FALSE, FALSE, sizeof (LiveSegment));
+
+  for (i = 0; lines[i]; i++) {
+    line = g_strstrip (lines[i]);
+
+    if (*line == '\0' || g_str_has_prefix (line, "#EXTM3U")
+        || g_str_has_prefix (line, "#EXT-X-ENDLIST")
+        || g_str_has_prefix (line, "#EXT-X-PLAYLIST-TYPE")
+        || g_str_has_prefix (line, "#EXT-X-MEDIA-SEQUENCE")
+        || g_str_has_prefix (line, "#EXT-X-DISCONTINUITY")) {
+      continue;
+    } else if (g_str_has_prefix (line, "#EXT-X-TARGETDURATION:")) {
+      pl->target_duration = atoi (line + strlen ("#EXT-X-TARGETDURATION:"));
+    } else if (g_str_has_prefix (line, "#EXTINF:")) {
+      duration = g_ascii_strtod (line + strlen ("#EXTINF:"), NULL);
+    } else if (*line == '#') {
+      if (pl->segments->len == 0 && duration < 0)
+        g_string_append_printf (pl->tags, "%s\n", line);
+    } else if (duration >= 0) {
+      seg.uri = g_strdup (line);
+      if (strchr (line, ':') || strchr (line, '?'))
+        seg.path = NULL;
+      else if (*line == '/')
+        seg.path = g_strdup (line);
+      else
+        seg.path = g_build_filename (dir, line, NULL);
+      seg.start = pl->duration;
+      seg.duration = duration * GST_SECOND;
+      g_array_append_val (pl->segments, seg);
+
+      pl->duration += seg.duration;
+      max_duration = MAX (max_duration, duration);
+      duration = -1;
+    }
+  }
+
+  g_strfreev (lines);
+  g_free (dir);
+
+  if (pl->duration == 0) {
+    live_playlist_free (pl);
+    return NULL;
+  }
+
+  if (pl->target_duration == 0)
+    pl->target_duration = (guint) max_duration +
+        (max_duration > (guint) max_duration ? 1 : 0);
+
+  return pl;
+}
+
+/* Media time of the live stream, must be called with cache_lock held */
+static GstClockTime
+live_now (InsanityHttpServer * srv)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+
+  return (GstClockTime) ((g_get_monotonic_time () - priv->live_start) *
+      priv->live_speed) * GST_USECOND;
+}
+
+/* Number of segments available at @now, the window being full from the
+ * start */
+static guint64
+live_playlist_produced (LivePlaylist * pl, guint window, GstClockTime now)
+{
+  LiveSegment *seg;
+  guint64 produced = window + (now / pl->duration) * pl->segments->len;
+  GstClockTime left = now % pl->duration;
+  guint i;
+
+  for (i = 0; i < pl->segments->len; i++) {
+    seg = &g_array_index (pl->segments, LiveSegment, i);
+    if (seg->start + seg->duration > left)
+      break;
+    produced++;
+  }
+
+  return produced;
+}
+
+static GstClockTime
+live_segment_start (LivePlaylist * pl, guint64 sequence)
+{
+  guint n = pl->segments->len;
+
+  return (sequence / n) * pl->duration +
+      g_array_index (pl->segments, LiveSegment, sequence % n).start;
+}
+
+/* Must be called with cache_lock held */
+static gchar *
+live_playlist_render (InsanityHttpServer * srv, LivePlaylist * pl)
+{
+  InsanityHttpServerPrivate *priv = srv->priv;
+  GString *playlist = g_string_new ("#EXTM3U\n");
+  gchar duration[G_ASCII_DTOSTR_BUF_SIZE];
+  guint n = pl->segments->len;
+  guint64 produced, first, sequence;
+  LiveSegment *seg;
+
+  produced = live_playlist_produced (pl, priv->live_window, live_now (srv));
+  first = produced - priv->live_window;
+
+  g_string_append (playlist, pl->tags->str);
+  g_string_append_printf (playlist, "#EXT-X-TARGETDURATION:%u\n"
+      "#EXT-X-MEDIA-SEQUENCE:%" G_GUINT64_FORMAT "\n"
+      "#EXT-X-DISCONTINUITY-SEQUENCE:%" G_GUINT64_FORMAT "\n",
+      priv->live_target_duration ? priv->live_target_duration :
+      pl->target_duration, first, first / n);
+
+  for (sequence = first; sequence < produced; sequence++) {
+    seg = &g_array_index (pl->segments, LiveSegment, sequence % n);
+
+    /* Timestamps start over with each loop */
+    if (sequence % n == 0 && sequence != first)
+      g_string_append (playlist, "#EXT-X-DISCONTINUITY\n");
+
+    g_ascii_dtostr (duration, sizeof (duration),
+        seg->duration / (gdouble) GST_SECOND);
+    /* The sequence tells which loop a segment request is for */
+    if (seg->path)
+      g_string_append_printf (playlist, "#EXTINF:%s,\n%s?live-sequence=%"
+          G_GUINT64_FORMAT "\n", duration, seg->uri, sequence);
+    else
+      g_string_append_printf (playlist, "#EXTINF:%s,\n%s\n", duration,
+          seg->uri);
+  }
+
+  return g_string_free (playlist, FALSE);
 }
 
-static void
-free_chunked_transmitter (ChunkedTransmitter * ct)
+/* Answers the requests for the documents added with
+ * insanity_http_server_add_document(), returns FALSE for anything else */
+static gboolean
+do_document (InsanityHttpServer * srv, SoupMessage * msg, const char *path)
 {
-  g_object_unref (ct->server);
+  ServerDocument *doc;
+  gchar *content_type = NULL, *contents = NULL, *length;
+
+  CACHE_LOCK (srv);
+  doc = g_hash_table_lookup (srv->priv->documents, path);
+  if (doc) {
+    content_type = g_strdup (doc->content_type);
+    contents = g_strdup (doc->contents);
+  }
+  CACHE_UNLOCK (srv);
 
-  if (ct->f)
-    g_mapped_file_unref (ct->f);
+  if (doc == NULL)
+    return FALSE;
 
-  if (ct->buf) {
-    gst_buffer_unmap (ct->buf, &ct->minfo);
-    gst_buffer_unref (ct->buf);
+  if (msg->method == SOUP_METHOD_GET) {
+    soup_message_set_response (msg, content_type, SOUP_MEMORY_TAKE, contents,
+        strlen (contents));
+  } else {
+    soup_message_headers_replace (msg->response_headers, "Content-Type",
+        content_type);
+    length = g_strdup_printf ("%lu", (gulong) strlen (contents));
+    soup_message_headers_append (msg->response_headers, "Content-Length",
+        length);
+    g_free (length);
+    g_free (contents);
   }
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+  g_free (content_type);
 
-  g_free (ct->path);
-
-  g_free (ct);
+  return TRUE;
 }
 
-static void
-http_message_finished (SoupMessage * msg, gpointer data)
+/* Answers the requests for media playlists when emulating a live stream,
+ * and reports the requests for their segments. Returns FALSE to let
+ * do_get() serve anything else */
+static gboolean
+do_live (InsanityHttpServer * srv, SoupMessage * msg, const char *path,
+    GHashTable * query)
 {
-  ChunkedTransmitter *ct = data;
+  InsanityHttpServerPrivate *priv = srv->priv;
+  InsanityTest *test = priv->test;
+  LivePlaylist *pl = NULL;
+  LiveSegment *seg;
+  const gchar *sequence_str;
+  guint64 sequence = 0;
+  GstClockTime start = 0, duration = 0;
+  GMappedFile *f;
+  gchar *local_uri, *body, *length;
+  gpointer found;
+  gboolean known;
+  guint i;
 
-  g_signal_emit (ct->srv, signals[SIGNAL_WRITING_DONE], 0, ct->path);
+  if (priv->source_folder == NULL)
+    return FALSE;
 
-  free_chunked_transmitter (ct);
-}
+  CACHE_LOCK (srv);
+  if (priv->live_window == 0) {
+    CACHE_UNLOCK (srv);
+    return FALSE;
+  }
 
-static void
-write_next_chunk (SoupMessage * msg, gpointer data)
-{
-  ChunkedTransmitter *ct = data;
-  SoupServer *server = g_object_ref (ct->server);
-  char *buf;
-  gsize size, buflen = ct->srv->priv->chunks_size,
-      written = ct->ptr - ct->contents;
+  sequence_str = query ? g_hash_table_lookup (query, "live-sequence") : NULL;
+  if (sequence_str) {
+    pl = g_hash_table_lookup (priv->live_segments, path);
+    if (pl) {
+      sequence = g_ascii_strtoull (sequence_str, NULL, 10);
+      start = live_segment_start (pl, sequence);
+      duration = g_array_index (pl->segments, LiveSegment,
+          sequence % pl->segments->len).duration;
+    }
+    CACHE_UNLOCK (srv);
 
-  size =
-      (ct->ptr + buflen >
-      ct->contents + ct->size) ? ct->contents + ct->size - ct->ptr : buflen;
+    if (pl && msg->method == SOUP_METHOD_GET)
+      g_signal_emit (srv, signals[SIGNAL_LIVE_SEGMENT_REQUESTED], 0, path,
+          sequence, start, duration);
+    return FALSE;
+  }
+
+  if (!g_str_has_suffix (path, ".m3u8")) {
+    CACHE_UNLOCK (srv);
+    return FALSE;
+  }
 
-  buf = g_malloc (size);
-  memcpy (buf, ct->ptr, size);
+  known = g_hash_table_lookup_extended (priv->live_playlists, path, NULL,
+      &found);
+  CACHE_UNLOCK (srv);
 
-  g_signal_emit (ct->srv, signals[SIGNAL_WRITING_CHUNK], 0,
-      ct->path, ct->contents + written, size, ct->size - written);
+  if (!known) {
+    local_uri = g_build_filename (priv->source_folder, path, NULL);
+    f = file_cache_get (srv, local_uri);
+    g_free (local_uri);
+    if (f == NULL)
+      return FALSE;
 
-  soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE, buf, size);
-  ct->ptr += size;
+    pl = live_playlist_parse (path, g_mapped_file_get_contents (f),
+        g_mapped_file_get_length (f));
+    g_mapped_file_unref (f);
+    LOG ("Serving %s as %s\n", path, pl ? "a live playlist" : "is");
+  }
 
-  if (ct->ptr == ct->contents + ct->size) {
-    /* done, will be automatically stopped */
+  CACHE_LOCK (srv);
+  if (known) {
+    pl = found;
+  } else if (g_hash_table_lookup_extended (priv->live_playlists, path, NULL,
+          &found)) {
+    /* Another request parsed it meanwhile */
+    live_playlist_free (pl);
+    pl = found;
+  } else {
+    g_hash_table_insert (priv->live_playlists, g_strdup (path), pl);
+    for (i = 0; pl && i < pl->segments->len; i++) {
+      seg = &g_array_index (pl->segments, LiveSegment, i);
+      if (seg->path)
+        g_hash_table_insert (priv->live_segments, g_strdup (seg->path), pl);
+    }
   }
 
-  soup_server_unpause_message (server, msg);
-  g_object_unref (server);
+  if (pl == NULL) {
+    CACHE_UNLOCK (srv);
+    return FALSE;
+  }
+
+  if (priv->live_start == 0)
+    priv->live_start = g_get_monotonic_time ();
+  priv->live_last = pl;
+  body = live_playlist_render (srv, pl);
+  CACHE_UNLOCK (srv);
+
+  soup_message_headers_replace (msg->response_headers, "Cache-Control",
+      "no-cache");
+  if (msg->method == SOUP_METHOD_GET) {
+    soup_message_set_response (msg, "application/vnd.apple.mpegurl",
+        SOUP_MEMORY_TAKE, body, strlen (body));
+  } else {
+    soup_message_headers_replace (msg->response_headers, "Content-Type",
+        "application/vnd.apple.mpegurl");
+    length = g_strdup_printf ("%lu", (gulong) strlen (body));
+    soup_message_headers_append (msg->response_headers, "Content-Length",
+        length);
+    g_free (length);
+    g_free (body);
+  }
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+
+  return TRUE;
 }
 
 static void
 do_get (InsanityHttpServer * srv, SoupServer * server, SoupMessage * msg,
-    const char *path)
+    SoupClientContext * client, const char *path)
 {
   char *uri, *local_uri = NULL;
   GMappedFile *f = NULL;
@@ -388,6 +2116,7 @@ do_get (InsanityHttpServer * srv, SoupServer * server, SoupMessage * msg,
   ChunkedTransmitter *ct;
 
   SoupKnownStatusCode status = SOUP_STATUS_OK;
+  HttpFault *fault = NULL;
 
   uri = soup_uri_to_string (soup_message_get_uri (msg), FALSE);
   LOG ("request: \"%s\"\n", uri);
@@ -416,7 +2145,7 @@ do_get (InsanityHttpServer * srv, SoupServer * server, SoupMessage * msg,
     else
       local_uri = g_build_filename (priv->source_folder, path, NULL);
 
-    if ((f = g_mapped_file_new (local_uri, FALSE, NULL)) == NULL) {
+    if ((f = file_cache_get (srv, local_uri)) == NULL) {
       status = SOUP_STATUS_NOT_FOUND;
       goto leave;
     }
@@ -424,11 +2153,24 @@ do_get (InsanityHttpServer * srv, SoupServer * server, SoupMessage * msg,
     size = g_mapped_file_get_length (f);
   }
 
+  if (msg->method == SOUP_METHOD_GET) {
+    STATS_LOCK (srv);
+    fault = take_fault (srv, path);
+    STATS_UNLOCK (srv);
+
+    if (fault && fault->type == FAULT_ERROR) {
+      emit_fault (srv, path, fault);
+      status = SOUP_STATUS_SERVICE_UNAVAILABLE;
+      goto leave;
+    }
+  }
+
   if (msg->method == SOUP_METHOD_GET) {
     const char *contents = NULL;
     SoupRange *ranges = NULL;
-    int nranges = 0;
+    int i, nranges = 0;
     goffset start, end;
+    guint delay;
     GstMapInfo minfo;
 
     if (size == 0) {
@@ -448,42 +2190,99 @@ do_get (InsanityHttpServer * srv, SoupServer * server, SoupMessage * msg,
       goto leave;
     }
 
-    if (soup_message_headers_get_ranges (msg->request_headers, size, &ranges,
-            &nranges)) {
-      start = ranges[0].start;
-      end = ranges[0].end;
-      soup_message_headers_free_ranges (msg->request_headers, ranges);
-      soup_message_headers_set_content_range (msg->response_headers, start, end,
-          size);
-      status = SOUP_STATUS_PARTIAL_CONTENT;
-    } else {
-      start = 0;
-      end = size - 1;
-    }
-    soup_message_headers_set_content_length (msg->response_headers, size);
-
     /* We'll send in chunks */
-    ct = g_malloc (sizeof (ChunkedTransmitter));
-    ct->server = g_object_ref (server);
-    ct->srv = srv;
-    ct->path = g_strdup (path);
+    ct = chunked_transmitter_new (srv, server, msg, client, path);
     if (f) {
       ct->f = g_mapped_file_ref (f);
-      ct->buf = NULL;
-    } else {
+    } else if (size > 0) {
       ct->buf = gst_buffer_ref (buf);
-      ct->f = NULL;
       ct->minfo = minfo;
     }
     ct->contents = contents;
-    ct->ptr = contents + start;
-    ct->size = end + 1;
+
+    /* Suffix ranges are resolved against the size by soup */
+    if (soup_message_headers_get_ranges (msg->request_headers, size, &ranges,
+            &nranges)) {
+      status = SOUP_STATUS_PARTIAL_CONTENT;
+    }
+
+    if (nranges == 0) {
+      chunked_transmitter_add_span (ct, contents, size);
+      ct->requested = size;
+    } else if (nranges == 1) {
+      soup_message_headers_set_content_range (msg->response_headers,
+          ranges[0].start, ranges[0].end, size);
+      chunked_transmitter_add_span (ct, contents + ranges[0].start,
+          ranges[0].end - ranges[0].start + 1);
+      ct->requested = ranges[0].end - ranges[0].start + 1;
+    } else {
+      gchar *boundary, *content_type;
+
+      boundary = g_strdup_printf ("insanity-%08x%08x", g_random_int (),
+          g_random_int ());
+
+      for (i = 0; i < nranges; i++) {
+        start = ranges[i].start;
+        end = ranges[i].end;
+
+        chunked_transmitter_add_string (ct,
+            g_strdup_printf ("%s--%s\r\n"
+                "Content-Type: application/octet-stream\r\n"
+                "Content-Range: bytes %" G_GOFFSET_FORMAT "-%" G_GOFFSET_FORMAT
+                "/%" G_GSSIZE_FORMAT "\r\n\r\n", i ? "\r\n" : "", boundary,
+                start, end, size));
+        chunked_transmitter_add_span (ct, contents + start, end - start + 1);
+        ct->requested += end - start + 1;
+      }
+      chunked_transmitter_add_string (ct,
+          g_strdup_printf ("\r\n--%s--\r\n", boundary));
+
+      content_type = g_strdup_printf ("multipart/byteranges; boundary=%s",
+          boundary);
+      soup_message_headers_replace (msg->response_headers, "Content-Type",
+          content_type);
+      g_free (content_type);
+      g_free (boundary);
+    }
+
+    if (ranges)
+      soup_message_headers_free_ranges (msg->request_headers, ranges);
+
+    if (fault && fault->type == FAULT_TRUNCATE) {
+      emit_fault (srv, path, fault);
+      ct->length = MIN (ct->length, fault->offset);
+    } else if (fault) {
+      ct->fault = fault;
+      fault = NULL;
+    }
+
+    soup_message_headers_set_content_length (msg->response_headers,
+        ct->length);
+
+    STATS_LOCK (srv);
+    priv->bytes_requested += ct->requested;
+    STATS_UNLOCK (srv);
 
     soup_message_headers_set_encoding (msg->response_headers,
         SOUP_ENCODING_CONTENT_LENGTH);
+    /* Chunks are dropped once written instead of piling up */
+    soup_message_body_set_accumulate (msg->response_body, FALSE);
     g_signal_connect (msg, "finished", G_CALLBACK (http_message_finished), ct);
     g_signal_connect (msg, "wrote-chunk", G_CALLBACK (write_next_chunk), ct);
     g_signal_connect (msg, "wrote-headers", G_CALLBACK (write_next_chunk), ct);
+
+    STATS_LOCK (srv);
+    delay = priv->first_byte_delay;
+    if (priv->first_byte_delay_jitter)
+      delay += g_random_double_range (0, priv->first_byte_delay_jitter);
+    STATS_UNLOCK (srv);
+
+    /* Nothing, headers included, is sent before the delay */
+    if (delay > 0) {
+      soup_server_pause_message (server, msg);
+      chunked_transmitter_delay (ct, delay * G_GINT64_CONSTANT (1000),
+          send_delayed_headers);
+    }
   } else {                      /* msg->method == SOUP_METHOD_HEAD */
 
     char *length;
@@ -505,6 +2304,8 @@ leave:
   g_free (local_uri);
   if (f)
     g_mapped_file_unref (f);
+  if (fault)
+    http_fault_free (fault);
 }
 
 static void
@@ -514,6 +2315,121 @@ print_header (const char *name, const char *value, gpointer data)
   LOG ("header: %s: %s\n", name, value);
 }
 
+static void
+access_log_request_free (AccessLogRequest * req)
+{
+  g_slice_free (AccessLogRequest, req);
+}
+
+static void
+access_log_wrote_headers (SoupMessage * msg, AccessLogRequest * req)
+{
+  if (req->first_byte_time == 0)
+    req->first_byte_time = g_get_monotonic_time ();
+}
+
+static void
+access_log_wrote_body_data (SoupMessage * msg, SoupBuffer * chunk,
+    AccessLogRequest * req)
+{
+  req->bytes_served += chunk->length;
+}
+
+static void
+access_log_finished (SoupMessage * msg, AccessLogRequest * req)
+{
+  InsanityHttpServerPrivate *priv = req->srv->priv;
+  InsanityHttpAccessLogEntry *entry;
+  const gchar *range;
+  gint64 now = g_get_monotonic_time ();
+
+  STATS_LOCK (req->srv);
+  if (priv->access_log_size > 0) {
+    entry = &priv->access_log[priv->access_log_next];
+    priv->access_log_next = (priv->access_log_next + 1) %
+        priv->access_log_size;
+    priv->access_log_length = MIN (priv->access_log_length + 1,
+        priv->access_log_size);
+
+    range = soup_message_headers_get_one (msg->request_headers, "Range");
+    entry->method = msg->method;
+    g_strlcpy (entry->path, soup_message_get_uri (msg)->path,
+        sizeof (entry->path));
+    g_strlcpy (entry->range, range ? range : "", sizeof (entry->range));
+    entry->status = msg->status_code;
+    entry->bytes_served = req->bytes_served;
+    entry->time_to_first_byte = req->first_byte_time ?
+        (req->first_byte_time - req->start_time) * GST_USECOND :
+        GST_CLOCK_TIME_NONE;
+    entry->transfer_time = (now - req->start_time) * GST_USECOND;
+    entry->reused_connection = req->reused_connection;
+    entry->connection_time = req->accept_time ?
+        (req->start_time - req->accept_time) * GST_USECOND :
+        GST_CLOCK_TIME_NONE;
+  }
+  STATS_UNLOCK (req->srv);
+}
+
+/* Follows @msg until it is finished to store it in the access log */
+static void
+access_log_watch (InsanityHttpServer * srv, SoupMessage * msg,
+    SoupClientContext * context)
+{
+  AccessLogRequest *req;
+  SoupSocket *sock = soup_client_context_get_socket (context);
+  gint64 *accept_time = NULL;
+  guint requests = 0;
+
+  STATS_LOCK (srv);
+  if (srv->priv->access_log_size == 0) {
+    STATS_UNLOCK (srv);
+    return;
+  }
+  STATS_UNLOCK (srv);
+
+  req = g_slice_new0 (AccessLogRequest);
+  req->srv = srv;
+  req->start_time = g_get_monotonic_time ();
+
+  /* Connections count the requests made on them */
+  if (sock) {
+    requests = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (sock),
+            "insanity-requests"));
+    g_object_set_data (G_OBJECT (sock), "insanity-requests",
+        GUINT_TO_POINTER (requests + 1));
+    accept_time = g_object_get_data (G_OBJECT (sock), "insanity-accept-time");
+  }
+  req->reused_connection = requests > 0;
+  if (!req->reused_connection && accept_time)
+    req->accept_time = *accept_time;
+
+  g_signal_connect (msg, "wrote-headers",
+      G_CALLBACK (access_log_wrote_headers), req);
+  g_signal_connect (msg, "wrote-body-data",
+      G_CALLBACK (access_log_wrote_body_data), req);
+  g_signal_connect_data (msg, "finished", G_CALLBACK (access_log_finished),
+      req, (GClosureNotify) access_log_request_free, 0);
+}
+
+static void
+new_connection_cb (SoupSocket * listener, SoupSocket * sock, gpointer data)
+{
+  gint64 *accept_time = g_new (gint64, 1);
+
+  *accept_time = g_get_monotonic_time ();
+  g_object_set_data_full (G_OBJECT (sock), "insanity-accept-time",
+      accept_time, g_free);
+}
+
+/* Remembers when connections are accepted, so that the time taken to set
+ * them up, TLS handshake included, shows in the access log */
+static void
+watch_connections (SoupServer * server)
+{
+  g_signal_connect (soup_server_get_listener (server), "new-connection",
+      G_CALLBACK (new_connection_cb), NULL);
+}
+
 static void
 server_callback (SoupServer * server, SoupMessage * msg,
     const char *path, GHashTable * query,
@@ -528,8 +2444,15 @@ server_callback (SoupServer * server, SoupMessage * msg,
   if (msg->request_body->length)
     LOG ("%s\n", msg->request_body->data);
 
-  if (msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD)
-    do_get (srv, server, msg, path);
+  access_log_watch (srv, msg, context);
+
+  if (msg->method == SOUP_METHOD_GET)
+    g_signal_emit (srv, signals[SIGNAL_REQUEST_STARTED], 0, path);
+
+  if (msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD) {
+    if (!do_document (srv, msg, path) && !do_live (srv, msg, path, query))
+      do_get (srv, server, msg, context, path);
+  }
   else
     soup_message_set_status (msg, SOUP_STATUS_NOT_IMPLEMENTED);
 
@@ -596,6 +2519,8 @@ http_server_start (InsanityHttpServer * srv)
   SoupAuthDomain *domain = NULL;
   GSimpleAsyncResult *async_res = srv->priv->async_res;
   gboolean ret = TRUE;
+  HttpWorker *worker;
+  guint i;
 
   InsanityHttpServerPrivate *priv = srv->priv;
   InsanityTest *test = priv->test;
@@ -628,14 +2553,52 @@ http_server_start (InsanityHttpServer * srv)
   priv->port = soup_server_get_port (server);
   LOG ("HTTP server listening on port %u\n", priv->port);
   soup_server_add_handler (server, NULL, server_callback, srv, NULL);
+  watch_connections (server);
 
   priv->server = server;
 
+  /* Drop the workers of a previous run, they were bound to its ports */
+  g_ptr_array_set_size (priv->workers, 0);
+  for (i = 1; i < priv->n_workers; i++) {
+    worker = g_slice_new0 (HttpWorker);
+    worker->srv = srv;
+    worker->context = g_main_context_new ();
+    worker->server = soup_server_new (SOUP_SERVER_PORT, port,
+        SOUP_SERVER_INTERFACE, bind_address, SOUP_SERVER_ASYNC_CONTEXT,
+        worker->context, NULL);
+
+    if (!worker->server) {
+      insanity_test_validate_checklist_item (test, "server-started", FALSE,
+          "Unable to bind a worker server");
+      g_main_context_unref (worker->context);
+      g_slice_free (HttpWorker, worker);
+      g_ptr_array_set_size (priv->workers, 0);
+      g_object_unref (priv->server);
+      priv->server = NULL;
+
+      if (async_res)
+        g_simple_async_result_set_op_res_gboolean (async_res, FALSE);
+
+      ret = FALSE;
+      goto done;
+    }
+
+    LOG ("HTTP worker %u listening on port %u\n", i,
+        soup_server_get_port (worker->server));
+    soup_server_add_handler (worker->server, NULL, server_callback, srv,
+        NULL);
+    watch_connections (worker->server);
+    g_ptr_array_add (priv->workers, worker);
+  }
+
+  /* Served from the server thread like the plain one, so that the cost of
+   * TLS is not hidden in the thread of the test */
   if (priv->ssl_cert_file && priv->ssl_key_file) {
     ssl_server = soup_server_new (SOUP_SERVER_PORT, ssl_port,
         SOUP_SERVER_INTERFACE, bind_address,
         SOUP_SERVER_SSL_CERT_FILE, priv->ssl_cert_file,
-        SOUP_SERVER_SSL_KEY_FILE, priv->ssl_key_file, NULL);
+        SOUP_SERVER_SSL_KEY_FILE, priv->ssl_key_file,
+        SOUP_SERVER_ASYNC_CONTEXT, priv->mcontext, NULL);
 
     if (!ssl_server) {
       char *message =
@@ -643,6 +2606,7 @@ http_server_start (InsanityHttpServer * srv)
       insanity_test_validate_checklist_item (test, "server-started", FALSE,
           message);
       g_free (message);
+      g_ptr_array_set_size (priv->workers, 0);
       g_object_unref (priv->server);
       priv->server = NULL;
 
@@ -655,6 +2619,7 @@ http_server_start (InsanityHttpServer * srv)
     priv->ssl_port = soup_server_get_port (ssl_server);
     LOG ("HTTPS server listening on port %u\n", priv->ssl_port);
     soup_server_add_handler (ssl_server, NULL, server_callback, srv, NULL);
+    watch_connections (ssl_server);
 
     priv->ssl_server = ssl_server;
   }
@@ -665,6 +2630,10 @@ http_server_start (InsanityHttpServer * srv)
   soup_server_add_auth_domain (server, domain);
   if (ssl_server)
     soup_server_add_auth_domain (ssl_server, domain);
+  for (i = 0; i < priv->workers->len; i++) {
+    worker = g_ptr_array_index (priv->workers, i);
+    soup_server_add_auth_domain (worker->server, domain);
+  }
   g_object_unref (domain);
   domain = soup_auth_domain_digest_new (SOUP_AUTH_DOMAIN_REALM, realm,
       SOUP_AUTH_DOMAIN_DIGEST_AUTH_CALLBACK, digest_auth_cb,
@@ -672,21 +2641,37 @@ http_server_start (InsanityHttpServer * srv)
   soup_server_add_auth_domain (server, domain);
   if (ssl_server)
     soup_server_add_auth_domain (ssl_server, domain);
+  for (i = 0; i < priv->workers->len; i++) {
+    worker = g_ptr_array_index (priv->workers, i);
+    soup_server_add_auth_domain (worker->server, domain);
+  }
   g_object_unref (domain);
 
-  if (bind_address)
-    g_object_unref (bind_address);
+  /* Only once everything is bound, a failed start must not leave the
+   * profile running on the main context */
+  STATS_LOCK (srv);
+  priv->bandwidth_profile_start = g_get_monotonic_time ();
+  schedule_bandwidth_step_unlocked (srv);
+  STATS_UNLOCK (srv);
 
   soup_server_run_async (server);
   if (ssl_server)
     soup_server_run_async (ssl_server);
 
+  for (i = 0; i < priv->workers->len; i++) {
+    if (!http_worker_start (g_ptr_array_index (priv->workers, i)))
+      LOG ("Could not start the thread of worker %u\n", i + 1);
+  }
+
   insanity_test_validate_checklist_item (test, "server-started", TRUE, NULL);
 
   if (async_res)
     g_simple_async_result_set_op_res_gboolean (async_res, TRUE);
 
 done:
+  if (bind_address)
+    g_object_unref (bind_address);
+
   /* Complete async operation async */
   g_simple_async_result_complete_in_idle (async_res);
 
@@ -713,8 +2698,10 @@ mainloop_thread_func (gpointer data)
     UNLOCK (srv);
   }
 
+  server_thread_enter (srv);
   while (priv->running)
     g_main_context_iteration (priv->mcontext, TRUE);
+  server_thread_leave (srv);
 
   return NULL;
 }
@@ -763,11 +2750,18 @@ insanity_http_server_start_async (InsanityHttpServer * srv,
 
   /* The server has been stopped but it is still ready to run */
   if (srv->priv->ready == TRUE) {
+    guint i;
+
     soup_server_run_async (priv->server);
 
     if (priv->ssl_server)
       soup_server_run_async (priv->ssl_server);
 
+    for (i = 0; i < priv->workers->len; i++) {
+      if (!http_worker_start (g_ptr_array_index (priv->workers, i)))
+        LOG ("Could not start the thread of worker %u\n", i + 1);
+    }
+
     LOCK (srv);
     srv->priv->running = TRUE;
     UNLOCK (srv);
@@ -824,7 +2818,7 @@ server_started_cb (GObject * server, GAsyncResult * res, gpointer psrv)
  *
  * Starts running @srv
  *
- * Returns: %TRUE if the server could be started %FALSE otherwize
+ * Returns: %TRUE if the server could be started %FALSE otherwise
  */
 gboolean
 insanity_http_server_start (InsanityHttpServer * srv,
@@ -853,13 +2847,14 @@ insanity_http_server_start (InsanityHttpServer * srv,
  *
  * Stop running @srv
  *
- * Returns: %TRUE if the server could be stoped %FALSE otherwize. If the server
+ * Returns: %TRUE if the server could be stoped %FALSE otherwise. If the server
  * was not running, returns %FALSE
  */
 gboolean
 insanity_http_server_stop (InsanityHttpServer * srv)
 {
   InsanityHttpServerPrivate *priv = srv->priv;
+  guint i;
 
   g_return_val_if_fail (INSANITY_IS_HTTP_SERVER (srv), FALSE);
 
@@ -870,6 +2865,18 @@ insanity_http_server_stop (InsanityHttpServer * srv)
   if (priv->ssl_server)
     soup_server_quit (priv->ssl_server);
 
+  /* Workers are joined but kept, the next start runs them again */
+  for (i = 0; i < priv->workers->len; i++)
+    http_worker_stop (g_ptr_array_index (priv->workers, i));
+
+  STATS_LOCK (srv);
+  if (priv->bandwidth_step_source) {
+    g_source_destroy (priv->bandwidth_step_source);
+    g_source_unref (priv->bandwidth_step_source);
+    priv->bandwidth_step_source = NULL;
+  }
+  STATS_UNLOCK (srv);
+
   LOCK (srv);
   priv->running = FALSE;
   UNLOCK (srv);
@@ -909,6 +2916,57 @@ insanity_http_server_get_port (InsanityHttpServer * srv)
   return srv->priv->port;
 }
 
+/**
+ * insanity_http_server_get_worker_port:
+ * @srv: The #InsanityHttpServer to get the port from
+ * @worker: The index of the worker, 0 being the main server
+ *
+ * Get the port the @worker plain HTTP server of @srv listens on, see the
+ * #InsanityHttpServer:workers property.
+ *
+ * Returns: The port in use by the worker, or 0 if there is no such worker
+ */
+guint
+insanity_http_server_get_worker_port (InsanityHttpServer * srv, guint worker)
+{
+  HttpWorker *w;
+
+  g_return_val_if_fail (INSANITY_IS_HTTP_SERVER (srv), 0);
+
+  if (worker == 0)
+    return srv->priv->port;
+
+  if (worker > srv->priv->workers->len)
+    return 0;
+
+  w = g_ptr_array_index (srv->priv->workers, worker - 1);
+
+  return soup_server_get_port (w->server);
+}
+
+/**
+ * insanity_http_server_get_next_port:
+ * @srv: The #InsanityHttpServer to get a port from
+ *
+ * Get the port of the plain HTTP servers of @srv in turn, so that clients
+ * connecting to them are spread across the workers.
+ *
+ * Returns: The port of the next worker of @srv
+ */
+guint
+insanity_http_server_get_next_port (InsanityHttpServer * srv)
+{
+  guint worker;
+
+  g_return_val_if_fail (INSANITY_IS_HTTP_SERVER (srv), 0);
+
+  LOCK (srv);
+  worker = srv->priv->next_worker++ % (srv->priv->workers->len + 1);
+  UNLOCK (srv);
+
+  return insanity_http_server_get_worker_port (srv, worker);
+}
+
 /**
  * insanity_http_server_get_ssl_port:
  * @srv: The #InsanityHttpServer to get the ssl port from
@@ -1006,3 +3064,218 @@ insanity_http_server_reset (InsanityHttpServer * srv)
   insanity_http_server_dispose_simple (srv);
   insanity_http_server_finalize_simple (srv);
 }
+
+/**
+ * insanity_http_server_get_access_log:
+ * @srv: The #InsanityHttpServer to get the access log from
+ *
+ * Get the last requests @srv answered, as many as the
+ * #InsanityHttpServer:access-log-size property allows, the oldest first.
+ *
+ * Returns: (transfer full): A #GArray of #InsanityHttpAccessLogEntry
+ */
+GArray *
+insanity_http_server_get_access_log (InsanityHttpServer * srv)
+{
+  InsanityHttpServerPrivate *priv;
+  GArray *log;
+  guint i, first;
+
+  g_return_val_if_fail (INSANITY_IS_HTTP_SERVER (srv), NULL);
+
+  priv = srv->priv;
+  log = g_array_new (FALSE, FALSE, sizeof (InsanityHttpAccessLogEntry));
+
+  STATS_LOCK (srv);
+  first = (priv->access_log_next + priv->access_log_size -
+      priv->access_log_length) % MAX (priv->access_log_size, 1);
+  for (i = 0; i < priv->access_log_length; i++)
+    g_array_append_val (log,
+        priv->access_log[(first + i) % priv->access_log_size]);
+  STATS_UNLOCK (srv);
+
+  return log;
+}
+
+static void
+append_csv_field (GString * line, const gchar * field)
+{
+  const gchar *c;
+
+  g_string_append_c (line, '"');
+  for (c = field; *c; c++) {
+    if (*c == '"')
+      g_string_append_c (line, '"');
+    g_string_append_c (line, *c);
+  }
+  g_string_append (line, "\",");
+}
+
+/**
+ * insanity_http_server_write_access_log:
+ * @srv: The #InsanityHttpServer to write the access log of
+ * @filename: The file to write to
+ * @error: Return location for a #GError, or %NULL
+ *
+ * Write the access log of @srv to @filename as CSV, one request per line
+ * after a header line. Times are in nanoseconds, -1 if unknown.
+ *
+ * Returns: %TRUE if the file could be written %FALSE otherwise
+ */
+gboolean
+insanity_http_server_write_access_log (InsanityHttpServer * srv,
+    const gchar * filename, GError ** error)
+{
+  InsanityHttpAccessLogEntry *entry;
+  GArray *log;
+  GString *contents;
+  gboolean ret;
+  guint i;
+
+  g_return_val_if_fail (INSANITY_IS_HTTP_SERVER (srv), FALSE);
+
+  log = insanity_http_server_get_access_log (srv);
+  contents = g_string_new ("method,path,range,status,bytes_served,"
+      "time_to_first_byte,transfer_time,reused_connection,connection_time\n");
+  for (i = 0; i < log->len; i++) {
+    entry = &g_array_index (log, InsanityHttpAccessLogEntry, i);
+
+    append_csv_field (contents, entry->method);
+    append_csv_field (contents, entry->path);
+    append_csv_field (contents, entry->range);
+    g_string_append_printf (contents, "%u,%" G_GUINT64_FORMAT ",%"
+        G_GINT64_FORMAT ",%" G_GINT64_FORMAT ",%d,%" G_GINT64_FORMAT "\n",
+        entry->status, entry->bytes_served,
+        GST_CLOCK_TIME_IS_VALID (entry->time_to_first_byte) ?
+        (gint64) entry->time_to_first_byte : -1,
+        (gint64) entry->transfer_time, entry->reused_connection ? 1 : 0,
+        GST_CLOCK_TIME_IS_VALID (entry->connection_time) ?
+        (gint64) entry->connection_time : -1);
+  }
+
+  ret = g_file_set_contents (filename, contents->str, contents->len, error);
+
+  g_string_free (contents, TRUE);
+  g_array_free (log, TRUE);
+
+  return ret;
+}
+
+/**
+ * insanity_http_server_report_access_log:
+ * @srv: The #InsanityHttpServer to report the access log of
+ *
+ * Sum the access log of @srv up in the "http-requests",
+ * "http-reused-connections", "http-time-to-first-byte-mean" and
+ * "http-transfer-time-mean" extra-info of the test it is used for, which
+ * have to be declared by the test.
+ */
+void
+insanity_http_server_report_access_log (InsanityHttpServer * srv)
+{
+  InsanityHttpAccessLogEntry *entry;
+  GArray *log;
+  guint i, reused = 0, n_ttfb = 0;
+  GstClockTime ttfb = 0, transfer = 0;
+  GValue v = { 0 };
+
+  g_return_if_fail (INSANITY_IS_HTTP_SERVER (srv));
+
+  log = insanity_http_server_get_access_log (srv);
+  if (log->len == 0)
+    goto done;
+
+  for (i = 0; i < log->len; i++) {
+    entry = &g_array_index (log, InsanityHttpAccessLogEntry, i);
+    if (entry->reused_connection)
+      reused++;
+    if (GST_CLOCK_TIME_IS_VALID (entry->time_to_first_byte)) {
+      ttfb += entry->time_to_first_byte;
+      n_ttfb++;
+    }
+    transfer += entry->transfer_time;
+  }
+
+  g_value_init (&v, G_TYPE_UINT);
+  g_value_set_uint (&v, log->len);
+  insanity_test_set_extra_info (srv->priv->test, "http-requests", &v);
+  g_value_set_uint (&v, reused);
+  insanity_test_set_extra_info (srv->priv->test, "http-reused-connections",
+      &v);
+  g_value_unset (&v);
+
+  g_value_init (&v, G_TYPE_UINT64);
+  if (n_ttfb) {
+    g_value_set_uint64 (&v, ttfb / n_ttfb);
+    insanity_test_set_extra_info (srv->priv->test,
+        "http-time-to-first-byte-mean", &v);
+  }
+  g_value_set_uint64 (&v, transfer / log->len);
+  insanity_test_set_extra_info (srv->priv->test, "http-transfer-time-mean",
+      &v);
+  g_value_unset (&v);
+
+done:
+  g_array_free (log, TRUE);
+}
+
+/**
+ * insanity_http_server_get_live_edge:
+ * @srv: The #InsanityHttpServer to get the live edge of
+ *
+ * Get the end of the newest segment of the live stream emulated by @srv,
+ * see the #InsanityHttpServer:live-window property. It is in the time of
+ * the live stream, as the start of the segments given by the
+ * #InsanityHttpServer::live-segment-requested signal.
+ *
+ * Returns: The live edge of the last playlist served, or
+ * #GST_CLOCK_TIME_NONE if no live playlist was served yet
+ */
+GstClockTime
+insanity_http_server_get_live_edge (InsanityHttpServer * srv)
+{
+  InsanityHttpServerPrivate *priv;
+  GstClockTime edge = GST_CLOCK_TIME_NONE;
+
+  g_return_val_if_fail (INSANITY_IS_HTTP_SERVER (srv), GST_CLOCK_TIME_NONE);
+
+  priv = srv->priv;
+  CACHE_LOCK (srv);
+  if (priv->live_last)
+    edge = live_segment_start (priv->live_last,
+        live_playlist_produced (priv->live_last, priv->live_window,
+            live_now (srv)));
+  CACHE_UNLOCK (srv);
+
+  return edge;
+}
+
+/**
+ * insanity_http_server_add_document:
+ * @srv: The #InsanityHttpServer to add a document to
+ * @path: The path to serve @contents at, from the root of the server
+ * @content_type: The MIME type of @contents
+ * @contents: The document to serve
+ *
+ * Serve @contents at @path instead of the file of the source folder, if
+ * any. This can be used to generate a playlist over existing media.
+ */
+void
+insanity_http_server_add_document (InsanityHttpServer * srv,
+    const gchar * path, const gchar * content_type, const gchar * contents)
+{
+  ServerDocument *doc;
+
+  g_return_if_fail (INSANITY_IS_HTTP_SERVER (srv));
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (content_type != NULL);
+  g_return_if_fail (contents != NULL);
+
+  doc = g_slice_new (ServerDocument);
+  doc->content_type = g_strdup (content_type);
+  doc->contents = g_strdup (contents);
+
+  CACHE_LOCK (srv);
+  g_hash_table_replace (srv->priv->documents, g_strdup (path), doc);
+  CACHE_UNLOCK (srv);
+}
@@ -50,6 +50,23 @@ extern const char *realm;
 extern const char *basic_auth_path;
 extern const char *digest_auth_path;
 
+/* One request answered by the server, see
+ * insanity_http_server_get_access_log(). Times are from the moment the
+ * request was received */
+typedef struct
+{
+  const gchar *method;
+  gchar path[256];              /* Truncated if longer */
+  gchar range[64];              /* Range header, empty if none */
+  guint status;
+  guint64 bytes_served;         /* Body only */
+  GstClockTime time_to_first_byte;
+  GstClockTime transfer_time;
+  gboolean reused_connection;   /* Not the first request of the connection */
+  GstClockTime connection_time; /* From accept to the request, TLS handshake
+                                 * included, unknown on reused connections */
+} InsanityHttpAccessLogEntry;
+
 typedef struct _InsanityHttpServer InsanityHttpServer;
 typedef struct _InsanityHttpServerClass InsanityHttpServerClass;
 typedef struct _InsanityHttpServerPrivate InsanityHttpServerPrivate;
@@ -98,6 +115,13 @@ guint insanity_http_server_get_port      (InsanityHttpServer *srv);
 guint
 insanity_http_server_get_ssl_port        (InsanityHttpServer *srv);
 
+guint
+insanity_http_server_get_worker_port     (InsanityHttpServer *srv,
+                                          guint worker);
+
+guint
+insanity_http_server_get_next_port       (InsanityHttpServer *srv);
+
 const char *
 insanity_http_server_get_source_folder   (InsanityHttpServer *srv);
 
@@ -111,6 +135,26 @@ insanity_http_server_get_soup_server     (InsanityHttpServer *srv);
 SoupServer *
 insanity_http_server_get_soup_ssl_server (InsanityHttpServer *srv);
 
+GArray *
+insanity_http_server_get_access_log      (InsanityHttpServer *srv);
+
+gboolean
+insanity_http_server_write_access_log    (InsanityHttpServer *srv,
+                                          const gchar *filename,
+                                          GError **error);
+
+void
+insanity_http_server_report_access_log   (InsanityHttpServer *srv);
+
+GstClockTime
+insanity_http_server_get_live_edge       (InsanityHttpServer *srv);
+
+void
+insanity_http_server_add_document        (InsanityHttpServer *srv,
+                                          const gchar *path,
+                                          const gchar *content_type,
+                                          const gchar *contents);
+
 G_END_DECLS
 
 #endif /* INSANITY_GST_H_GUARD */
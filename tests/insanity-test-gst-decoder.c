@@ -87,6 +87,7 @@ static gboolean glob_testing_parser = FALSE;
 
 static ProbeContext *glob_prob_ctx = NULL;
 static MediaDescriptorParser *glob_media_desc_parser = NULL;
+static GstPad *glob_media_desc_pad = NULL;      /* Owned by the parser */
 static GstClockTime glob_playback_duration = GST_CLOCK_TIME_NONE;
 static gboolean glob_push_mode = FALSE;
 static GstBuffer *glob_parsing_buf = NULL;
@@ -157,6 +158,7 @@ clean_test (InsanityTest * test)
     glob_prob_ctx = NULL;
   }
 
+  glob_media_desc_pad = NULL;
   if (glob_media_desc_parser != NULL) {
     g_object_unref (glob_media_desc_parser);
     glob_media_desc_parser = NULL;
@@ -277,6 +279,41 @@ validate_current_test (InsanityTest * test, gboolean validate,
   }
 }
 
+/* Decoders clip to the seek position, so the first buffer is the frame
+ * covering it, or the last frame before the stop position when playing
+ * backward */
+static GstBuffer *
+get_expected_seek_buffer (void)
+{
+  if (glob_media_desc_pad == NULL)
+    return NULL;
+
+  if (glob_seek_rate < 0) {
+    if (GST_CLOCK_TIME_IS_VALID (glob_seek_stop_ts) == FALSE ||
+        glob_seek_stop_ts == 0)
+      return NULL;
+
+    return media_descriptor_parser_get_frame_at (glob_media_desc_parser,
+        glob_media_desc_pad, glob_seek_stop_ts - 1);
+  }
+
+  return media_descriptor_parser_get_frame_at (glob_media_desc_parser,
+      glob_media_desc_pad, glob_seek_segment_seektime);
+}
+
+/* Audio decoders and clipping elements may cut the expected frame, so the
+ * first buffer can start anywhere inside it */
+static gboolean
+buffer_in_expected_frame (GstClockTime ts, GstBuffer * expected)
+{
+  GstClockTime start = GST_BUFFER_PTS (expected);
+
+  if (GST_BUFFER_DURATION_IS_VALID (expected) == FALSE)
+    return ABS (GST_CLOCK_DIFF (ts, start)) <= SEEK_THRESHOLD;
+
+  return ts >= start && ts < start + GST_BUFFER_DURATION (expected);
+}
+
 static gboolean
 seek_mode_testing (InsanityTest * test)
 {
@@ -460,6 +497,21 @@ unvalidate_seeking_tests (InsanityTest * test)
   g_free (message);
 }
 
+static void
+on_settled (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
+{
+  seek_mode_testing (INSANITY_TEST (ptest));
+}
+
+/* Seeks as soon as the pipeline is done changing state, rather than
+ * after sleeping a fixed time */
+static void
+start_seek_mode_testing (InsanityTest * test)
+{
+  insanity_gst_pipeline_test_wait_for_state (INSANITY_GST_PIPELINE_TEST (test),
+      GST_STATE_PLAYING, 1000, on_settled, NULL);
+}
+
 static gboolean
 next_test (InsanityTest * test)
 {
@@ -482,17 +534,17 @@ next_test (InsanityTest * test)
 
       glob_in_progress = TEST_BACKWARD_PLAYBACK;
       glob_waiting_segment = TRUE;
-      g_timeout_add (1000, (GSourceFunc) & seek_mode_testing, test);
+      start_seek_mode_testing (test);
       break;
     case TEST_BACKWARD_PLAYBACK:
       glob_in_progress = TEST_FAST_FORWARD;
       glob_waiting_segment = TRUE;
-      g_timeout_add (1000, (GSourceFunc) & seek_mode_testing, test);
+      start_seek_mode_testing (test);
       break;
     case TEST_FAST_FORWARD:
       glob_in_progress = TEST_FAST_BACKWARD;
       glob_waiting_segment = TRUE;
-      g_timeout_add (1000, (GSourceFunc) & seek_mode_testing, test);
+      start_seek_mode_testing (test);
       break;
     default:
       insanity_test_done (test);
@@ -509,6 +561,7 @@ check_wedged (gpointer data)
 {
   InsanityTest *test = data;
   gboolean wedged = FALSE;
+  const gchar *reason = NULL;
   gint64 idle;
 
   DECODER_TEST_LOCK ();
@@ -517,18 +570,19 @@ check_wedged (gpointer data)
 
   if (idle >= IDLE_TIMEOUT) {
     wedged = TRUE;
-    LOG (test, "Nothing probed in too long");
+    reason = "Nothing probed in too long";
   } else if (glob_waiting_segment == TRUE) {
     idle = (global_last_seek <= 0) ?
         0 : 1000 * (g_get_monotonic_time () - global_last_seek);
 
     if (idle >= WAIT_SEGMENT_TIMEOUT) {
-      LOG (test, "Waited segment for too much time");
       wedged = TRUE;
+      reason = "Waited segment for too much time";
     }
   }
 
   if (wedged) {
+    LOG (test, "%s", reason);
     LOG (test, "Wedged, kicking");
 
     switch (glob_in_progress) {
@@ -563,6 +617,11 @@ check_wedged (gpointer data)
 
   DECODER_TEST_UNLOCK ();
 
+  /* Out of the lock, streaming threads may be waiting on it */
+  if (wedged)
+    insanity_gst_pipeline_test_dump_stall_diagnostics
+        (INSANITY_GST_PIPELINE_TEST (test), reason);
+
   return TRUE;
 }
 
@@ -644,9 +703,19 @@ probe_cb (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
               glob_seek_rate <
               0 ? glob_seek_stop_ts : glob_seek_segment_seektime);
 
-          GstClockTimeDiff diff = ABS (GST_CLOCK_DIFF (stime_ts, expected_ts));
+          GstBuffer *expected = get_expected_seek_buffer ();
+          gboolean wrong_buf;
+
+          if (expected != NULL) {
+            wrong_buf = !buffer_in_expected_frame (ts, expected);
+            expected_ts = gst_segment_to_stream_time (&glob_last_segment,
+                glob_last_segment.format, GST_BUFFER_PTS (expected));
+          } else {
+            wrong_buf = ABS (GST_CLOCK_DIFF (stime_ts, expected_ts)) >
+                SEEK_THRESHOLD;
+          }
 
-          if (diff > SEEK_THRESHOLD) {
+          if (wrong_buf) {
             gchar *valmsg =
                 g_strdup_printf ("Received buffer timestamp %" GST_TIME_FORMAT
                 " Seeek wanted %" GST_TIME_FORMAT "",
@@ -883,8 +952,9 @@ pad_added_cb (GstElement * element, GstPad * new_pad, InsanityTest * test)
     goto error;
   }
 
-  if (glob_media_desc_parser)
-    media_descriptor_parser_add_stream (glob_media_desc_parser, new_pad);
+  if (glob_media_desc_parser &&
+      media_descriptor_parser_add_stream (glob_media_desc_parser, new_pad))
+    glob_media_desc_pad = new_pad;
 
 done:
   DECODER_TEST_UNLOCK ();
@@ -1235,7 +1305,7 @@ start_cb (InsanityTest * test)
   gboolean ret = TRUE;
 
   GError *err = NULL;
-  gchar *xmllocation = NULL, *location = NULL;
+  gchar *xmllocation = NULL, *location = NULL, *cachedir = NULL;
 
   DECODER_TEST_LOCK ();
 
@@ -1246,6 +1316,11 @@ start_cb (InsanityTest * test)
     goto done;
   }
 
+  insanity_test_get_string_argument (test, "media-descriptor-cache-dir",
+      &cachedir);
+  media_descriptor_parser_set_cache_dir (cachedir);
+  g_free (cachedir);
+
   gst_segment_init (&glob_last_segment, GST_FORMAT_UNDEFINED);
   glob_parsing_buf = gst_buffer_new ();
   xmllocation = g_strconcat (location, ".xml", NULL);
@@ -1333,6 +1408,10 @@ main (int argc, char **argv)
   insanity_test_add_boolean_argument (test, "push-mode",
       "Whether the pipeline should run in push mode or not (pull mode)",
       NULL, FALSE, FALSE);
+  insanity_test_add_string_argument (test, "media-descriptor-cache-dir",
+      "Directory where parsed media descriptors are cached so they do not "
+      "need to be parsed again, the cache is disabled if empty", NULL, TRUE,
+      "");
   insanity_test_add_uint64_argument (test, "playback-duration",
       "Stream time to playback for before seeking, in seconds", NULL, TRUE, 2);
 
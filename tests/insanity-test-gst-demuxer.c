@@ -37,12 +37,6 @@ static GStaticMutex glob_mutex = G_STATIC_MUTEX_INIT;
 #define DEMUX_TEST_LOCK() g_static_mutex_lock (&glob_mutex)
 #define DEMUX_TEST_UNLOCK() g_static_mutex_unlock (&glob_mutex)
 
-/* How far we allow a timestamp to be to match our target
- * 3 quarters of a second for now. Seeking precision isn't
- * very good it seems. Needs to be at the very least one
- * frame's worth for low framerate video. */
-#define SEEK_THRESHOLD (GST_SECOND * 3 / 4)
-
 /* timeout for gst_element_get_state() after a seek */
 #define SEEK_TIMEOUT (10 * GST_SECOND)
 #define FAST_FORWARD_PLAYING_THRESHOLD (G_USEC_PER_SEC / 3)
@@ -299,6 +293,7 @@ generate_xml_media_descriptor (InsanityTest * test)
   GError *err = NULL;
   GstDiscovererInfo *info = NULL;
   gchar *location = NULL, *suburi = NULL;
+  gboolean checksum_frames = FALSE;
 
   GstDiscoverer *discoverer = gst_discoverer_new (5 * GST_SECOND, NULL);
 
@@ -334,6 +329,10 @@ generate_xml_media_descriptor (InsanityTest * test)
   glob_writer = media_descriptor_writer_new (test,
       location, glob_duration, glob_seekable);
 
+  insanity_test_get_boolean_argument (test, "checksum-frames",
+      &checksum_frames);
+  media_descriptor_writer_set_checksum_frames (glob_writer, checksum_frames);
+
   glob_in_progress = TEST_DESCRIPTOR_GENERATION;
   glob_pipeline_restarted = FALSE;
 
@@ -473,6 +472,19 @@ test_position (InsanityTest * test, GstBuffer * buf, GstPad * pad)
   next_test (test);
 }
 
+/* Demuxers restart from the keyframe preceding the seek position at the
+ * earliest, in both directions. Streams where every frame is a keyframe,
+ * like audio, may restart closer to the seek position */
+static GstBuffer *
+get_expected_seek_buffer (GstPad * pad)
+{
+  if (glob_parser == NULL)
+    return NULL;
+
+  return media_descriptor_parser_get_keyframe_before (glob_parser, pad,
+      glob_seek_rate < 0 ? glob_seek_stop_ts : glob_seek_segment_seektime);
+}
+
 static gboolean
 test_seek_modes (InsanityTest * test)
 {
@@ -739,6 +751,8 @@ check_wedged (gpointer data)
       0 : 1000 * (g_get_monotonic_time () - global_last_probe);
   if (idle >= IDLE_TIMEOUT) {
     LOG (test, "Wedged, kicking\n");
+    insanity_gst_pipeline_test_dump_stall_diagnostics
+        (INSANITY_GST_PIPELINE_TEST (test), "Nothing probed in too long");
 
     /* Unvalidate tests in progress */
     switch (glob_in_progress) {
@@ -923,7 +937,8 @@ probe_cb (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
             " off_end %" G_GUINT64_FORMAT " -> %" G_GUINT64_FORMAT
             " duration %" GST_TIME_FORMAT " -> %" GST_TIME_FORMAT
             " timestamp %" GST_TIME_FORMAT " -> %" GST_TIME_FORMAT
-            " Is Keyframe %i -> %i", GST_BUFFER_OFFSET (glob_parsing_buf),
+            " Is Keyframe %i -> %i (or payload checksum mismatch)",
+            GST_BUFFER_OFFSET (glob_parsing_buf),
             GST_BUFFER_OFFSET (buf), GST_BUFFER_OFFSET_END (glob_parsing_buf),
             GST_BUFFER_OFFSET_END (buf),
             GST_TIME_ARGS (GST_BUFFER_DURATION (glob_parsing_buf)),
@@ -976,18 +991,27 @@ probe_cb (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
             probectx->last_segment.format, ts);
 
         if (GST_CLOCK_TIME_IS_VALID (glob_seek_first_buf_ts) == FALSE) {
+          gboolean wrong_buf;
+          GstBuffer *expected = get_expected_seek_buffer (pad);
           GstClockTime expected_ts =
               gst_segment_to_stream_time (&probectx->last_segment,
               probectx->last_segment.format,
               glob_seek_rate <
               0 ? glob_seek_stop_ts : glob_seek_segment_seektime);
 
-          if (stime_ts > expected_ts) {
+          /* Nothing may be skipped past the seek position */
+          wrong_buf = (stime_ts > expected_ts);
+          if (expected != NULL)
+            wrong_buf |= (ts < GST_BUFFER_PTS (expected));
+
+          if (wrong_buf) {
             gchar *valmsg =
                 g_strdup_printf ("Received buffer timestamp %" GST_TIME_FORMAT
-                " Seeek wanted %" GST_TIME_FORMAT " Rate: %lf \n",
-                GST_TIME_ARGS (stime_ts),
-                GST_TIME_ARGS (expected_ts), glob_seek_rate);
+                " Seeek wanted %" GST_TIME_FORMAT ", keyframe before %"
+                GST_TIME_FORMAT " Rate: %lf \n", GST_TIME_ARGS (stime_ts),
+                GST_TIME_ARGS (expected_ts),
+                GST_TIME_ARGS (expected ? GST_BUFFER_PTS (expected) :
+                    GST_CLOCK_TIME_NONE), glob_seek_rate);
 
             validate_current_test (test, FALSE, valmsg);
             next_test (test);
@@ -1421,7 +1445,7 @@ start_cb (InsanityTest * test)
   gboolean ret = TRUE;
 
   GError *err = NULL;
-  gchar *xmllocation = NULL, *location = NULL;
+  gchar *xmllocation = NULL, *location = NULL, *cachedir = NULL;
 
   DEMUX_TEST_LOCK ();
 
@@ -1432,6 +1456,11 @@ start_cb (InsanityTest * test)
     goto done;
   }
 
+  insanity_test_get_string_argument (test, "media-descriptor-cache-dir",
+      &cachedir);
+  media_descriptor_parser_set_cache_dir (cachedir);
+  g_free (cachedir);
+
   glob_parsing_buf = gst_buffer_new ();
   xmllocation = g_strconcat (location, ".xml", NULL);
   glob_parser = media_descriptor_parser_new (test, xmllocation, &err);
@@ -1545,6 +1574,14 @@ main (int argc, char **argv)
   insanity_test_add_boolean_argument (test, "generate-media-descriptor",
       "Whether you want to generate the media descriptor XML file if needed",
       NULL, TRUE, TRUE);
+  insanity_test_add_boolean_argument (test, "checksum-frames",
+      "Whether to store a checksum of each frame payload when generating the "
+      "media descriptor XML file, so frames content can be verified",
+      NULL, TRUE, FALSE);
+  insanity_test_add_string_argument (test, "media-descriptor-cache-dir",
+      "Directory where parsed media descriptors are cached so they do not "
+      "need to be parsed again, the cache is disabled if empty", NULL, TRUE,
+      "");
   insanity_test_add_uint64_argument (test, "playback-duration",
       "Stream time to playback for before seeking, in seconds", NULL, TRUE, 2);
 
@@ -22,11 +22,15 @@
 #include <stdio.h>
 #include <glib.h>
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include <gst/gst.h>
 #include <gst/pbutils/pbutils.h>
 #include <stdlib.h>
+#include <string.h>
 #include <insanity-gst/insanity-gst.h>
 
+#include "media-descriptor-common.h"
+
 static GstDiscoverer *dc;
 static gint timeout = 10;
 static GMainLoop *ml;
@@ -74,6 +78,89 @@ typedef struct
 static Topology *topology;
 static Properties *properties;
 
+/* Timings of the previous discoveries of a file are kept next to it */
+#define TIMING_SUFFIX ".discoverer-timing"
+#define TIMING_HISTORY_LENGTH 8
+
+/* A discovery is considered a regression when it takes more than twice the
+ * usual time, small variations of fast discoveries being ignored */
+#define REGRESSION_FACTOR 2
+#define REGRESSION_MIN_DELTA_MS 250
+
+/* Bounds of the adaptive timeout, which gives the usual discovery time
+ * plenty of margin and big files some more time */
+#define ADAPTIVE_TIMEOUT_MIN (2 * GST_SECOND)
+#define ADAPTIVE_TIMEOUT_MAX (60 * GST_SECOND)
+#define ADAPTIVE_TIMEOUT_FACTOR 4
+#define ADAPTIVE_TIMEOUT_BYTES_PER_SECOND (16 * 1024 * 1024)
+
+typedef struct
+{
+  /* Monotonic times, written from the discoverer threads */
+  gint64 start_time;
+  gint64 typefind_time;
+
+  gchar *history_file;
+  guint64 size;
+  gint *history;                /* in ms */
+  gsize history_length;
+} DiscoveryTiming;
+
+G_LOCK_DEFINE_STATIC (timings);
+static gboolean use_timing_history = FALSE;
+static gboolean adaptive_timeout = FALSE;
+static DiscoveryTiming single_timing;
+static DiscoveryTiming *timing = NULL;
+
+/* Batch mode, several URIs checked by a pool of discoverers */
+static const gchar *checklist_items[] = {
+  "discoverer-returned-results", "comparison-file-parsed",
+  "discoverer-correct", "discovery-time-in-range", NULL
+};
+
+typedef struct
+{
+  GstDiscoverer *dc;
+  gchar *uri;
+  DiscoveryTiming timing;
+} BatchSlot;
+
+static gboolean batch_mode = FALSE;
+static GPtrArray *batch_uris = NULL;
+static guint batch_next = 0;
+static guint batch_done = 0;
+static guint batch_n_failed = 0;
+static GArray *batch_latencies = NULL;
+static guint batch_item_failures[G_N_ELEMENTS (checklist_items)];
+/* Checklist items failed by the URI being compared, and why it first failed */
+static guint batch_uri_failures = 0;
+static gchar *batch_uri_failure_msg = NULL;
+
+/* In batch mode, the checklist items are only validated once all the URIs
+ * have been checked */
+static void
+validate_item (const gchar * item, gboolean status, const gchar * description)
+{
+  guint i;
+
+  if (batch_mode == FALSE) {
+    insanity_test_validate_checklist_item (gstest, item, status, description);
+    return;
+  }
+
+  if (status == TRUE)
+    return;
+
+  for (i = 0; checklist_items[i]; i++) {
+    if (g_str_equal (checklist_items[i], item))
+      batch_uri_failures |= 1 << i;
+  }
+
+  if (batch_uri_failure_msg == NULL)
+    batch_uri_failure_msg = g_strdup_printf ("%s: %s", item,
+        description ? description : "failed");
+}
+
 static Topology *read_topology_wrapped (Topology * local_topology, int depth);
 
 static Topology *
@@ -116,8 +203,7 @@ read_unknown (Topology * local_topology, int depth)
         local_topology->contained_topologies =
             g_list_append (local_topology->contained_topologies, bottomology);
       } else {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE,
+        validate_item ("comparison-file-parsed", FALSE,
             "Found contained topology in unknown stream, unable to parse it\n");
         return NULL;
       }
@@ -196,8 +282,8 @@ read_video (Topology * local_topology, int depth)
       if (!g_str_has_prefix (line, "None")) {
         tags = gst_tag_list_new_from_string (line);
         if (tags == NULL) {
-          insanity_test_validate_checklist_item (gstest,
-              "comparison-file-parsed", FALSE, "Erroneous value in tags field");
+          validate_item ("comparison-file-parsed", FALSE,
+              "Erroneous value in tags field");
           g_strfreev (splitted);
           return NULL;
         }
@@ -206,40 +292,40 @@ read_video (Topology * local_topology, int depth)
     } else if (g_str_has_prefix (splitted[0], "Width")) {
       local_topology->width = g_ascii_strtoll (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in width field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in width field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Height")) {
       local_topology->height = g_ascii_strtoll (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in height field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in height field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Depth")) {
       local_topology->depth = g_ascii_strtoll (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in depth field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in depth field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Bitrate")) {
       local_topology->bitrate = g_ascii_strtoull (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in bitrate field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in bitrate field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Max bitrate")) {
       local_topology->max_bitrate = g_ascii_strtoull (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in max bitrate field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in max bitrate field");
         g_strfreev (splitted);
         return NULL;
       }
@@ -249,8 +335,8 @@ read_video (Topology * local_topology, int depth)
       } else if (g_str_has_prefix (splitted[1], "false")) {
         local_topology->interlaced = FALSE;
       } else {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in interlaced field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in interlaced field");
         g_strfreev (splitted);
         return NULL;
       }
@@ -259,8 +345,8 @@ read_video (Topology * local_topology, int depth)
       local_topology->framerate_num =
           g_ascii_strtoull (splitted2[0], &endptr, 0);
       if (endptr == splitted2[0] && local_topology->framerate_num == 0) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in framerate field!");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in framerate field!");
         g_strfreev (splitted2);
         g_strfreev (splitted);
         return NULL;
@@ -268,8 +354,8 @@ read_video (Topology * local_topology, int depth)
       local_topology->framerate_denom =
           g_ascii_strtoull (splitted2[1], &endptr, 0);
       if (local_topology->framerate_denom == 0) {       /* Shouldn't have a 0 denominator anyway!! */
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in framerate field!");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in framerate field!");
         g_strfreev (splitted2);
         g_strfreev (splitted);
         return NULL;
@@ -280,8 +366,8 @@ read_video (Topology * local_topology, int depth)
       local_topology->aspectratio_num =
           g_ascii_strtoull (splitted2[0], NULL, 0);
       if (local_topology->aspectratio_num == 0) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in aspect ratio field!");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in aspect ratio field!");
         g_strfreev (splitted2);
         g_strfreev (splitted);
         return NULL;
@@ -289,8 +375,8 @@ read_video (Topology * local_topology, int depth)
       local_topology->aspectratio_denom =
           g_ascii_strtoull (splitted2[1], NULL, 0);
       if (local_topology->aspectratio_denom == 0) {     /* Shouldn't have a 0 denominator anyway!! */
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in aspect ratio field!");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in aspect ratio field!");
         g_strfreev (splitted2);
         g_strfreev (splitted);
         return NULL;
@@ -308,8 +394,7 @@ read_video (Topology * local_topology, int depth)
         local_topology->contained_topologies =
             g_list_append (local_topology->contained_topologies, bottomology);
     } else {
-      insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-          FALSE,
+      validate_item ("comparison-file-parsed", FALSE,
           "Found contained topology in video stream, unable to parse it\n");
       return NULL;
     }
@@ -381,8 +466,8 @@ read_audio (Topology * local_topology, int depth)
       if (!g_str_has_prefix (line, "None")) {
         tags = gst_tag_list_new_from_string (line);
         if (tags == NULL) {
-          insanity_test_validate_checklist_item (gstest,
-              "comparison-file-parsed", FALSE, "Erroneous value in tags field");
+          validate_item ("comparison-file-parsed", FALSE,
+              "Erroneous value in tags field");
           g_strfreev (splitted);
           return NULL;
         }
@@ -396,24 +481,24 @@ read_audio (Topology * local_topology, int depth)
       local_topology->channels = g_ascii_strtoull (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
         g_strfreev (splitted);
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in channels field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in channels field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Sample rate")) {
       local_topology->sample_rate = g_ascii_strtoull (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in sample rate field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in sample rate field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Depth")) {
       local_topology->depth = g_ascii_strtoll (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in depth field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in depth field");
         g_strfreev (splitted);
         return NULL;
       }
@@ -421,16 +506,16 @@ read_audio (Topology * local_topology, int depth)
       local_topology->bitrate = g_ascii_strtoull (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
         g_strfreev (splitted);
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in bitrate field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in bitrate field");
         g_strfreev (splitted);
         return NULL;
       }
     } else if (g_str_has_prefix (splitted[0], "Max bitrate")) {
       local_topology->max_bitrate = g_ascii_strtoull (splitted[1], &endptr, 0);
       if (endptr == splitted[1]) {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in max bitrate field");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in max bitrate field");
         g_strfreev (splitted);
         return NULL;
       }
@@ -446,8 +531,7 @@ read_audio (Topology * local_topology, int depth)
         local_topology->contained_topologies =
             g_list_append (local_topology->contained_topologies, bottomology);
       } else {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE,
+        validate_item ("comparison-file-parsed", FALSE,
             "Found contained topology in audio stream, unable to parse it\n");
         g_strfreev (splitted);
         return NULL;
@@ -521,8 +605,8 @@ read_subtitles (Topology * local_topology, int depth)
       if (!g_str_has_prefix (line, "None")) {
         tags = gst_tag_list_new_from_string (line);
         if (tags == NULL) {
-          insanity_test_validate_checklist_item (gstest,
-              "comparison-file-parsed", FALSE, "Erroneous value in tags field");
+          validate_item ("comparison-file-parsed", FALSE,
+              "Erroneous value in tags field");
           g_strfreev (splitted);
           return NULL;
         }
@@ -544,8 +628,7 @@ read_subtitles (Topology * local_topology, int depth)
         local_topology->contained_topologies =
             g_list_append (local_topology->contained_topologies, bottomology);
     } else {
-      insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-          FALSE,
+      validate_item ("comparison-file-parsed", FALSE,
           "Found contained topology in subtitle stream, unable to parse it\n");
       g_strfreev (splitted);
       return NULL;
@@ -605,8 +688,8 @@ read_topology_wrapped (Topology * local_topology, int depth)
     splitted = g_strsplit (line, ": ", 2);
     local_topology->caps = gst_caps_from_string (splitted[1]);
     if (local_topology->caps == NULL) {
-      insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-          FALSE, "Erroneous value in caps field");
+      validate_item ("comparison-file-parsed", FALSE,
+          "Erroneous value in caps field");
       g_strfreev (splitted);
       return NULL;
     }
@@ -725,8 +808,8 @@ read_properties (void)
             nsecs * GST_NSECOND;
         local_properties->duration = duration;
       } else {
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Erroneous value in duration field!");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Erroneous value in duration field!");
         g_strfreev (splitted);
         return NULL;
       }
@@ -737,8 +820,8 @@ read_properties (void)
         local_properties->seekable = FALSE;
       } else {
         /*Unknown value found */
-        insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-            FALSE, "Properties: Seekable value is not a boolean");
+        validate_item ("comparison-file-parsed", FALSE,
+            "Properties: Seekable value is not a boolean");
         g_strfreev (splitted);
         return NULL;
       }
@@ -750,8 +833,163 @@ read_properties (void)
   return local_properties;
 }
 
+/* Compiled expected files, stored as a GVariant so they can be loaded back
+ * with a single mmap instead of being parsed again. The topology is
+ * flattened depth first, each node being followed by its children */
+#define EXPECTED_CACHE_FORMAT_VERSION 3
+#define TOPOLOGY_VARIANT_FORMAT "(umsmsiiiiiiiiiiibmsu)"
+#define EXPECTED_CACHE_VARIANT_FORMAT \
+  "(utxxta" TOPOLOGY_VARIANT_FORMAT "tba{ss})"
+
+static gchar *expected_cache_dir = NULL;
+
+static void free_topology (Topology * local_topology);
+
+static void
+expected_cache_add_topology (GVariantBuilder * nodes,
+    Topology * local_topology)
+{
+  GList *tmp;
+  gchar *capsstr = NULL, *tagsstr = NULL;
+
+  if (local_topology->caps)
+    capsstr = gst_caps_to_string (local_topology->caps);
+  if (local_topology->tags)
+    tagsstr = gst_tag_list_to_string (local_topology->tags);
+
+  g_variant_builder_add (nodes, TOPOLOGY_VARIANT_FORMAT,
+      (guint32) local_topology->type, capsstr, tagsstr,
+      local_topology->channels, local_topology->sample_rate,
+      local_topology->depth, local_topology->bitrate,
+      local_topology->max_bitrate, local_topology->width,
+      local_topology->height, local_topology->framerate_num,
+      local_topology->framerate_denom, local_topology->aspectratio_num,
+      local_topology->aspectratio_denom, local_topology->interlaced,
+      local_topology->language,
+      g_list_length (local_topology->contained_topologies));
+
+  g_free (capsstr);
+  g_free (tagsstr);
+
+  for (tmp = local_topology->contained_topologies; tmp; tmp = tmp->next)
+    expected_cache_add_topology (nodes, (Topology *) tmp->data);
+}
+
+static void
+expected_cache_save (const gchar * cachepath, const FileStamp * stamp)
+{
+  GVariant *variant;
+  GVariantBuilder nodes, tags;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_variant_builder_init (&nodes, G_VARIANT_TYPE ("a"
+          TOPOLOGY_VARIANT_FORMAT));
+  expected_cache_add_topology (&nodes, topology);
+
+  g_variant_builder_init (&tags, G_VARIANT_TYPE ("a{ss}"));
+  g_hash_table_iter_init (&iter, properties->tags);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_variant_builder_add (&tags, "{ss}", key, value ? value : "");
+
+  variant = g_variant_ref_sink (g_variant_new (EXPECTED_CACHE_VARIANT_FORMAT,
+          EXPECTED_CACHE_FORMAT_VERSION, stamp->size, stamp->mtime,
+          (gint64) stamp->mtime_nsec, stamp->inode, &nodes,
+          properties->duration, properties->seekable, &tags));
+
+  cache_file_save (cachepath, variant);
+  g_variant_unref (variant);
+}
+
+static Topology *
+expected_cache_read_topology (GVariant * nodes, gsize * index)
+{
+  guint32 type, n_children, i;
+  const gchar *capsstr, *tagsstr, *language;
+  Topology *local_topology, *child;
+
+  if (*index >= g_variant_n_children (nodes))
+    return NULL;
+
+  local_topology = g_new0 (Topology, 1);
+  g_variant_get_child (nodes, (*index)++, "(um&sm&siiiiiiiiiiibm&su)", &type,
+      &capsstr, &tagsstr, &local_topology->channels,
+      &local_topology->sample_rate, &local_topology->depth,
+      &local_topology->bitrate, &local_topology->max_bitrate,
+      &local_topology->width, &local_topology->height,
+      &local_topology->framerate_num, &local_topology->framerate_denom,
+      &local_topology->aspectratio_num, &local_topology->aspectratio_denom,
+      &local_topology->interlaced, &language, &n_children);
+
+  local_topology->type = type;
+  if (capsstr)
+    local_topology->caps = gst_caps_from_string (capsstr);
+  if (tagsstr)
+    local_topology->tags = gst_tag_list_new_from_string (tagsstr);
+  local_topology->language = g_strdup (language);
+
+  if (type > TYPE_UNKNOWN || (capsstr && local_topology->caps == NULL)
+      || (tagsstr && local_topology->tags == NULL))
+    goto failed;
+
+  for (i = 0; i < n_children; i++) {
+    child = expected_cache_read_topology (nodes, index);
+    if (child == NULL)
+      goto failed;
+
+    local_topology->contained_topologies =
+        g_list_prepend (local_topology->contained_topologies, child);
+  }
+  local_topology->contained_topologies =
+      g_list_reverse (local_topology->contained_topologies);
+
+  return local_topology;
+
+failed:
+  free_topology (local_topology);
+  return NULL;
+}
+
+/* Sets topology and properties from the cache file if it is still valid */
 static gboolean
-read_expected_file (gchar * filename)
+expected_cache_load (const gchar * cachepath, const FileStamp * stamp)
+{
+  gsize index = 0;
+  const gchar *key, *value;
+  GVariant *variant, *nodes;
+  GVariantIter *tags_iter;
+
+  variant = cache_file_load (cachepath,
+      G_VARIANT_TYPE (EXPECTED_CACHE_VARIANT_FORMAT),
+      EXPECTED_CACHE_FORMAT_VERSION, stamp);
+  if (variant == NULL)
+    return FALSE;
+
+  nodes = g_variant_get_child_value (variant, 5);
+  topology = expected_cache_read_topology (nodes, &index);
+  g_variant_unref (nodes);
+  if (topology == NULL) {
+    g_variant_unref (variant);
+    return FALSE;
+  }
+
+  properties = g_new0 (Properties, 1);
+  properties->tags =
+      g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  g_variant_get_child (variant, 6, "t", &properties->duration);
+  g_variant_get_child (variant, 7, "b", &properties->seekable);
+  g_variant_get_child (variant, 8, "a{ss}", &tags_iter);
+  while (g_variant_iter_next (tags_iter, "{&s&s}", &key, &value))
+    g_hash_table_insert (properties->tags, g_strdup (key), g_strdup (value));
+  g_variant_iter_free (tags_iter);
+
+  g_variant_unref (variant);
+
+  return TRUE;
+}
+
+static gboolean
+parse_expected_file (gchar * filename)
 {
   int indent;
   gchar *line;
@@ -762,8 +1000,7 @@ read_expected_file (gchar * filename)
 
   if (!g_file_get_contents (filename, &contents, NULL, &err)) {
     contents = g_strdup_printf ("Cannot read expected file: %s", err->message);
-    insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-        FALSE, contents);
+    validate_item ("comparison-file-parsed", FALSE, contents);
     g_free (contents);
     g_clear_error (&err);
     return FALSE;
@@ -816,8 +1053,8 @@ read_expected_file (gchar * filename)
   g_strfreev (plines);
 
   if (topology == NULL || properties == NULL) {
-    insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-        FALSE, "Expected file contains no useful data");
+    validate_item ("comparison-file-parsed", FALSE,
+        "Expected file contains no useful data");
     return FALSE;
   }
 
@@ -825,11 +1062,29 @@ read_expected_file (gchar * filename)
 }
 
 static gboolean
-_run_async (GstDiscoverer * dc)
+read_expected_file (gchar * filename)
 {
-  gst_discoverer_discover_uri_async (dc, uri);
+  GStatBuf st;
+  FileStamp stamp;
+  gchar *cachepath = NULL;
+  gboolean ret;
 
-  return FALSE;
+  if (expected_cache_dir && g_stat (filename, &st) == 0) {
+    file_stamp_init (&stamp, &st);
+    cachepath = cache_file_get_filename (expected_cache_dir, filename,
+        ".dccache");
+    if (expected_cache_load (cachepath, &stamp)) {
+      g_free (cachepath);
+      return TRUE;
+    }
+  }
+
+  ret = parse_expected_file (filename);
+  if (ret && cachepath)
+    expected_cache_save (cachepath, &stamp);
+  g_free (cachepath);
+
+  return ret;
 }
 
 static gchar *
@@ -1132,8 +1387,16 @@ compare_topology (GstDiscovererStreamInfo * info, Topology * local_topology)
 
     for (tmp1 = streams1; tmp1; tmp1 = tmp1->next) {
       GstDiscovererStreamInfo *tmpinf = (GstDiscovererStreamInfo *) tmp1->data;
+
+      caps = gst_discoverer_stream_info_get_caps (tmpinf);
       for (tmp2 = streams2; tmp2; tmp2 = tmp2->next) {
         Topology *tmpinf2 = (Topology *) tmp2->data;
+
+        /* Streams with other caps can not match, no need to describe how
+         * they differ */
+        if (caps && !gst_caps_is_equal (caps, tmpinf2->caps))
+          continue;
+
         ret1 = compare_topology (tmpinf, tmpinf2);
         if (ret1 == NULL) {
           /*Streams match */
@@ -1143,6 +1406,8 @@ compare_topology (GstDiscovererStreamInfo * info, Topology * local_topology)
           g_free (ret1);
         }
       }
+      if (caps)
+        gst_caps_unref (caps);
     }
 
     for (tmp2 = streams2; tmp2; tmp2 = tmp2->next) {
@@ -1253,8 +1518,7 @@ search_tag (GQuark field_id, const GValue * value, gpointer user_data)
     tmp =
         g_strdup_printf ("Error in Properties Tags: NOT found: %s",
         search_string);
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", FALSE,
-        tmp);
+    validate_item ("discoverer-correct", FALSE, tmp);
     g_free (tmp);
     return FALSE;
   } else if (!g_str_equal (lookup_result, ser)) {
@@ -1262,8 +1526,7 @@ search_tag (GQuark field_id, const GValue * value, gpointer user_data)
         g_strdup_printf ("Error in Properties Tag %s: found: %s, expected: %s",
         search_string, ser, lookup_result);
 
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", FALSE,
-        tmp);
+    validate_item ("discoverer-correct", FALSE, tmp);
     g_hash_table_remove (properties->tags, search_string);
     g_free (ser);
     g_free (tmp);
@@ -1289,8 +1552,7 @@ compare_properties (GstDiscovererInfo * dcinfo)
         GST_TIME_ARGS (gst_discoverer_info_get_duration (info)),
         GST_TIME_ARGS (properties->duration));
 
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", FALSE,
-        tmp);
+    validate_item ("discoverer-correct", FALSE, tmp);
     g_free (tmp);
     return FALSE;
   }
@@ -1300,8 +1562,7 @@ compare_properties (GstDiscovererInfo * dcinfo)
         gst_discoverer_info_get_seekable (info) ? "true" : "false",
         properties->seekable ? "true" : "false");
 
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", FALSE,
-        tmp);
+    validate_item ("discoverer-correct", FALSE, tmp);
     g_free (tmp);
     return FALSE;
   }
@@ -1316,6 +1577,291 @@ compare_properties (GstDiscovererInfo * dcinfo)
 
 }
 
+/* The discoverer keeps its elements from one discovery to the next, they
+ * must only get our handlers once */
+#define TIMING_CONNECTED_KEY "insanity-timing-connected"
+
+static void
+timing_connect_once (gpointer object, const gchar * signal, GCallback func,
+    DiscoveryTiming * t)
+{
+  if (g_object_get_data (G_OBJECT (object), TIMING_CONNECTED_KEY))
+    return;
+
+  g_object_set_data (G_OBJECT (object), TIMING_CONNECTED_KEY,
+      GINT_TO_POINTER (1));
+  g_signal_connect (object, signal, func, t);
+}
+
+static void
+_have_type (GstElement * typefind, guint probability, GstCaps * caps,
+    DiscoveryTiming * t)
+{
+  G_LOCK (timings);
+  if (t->typefind_time == 0)
+    t->typefind_time = g_get_monotonic_time ();
+  G_UNLOCK (timings);
+}
+
+static void
+_element_added (GstBin * bin, GstElement * element, DiscoveryTiming * t)
+{
+  GstElement *typefind = NULL;
+  GstElementFactory *factory = gst_element_get_factory (element);
+
+  /* uridecodebin typefinds streams itself, and leaves the other sources to
+   * the typefind element of its decodebin */
+  if (factory && g_str_equal (GST_OBJECT_NAME (factory), "typefind"))
+    typefind = gst_object_ref (element);
+  else if (GST_IS_BIN (element))
+    typefind = gst_bin_get_by_name (GST_BIN (element), "typefind");
+
+  if (typefind) {
+    timing_connect_once (typefind, "have-type", G_CALLBACK (_have_type), t);
+    gst_object_unref (typefind);
+  }
+}
+
+/* The internal pipeline of the discoverer is private, its source element is
+ * the only way in to see when the type of the stream was found */
+static void
+_source_setup (GstDiscoverer * sdc, GstElement * source, DiscoveryTiming * t)
+{
+  GstObject *parent = gst_object_get_parent (GST_OBJECT (source));
+
+  if (parent == NULL)
+    return;
+
+  if (GST_IS_BIN (parent))
+    timing_connect_once (parent, "element-added", G_CALLBACK (_element_added),
+        t);
+  gst_object_unref (parent);
+}
+
+static void
+connect_timing (GstDiscoverer * tdc, DiscoveryTiming * t)
+{
+#if GST_CHECK_VERSION (1, 6, 0)
+  g_signal_connect (tdc, "source-setup", G_CALLBACK (_source_setup), t);
+#endif
+}
+
+static void
+timing_clear (DiscoveryTiming * t)
+{
+  g_free (t->history_file);
+  g_free (t->history);
+  memset (t, 0, sizeof (DiscoveryTiming));
+}
+
+static void
+timing_load_history (DiscoveryTiming * t, const gchar * turi)
+{
+  gchar *history_uri, *filename;
+  GStatBuf st;
+  GKeyFile *kf;
+
+  filename = g_filename_from_uri (turi, NULL, NULL);
+  if (filename == NULL)
+    return;
+
+  if (g_stat (filename, &st) == 0)
+    t->size = st.st_size;
+  g_free (filename);
+
+  if (use_timing_history == FALSE)
+    return;
+
+  history_uri = g_strconcat (turi, TIMING_SUFFIX, NULL);
+  t->history_file = g_filename_from_uri (history_uri, NULL, NULL);
+  g_free (history_uri);
+  if (t->history_file == NULL)
+    return;
+
+  /* The history of another version of the file is useless */
+  kf = g_key_file_new ();
+  if (g_key_file_load_from_file (kf, t->history_file, G_KEY_FILE_NONE, NULL)
+      && g_key_file_get_uint64 (kf, "timing", "size", NULL) == t->size) {
+    t->history = g_key_file_get_integer_list (kf, "timing", "times-ms",
+        &t->history_length, NULL);
+  }
+  g_key_file_free (kf);
+}
+
+static gint
+compare_ints (gconstpointer a, gconstpointer b, gpointer unused)
+{
+  return *(const gint *) a - *(const gint *) b;
+}
+
+static gint
+timing_get_median (DiscoveryTiming * t)
+{
+  gint *sorted, median;
+
+  sorted = g_memdup (t->history, t->history_length * sizeof (gint));
+  g_qsort_with_data (sorted, t->history_length, sizeof (gint), compare_ints,
+      NULL);
+  median = sorted[t->history_length / 2];
+  g_free (sorted);
+
+  return median;
+}
+
+static gint
+timing_get_max (DiscoveryTiming * t)
+{
+  gsize i;
+  gint max = 0;
+
+  for (i = 0; i < t->history_length; i++)
+    max = MAX (max, t->history[i]);
+
+  return max;
+}
+
+/* Prepares the timing of the discovery of @turi by @tdc, which is about to
+ * start */
+static void
+timing_start (DiscoveryTiming * t, GstDiscoverer * tdc, const gchar * turi)
+{
+  GstClockTime dc_timeout;
+
+  G_LOCK (timings);
+  timing_clear (t);
+  G_UNLOCK (timings);
+
+  timing_load_history (t, turi);
+
+  if (adaptive_timeout) {
+    dc_timeout = ADAPTIVE_TIMEOUT_MIN +
+        gst_util_uint64_scale (t->size, GST_SECOND,
+        ADAPTIVE_TIMEOUT_BYTES_PER_SECOND);
+    if (t->history_length > 0)
+      dc_timeout = MAX (dc_timeout, ADAPTIVE_TIMEOUT_FACTOR *
+          timing_get_max (t) * GST_MSECOND);
+    dc_timeout = MIN (dc_timeout, ADAPTIVE_TIMEOUT_MAX);
+  } else {
+    dc_timeout = timeout * GST_SECOND;
+  }
+  g_object_set (tdc, "timeout", (guint64) dc_timeout, NULL);
+
+  G_LOCK (timings);
+  t->start_time = g_get_monotonic_time ();
+  G_UNLOCK (timings);
+}
+
+static void
+timing_record (DiscoveryTiming * t, gint time_ms)
+{
+  GKeyFile *kf;
+  gchar *data;
+  gsize length, first = 0;
+  gint *times;
+
+  times = g_new (gint, t->history_length + 1);
+  if (t->history_length > 0)
+    memcpy (times, t->history, t->history_length * sizeof (gint));
+  times[t->history_length] = time_ms;
+  if (t->history_length + 1 > TIMING_HISTORY_LENGTH)
+    first = t->history_length + 1 - TIMING_HISTORY_LENGTH;
+
+  kf = g_key_file_new ();
+  g_key_file_set_uint64 (kf, "timing", "size", t->size);
+  g_key_file_set_integer_list (kf, "timing", "times-ms", times + first,
+      t->history_length + 1 - first);
+  data = g_key_file_to_data (kf, &length, NULL);
+  if (!g_file_set_contents (t->history_file, data, length, NULL))
+    insanity_test_printf (gstest, "Could not write timing history %s\n",
+        t->history_file);
+
+  g_free (data);
+  g_key_file_free (kf);
+  g_free (times);
+}
+
+static void
+set_time_info (const gchar * label, GstClockTime time)
+{
+  GValue v = { 0 };
+
+  g_value_init (&v, G_TYPE_UINT64);
+  g_value_set_uint64 (&v, time);
+  insanity_test_set_extra_info (gstest, label, &v);
+  g_value_unset (&v);
+}
+
+/* Reports how long the discovery that just finished took, and compares it
+ * to the previous discoveries of the same file */
+static void
+check_discovery_time (GstDiscoverer * tdc, GstDiscovererInfo * dcinfo)
+{
+  gint64 now = g_get_monotonic_time ();
+  GstClockTime total, typefind = GST_CLOCK_TIME_NONE;
+  guint64 dc_timeout;
+  gint total_ms, median;
+  gchar *msg;
+
+  G_LOCK (timings);
+  total = (now - timing->start_time) * GST_USECOND;
+  if (timing->typefind_time != 0)
+    typefind = (timing->typefind_time - timing->start_time) * GST_USECOND;
+  G_UNLOCK (timings);
+  total_ms = total / GST_MSECOND;
+
+  if (GST_CLOCK_TIME_IS_VALID (typefind)) {
+    insanity_test_printf (gstest, "Discovery took %" GST_TIME_FORMAT
+        " (typefind %" GST_TIME_FORMAT ", preroll %" GST_TIME_FORMAT ")\n",
+        GST_TIME_ARGS (total), GST_TIME_ARGS (typefind),
+        GST_TIME_ARGS (total - typefind));
+  } else {
+    insanity_test_printf (gstest, "Discovery took %" GST_TIME_FORMAT "\n",
+        GST_TIME_ARGS (total));
+  }
+
+  /* Only the last URI would be left in batch mode */
+  if (batch_mode == FALSE) {
+    g_object_get (tdc, "timeout", &dc_timeout, NULL);
+    set_time_info ("discovery-time", total);
+    set_time_info ("discovery-timeout", dc_timeout);
+    if (GST_CLOCK_TIME_IS_VALID (typefind)) {
+      set_time_info ("discovery-typefind-time", typefind);
+      set_time_info ("discovery-preroll-time", total - typefind);
+    }
+  }
+
+  if (timing->history_length == 0) {
+    validate_item ("discovery-time-in-range", TRUE,
+        "No previous discovery time to compare to");
+  } else {
+    median = timing_get_median (timing);
+    if (total_ms > MAX (median * REGRESSION_FACTOR,
+            median + REGRESSION_MIN_DELTA_MS)) {
+      msg = g_strdup_printf ("Discovery took %d ms, usually %d ms", total_ms,
+          median);
+      validate_item ("discovery-time-in-range", FALSE, msg);
+      g_free (msg);
+    } else {
+      validate_item ("discovery-time-in-range", TRUE, NULL);
+    }
+  }
+
+  /* Timeouts and errors say nothing about the usual discovery time */
+  if (timing->history_file != NULL
+      && gst_discoverer_info_get_result (dcinfo) == GST_DISCOVERER_OK)
+    timing_record (timing, total_ms);
+}
+
+
+static gboolean
+_run_async (GstDiscoverer * dc)
+{
+  timing = &single_timing;
+  timing_start (timing, dc, uri);
+  gst_discoverer_discover_uri_async (dc, uri);
+
+  return FALSE;
+}
 
 static void
 _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
@@ -1336,11 +1882,13 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
 
   insanity_test_printf (gstest, "Analyzing done!\n");
   if (info == NULL) {
-    insanity_test_validate_checklist_item (gstest,
-        "discoverer-returned-results", FALSE, "Discoverer went missing!");
+    validate_item ("discoverer-returned-results", FALSE,
+        "Discoverer went missing!");
     return;
   }
 
+  check_discovery_time (dc, dcinfo);
+
   insanity_test_printf (gstest, "discoverer_test_test\n");
 
   result = gst_discoverer_info_get_result (dcinfo);
@@ -1353,8 +1901,7 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
     }
     case GST_DISCOVERER_URI_INVALID:
     {
-      insanity_test_validate_checklist_item (gstest,
-          "discoverer-returned-results", FALSE, "URI is not valid");
+      validate_item ("discoverer-returned-results", FALSE, "URI is not valid");
       return;
     }
     case GST_DISCOVERER_ERROR:
@@ -1362,21 +1909,20 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
       compare_result =
           g_strconcat ("An error was encountered while discovering the file: ",
           dcerr->message, (char *) NULL);
-      insanity_test_validate_checklist_item (gstest,
-          "discoverer-returned-results", FALSE, compare_result);
+      validate_item ("discoverer-returned-results", FALSE, compare_result);
       g_free (compare_result);
       return;
     }
     case GST_DISCOVERER_TIMEOUT:
     {
-      insanity_test_validate_checklist_item (gstest,
-          "discoverer-returned-results", FALSE, "Analyzing URI timed out");
+      validate_item ("discoverer-returned-results", FALSE,
+          "Analyzing URI timed out");
       return;
     }
     case GST_DISCOVERER_BUSY:
     {
-      insanity_test_validate_checklist_item (gstest,
-          "discoverer-returned-results", FALSE, "Discoverer was busy");
+      validate_item ("discoverer-returned-results", FALSE,
+          "Discoverer was busy");
       return;
     }
     case GST_DISCOVERER_MISSING_PLUGINS:
@@ -1384,15 +1930,13 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
       tmp = gst_structure_to_string (gst_discoverer_info_get_misc (info));
       compare_result = g_strconcat ("Missing plugins", tmp, NULL);
       g_free (tmp);
-      insanity_test_validate_checklist_item (gstest,
-          "discoverer-returned-results", FALSE, compare_result);
+      validate_item ("discoverer-returned-results", FALSE, compare_result);
       g_free (compare_result);
       return;
     }
   }
 
-  insanity_test_validate_checklist_item (gstest, "discoverer-returned-results",
-      TRUE, "Discoverer returned");
+  validate_item ("discoverer-returned-results", TRUE, "Discoverer returned");
 
   expected_uri = g_strconcat (uri, ".discoverer-expected", (char *) NULL);
 
@@ -1402,18 +1946,15 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
     compare_result =
         g_strconcat ("Cannot figure out expected filename: ", err->message,
         (char *) NULL);
-    insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-        FALSE, compare_result);
+    validate_item ("comparison-file-parsed", FALSE, compare_result);
     g_clear_error (&err);
     g_free (compare_result);
     return;
   }
 
   if (skip_compare) {
-    insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-        TRUE, NULL);
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", TRUE,
-        NULL);
+    validate_item ("comparison-file-parsed", TRUE, NULL);
+    validate_item ("discoverer-correct", TRUE, NULL);
     return;
   }
 
@@ -1423,7 +1964,7 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
     return;                     /*test already invalidated before, reason given */
   }
 
-  insanity_test_validate_checklist_item (gstest, "comparison-file-parsed", TRUE,
+  validate_item ("comparison-file-parsed", TRUE,
       "Comparison file parsed successfully");
 
   if (!compare_properties (dcinfo)) {
@@ -1439,13 +1980,12 @@ _new_discovered_uri (GstDiscoverer * dc, GstDiscovererInfo * dcinfo,
   gst_discoverer_stream_info_unref (sinfo);
 
   if (compare_result != NULL) {
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", FALSE,
-        compare_result);
+    validate_item ("discoverer-correct", FALSE, compare_result);
     g_free (compare_result);
     return;
   } else {
     g_free (compare_result);
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", TRUE,
+    validate_item ("discoverer-correct", TRUE,
         "Discoverer returned the right results");
     return;
   }
@@ -1474,6 +2014,7 @@ discoverer_test_setup (InsanityTest * test)
   /* connect signals */
   g_signal_connect (dc, "discovered", G_CALLBACK (_new_discovered_uri), NULL);
   g_signal_connect (dc, "finished", G_CALLBACK (_discoverer_finished), NULL);
+  connect_timing (dc, &single_timing);
 
   return TRUE;
 }
@@ -1498,7 +2039,8 @@ free_topology (Topology * local_topology)
     free_topology (tmptop);
   }
 
-  gst_caps_unref (local_topology->caps);
+  if (local_topology->caps != NULL)
+    gst_caps_unref (local_topology->caps);
   if (local_topology->tags != NULL)
     gst_tag_list_unref (local_topology->tags);
   g_free (local_topology->language);
@@ -1515,6 +2057,283 @@ free_properties (Properties * local_properties)
   g_free (local_properties);
 }
 
+static void
+batch_add_uri (const gchar * location)
+{
+  gchar *buri;
+
+  if (gst_uri_is_valid (location))
+    buri = g_strdup (location);
+  else
+    buri = gst_filename_to_uri (location, NULL);
+
+  if (buri != NULL)
+    g_ptr_array_add (batch_uris, buri);
+}
+
+/* Files generated next to the media, which are never media files */
+static const gchar *batch_ignored_suffixes[] = {
+  ".xml", ".discoverer-expected", TIMING_SUFFIX, ".mdcache", ".dccache",
+  NULL
+};
+
+static gboolean
+batch_is_ignored (const gchar * name)
+{
+  guint i;
+
+  if (name[0] == '.')
+    return TRUE;
+
+  for (i = 0; batch_ignored_suffixes[i]; i++) {
+    if (g_str_has_suffix (name, batch_ignored_suffixes[i]))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+batch_collect_directory (const gchar * path)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *child;
+
+    if (batch_is_ignored (name))
+      continue;
+
+    child = g_build_filename (path, name, NULL);
+    if (g_file_test (child, G_FILE_TEST_IS_DIR))
+      batch_collect_directory (child);
+    else if (g_file_test (child, G_FILE_TEST_IS_REGULAR))
+      batch_add_uri (child);
+    g_free (child);
+  }
+
+  g_dir_close (dir);
+}
+
+/* @batch is either a directory to walk or a file listing one URI or
+ * filename per line */
+static gboolean
+batch_collect_uris (const gchar * batch)
+{
+  gchar *contents;
+  gchar **blines, **line;
+
+  if (g_file_test (batch, G_FILE_TEST_IS_DIR)) {
+    batch_collect_directory (batch);
+    return TRUE;
+  }
+
+  if (!g_file_get_contents (batch, &contents, NULL, NULL))
+    return FALSE;
+
+  blines = g_strsplit (contents, "\n", 0);
+  for (line = blines; *line; line++) {
+    g_strstrip (*line);
+    if (**line != '\0' && **line != '#')
+      batch_add_uri (*line);
+  }
+
+  g_strfreev (blines);
+  g_free (contents);
+
+  return TRUE;
+}
+
+static gboolean
+batch_start_next (BatchSlot * slot)
+{
+  if (batch_next >= batch_uris->len)
+    return FALSE;
+
+  slot->uri = g_ptr_array_index (batch_uris, batch_next++);
+  timing_start (&slot->timing, slot->dc, slot->uri);
+  gst_discoverer_discover_uri_async (slot->dc, slot->uri);
+
+  return TRUE;
+}
+
+static void
+_batch_discovered_uri (GstDiscoverer * bdc, GstDiscovererInfo * dcinfo,
+    GError * dcerr, BatchSlot * slot)
+{
+  guint i;
+  gint64 latency = g_get_monotonic_time () - slot->timing.start_time;
+
+  g_array_append_val (batch_latencies, latency);
+
+  uri = slot->uri;
+  timing = &slot->timing;
+  _new_discovered_uri (bdc, dcinfo, dcerr);
+  timing = NULL;
+  uri = NULL;
+
+  if (batch_uri_failures) {
+    for (i = 0; checklist_items[i]; i++) {
+      if (batch_uri_failures & (1 << i))
+        batch_item_failures[i]++;
+    }
+    batch_n_failed++;
+
+    insanity_test_printf (gstest, "FAIL %s (%" G_GINT64_FORMAT " ms): %s\n",
+        slot->uri, latency / 1000, batch_uri_failure_msg);
+  } else {
+    insanity_test_printf (gstest, "PASS %s (%" G_GINT64_FORMAT " ms)\n",
+        slot->uri, latency / 1000);
+  }
+
+  batch_uri_failures = 0;
+  g_free (batch_uri_failure_msg);
+  batch_uri_failure_msg = NULL;
+
+  if (properties != NULL) {
+    free_properties (properties);
+    properties = NULL;
+  }
+  if (topology != NULL) {
+    free_topology (topology);
+    topology = NULL;
+  }
+
+  batch_done++;
+  if (batch_start_next (slot) == FALSE && batch_done == batch_uris->len)
+    g_main_loop_quit (ml);
+}
+
+static gint
+compare_latencies (gconstpointer a, gconstpointer b)
+{
+  gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+
+  return la < lb ? -1 : la > lb;
+}
+
+static void
+batch_set_latency_info (const gchar * label, guint percentile)
+{
+  GValue v = { 0 };
+  guint n = batch_latencies->len;
+  guint index = MIN (n - 1, (n * percentile) / 100);
+
+  g_value_init (&v, G_TYPE_UINT64);
+  g_value_set_uint64 (&v, g_array_index (batch_latencies, gint64,
+          index) * GST_USECOND);
+  insanity_test_set_extra_info (gstest, label, &v);
+  g_value_unset (&v);
+}
+
+static void
+batch_report (gint64 elapsed)
+{
+  guint i;
+  GValue v = { 0 };
+  gdouble files_per_second = 0;
+
+  if (elapsed > 0)
+    files_per_second = batch_done * (gdouble) G_USEC_PER_SEC / elapsed;
+
+  g_value_init (&v, G_TYPE_DOUBLE);
+  g_value_set_double (&v, files_per_second);
+  insanity_test_set_extra_info (gstest, "batch-files-per-second", &v);
+  g_value_unset (&v);
+
+  g_value_init (&v, G_TYPE_UINT);
+  g_value_set_uint (&v, batch_n_failed);
+  insanity_test_set_extra_info (gstest, "batch-failures", &v);
+  g_value_unset (&v);
+
+  if (batch_latencies->len > 0) {
+    g_array_sort (batch_latencies, compare_latencies);
+    batch_set_latency_info ("batch-latency-p50", 50);
+    batch_set_latency_info ("batch-latency-p90", 90);
+    batch_set_latency_info ("batch-latency-p99", 99);
+    batch_set_latency_info ("batch-latency-max", 100);
+  }
+
+  insanity_test_printf (gstest, "%u URIs checked, %u failed, %.2f files/s\n",
+      batch_done, batch_n_failed, files_per_second);
+
+  for (i = 0; checklist_items[i]; i++) {
+    gchar *msg = NULL;
+
+    if (batch_item_failures[i])
+      msg = g_strdup_printf ("%u of %u URIs failed", batch_item_failures[i],
+          batch_done);
+
+    insanity_test_validate_checklist_item (gstest, checklist_items[i],
+        batch_item_failures[i] == 0, msg);
+    g_free (msg);
+  }
+}
+
+static void
+batch_run (InsanityTest * test, const gchar * batch)
+{
+  gint i, n_discoverers;
+  gint64 start_time;
+  BatchSlot *slots;
+
+  batch_mode = TRUE;
+  batch_uris = g_ptr_array_new_with_free_func (g_free);
+  batch_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  if (batch_collect_uris (batch) == FALSE || batch_uris->len == 0) {
+    batch_mode = FALSE;
+    validate_item ("discoverer-returned-results", FALSE,
+        "No URI to check in batch");
+    goto done;
+  }
+
+  insanity_test_get_boolean_argument (test, "skip-compare", &skip_compare);
+  insanity_test_get_int_argument (test, "discoverers", &n_discoverers);
+  n_discoverers = CLAMP (n_discoverers, 1, (gint) batch_uris->len);
+
+  insanity_test_printf (test, "Checking %u URIs with %d discoverers\n",
+      batch_uris->len, n_discoverers);
+
+  g_assert (ml == NULL);
+  ml = g_main_loop_new (NULL, FALSE);
+
+  slots = g_new0 (BatchSlot, n_discoverers);
+  for (i = 0; i < n_discoverers; i++) {
+    slots[i].dc = gst_discoverer_new (timeout * GST_SECOND, NULL);
+    g_signal_connect (slots[i].dc, "discovered",
+        G_CALLBACK (_batch_discovered_uri), &slots[i]);
+    connect_timing (slots[i].dc, &slots[i].timing);
+    gst_discoverer_start (slots[i].dc);
+  }
+
+  start_time = g_get_monotonic_time ();
+  for (i = 0; i < n_discoverers; i++)
+    batch_start_next (&slots[i]);
+
+  g_main_loop_run (ml);
+
+  for (i = 0; i < n_discoverers; i++) {
+    gst_discoverer_stop (slots[i].dc);
+    g_object_unref (slots[i].dc);
+    timing_clear (&slots[i].timing);
+  }
+  g_free (slots);
+
+  batch_report (g_get_monotonic_time () - start_time);
+
+done:
+  g_ptr_array_free (batch_uris, TRUE);
+  g_array_free (batch_latencies, TRUE);
+  batch_uris = NULL;
+  batch_latencies = NULL;
+}
+
 static void
 discoverer_test_stop (InsanityTest * test)
 {
@@ -1539,6 +2358,10 @@ discoverer_test_stop (InsanityTest * test)
   }
   lines = NULL;
   uri = NULL;
+  timing = NULL;
+  timing_clear (&single_timing);
+  g_free (expected_cache_dir);
+  expected_cache_dir = NULL;
 
   (void) test;
 }
@@ -1555,19 +2378,42 @@ discoverer_test_teardown (InsanityTest * test)
 static void
 discoverer_test_test (InsanityTest * test)
 {
+  gchar *batch = NULL;
+
+  insanity_test_get_string_argument (test, "expected-cache-dir",
+      &expected_cache_dir);
+  if (expected_cache_dir && expected_cache_dir[0] == '\0') {
+    g_free (expected_cache_dir);
+    expected_cache_dir = NULL;
+  }
+
+  insanity_test_get_boolean_argument (test, "timing-history",
+      &use_timing_history);
+  insanity_test_get_boolean_argument (test, "adaptive-timeout",
+      &adaptive_timeout);
+
+  insanity_test_get_string_argument (test, "batch", &batch);
+  if (batch != NULL && batch[0] != '\0') {
+    batch_run (test, batch);
+    g_free (batch);
+
+    insanity_test_done (test);
+    return;
+  }
+  g_free (batch);
+
   insanity_test_get_string_argument (test, "uri", &uri);
 
-  if (g_str_has_suffix (uri, ".discoverer-expected")) {
+  if (g_str_has_suffix (uri, ".discoverer-expected")
+      || g_str_has_suffix (uri, TIMING_SUFFIX)) {
     /* Not examining expected files... */
     g_free (uri);
     uri = NULL;
 
-    insanity_test_validate_checklist_item (gstest,
-        "discoverer-returned-results", TRUE, NULL);
-    insanity_test_validate_checklist_item (gstest, "comparison-file-parsed",
-        TRUE, NULL);
-    insanity_test_validate_checklist_item (gstest, "discoverer-correct", TRUE,
-        NULL);
+    validate_item ("discoverer-returned-results", TRUE, NULL);
+    validate_item ("comparison-file-parsed", TRUE, NULL);
+    validate_item ("discoverer-correct", TRUE, NULL);
+    validate_item ("discovery-time-in-range", TRUE, NULL);
 
     insanity_test_done (test);
     (void) test;
@@ -1625,10 +2471,60 @@ main (int argc, char **argv)
   insanity_test_add_checklist_item (test, "discoverer-correct",
       "Discoverer returned correct results",
       "Discoverer returned something wrong", FALSE);
+  insanity_test_add_checklist_item (test, "discovery-time-in-range",
+      "Discovery took about as long as the previous times",
+      "Discovery took much longer than the previous times", FALSE);
 
   insanity_test_add_string_argument (test, "uri", "Input file",
       "URI of file to process", TRUE, "file:///home/user/video.avi");
 
+  insanity_test_add_string_argument (test, "batch", "Batch of files",
+      "Directory to check all the files of, or file listing the URIs to "
+      "check, one per line. When set, uri is ignored", TRUE, "");
+  insanity_test_add_int_argument (test, "discoverers",
+      "Discoverers in batch mode",
+      "Number of URIs discovered concurrently in batch mode", TRUE, 4);
+
+  insanity_test_add_extra_info (test, "batch-files-per-second",
+      "Number of URIs checked per second in batch mode");
+  insanity_test_add_extra_info (test, "batch-failures",
+      "Number of URIs that failed in batch mode");
+  insanity_test_add_extra_info (test, "batch-latency-p50",
+      "Median time taken to discover a URI in batch mode (in nanoseconds)");
+  insanity_test_add_extra_info (test, "batch-latency-p90",
+      "90th percentile of the time taken to discover a URI in batch mode "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "batch-latency-p99",
+      "99th percentile of the time taken to discover a URI in batch mode "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "batch-latency-max",
+      "Maximum time taken to discover a URI in batch mode (in nanoseconds)");
+
+  insanity_test_add_string_argument (test, "expected-cache-dir",
+      "Compiled expected files cache",
+      "Directory where parsed expected files are cached so they do not need "
+      "to be parsed again, the cache is disabled if empty", TRUE, "");
+
+  insanity_test_add_boolean_argument (test, "timing-history",
+      "Keep a history of discovery times",
+      "Record the discovery times of each file next to it, and fail when a "
+      "discovery takes much longer than it used to", TRUE, FALSE);
+  insanity_test_add_boolean_argument (test, "adaptive-timeout",
+      "Adapt the discovery timeout",
+      "Derive the discovery timeout from the size of the file and its "
+      "discovery time history instead of using a fixed 10 seconds",
+      TRUE, FALSE);
+
+  insanity_test_add_extra_info (test, "discovery-time",
+      "Time taken to discover the URI (in nanoseconds)");
+  insanity_test_add_extra_info (test, "discovery-typefind-time",
+      "Time taken to find the type of the URI (in nanoseconds)");
+  insanity_test_add_extra_info (test, "discovery-preroll-time",
+      "Time taken to preroll once the type of the URI was found "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "discovery-timeout",
+      "Timeout the URI was discovered with (in nanoseconds)");
+
   insanity_test_add_boolean_argument (test, "skip-compare",
       "Skip comparing results",
       "Just check whether discoverer returns something without comparing it",
@@ -39,14 +39,6 @@
    never come (they may come late when there is a video transition) */
 #define MENU_WAIT_DELAY 8000
 
-typedef enum
-{
-  NEXT_STEP_NOW,
-  NEXT_STEP_ON_PLAYING,
-  NEXT_STEP_RESTART_ON_PLAYING,
-  NEXT_STEP_RESTART_SOON,
-} NextStepTrigger;
-
 typedef enum
 {
   AVC_NONE = 0,                 /* waiting to get commands set */
@@ -60,26 +52,18 @@ static const char *const available_command_names[] =
 
 static GstElement *global_pipeline = NULL;
 static GstNavigation *global_nav = NULL;
-static unsigned int global_state = 0;
-static unsigned int global_next_state = 0;
-static gboolean global_waiting_on_playing = FALSE;
+static InsanityGstStepSequencer *global_sequencer = NULL;
 static guint global_angle = 0;
 static guint global_n_angles = 0;
 static guint global_n_allowed_commands = 0;
 static GstNavigationCommand global_allowed_commands[256];
 static guint global_random_command_counter = 0;
 static GRand *global_prg = NULL;
-static guint global_state_change_timeout = 0;
 static int global_longest_title = -1;
-static GstClockTime global_wait_time = GST_CLOCK_TIME_NONE;
 static GstClockTime global_playback_time = GST_CLOCK_TIME_NONE;
-static guint global_timer_id = 0;
 static AvailableCommands global_available_commands = AVC_NONE;
 static gboolean global_menu_wait_timer_id = 0;
 
-static void on_ready_for_next_state (InsanityGstPipelineTest * ptest,
-    gboolean timeout);
-
 static GstPipeline *
 dvd_test_create_pipeline (InsanityGstPipelineTest * ptest, gpointer userdata)
 {
@@ -122,29 +106,19 @@ dvd_test_get_position (InsanityTest * test)
   return pos;
 }
 
-static GstClockTime
-dvd_test_get_wait_time (InsanityTest * test)
-{
-  gint64 pos = dvd_test_get_position (test);
-  if (GST_CLOCK_TIME_IS_VALID (pos)) {
-    pos += global_playback_time * GST_SECOND;
-  }
-  return pos;
-}
-
-static NextStepTrigger
+static InsanityGstStepTrigger
 send_dvd_command (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
   if (global_available_commands == AVC_NONE
       || global_available_commands == AVC_SOME)
-    return NEXT_STEP_RESTART_SOON;
+    return INSANITY_GST_STEP_RESTART_SOON;
 
   gst_navigation_send_command (global_nav, data);
-  return NEXT_STEP_ON_PLAYING;
+  return INSANITY_GST_STEP_NEXT_ON_PLAYING;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 retrieve_commands (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -218,10 +192,10 @@ retrieve_commands (InsanityGstPipelineTest * ptest, const char *step,
         "Failed to send command query");
   }
   gst_query_unref (q);
-  return NEXT_STEP_NOW;
+  return INSANITY_GST_STEP_NEXT_NOW;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 retrieve_angles (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -268,17 +242,17 @@ retrieve_angles (InsanityGstPipelineTest * ptest, const char *step,
         "Failed to send angles query");
   }
   gst_query_unref (q);
-  return NEXT_STEP_NOW;
+  return INSANITY_GST_STEP_NEXT_NOW;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 cycle_angles (InsanityGstPipelineTest * ptest, const char *step, guintptr data)
 {
   guint n;
 
   if (global_available_commands == AVC_NONE
       || global_available_commands == AVC_SOME)
-    return NEXT_STEP_RESTART_SOON;
+    return INSANITY_GST_STEP_RESTART_SOON;
 
   /* First retrieve amount of angles, will be saved globally */
   retrieve_angles (ptest, step, (guintptr) NULL);
@@ -295,10 +269,10 @@ cycle_angles (InsanityGstPipelineTest * ptest, const char *step, guintptr data)
 
   /* Do we end up where we were ? Or do the next/prev stop at 0 and N-1 ? Samples have only 1 angle */
 
-  return NEXT_STEP_NOW;
+  return INSANITY_GST_STEP_NEXT_NOW;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 cycle_unused_commands (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -307,7 +281,7 @@ cycle_unused_commands (InsanityGstPipelineTest * ptest, const char *step,
 
   if (global_available_commands == AVC_NONE
       || global_available_commands == AVC_SOME)
-    return NEXT_STEP_RESTART_SOON;
+    return INSANITY_GST_STEP_RESTART_SOON;
 
   /* First retrieve allowed commands, will be saved globally */
   retrieve_commands (ptest, step, (guintptr) NULL);
@@ -335,20 +309,10 @@ cycle_unused_commands (InsanityGstPipelineTest * ptest, const char *step,
   insanity_test_validate_checklist_item (test, "cycle-unused-commands", TRUE,
       NULL);
 
-  return NEXT_STEP_NOW;
-}
-
-static gboolean
-state_change_timeout (gpointer data)
-{
-  InsanityGstPipelineTest *ptest = data;
-
-  on_ready_for_next_state (ptest, TRUE);
-
-  return FALSE;
+  return INSANITY_GST_STEP_NEXT_NOW;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 seek_to_main_title (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -360,7 +324,7 @@ seek_to_main_title (InsanityGstPipelineTest * ptest, const char *step,
 
   if (global_longest_title < 0) {
     insanity_test_printf (test, "Longest title not known, not seeking\n");
-    return NEXT_STEP_NOW;
+    return INSANITY_GST_STEP_NEXT_NOW;
   }
   title = global_longest_title;
 
@@ -372,17 +336,16 @@ seek_to_main_title (InsanityGstPipelineTest * ptest, const char *step,
   if (!res) {
     insanity_test_validate_checklist_item (INSANITY_TEST (ptest), step, FALSE,
         "Failed to send seek event");
-    return NEXT_STEP_NOW;
+    return INSANITY_GST_STEP_NEXT_NOW;
   }
   gst_element_get_state (global_pipeline, NULL, NULL, SEEK_TIMEOUT);
 
-  global_state_change_timeout =
-      g_timeout_add (1000, (GSourceFunc) & state_change_timeout, ptest);
+  insanity_gst_step_sequencer_set_step_timeout (global_sequencer, 1000);
   insanity_test_validate_checklist_item (test, step, TRUE, NULL);
-  return NEXT_STEP_ON_PLAYING;
+  return INSANITY_GST_STEP_NEXT_ON_PLAYING;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 send_random_commands (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -392,7 +355,7 @@ send_random_commands (InsanityGstPipelineTest * ptest, const char *step,
 
   if (global_available_commands == AVC_NONE
       || global_available_commands == AVC_SOME)
-    return NEXT_STEP_RESTART_SOON;
+    return INSANITY_GST_STEP_RESTART_SOON;
 
   /* First retrieve allowed commands, will be saved globally */
   retrieve_commands (ptest, step, (guintptr) NULL);
@@ -413,124 +376,39 @@ send_random_commands (InsanityGstPipelineTest * ptest, const char *step,
      Therefore, we add a timeout function that will bump to next when no state
      change has happened after a short time. */
 
+  insanity_gst_step_sequencer_set_step_timeout (global_sequencer, 1000);
+
   /* Stop after enough commands */
-  global_state_change_timeout =
-      g_timeout_add (1000, (GSourceFunc) & state_change_timeout, ptest);
   if (++*counter == MAX_RANDOM_COMMANDS) {
     *counter = 0;
     insanity_test_validate_checklist_item (test, "send-random-commands", TRUE,
         NULL);
-    return NEXT_STEP_ON_PLAYING;
+    return INSANITY_GST_STEP_NEXT_ON_PLAYING;
   } else {
-    return NEXT_STEP_RESTART_ON_PLAYING;
+    return INSANITY_GST_STEP_RESTART_ON_PLAYING;
   }
 }
 
 /*
-  This is an ordered list of steps to perform.
-  A test function needs the passed step if needed, and validate it UNLESS it returns
-  NEXT_STEP_ON_PLAYING, in which case validation will be automatically done whenever
-  next state change to PLAYING happens (eg, selecting a title to play is just sending
-  a command, but it is deemed to have succeeded only if we get to PLAYING at some
-  point later). A step can return NEXT_STEP_RESTART_ON_PLAYING, which will cause it
-  to be called again upon next state change to PLAYING. The step function is then
-  responsible for keeping its own private state so it can end up returning something
-  else at some point.
+  This is an ordered list of steps to perform, see InsanityGstStepSequencer.
+  Selecting a title to play is just sending a command, but it is deemed to have
+  succeeded only if we get to PLAYING at some point later.
 */
-static const struct
-{
-  const char *step;
-    NextStepTrigger (*f) (InsanityGstPipelineTest *, const char *, guintptr);
-  guintptr data;
-} steps[] = {
-  {
-  "select-root-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_DVD_ROOT_MENU}, {
-  "retrieve-commands", &retrieve_commands, (guintptr) "root-menu"}, {
-  "retrieve-angles", &retrieve_angles, (guintptr) "root-menu"}, {
-  "select-first-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_MENU1}, {
-  "retrieve-commands", &retrieve_commands, (guintptr) "first-menu"}, {
-  "retrieve-angles", &retrieve_angles, (guintptr) "first-menu"}, {
-  "seek-to-main-title", &seek_to_main_title, 0}, {
-  "cycle-angles", &cycle_angles, 0}, {
-  "cycle-unused-commands", &cycle_unused_commands, 0}, {
-  "select-root-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_DVD_ROOT_MENU}, {
-  "send-random-commands", &send_random_commands,
-        (guintptr) & global_random_command_counter}, {
-"select-root-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_DVD_ROOT_MENU},};
-
-static gboolean
-do_next_step (gpointer data)
-{
-  InsanityGstPipelineTest *ptest = data;
-  InsanityTest *test = data;
-  NextStepTrigger next;
-
-  /* When out of steps to perform, end the test */
-  if (global_state == sizeof (steps) / sizeof (steps[0])) {
-    insanity_test_done (test);
-    return FALSE;
-  }
-
-  insanity_test_printf (test, "Calling step %u/%zu (%s, data %u)\n",
-      global_state + 1, sizeof (steps) / sizeof (steps[0]),
-      steps[global_state].step, steps[global_state].data);
-  next =
-      (*steps[global_state].f) (ptest, steps[global_state].step,
-      steps[global_state].data);
-  switch (next) {
-    default:
-      g_assert (0);
-      /* fall through */
-    case NEXT_STEP_NOW:
-      global_state++;
-      g_idle_add ((GSourceFunc) & do_next_step, ptest);
-      break;
-    case NEXT_STEP_RESTART_SOON:
-      g_timeout_add (100, (GSourceFunc) & do_next_step, ptest);
-      break;
-    case NEXT_STEP_ON_PLAYING:
-      global_next_state = global_state + 1;
-      global_waiting_on_playing = TRUE;
-      break;
-    case NEXT_STEP_RESTART_ON_PLAYING:
-      global_next_state = global_state;
-      global_waiting_on_playing = TRUE;
-      break;
-  }
-
-  return FALSE;
-}
-
-static gboolean
-wait_and_do_next_step (gpointer data)
-{
-  InsanityTest *test = INSANITY_TEST (data);
-
-  if (GST_CLOCK_TIME_IS_VALID (global_wait_time)
-      && dvd_test_get_position (test) < global_wait_time)
-    return TRUE;
-
-  g_idle_add ((GSourceFunc) & do_next_step, test);
-  return FALSE;
-}
-
-static void
-on_ready_for_next_state (InsanityGstPipelineTest * ptest, gboolean timeout)
-{
-  global_waiting_on_playing = FALSE;
-  if (global_next_state != global_state) {
-    insanity_test_validate_checklist_item (INSANITY_TEST (ptest),
-        steps[global_state].step, TRUE, NULL);
-    global_state = global_next_state;
-  }
-  insanity_test_printf (INSANITY_TEST (ptest),
-      "Got %s, waiting a bit before going to next step\n",
-      timeout ? "timeout" : "playing");
-  global_wait_time = dvd_test_get_wait_time (INSANITY_TEST (ptest));
-  global_timer_id =
-      g_timeout_add (250, (GSourceFunc) & wait_and_do_next_step,
-      INSANITY_TEST (ptest));
-}
+static const InsanityGstStep steps[] = {
+  {"select-root-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_DVD_ROOT_MENU},
+  {"retrieve-commands", &retrieve_commands, (guintptr) "root-menu"},
+  {"retrieve-angles", &retrieve_angles, (guintptr) "root-menu"},
+  {"select-first-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_MENU1},
+  {"retrieve-commands", &retrieve_commands, (guintptr) "first-menu"},
+  {"retrieve-angles", &retrieve_angles, (guintptr) "first-menu"},
+  {"seek-to-main-title", &seek_to_main_title, 0},
+  {"cycle-angles", &cycle_angles, 0},
+  {"cycle-unused-commands", &cycle_unused_commands, 0},
+  {"select-root-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_DVD_ROOT_MENU},
+  {"send-random-commands", &send_random_commands,
+      (guintptr) & global_random_command_counter},
+  {"select-root-menu", &send_dvd_command, GST_NAVIGATION_COMMAND_DVD_ROOT_MENU},
+};
 
 static gboolean
 dvd_test_no_menu_commands (gpointer data)
@@ -607,18 +485,12 @@ dvd_test_bus_message (InsanityGstPipelineTest * ptest, GstMessage * msg)
         GstState oldstate, newstate, pending;
         gst_message_parse_state_changed (msg, &oldstate, &newstate, &pending);
 
-        if (global_state_change_timeout) {
-          g_source_remove (global_state_change_timeout);
-          global_state_change_timeout = 0;
-        }
-
         if (newstate == GST_STATE_READY)
           global_available_commands = AVC_NONE;
 
-        if (newstate == GST_STATE_PLAYING && pending == GST_STATE_VOID_PENDING
-            && global_waiting_on_playing) {
-          on_ready_for_next_state (ptest, FALSE);
-        }
+        /* Not polled any more, but still expected to work */
+        if (newstate == GST_STATE_PLAYING && pending == GST_STATE_VOID_PENDING)
+          dvd_test_get_position (INSANITY_TEST (ptest));
       }
       break;
     case GST_MESSAGE_ELEMENT:
@@ -764,13 +636,15 @@ dvd_test_start (InsanityTest * test)
   global_playback_time = g_value_get_int (&ival);
   g_value_unset (&ival);
 
-  global_state = 0;
-  global_next_state = 0;
   global_random_command_counter = 0;
   global_longest_title = -1;
-  global_waiting_on_playing = TRUE;
   global_available_commands = AVC_NONE;
 
+  /* Menus may be still, the settle wait gives up after a while */
+  insanity_gst_step_sequencer_set_settle_time (global_sequencer,
+      global_playback_time * GST_SECOND);
+  insanity_gst_step_sequencer_start (global_sequencer, GST_STATE_PLAYING);
+
   return TRUE;
 }
 
@@ -781,10 +655,7 @@ dvd_test_stop (InsanityTest * test)
     g_source_remove (global_menu_wait_timer_id);
     global_menu_wait_timer_id = 0;
   }
-  if (global_timer_id) {
-    g_source_remove (global_timer_id);
-    global_timer_id = 0;
-  }
+  insanity_gst_step_sequencer_stop (global_sequencer);
   if (global_nav) {
     gst_object_unref (global_nav);
     global_nav = NULL;
@@ -878,8 +749,12 @@ main (int argc, char **argv)
       G_CALLBACK (&dvd_test_reached_initial_state), 0);
   g_signal_connect_after (test, "teardown", G_CALLBACK (&dvd_test_teardown), 0);
 
+  global_sequencer = insanity_gst_step_sequencer_new (ptest, steps,
+      G_N_ELEMENTS (steps));
+
   ret = insanity_test_run (test, &argc, &argv);
 
+  g_object_unref (global_sequencer);
   g_object_unref (test);
 
   return ret ? 0 : 1;
@@ -37,15 +37,14 @@
 
 /* timeout for gst_element_get_state() after a seek */
 #define SEEK_TIMEOUT (40 * GST_MSECOND)
-#define PLAY_TIMEOUT (10 * G_USEC_PER_SEC)
+#define PLAY_TIMEOUT 10000
 
 #define LOG(format, args...) \
   INSANITY_LOG (test, "hls", INSANITY_LOG_LEVEL_DEBUG, format, ##args)
 
 static unsigned glob_nsinks = 0;
-static guint glob_timer_id = 0;
+static guint glob_wait_id = 0;
 static guint glob_seek_nb = 0;
-static gint64 glob_first_wait = 0;
 static unsigned int glob_state = 0;
 static gboolean glob_is_live = FALSE;
 static gboolean glob_done_hls = FALSE;
@@ -65,7 +64,6 @@ static GstClockTime glob_target = GST_CLOCK_TIME_NONE;
 static GstClockTime glob_segment = GST_CLOCK_TIME_NONE;
 static GstClockTime glob_duration = GST_CLOCK_TIME_NONE;
 static GstClockTime glob_playback_time = 5;
-static GstClockTime glob_wait_time = GST_CLOCK_TIME_NONE;
 
 typedef struct
 {
@@ -100,10 +98,561 @@ source_setup_cb (GstElement * playbin, GstElement * source, gpointer user_data)
   g_object_set (source, "user-id", good_user, "user-pw", good_pw, NULL);
 }
 
+/* Fault injection: the server reports faults from its own thread and the
+ * buffers arrive from the streaming threads */
+G_LOCK_DEFINE_STATIC (faults);
+static guint glob_faults = 0;
+static gint64 glob_fault_time = 0;  /* Of the oldest unrecovered fault */
+static gint64 glob_fault_recovery_max = 0;
+
+static void
+fault_injected_cb (InsanityHttpServer * srv, const gchar * path,
+    const gchar * fault, InsanityTest * test)
+{
+  insanity_test_printf (test, "Fault \"%s\" injected into %s\n", fault, path);
+
+  G_LOCK (faults);
+  glob_faults++;
+  if (glob_fault_time == 0)
+    glob_fault_time = g_get_monotonic_time ();
+  G_UNLOCK (faults);
+}
+
+static GstPadProbeReturn
+fault_recovery_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  G_LOCK (faults);
+  if (glob_fault_time) {
+    glob_fault_recovery_max = MAX (glob_fault_recovery_max,
+        g_get_monotonic_time () - glob_fault_time);
+    glob_fault_time = 0;
+  }
+  G_UNLOCK (faults);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+watch_faults (GstElement * sink)
+{
+  GstPad *pad;
+
+  if (sink == NULL)
+    return;
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, fault_recovery_probe,
+      NULL, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+}
+
+/* Sums the requests answered by the server up, and writes them all to the
+ * file given by the "access-log" argument if any */
+static void
+access_log_report (InsanityTest * test)
+{
+  gchar *filename = NULL;
+  GError *error = NULL;
+
+  insanity_test_get_string_argument (test, "access-log", &filename);
+
+  if (glob_server == NULL)
+    goto done;
+
+  insanity_http_server_report_access_log (glob_server);
+
+  if (filename && *filename
+      && !insanity_http_server_write_access_log (glob_server, filename,
+          &error)) {
+    insanity_test_printf (test, "Could not write access log: %s\n",
+        error->message);
+    g_error_free (error);
+  }
+
+done:
+  g_free (filename);
+}
+
+static void
+fault_report (InsanityTest * test)
+{
+  GValue v = { 0 };
+
+  G_LOCK (faults);
+  if (glob_faults > 0) {
+    insanity_test_validate_checklist_item (test,
+        "playback-continues-after-faults", glob_fault_time == 0,
+        glob_fault_time ? "No buffer reached the sinks after the last fault"
+        : NULL);
+
+    g_value_init (&v, G_TYPE_UINT);
+    g_value_set_uint (&v, glob_faults);
+    insanity_test_set_extra_info (test, "faults-injected", &v);
+    g_value_unset (&v);
+
+    g_value_init (&v, G_TYPE_UINT64);
+    g_value_set_uint64 (&v, glob_fault_recovery_max * GST_USECOND);
+    insanity_test_set_extra_info (test, "fault-recovery-time", &v);
+    g_value_unset (&v);
+  }
+
+  glob_faults = 0;
+  glob_fault_time = 0;
+  glob_fault_recovery_max = 0;
+  G_UNLOCK (faults);
+}
+
+/* Live mode, the server emulates a live stream. The time of the live stream
+ * being played is the start of the first segment requested, plus the
+ * running time of the pipeline, plus what was skipped when the demuxer
+ * jumped ahead to catch up */
+#define LIVE_SAMPLE_INTERVAL 250
+/* How close to its latency from before a fault playback has to get back */
+#define LIVE_CATCH_UP_TOLERANCE GST_SECOND
+
+static guint glob_live_window = 0;
+static gint glob_live_play_time = 0;
+static guint glob_live_timer_id = 0;
+static guint glob_play_end_id = 0;    /* When not seeking */
+
+/* Segments are requested from the server thread */
+G_LOCK_DEFINE_STATIC (live);
+static GstClockTime glob_live_anchor = GST_CLOCK_TIME_NONE;
+static GstClockTime glob_live_end = GST_CLOCK_TIME_NONE;  /* Newest requested */
+static GstClockTime glob_live_skipped = 0;
+
+static guint glob_live_samples = 0;
+static GstClockTime glob_live_latency_sum = 0;
+static GstClockTime glob_live_latency_max = 0;
+static GstClockTime glob_live_latency_last = GST_CLOCK_TIME_NONE;
+static guint glob_live_faults = 0;
+static GstClockTime glob_live_baseline = GST_CLOCK_TIME_NONE;
+static gint64 glob_live_fault_time = 0;  /* Of the fault being caught up */
+static gboolean glob_live_behind = FALSE;
+static gint64 glob_live_catch_up_max = -1;
+
+static void
+live_segment_requested_cb (InsanityHttpServer * srv, const gchar * path,
+    guint64 sequence, guint64 start, guint64 duration, InsanityTest * test)
+{
+  G_LOCK (live);
+  if (!GST_CLOCK_TIME_IS_VALID (glob_live_anchor)) {
+    glob_live_anchor = start;
+  } else if (start > glob_live_end) {
+    insanity_test_printf (test, "Skipped %" GST_TIME_FORMAT " of the live "
+        "stream\n", GST_TIME_ARGS (start - glob_live_end));
+    glob_live_skipped += start - glob_live_end;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID (glob_live_end)
+      || start + duration > glob_live_end)
+    glob_live_end = start + duration;
+  G_UNLOCK (live);
+}
+
+static GstClockTime
+pipeline_running_time (void)
+{
+  GstClockTime running = GST_CLOCK_TIME_NONE;
+  GstClock *clock;
+  GstState state;
+
+  gst_element_get_state (glob_pipeline, &state, NULL, 0);
+  if (state != GST_STATE_PLAYING)
+    return gst_element_get_start_time (glob_pipeline);
+
+  clock = gst_element_get_clock (glob_pipeline);
+  if (clock) {
+    running = gst_clock_get_time (clock) -
+        gst_element_get_base_time (glob_pipeline);
+    gst_object_unref (clock);
+  }
+
+  return running;
+}
+
+static gboolean
+live_sample (gpointer data)
+{
+  GstClockTime edge, running, played, latency;
+  gint64 now = g_get_monotonic_time ();
+  guint faults;
+
+  edge = insanity_http_server_get_live_edge (glob_server);
+  running = pipeline_running_time ();
+
+  G_LOCK (live);
+  played = glob_live_anchor;
+  if (GST_CLOCK_TIME_IS_VALID (played))
+    played += glob_live_skipped;
+  G_UNLOCK (live);
+
+  if (!GST_CLOCK_TIME_IS_VALID (edge) || !GST_CLOCK_TIME_IS_VALID (running)
+      || !GST_CLOCK_TIME_IS_VALID (played))
+    return TRUE;
+
+  played += running;
+  latency = edge > played ? edge - played : 0;
+
+  glob_live_samples++;
+  glob_live_latency_sum += latency;
+  glob_live_latency_max = MAX (glob_live_latency_max, latency);
+
+  /* A fault starts measuring how long playback takes to get back near the
+   * latency it had before, if it fell behind */
+  G_LOCK (faults);
+  faults = glob_faults;
+  G_UNLOCK (faults);
+  if (faults > glob_live_faults && glob_live_fault_time == 0) {
+    glob_live_baseline = GST_CLOCK_TIME_IS_VALID (glob_live_latency_last) ?
+        glob_live_latency_last : latency;
+    glob_live_fault_time = now;
+    glob_live_behind = FALSE;
+  }
+  glob_live_faults = faults;
+
+  if (glob_live_fault_time) {
+    if (latency > glob_live_baseline + LIVE_CATCH_UP_TOLERANCE) {
+      glob_live_behind = TRUE;
+    } else if (glob_live_behind) {
+      glob_live_catch_up_max = MAX (glob_live_catch_up_max,
+          now - glob_live_fault_time);
+      glob_live_fault_time = 0;
+      glob_live_behind = FALSE;
+    }
+  }
+
+  glob_live_latency_last = latency;
+
+  return TRUE;
+}
+
+static gboolean
+play_done (gpointer data)
+{
+  InsanityTest *test = data;
+
+  glob_play_end_id = 0;
+  insanity_test_done (test);
+
+  return FALSE;
+}
+
+static void
+live_report (InsanityTest * test)
+{
+  GValue v = { 0 };
+
+  if (glob_live_samples > 0) {
+    insanity_test_printf (test, "Live latency %" GST_TIME_FORMAT " on average"
+        ", %" GST_TIME_FORMAT " at most\n",
+        GST_TIME_ARGS (glob_live_latency_sum / glob_live_samples),
+        GST_TIME_ARGS (glob_live_latency_max));
+
+    g_value_init (&v, G_TYPE_UINT64);
+    g_value_set_uint64 (&v, glob_live_latency_sum / glob_live_samples);
+    insanity_test_set_extra_info (test, "live-latency-mean", &v);
+    g_value_set_uint64 (&v, glob_live_latency_max);
+    insanity_test_set_extra_info (test, "live-latency-max", &v);
+    if (glob_live_catch_up_max >= 0) {
+      g_value_set_uint64 (&v, glob_live_catch_up_max * GST_USECOND);
+      insanity_test_set_extra_info (test, "live-catch-up-time", &v);
+    }
+    g_value_unset (&v);
+  }
+
+  if (glob_live_faults > 0)
+    insanity_test_validate_checklist_item (test, "live-caught-up",
+        !glob_live_behind, glob_live_behind ?
+        "Playback was still behind the live edge at the end" : NULL);
+
+  G_LOCK (live);
+  glob_live_anchor = GST_CLOCK_TIME_NONE;
+  glob_live_end = GST_CLOCK_TIME_NONE;
+  glob_live_skipped = 0;
+  G_UNLOCK (live);
+
+  glob_live_samples = 0;
+  glob_live_latency_sum = 0;
+  glob_live_latency_max = 0;
+  glob_live_latency_last = GST_CLOCK_TIME_NONE;
+  glob_live_faults = 0;
+  glob_live_fault_time = 0;
+  glob_live_behind = FALSE;
+  glob_live_catch_up_max = -1;
+}
+
+/* Adaptive bitrate: the variant played is the one whose playlist was
+ * requested last before a segment, and the server announces the steps of
+ * its bandwidth profile. Both come from the server thread */
+#define MASTER_PLAYLIST "insanity-master.m3u8"
+
+typedef struct
+{
+  gchar *path;                  /* Of its playlist, from the server root */
+  guint64 bandwidth;            /* In bits per second */
+} HlsVariant;
+
+static gint glob_abr_play_time = 0;
+
+G_LOCK_DEFINE_STATIC (abr);
+static GArray *glob_variants = NULL;
+static gint glob_variant_requested = -1;
+static gint glob_variant_played = -1;
+static guint glob_abr_switches = 0;
+static guint64 glob_abr_rate = 0;     /* Of the server, 0 for unlimited */
+static gint glob_abr_pending = 0;     /* Direction of an unanswered change */
+static gint64 glob_abr_change_time = 0;
+static gint64 glob_abr_down_reaction = -1;
+static gint64 glob_abr_up_reaction = -1;
+
+/* Rebuffering is reported by the pipeline test */
+static gint64 glob_play_start = 0;
+static guint64 glob_bytes_start = 0;
+
+/* Must be called with the abr lock held */
+static void
+clear_variants (void)
+{
+  guint i;
+
+  if (glob_variants == NULL)
+    glob_variants = g_array_new (FALSE, FALSE, sizeof (HlsVariant));
+
+  for (i = 0; i < glob_variants->len; i++)
+    g_free (g_array_index (glob_variants, HlsVariant, i).path);
+  g_array_set_size (glob_variants, 0);
+}
+
+/* Must be called with the abr lock held */
+static void
+parse_master_playlist (const gchar * contents)
+{
+  gchar **lines, *line, *bandwidth;
+  gboolean stream_inf = FALSE;
+  HlsVariant variant = { NULL, 0 };
+  guint i;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i]; i++) {
+    line = g_strstrip (lines[i]);
+
+    if (g_str_has_prefix (line, "#EXT-X-STREAM-INF:")) {
+      /* Not AVERAGE-BANDWIDTH */
+      variant.bandwidth = 0;
+      for (bandwidth = strstr (line, "BANDWIDTH="); bandwidth;
+          bandwidth = strstr (bandwidth + 1, "BANDWIDTH=")) {
+        if (bandwidth[-1] == ':' || bandwidth[-1] == ',') {
+          variant.bandwidth = g_ascii_strtoull (bandwidth +
+              strlen ("BANDWIDTH="), NULL, 10);
+          break;
+        }
+      }
+      stream_inf = TRUE;
+    } else if (stream_inf && *line != '\0' && *line != '#') {
+      /* Only the variants we serve */
+      if (strchr (line, ':') == NULL) {
+        variant.path = *line == '/' ? g_strdup (line) :
+            g_strconcat ("/", line, NULL);
+        g_array_append_val (glob_variants, variant);
+      }
+      stream_inf = FALSE;
+    }
+  }
+  g_strfreev (lines);
+}
+
+/* Learns the variants from the "variants" argument, generating a master
+ * playlist over them, or from the playlist played if it is a master one.
+ * Returns the playlist to play */
+static gchar *
+setup_variants (InsanityTest * test, const gchar * folder,
+    const gchar * playlist)
+{
+  gchar *variants = NULL, *contents, *filename, **items, *sep, *path;
+  HlsVariant variant;
+  GString *master;
+  guint i;
+
+  G_LOCK (abr);
+  clear_variants ();
+
+  insanity_test_get_string_argument (test, "variants", &variants);
+  if (variants && *variants) {
+    master = g_string_new ("#EXTM3U\n");
+    items = g_strsplit (variants, ",", -1);
+    for (i = 0; items[i]; i++) {
+      sep = strrchr (items[i], ':');
+      if (sep == NULL) {
+        insanity_test_printf (test, "Invalid variant \"%s\"\n", items[i]);
+        continue;
+      }
+      *sep = '\0';
+      path = g_strstrip (items[i]);
+      while (*path == '/')
+        path++;
+
+      variant.path = g_strconcat ("/", path, NULL);
+      variant.bandwidth = g_ascii_strtoull (sep + 1, NULL, 10);
+      g_array_append_val (glob_variants, variant);
+      g_string_append_printf (master, "#EXT-X-STREAM-INF:PROGRAM-ID=1,"
+          "BANDWIDTH=%" G_GUINT64_FORMAT "\n%s\n", variant.bandwidth, path);
+    }
+    g_strfreev (items);
+
+    insanity_http_server_add_document (glob_server, "/" MASTER_PLAYLIST,
+        "application/vnd.apple.mpegurl", master->str);
+    g_string_free (master, TRUE);
+    playlist = MASTER_PLAYLIST;
+  } else {
+    filename = g_build_filename (folder, playlist, NULL);
+    if (g_file_get_contents (filename, &contents, NULL, NULL)) {
+      parse_master_playlist (contents);
+      g_free (contents);
+    }
+    g_free (filename);
+  }
+
+  if (glob_variants->len > 1)
+    insanity_test_printf (test, "Playing %u variants\n", glob_variants->len);
+  G_UNLOCK (abr);
+
+  g_free (variants);
+
+  return g_strdup (playlist);
+}
+
+/* Compares two rates in bytes per second, 0 being unlimited */
+static gint
+compare_rates (guint64 a, guint64 b)
+{
+  if (a == b)
+    return 0;
+  if (a == 0 || (b != 0 && a > b))
+    return 1;
+  return -1;
+}
+
+static void
+request_started_cb (InsanityHttpServer * srv, const gchar * path,
+    InsanityTest * test)
+{
+  HlsVariant *from, *to;
+  gint64 now = g_get_monotonic_time ();
+  gint direction;
+  guint i;
+
+  G_LOCK (abr);
+  if (glob_variants == NULL || glob_variants->len < 2)
+    goto done;
+
+  for (i = 0; i < glob_variants->len; i++) {
+    if (!strcmp (g_array_index (glob_variants, HlsVariant, i).path, path)) {
+      glob_variant_requested = i;
+      goto done;
+    }
+  }
+
+  /* Only segments tell the variant is actually played */
+  if (g_str_has_suffix (path, ".m3u8") || glob_variant_requested < 0
+      || glob_variant_requested == glob_variant_played)
+    goto done;
+
+  if (glob_variant_played >= 0) {
+    from = &g_array_index (glob_variants, HlsVariant, glob_variant_played);
+    to = &g_array_index (glob_variants, HlsVariant, glob_variant_requested);
+    insanity_test_printf (test, "Switched from %s (%" G_GUINT64_FORMAT
+        " bps) to %s (%" G_GUINT64_FORMAT " bps)\n", from->path,
+        from->bandwidth, to->path, to->bandwidth);
+    glob_abr_switches++;
+
+    direction = to->bandwidth > from->bandwidth ? 1 : -1;
+    if (glob_abr_pending == direction) {
+      if (direction < 0)
+        glob_abr_down_reaction = MAX (glob_abr_down_reaction,
+            now - glob_abr_change_time);
+      else
+        glob_abr_up_reaction = MAX (glob_abr_up_reaction,
+            now - glob_abr_change_time);
+      glob_abr_pending = 0;
+    }
+  }
+  glob_variant_played = glob_variant_requested;
+
+done:
+  G_UNLOCK (abr);
+}
+
+static void
+bandwidth_changed_cb (InsanityHttpServer * srv, guint64 rate,
+    InsanityTest * test)
+{
+  gint direction;
+
+  insanity_test_printf (test, "Server bandwidth now %" G_GUINT64_FORMAT
+      " bytes per second\n", rate);
+
+  G_LOCK (abr);
+  direction = compare_rates (rate, glob_abr_rate);
+  glob_abr_rate = rate;
+  if (direction != 0) {
+    glob_abr_pending = direction;
+    glob_abr_change_time = g_get_monotonic_time ();
+  }
+  G_UNLOCK (abr);
+}
+
+static void
+abr_report (InsanityTest * test)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint64 bytes;
+  GValue v = { 0 };
+
+  if (glob_play_start && now > glob_play_start) {
+    g_object_get (glob_server, "bytes-sent", &bytes, NULL);
+    g_value_init (&v, G_TYPE_DOUBLE);
+    g_value_set_double (&v, (bytes - glob_bytes_start) * 8.0 *
+        G_USEC_PER_SEC / (now - glob_play_start));
+    insanity_test_set_extra_info (test, "delivered-bitrate", &v);
+    g_value_unset (&v);
+  }
+
+  G_LOCK (abr);
+  if (glob_variants && glob_variants->len > 1) {
+    g_value_init (&v, G_TYPE_UINT);
+    g_value_set_uint (&v, glob_abr_switches);
+    insanity_test_set_extra_info (test, "abr-switches", &v);
+    g_value_unset (&v);
+
+    g_value_init (&v, G_TYPE_UINT64);
+    if (glob_abr_down_reaction >= 0) {
+      g_value_set_uint64 (&v, glob_abr_down_reaction * GST_USECOND);
+      insanity_test_set_extra_info (test, "abr-down-reaction-time", &v);
+    }
+    if (glob_abr_up_reaction >= 0) {
+      g_value_set_uint64 (&v, glob_abr_up_reaction * GST_USECOND);
+      insanity_test_set_extra_info (test, "abr-up-reaction-time", &v);
+    }
+    g_value_unset (&v);
+  }
+
+  glob_variant_requested = -1;
+  glob_variant_played = -1;
+  glob_abr_switches = 0;
+  glob_abr_pending = 0;
+  glob_abr_down_reaction = -1;
+  glob_abr_up_reaction = -1;
+  G_UNLOCK (abr);
+
+  glob_play_start = 0;
+}
+
 static GstPipeline *
 hls_test_create_pipeline (InsanityGstPipelineTest * ptest, gpointer userdata)
 {
-  GstElement *pipeline = NULL;
+  GstElement *pipeline = NULL, *asink, *vsink;
   const char *launch_line =
       "playbin audio-sink=\"fakesink name=asink\" video-sink=\"fakesink name=vsink\"";
   GError *error = NULL;
@@ -127,6 +676,10 @@ hls_test_create_pipeline (InsanityGstPipelineTest * ptest, gpointer userdata)
   g_signal_connect (pipeline, "source-setup", G_CALLBACK (source_setup_cb),
       NULL);
 
+  g_object_get (pipeline, "audio-sink", &asink, "video-sink", &vsink, NULL);
+  watch_faults (asink);
+  watch_faults (vsink);
+
   glob_pipeline = pipeline;
 
   return GST_PIPELINE (pipeline);
@@ -150,42 +703,28 @@ hls_test_get_position (InsanityTest * test)
   return pos;
 }
 
-static GstClockTime
-hls_test_get_wait_time (InsanityTest * test)
+/* Lets the stream play for a while, then calls func, from any thread */
+static void
+play_then (InsanityGstPipelineTest * ptest, InsanityGstWaitFunction func)
 {
-  gint64 pos = hls_test_get_position (test);
-
-  if (GST_CLOCK_TIME_IS_VALID (pos)) {
-    pos += glob_playback_time * GST_SECOND;
-  }
-
-  return pos;
+  glob_wait_id = insanity_gst_pipeline_test_wait_for_playback (ptest, NULL,
+      glob_playback_time * GST_SECOND,
+      glob_playback_time * 1000 + PLAY_TIMEOUT, func, NULL);
 }
 
-static gboolean
-wait_and_do_seek (gpointer data)
+static void
+do_seek (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
 {
-  InsanityTest *test = data;
+  InsanityTest *test = INSANITY_TEST (ptest);
   GstEvent *event;
   gboolean res;
 
-  if (GST_CLOCK_TIME_IS_VALID (glob_wait_time)) {
-    GstClockTime cur = hls_test_get_position (test);
-
-    if (glob_first_wait == 0)
-      glob_first_wait = g_get_monotonic_time ();
+  glob_wait_id = 0;
 
-    if (cur < glob_wait_time) {
-      guint64 diff = g_get_monotonic_time () - glob_first_wait;
-
-      if (diff > glob_playback_time * G_USEC_PER_SEC + PLAY_TIMEOUT)
-        glob_play_in_time = FALSE;
-      else
-        return TRUE;
-    }
-  }
-
-  glob_first_wait = 0;
+  /* Not polled any more, but still expected to work */
+  hls_test_get_position (test);
+  if (!met)
+    glob_play_in_time = FALSE;
 
   LOG ("Seeking at %i\n", seek_targets[glob_seek_nb].perc);
 
@@ -193,7 +732,7 @@ wait_and_do_seek (gpointer data)
   if (!GST_CLOCK_TIME_IS_VALID (glob_duration)) {
     insanity_test_validate_checklist_item (test, "duration-known", FALSE, NULL);
     insanity_test_done (test);
-    return FALSE;
+    return;
   }
 
   glob_target = gst_util_uint64_scale (glob_duration,
@@ -203,35 +742,25 @@ wait_and_do_seek (gpointer data)
       GST_SEEK_TYPE_SET, glob_target, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
 
   glob_validate_on_playing = "seek";
-  res = gst_element_send_event (glob_pipeline, event);
+  res = insanity_gst_pipeline_test_send_seek (ptest, event);
   if (!res) {
     glob_validate_on_playing = NULL;
     insanity_test_validate_checklist_item (test, "seek", FALSE,
         "Failed to send seek event");
-    return FALSE;
+    return;
   }
   seek_targets[glob_seek_nb].seeked = TRUE;
   gst_element_get_state (glob_pipeline, NULL, NULL, SEEK_TIMEOUT);
   insanity_test_validate_checklist_item (test, "seek", TRUE, NULL);
-
-  return FALSE;
 }
 
-static gboolean
-wait_and_end_step (gpointer data)
+static void
+end_step (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
 {
-  InsanityTest *test = data;
+  glob_wait_id = 0;
 
-  if (GST_CLOCK_TIME_IS_VALID (glob_wait_time)
-      && hls_test_get_position (test) < glob_wait_time)
-    return TRUE;
-
-  if (glob_is_seekable) {
-    glob_wait_time = hls_test_get_wait_time (test);
-    glob_timer_id = g_timeout_add (250, (GSourceFunc) & wait_and_do_seek, test);
-  }
-
-  return FALSE;
+  if (glob_is_seekable)
+    play_then (ptest, do_seek);
 }
 
 static gboolean
@@ -307,9 +836,7 @@ probe (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
         glob_seek_nb++;
         if (glob_is_seekable && glob_seek_nb < G_N_ELEMENTS (seek_targets)) {
           /* Program next seek */
-          glob_wait_time = hls_test_get_wait_time (INSANITY_TEST (ptest));
-          glob_timer_id = g_timeout_add (250, (GSourceFunc) & wait_and_end_step,
-              INSANITY_TEST (ptest));
+          play_then (INSANITY_GST_PIPELINE_TEST (ptest), end_step);
         } else {
           /* Done with the test */
           insanity_test_done (test);
@@ -505,10 +1032,7 @@ hls_test_bus_message (InsanityGstPipelineTest * ptest, GstMessage * msg)
           insanity_test_validate_checklist_item (INSANITY_TEST (ptest),
               validate_checklist_item, TRUE, NULL);
           /* let it run a couple seconds */
-          glob_wait_time = hls_test_get_wait_time (INSANITY_TEST (ptest));
-          glob_timer_id =
-              g_timeout_add (250, (GSourceFunc) & wait_and_end_step,
-              INSANITY_TEST (ptest));
+          play_then (ptest, end_step);
         }
       }
       break;
@@ -529,6 +1053,9 @@ hls_test_setup (InsanityTest * test)
   char *ssl_key_file = NULL;
   GValue v = { 0 };
   gboolean started;
+  gint chunks_size, max_bandwidth, first_byte_delay;
+  gint live_window, live_speed, live_target_duration;
+  gchar *bandwidth_profile = NULL, *fault_script = NULL;
 
   if (insanity_test_get_argument (test, "ssl-cert-file", &v)) {
     ssl_cert_file = g_value_dup_string (&v);
@@ -541,6 +1068,58 @@ hls_test_setup (InsanityTest * test)
 
   glob_server = insanity_http_server_new (test);
 
+  insanity_test_get_int_argument (test, "chunks-size", &chunks_size);
+  if (chunks_size > 0)
+    g_object_set (glob_server, "chunks-size", (gulong) chunks_size, NULL);
+
+  insanity_test_get_int_argument (test, "max-bandwidth", &max_bandwidth);
+  if (max_bandwidth > 0)
+    g_object_set (glob_server, "max-bandwidth", (guint64) max_bandwidth, NULL);
+
+  insanity_test_get_int_argument (test, "first-byte-delay", &first_byte_delay);
+  if (first_byte_delay > 0)
+    g_object_set (glob_server, "first-byte-delay", (guint) first_byte_delay,
+        NULL);
+
+  if (insanity_test_get_string_argument (test, "bandwidth-profile",
+          &bandwidth_profile)) {
+    if (bandwidth_profile && *bandwidth_profile)
+      g_object_set (glob_server, "bandwidth-profile", bandwidth_profile, NULL);
+    g_free (bandwidth_profile);
+  }
+
+  if (insanity_test_get_string_argument (test, "fault-script", &fault_script)) {
+    if (fault_script && *fault_script)
+      g_object_set (glob_server, "fault-script", fault_script, NULL);
+    g_free (fault_script);
+  }
+  g_signal_connect (glob_server, "fault-injected",
+      G_CALLBACK (fault_injected_cb), test);
+
+  /* Set before the bandwidth profile starts with the server */
+  glob_abr_rate = MAX (max_bandwidth, 0);
+  g_signal_connect (glob_server, "request-started",
+      G_CALLBACK (request_started_cb), test);
+  g_signal_connect (glob_server, "bandwidth-changed",
+      G_CALLBACK (bandwidth_changed_cb), test);
+  insanity_test_get_int_argument (test, "abr-play-time", &glob_abr_play_time);
+
+  insanity_test_get_int_argument (test, "live-window", &live_window);
+  insanity_test_get_int_argument (test, "live-speed", &live_speed);
+  insanity_test_get_int_argument (test, "live-target-duration",
+      &live_target_duration);
+  insanity_test_get_int_argument (test, "live-play-time",
+      &glob_live_play_time);
+  glob_live_window = MAX (live_window, 0);
+  if (glob_live_window > 0) {
+    g_object_set (glob_server, "live-window", glob_live_window,
+        "live-target-duration", (guint) MAX (live_target_duration, 0), NULL);
+    if (live_speed > 0)
+      g_object_set (glob_server, "live-speed", live_speed / 100.0, NULL);
+    g_signal_connect (glob_server, "live-segment-requested",
+        G_CALLBACK (live_segment_requested_cb), test);
+  }
+
   started = insanity_http_server_start (glob_server,
       ssl_cert_file, ssl_key_file);
 
@@ -598,12 +1177,17 @@ hls_test_start (InsanityTest * test)
   ssl_port = insanity_http_server_get_ssl_port (glob_server);
   ssl_server = insanity_http_server_get_soup_ssl_server (glob_server);
   playlist = g_path_get_basename (source_folder);
+  hlsuri = setup_variants (test, folder_uri, playlist);
+  g_free (playlist);
+  playlist = hlsuri;
+  g_free (folder_uri);
   if (ssl_server) {
     hlsuri = g_strdup_printf ("http://127.0.0.1:%u/%s", ssl_port, playlist);
   } else {
     hlsuri = g_strdup_printf ("http://127.0.0.1:%u/%s", port, playlist);
   }
   g_free (source_folder);
+  g_free (playlist);
   g_object_set (glob_pipeline, "uri", hlsuri, NULL);
   g_free (hlsuri);
 
@@ -614,32 +1198,42 @@ hls_test_start (InsanityTest * test)
   return TRUE;
 }
 
-static gboolean
-wait_and_start (gpointer data)
+static void
+query_duration (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
 {
-  InsanityGstPipelineTest *ptest = data;
+  glob_wait_id = 0;
 
-  /* Try getting duration */
-  if (!GST_CLOCK_TIME_IS_VALID (glob_wait_time)) {
-    insanity_gst_pipeline_test_query_duration (ptest, GST_FORMAT_TIME, NULL);
-  }
-
-  /* If we have it, start; if not, we'll be called again */
-  if (GST_CLOCK_TIME_IS_VALID (glob_wait_time) && glob_is_seekable) {
-    glob_wait_time = hls_test_get_wait_time (INSANITY_TEST (ptest));
-    glob_timer_id =
-        g_timeout_add (250, (GSourceFunc) & wait_and_do_seek, ptest);
-    return FALSE;
-  }
-  return TRUE;
+  /* We start from the duration callback once it is known, otherwise
+   * from the duration timeout */
+  insanity_gst_pipeline_test_query_duration (ptest, GST_FORMAT_TIME, NULL);
 }
 
 static void
 hls_test_test (InsanityGstPipelineTest * ptest)
 {
+  glob_play_start = g_get_monotonic_time ();
+  g_object_get (glob_server, "bytes-sent", &glob_bytes_start, NULL);
+
+  /* No duration nor seeking in a live stream, it is played for a while */
+  if (glob_live_window > 0) {
+    glob_live_timer_id = g_timeout_add (LIVE_SAMPLE_INTERVAL,
+        (GSourceFunc) live_sample, ptest);
+    glob_play_end_id = g_timeout_add_seconds (MAX (glob_live_play_time, 1),
+        (GSourceFunc) play_done, ptest);
+    return;
+  }
+
+  /* Same when watching the adaptive bitrate follow the bandwidth */
+  if (glob_abr_play_time > 0) {
+    glob_play_end_id = g_timeout_add_seconds (glob_abr_play_time,
+        (GSourceFunc) play_done, ptest);
+    return;
+  }
+
   glob_duration_timeout =
       g_timeout_add (5000, (GSourceFunc) & duration_timeout, ptest);
-  glob_timer_id = g_timeout_add (250, (GSourceFunc) & wait_and_start, ptest);
+  glob_wait_id = insanity_gst_pipeline_test_wait_for_state (ptest,
+      GST_STATE_PLAYING, 0, query_duration, NULL);
 }
 
 static void
@@ -664,9 +1258,9 @@ hls_test_duration (InsanityGstPipelineTest * ptest, GstFormat fmt,
 
   if (start && glob_is_seekable) {
     /* start now if we were waiting for the duration before doing so */
-    glob_wait_time = hls_test_get_wait_time (INSANITY_TEST (ptest));
-    glob_timer_id =
-        g_timeout_add (250, (GSourceFunc) & wait_and_do_seek, ptest);
+    if (glob_wait_id)
+      insanity_gst_pipeline_test_cancel_wait (ptest, glob_wait_id);
+    play_then (ptest, do_seek);
   }
 }
 
@@ -676,9 +1270,10 @@ hls_test_stop (InsanityTest * test)
   gint i;
   gboolean segments = TRUE, buffers = TRUE;
 
-  if (glob_timer_id) {
-    g_source_remove (glob_timer_id);
-    glob_timer_id = 0;
+  if (glob_wait_id) {
+    insanity_gst_pipeline_test_cancel_wait (INSANITY_GST_PIPELINE_TEST (test),
+        glob_wait_id);
+    glob_wait_id = 0;
   }
 
   if (glob_duration_timeout) {
@@ -686,6 +1281,16 @@ hls_test_stop (InsanityTest * test)
     glob_duration_timeout = 0;
   }
 
+  if (glob_live_timer_id) {
+    g_source_remove (glob_live_timer_id);
+    glob_live_timer_id = 0;
+  }
+
+  if (glob_play_end_id) {
+    g_source_remove (glob_play_end_id);
+    glob_play_end_id = 0;
+  }
+
   if (glob_is_seekable) {
     for (i = 0; i < G_N_ELEMENTS (seek_targets); i++) {
       if (seek_targets[i].seeked == FALSE) {
@@ -723,6 +1328,11 @@ hls_test_stop (InsanityTest * test)
   insanity_test_validate_checklist_item (test, "play-in-time",
       glob_play_in_time, NULL);
 
+  live_report (test);
+  abr_report (test);
+  fault_report (test);
+  access_log_report (test);
+
   return TRUE;
 }
 
@@ -750,11 +1360,89 @@ main (int argc, char **argv)
       "Certificate file for SSL server", ssl_cert_file, TRUE, NULL);
   insanity_test_add_string_argument (test, "ssl-key-file",
       "Key file for SSL server", NULL, TRUE, ssl_key_file);
+  insanity_test_add_int_argument (test, "chunks-size",
+      "Size of the chunks the server writes, in bytes", NULL, TRUE, 4096);
+  insanity_test_add_int_argument (test, "max-bandwidth",
+      "Bandwidth the server is limited to, in bytes per second "
+      "(0 for unlimited)", NULL, TRUE, 0);
+  insanity_test_add_int_argument (test, "first-byte-delay",
+      "Time the server waits before answering, in milliseconds", NULL, TRUE,
+      0);
+  insanity_test_add_string_argument (test, "bandwidth-profile",
+      "File describing how the server bandwidth changes over time",
+      "One \"<seconds> <bytes per second>\" line per change", TRUE, NULL);
+  insanity_test_add_string_argument (test, "fault-script",
+      "Faults the server injects into the next requests",
+      "Faults separated by ';', each one of \"stall <offset> <ms>\", "
+      "\"close <offset>\", \"error <count>\" or \"truncate <length>\", "
+      "optionally followed by a pattern of the paths it applies to",
+      TRUE, NULL);
+  insanity_test_add_string_argument (test, "access-log",
+      "File to write the requests the server answered to, as CSV", NULL,
+      TRUE, NULL);
+  insanity_test_add_int_argument (test, "live-window",
+      "Number of segments in the playlists when serving the stream as a live "
+      "one (0 to serve it as is)", "The original segments are looped over "
+      "in a window sliding in real time", TRUE, 0);
+  insanity_test_add_int_argument (test, "live-speed",
+      "How fast the live stream advances, in percent of real time", NULL,
+      TRUE, 100);
+  insanity_test_add_int_argument (test, "live-target-duration",
+      "Target duration of the live playlists, in seconds (0 to keep the "
+      "original one)", NULL, TRUE, 0);
+  insanity_test_add_int_argument (test, "live-play-time",
+      "Time to play the live stream for, in seconds", NULL, TRUE, 30);
+  insanity_test_add_string_argument (test, "variants",
+      "Variant playlists to generate a master playlist over",
+      "Comma separated \"<playlist>:<bits per second>\" items, the "
+      "playlists being relative to the folder of the uri", TRUE, NULL);
+  insanity_test_add_int_argument (test, "abr-play-time",
+      "Time to play for instead of seeking, in seconds, to watch the "
+      "variant switches (0 to seek)", NULL, TRUE, 0);
+  insanity_test_add_extra_info (test, "abr-switches",
+      "Number of times playback switched to another variant");
+  insanity_test_add_extra_info (test, "abr-down-reaction-time",
+      "Longest time between a bandwidth drop and the switch to a lower "
+      "variant (in nanoseconds)");
+  insanity_test_add_extra_info (test, "abr-up-reaction-time",
+      "Longest time between a bandwidth rise and the switch to a higher "
+      "variant (in nanoseconds)");
+  insanity_test_add_extra_info (test, "delivered-bitrate",
+      "Average bitrate the server delivered while playing (in bits per "
+      "second)");
+  insanity_test_add_extra_info (test, "live-latency-mean",
+      "Mean distance of the playback behind the newest live segment "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "live-latency-max",
+      "Longest distance of the playback behind the newest live segment "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "live-catch-up-time",
+      "Longest time taken to get back near the live edge after a fault "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "http-requests",
+      "Number of requests the server answered");
+  insanity_test_add_extra_info (test, "http-reused-connections",
+      "Number of requests made on an already used connection");
+  insanity_test_add_extra_info (test, "http-time-to-first-byte-mean",
+      "Mean time between a request and its answer (in nanoseconds)");
+  insanity_test_add_extra_info (test, "http-transfer-time-mean",
+      "Mean time taken to answer a request entirely (in nanoseconds)");
+  insanity_test_add_extra_info (test, "faults-injected",
+      "Number of faults the server injected");
+  insanity_test_add_extra_info (test, "fault-recovery-time",
+      "Longest time between a fault and the next buffer at the sinks "
+      "(in nanoseconds)");
   insanity_test_add_checklist_item (test, "uri-is-file",
       "The URI is a file URI", NULL, FALSE);
 
   insanity_test_add_checklist_item (test, "seek", "A seek succeeded", NULL,
       FALSE);
+  insanity_test_add_checklist_item (test, "playback-continues-after-faults",
+      "Buffers reached the sinks after the faults injected by the server",
+      NULL, FALSE);
+  insanity_test_add_checklist_item (test, "live-caught-up",
+      "Playback got back near the live edge after the faults injected by "
+      "the server", NULL, FALSE);
   insanity_test_add_checklist_item (test, "duration-known",
       "Stream duration could be determined", NULL, FALSE);
   insanity_test_add_checklist_item (test, "protocol-is-hls",
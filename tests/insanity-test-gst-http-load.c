@@ -0,0 +1,557 @@
+/* Insanity QA system
+
+ Copyright (c) 2012, Collabora Ltd
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Lesser General Public
+ License as published by the Free Software Foundation; either
+ version 2.1 of the License, or (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Lesser General Public License for more details.
+
+ You should have received a copy of the GNU Lesser General Public
+ License along with this program; if not, write to the
+ Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*/
+
+/* Plays the same file from many clients at once in a single process, all
+ * of them fetching it from one InsanityHttpServer, and reports how the
+ * startup of the clients degrades as their number grows. */
+
+#include <string.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <insanity-gst/insanity-gst.h>
+#include "insanity-http-server.h"
+
+typedef struct
+{
+  guint id;
+  GstElement *pipeline;
+  guint bus_watch;
+  guint timer_id;
+
+  gint64 start_time;
+  gint64 first_buffer_time;     /* Protected by the clients lock */
+  gint64 playing_time;
+
+  gboolean buffering;
+  guint rebuffers;
+  gboolean failed;
+  gboolean done;
+} LoadClient;
+
+static InsanityHttpServer *global_server = NULL;
+static gchar *global_folder = NULL;
+
+/* Buffers come from the streaming threads */
+G_LOCK_DEFINE_STATIC (clients);
+static LoadClient *global_clients = NULL;
+static guint global_n_clients = 0;
+static guint global_n_done = 0;
+static gboolean global_use_playbin = TRUE;
+static gint global_playback_time = 5;
+static gint64 global_start_time = 0;
+static InsanityTest *global_test = NULL;
+
+/* Runs the timers and bus watches of the clients on the default context */
+static GMainLoop *global_ml = NULL;
+
+static gint
+compare_times (gconstpointer a, gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a, tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Sorts @values and reports their 50th, 95th and 99th percentiles */
+static void
+set_percentile_info (InsanityTest * test, const gchar * prefix,
+    GArray * values, gboolean is_time)
+{
+  static const guint percentiles[] = { 50, 95, 99 };
+  GValue v = { 0 };
+  gchar *label;
+  gint64 value;
+  guint i, index;
+
+  if (values->len == 0)
+    return;
+
+  g_array_sort (values, compare_times);
+  for (i = 0; i < G_N_ELEMENTS (percentiles); i++) {
+    index = MIN (values->len - 1, (values->len * percentiles[i]) / 100);
+    value = g_array_index (values, gint64, index);
+
+    label = g_strdup_printf ("%s-p%u", prefix, percentiles[i]);
+    g_value_init (&v, G_TYPE_UINT64);
+    g_value_set_uint64 (&v, is_time ? value * GST_USECOND : value);
+    insanity_test_set_extra_info (test, label, &v);
+    g_value_unset (&v);
+    g_free (label);
+  }
+}
+
+static void
+load_report (InsanityTest * test)
+{
+  GArray *first_buffer, *playing, *rebuffers;
+  LoadClient *client;
+  guint i, n_failed = 0;
+  guint64 bytes;
+  gint64 value, elapsed;
+  gdouble throughput = 0;
+  GValue v = { 0 };
+  gchar *msg = NULL;
+
+  first_buffer = g_array_new (FALSE, FALSE, sizeof (gint64));
+  playing = g_array_new (FALSE, FALSE, sizeof (gint64));
+  rebuffers = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  G_LOCK (clients);
+  for (i = 0; i < global_n_clients; i++) {
+    client = &global_clients[i];
+    if (client->failed || client->start_time == 0) {
+      n_failed++;
+      continue;
+    }
+
+    if (client->first_buffer_time) {
+      value = client->first_buffer_time - client->start_time;
+      g_array_append_val (first_buffer, value);
+    }
+    if (client->playing_time) {
+      value = client->playing_time - client->start_time;
+      g_array_append_val (playing, value);
+    }
+    value = client->rebuffers;
+    g_array_append_val (rebuffers, value);
+  }
+  G_UNLOCK (clients);
+
+  set_percentile_info (test, "time-to-first-buffer", first_buffer, TRUE);
+  set_percentile_info (test, "time-to-playing", playing, TRUE);
+  set_percentile_info (test, "rebuffers", rebuffers, FALSE);
+
+  g_object_get (global_server, "bytes-sent", &bytes, NULL);
+  elapsed = g_get_monotonic_time () - global_start_time;
+  if (elapsed > 0)
+    throughput = bytes * (gdouble) G_USEC_PER_SEC / elapsed;
+
+  g_value_init (&v, G_TYPE_DOUBLE);
+  g_value_set_double (&v, throughput);
+  insanity_test_set_extra_info (test, "server-throughput", &v);
+  g_value_unset (&v);
+
+  g_value_init (&v, G_TYPE_UINT);
+  g_value_set_uint (&v, n_failed);
+  insanity_test_set_extra_info (test, "failed-clients", &v);
+  g_value_unset (&v);
+
+  insanity_test_printf (test, "%u clients, %u failed, server sent %"
+      G_GUINT64_FORMAT " bytes at %.2f MB/s\n", global_n_clients, n_failed,
+      bytes, throughput / (1024 * 1024));
+
+  if (n_failed)
+    msg = g_strdup_printf ("%u of %u clients failed", n_failed,
+        global_n_clients);
+  insanity_test_validate_checklist_item (test, "all-clients-played",
+      n_failed == 0, msg);
+  g_free (msg);
+
+  g_array_free (first_buffer, TRUE);
+  g_array_free (playing, TRUE);
+  g_array_free (rebuffers, TRUE);
+}
+
+static void
+client_stop (LoadClient * client)
+{
+  if (client->timer_id) {
+    g_source_remove (client->timer_id);
+    client->timer_id = 0;
+  }
+
+  if (client->bus_watch) {
+    g_source_remove (client->bus_watch);
+    client->bus_watch = 0;
+  }
+
+  if (client->pipeline) {
+    gst_element_set_state (client->pipeline, GST_STATE_NULL);
+    gst_object_unref (client->pipeline);
+    client->pipeline = NULL;
+  }
+}
+
+static void
+client_done (LoadClient * client, gboolean failed)
+{
+  if (client->done)
+    return;
+
+  client->done = TRUE;
+  client->failed = failed;
+  client_stop (client);
+
+  if (++global_n_done == global_n_clients) {
+    load_report (global_test);
+    g_main_loop_quit (global_ml);
+    insanity_test_done (global_test);
+  }
+}
+
+static gboolean
+client_played_enough (gpointer data)
+{
+  LoadClient *client = data;
+
+  client->timer_id = 0;
+  client_done (client, FALSE);
+
+  return FALSE;
+}
+
+static GstPadProbeReturn
+client_buffer_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  LoadClient *client = data;
+
+  G_LOCK (clients);
+  if (client->first_buffer_time == 0)
+    client->first_buffer_time = g_get_monotonic_time ();
+  G_UNLOCK (clients);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+client_watch_sink (LoadClient * client, GstElement * sink)
+{
+  GstPad *pad;
+
+  if (sink == NULL)
+    return;
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, client_buffer_probe,
+      client, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+}
+
+static gboolean
+client_bus_message (GstBus * bus, GstMessage * msg, gpointer data)
+{
+  LoadClient *client = data;
+  GstState oldstate, newstate, pending;
+  GError *error = NULL;
+  gint percent;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+      gst_message_parse_error (msg, &error, NULL);
+      insanity_test_printf (global_test, "Client %u failed: %s\n",
+          client->id, error->message);
+      g_error_free (error);
+      client_done (client, TRUE);
+      return FALSE;
+    case GST_MESSAGE_EOS:
+      client_done (client, FALSE);
+      return FALSE;
+    case GST_MESSAGE_BUFFERING:
+      gst_message_parse_buffering (msg, &percent);
+
+      /* Only buffering once playing counts as a rebuffer */
+      if (percent < 100 && !client->buffering) {
+        client->buffering = TRUE;
+        if (client->playing_time) {
+          client->rebuffers++;
+          gst_element_set_state (client->pipeline, GST_STATE_PAUSED);
+        }
+      } else if (percent == 100 && client->buffering) {
+        client->buffering = FALSE;
+        gst_element_set_state (client->pipeline, GST_STATE_PLAYING);
+      }
+      break;
+    case GST_MESSAGE_STATE_CHANGED:
+      if (GST_MESSAGE_SRC (msg) != GST_OBJECT (client->pipeline))
+        break;
+
+      gst_message_parse_state_changed (msg, &oldstate, &newstate, &pending);
+      if (newstate == GST_STATE_PLAYING && client->playing_time == 0) {
+        client->playing_time = g_get_monotonic_time ();
+        client->timer_id = g_timeout_add_seconds (global_playback_time,
+            client_played_enough, client);
+      }
+      break;
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+client_start (gpointer data)
+{
+  LoadClient *client = data;
+  GstElement *asink = NULL, *vsink = NULL;
+  GError *error = NULL;
+  GstBus *bus;
+  gchar *uri, *launch_line;
+
+  /* Spread the clients over the server workers */
+  uri = g_strdup_printf ("http://127.0.0.1:%u/",
+      insanity_http_server_get_next_port (global_server));
+  if (global_use_playbin)
+    launch_line = g_strdup_printf ("playbin uri=%s "
+        "audio-sink=\"fakesink name=asink\" "
+        "video-sink=\"fakesink name=vsink\"", uri);
+  else
+    launch_line = g_strdup_printf ("souphttpsrc location=%s ! decodebin ! "
+        "fakesink name=vsink", uri);
+  g_free (uri);
+
+  client->timer_id = 0;
+  client->pipeline = gst_parse_launch (launch_line, &error);
+  g_free (launch_line);
+  if (client->pipeline == NULL || error) {
+    insanity_test_printf (global_test, "Client %u could not be created: %s\n",
+        client->id, error ? error->message : "unknown error");
+    if (error)
+      g_error_free (error);
+    client_done (client, TRUE);
+    return FALSE;
+  }
+
+  if (global_use_playbin)
+    g_object_get (client->pipeline, "audio-sink", &asink, "video-sink",
+        &vsink, NULL);
+  else
+    vsink = gst_bin_get_by_name (GST_BIN (client->pipeline), "vsink");
+  client_watch_sink (client, asink);
+  client_watch_sink (client, vsink);
+
+  bus = gst_element_get_bus (client->pipeline);
+  client->bus_watch = gst_bus_add_watch (bus, client_bus_message, client);
+  gst_object_unref (bus);
+
+  client->start_time = g_get_monotonic_time ();
+  if (gst_element_set_state (client->pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE)
+    client_done (client, TRUE);
+
+  return FALSE;
+}
+
+static gboolean
+load_test_setup (InsanityTest * test)
+{
+  gint workers;
+
+  global_server = insanity_http_server_new (test);
+
+  insanity_test_get_int_argument (test, "server-workers", &workers);
+  if (workers > 1)
+    g_object_set (global_server, "workers", (guint) workers, NULL);
+
+  return insanity_http_server_start (global_server, NULL, NULL);
+}
+
+static void
+load_test_teardown (InsanityTest * test)
+{
+  if (global_server != NULL) {
+    g_object_unref (global_server);
+    global_server = NULL;
+  }
+}
+
+static gboolean
+load_test_start (InsanityTest * test)
+{
+  gchar *uri = NULL;
+  const gchar *protocol;
+  gboolean ret = FALSE;
+
+  insanity_test_get_string_argument (test, "uri", &uri);
+  if (uri == NULL || !gst_uri_is_valid (uri)) {
+    insanity_test_validate_checklist_item (test, "uri-is-file", FALSE,
+        "No valid URI to test on");
+    goto done;
+  }
+
+  protocol = gst_uri_get_protocol (uri);
+  if (!protocol || g_ascii_strcasecmp (protocol, "file")) {
+    insanity_test_validate_checklist_item (test, "uri-is-file", FALSE, NULL);
+    goto done;
+  }
+  insanity_test_validate_checklist_item (test, "uri-is-file", TRUE, NULL);
+
+  /* The server answers requests for "/" with the file itself */
+  g_free (global_folder);
+  global_folder = gst_uri_get_location (uri);
+  insanity_http_server_set_source_folder (global_server, global_folder);
+
+  ret = TRUE;
+
+done:
+  g_free (uri);
+
+  return ret;
+}
+
+static void
+load_test_test (InsanityTest * test)
+{
+  gint clients, stagger;
+  gchar *client_type = NULL;
+  guint i;
+
+  global_test = test;
+  insanity_test_get_int_argument (test, "clients", &clients);
+  insanity_test_get_int_argument (test, "stagger", &stagger);
+  insanity_test_get_int_argument (test, "playback-time",
+      &global_playback_time);
+  insanity_test_get_string_argument (test, "client", &client_type);
+  global_use_playbin = g_strcmp0 (client_type, "decodebin") != 0;
+  g_free (client_type);
+
+  global_n_clients = MAX (clients, 1);
+  global_n_done = 0;
+  global_clients = g_new0 (LoadClient, global_n_clients);
+  global_start_time = g_get_monotonic_time ();
+
+  g_assert (global_ml == NULL);
+  global_ml = g_main_loop_new (NULL, FALSE);
+
+  /* All at once, or one every stagger milliseconds */
+  for (i = 0; i < global_n_clients; i++) {
+    global_clients[i].id = i;
+    global_clients[i].timer_id = g_timeout_add (i * MAX (stagger, 0),
+        client_start, &global_clients[i]);
+  }
+
+  g_main_loop_run (global_ml);
+}
+
+static gboolean
+load_test_stop (InsanityTest * test)
+{
+  guint i;
+
+  if (global_ml != NULL) {
+    g_main_loop_quit (global_ml);
+    while (g_main_loop_is_running (global_ml))
+      g_usleep (20000);
+    g_main_loop_unref (global_ml);
+    global_ml = NULL;
+  }
+
+  if (global_clients == NULL)
+    return TRUE;
+
+  /* Report what we got if the test was interrupted */
+  if (global_n_done < global_n_clients)
+    load_report (test);
+
+  for (i = 0; i < global_n_clients; i++)
+    client_stop (&global_clients[i]);
+
+  G_LOCK (clients);
+  g_free (global_clients);
+  global_clients = NULL;
+  global_n_clients = 0;
+  G_UNLOCK (clients);
+
+  g_free (global_folder);
+  global_folder = NULL;
+
+  return TRUE;
+}
+
+int
+main (int argc, char **argv)
+{
+  InsanityTest *test;
+  gboolean ret;
+
+  g_type_init ();
+
+  test = INSANITY_TEST (insanity_gst_test_new ("http-load-test",
+          "Tests playback startup with many HTTP clients",
+          "Plays the same file from many clients fetching it from one local "
+          "HTTP server, and reports startup latency percentiles"));
+
+  insanity_test_add_string_argument (test, "uri",
+      "The uri to test on (file only)", NULL, FALSE, "");
+  insanity_test_add_int_argument (test, "clients", "Number of clients",
+      "Number of clients playing the file at the same time", TRUE, 8);
+  insanity_test_add_int_argument (test, "stagger",
+      "Time between client starts",
+      "Time in milliseconds between the start of two clients, 0 to start "
+      "them all at once", TRUE, 0);
+  insanity_test_add_int_argument (test, "playback-time",
+      "Playback time per client",
+      "Time in seconds each client plays once it reached PLAYING", TRUE, 5);
+  insanity_test_add_string_argument (test, "client", "Client pipeline",
+      "\"playbin\", or \"decodebin\" for souphttpsrc ! decodebin ! fakesink",
+      TRUE, "playbin");
+  insanity_test_add_int_argument (test, "server-workers",
+      "Server worker threads",
+      "Number of threads the HTTP server answers the clients from", TRUE, 1);
+
+  insanity_test_add_checklist_item (test, "uri-is-file",
+      "The URI is a file URI", NULL, FALSE);
+  insanity_test_add_checklist_item (test, "all-clients-played",
+      "All the clients played without error", NULL, FALSE);
+
+  insanity_test_add_extra_info (test, "time-to-first-buffer-p50",
+      "Median time between the start of a client and its first buffer "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "time-to-first-buffer-p95",
+      "95th percentile of the time between the start of a client and its "
+      "first buffer (in nanoseconds)");
+  insanity_test_add_extra_info (test, "time-to-first-buffer-p99",
+      "99th percentile of the time between the start of a client and its "
+      "first buffer (in nanoseconds)");
+  insanity_test_add_extra_info (test, "time-to-playing-p50",
+      "Median time a client takes to reach PLAYING (in nanoseconds)");
+  insanity_test_add_extra_info (test, "time-to-playing-p95",
+      "95th percentile of the time a client takes to reach PLAYING "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "time-to-playing-p99",
+      "99th percentile of the time a client takes to reach PLAYING "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "rebuffers-p50",
+      "Median number of times a client had to buffer again while playing");
+  insanity_test_add_extra_info (test, "rebuffers-p95",
+      "95th percentile of the number of times a client had to buffer again "
+      "while playing");
+  insanity_test_add_extra_info (test, "rebuffers-p99",
+      "99th percentile of the number of times a client had to buffer again "
+      "while playing");
+  insanity_test_add_extra_info (test, "server-throughput",
+      "Bytes per second the server sent to all the clients");
+  insanity_test_add_extra_info (test, "failed-clients",
+      "Number of clients that failed");
+
+  g_signal_connect_after (test, "setup", G_CALLBACK (&load_test_setup), 0);
+  g_signal_connect_after (test, "start", G_CALLBACK (&load_test_start), 0);
+  g_signal_connect (test, "test", G_CALLBACK (&load_test_test), 0);
+  g_signal_connect_after (test, "stop", G_CALLBACK (&load_test_stop), 0);
+  g_signal_connect_after (test, "teardown", G_CALLBACK (&load_test_teardown),
+      0);
+
+  ret = insanity_test_run (test, &argc, &argv);
+
+  g_object_unref (test);
+
+  return ret ? 0 : 1;
+}
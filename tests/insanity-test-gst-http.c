@@ -28,23 +28,46 @@
 #include <stdio.h>
 #include <string.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <glib-object.h>
+#ifdef G_OS_UNIX
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
 #include <insanity-gst/insanity-gst.h>
 #include "insanity-http-server.h"
 
 /* timeout for gst_element_get_state() after a seek */
 #define SEEK_TIMEOUT (40 * GST_MSECOND)
 
+/* how much longer than the playback time to wait for it, in seconds */
+#define PLAYBACK_TIMEOUT_MARGIN 10
+
 static GstElement *global_pipeline = NULL;
 static const char *global_validate_on_playing = NULL;
 static gboolean global_done_http = FALSE;
 static InsanityHttpServer *global_server = NULL;
 static GstClockTime global_duration = GST_CLOCK_TIME_NONE;
 static int global_seek_target = -1;
-static GstClockTime global_wait_time = GST_CLOCK_TIME_NONE;
 static GstClockTime global_playback_time = GST_CLOCK_TIME_NONE;
 static guint global_duration_timeout = 0;
-static guint global_timer_id = 0;
+static guint global_wait_id = 0;
+
+/* Benchmark mode, the file is downloaded as fast as possible, over HTTP
+ * then over HTTPS with keys generated at setup if none were given */
+static gboolean global_benchmark = FALSE;
+static gboolean global_benchmark_https = FALSE;
+static gint64 global_benchmark_start = 0;
+static guint64 global_benchmark_bytes_start = 0;
+static guint64 global_benchmark_cpu_start = 0;
+static guint64 global_benchmark_server_cpu_start = 0;
+static guint global_benchmark_requests_start = 0;
+static GstClockTime global_benchmark_connection_time = GST_CLOCK_TIME_NONE;
+static gchar *global_benchmark_keys_dir = NULL;
+
+/* Set from the streaming thread */
+G_LOCK_DEFINE_STATIC (first_buffer);
+static gint64 global_benchmark_first_buffer = 0;
 
 static gchar *http_uri = NULL;
 static gchar *https_uri = NULL;
@@ -55,12 +78,228 @@ source_setup_cb (GstElement * playbin, GstElement * source, gpointer user_data)
   g_object_set (source, "user-id", good_user, "user-pw", good_pw, NULL);
 }
 
+/* Fault injection: the server reports faults from its own thread and the
+ * buffers arrive from the streaming threads */
+G_LOCK_DEFINE_STATIC (faults);
+static guint global_faults = 0;
+static gint64 global_fault_time = 0;  /* Of the oldest unrecovered fault */
+static gint64 global_fault_recovery_max = 0;
+
+static void
+fault_injected_cb (InsanityHttpServer * srv, const gchar * path,
+    const gchar * fault, InsanityTest * test)
+{
+  insanity_test_printf (test, "Fault \"%s\" injected into %s\n", fault, path);
+
+  G_LOCK (faults);
+  global_faults++;
+  if (global_fault_time == 0)
+    global_fault_time = g_get_monotonic_time ();
+  G_UNLOCK (faults);
+}
+
+static GstPadProbeReturn
+fault_recovery_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  G_LOCK (faults);
+  if (global_fault_time) {
+    global_fault_recovery_max = MAX (global_fault_recovery_max,
+        g_get_monotonic_time () - global_fault_time);
+    global_fault_time = 0;
+  }
+  G_UNLOCK (faults);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+watch_faults (GstElement * sink)
+{
+  GstPad *pad;
+
+  if (sink == NULL)
+    return;
+
+  pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, fault_recovery_probe,
+      NULL, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+}
+
+/* Sums the requests answered by the server up, and writes them all to the
+ * file given by the "access-log" argument if any */
+static void
+access_log_report (InsanityTest * test)
+{
+  gchar *filename = NULL;
+  GError *error = NULL;
+  GValue v = { 0 };
+
+  if (insanity_test_get_argument (test, "access-log", &v)) {
+    filename = g_value_dup_string (&v);
+    g_value_unset (&v);
+  }
+
+  if (global_server == NULL)
+    goto done;
+
+  insanity_http_server_report_access_log (global_server);
+
+  if (filename && *filename
+      && !insanity_http_server_write_access_log (global_server, filename,
+          &error)) {
+    insanity_test_printf (test, "Could not write access log: %s\n",
+        error->message);
+    g_error_free (error);
+  }
+
+done:
+  g_free (filename);
+}
+
+static void
+fault_report (InsanityTest * test)
+{
+  GValue v = { 0 };
+
+  G_LOCK (faults);
+  if (global_faults > 0) {
+    insanity_test_validate_checklist_item (test,
+        "playback-continues-after-faults", global_fault_time == 0,
+        global_fault_time ? "No buffer reached the sinks after the last fault"
+        : NULL);
+
+    g_value_init (&v, G_TYPE_UINT);
+    g_value_set_uint (&v, global_faults);
+    insanity_test_set_extra_info (test, "faults-injected", &v);
+    g_value_unset (&v);
+
+    g_value_init (&v, G_TYPE_UINT64);
+    g_value_set_uint64 (&v, global_fault_recovery_max * GST_USECOND);
+    insanity_test_set_extra_info (test, "fault-recovery-time", &v);
+    g_value_unset (&v);
+  }
+
+  global_faults = 0;
+  global_fault_time = 0;
+  global_fault_recovery_max = 0;
+  G_UNLOCK (faults);
+}
+
+static GstPadProbeReturn
+first_buffer_probe (GstPad * pad, GstPadProbeInfo * info, gpointer data)
+{
+  G_LOCK (first_buffer);
+  if (global_benchmark_first_buffer == 0)
+    global_benchmark_first_buffer = g_get_monotonic_time ();
+  G_UNLOCK (first_buffer);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* CPU time of the whole process, server threads included */
+static guint64
+process_cpu_time (void)
+{
+#ifdef G_OS_UNIX
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * GST_SECOND +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * GST_USECOND;
+#endif
+
+  return 0;
+}
+
+/* Generates a self signed certificate for the benchmark, so that HTTPS can
+ * be measured without the caller having to provide one */
+static gboolean
+generate_ssl_keys (InsanityTest * test, gchar ** cert_file,
+    gchar ** key_file)
+{
+  gchar *argv[] = { (gchar *) "openssl", (gchar *) "req", (gchar *) "-x509",
+    (gchar *) "-newkey", (gchar *) "rsa:2048", (gchar *) "-nodes",
+    (gchar *) "-days", (gchar *) "1", (gchar *) "-subj",
+    (gchar *) "/CN=127.0.0.1", (gchar *) "-keyout", NULL, (gchar *) "-out",
+    NULL, NULL
+  };
+  GError *error = NULL;
+  gint status;
+
+  global_benchmark_keys_dir = g_dir_make_tmp ("insanity-http-XXXXXX", &error);
+  if (global_benchmark_keys_dir == NULL)
+    goto error;
+
+  *key_file = g_build_filename (global_benchmark_keys_dir, "key.pem", NULL);
+  *cert_file = g_build_filename (global_benchmark_keys_dir, "cert.pem", NULL);
+  argv[11] = *key_file;
+  argv[13] = *cert_file;
+
+  if (!g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH |
+          G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
+          NULL, NULL, &status, &error))
+    goto error;
+
+#ifdef G_OS_UNIX
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0) {
+#else
+  if (status != 0) {
+#endif
+    insanity_test_printf (test, "openssl could not generate the keys\n");
+    goto failed;
+  }
+
+  return TRUE;
+
+error:
+  insanity_test_printf (test, "Could not generate the keys: %s\n",
+      error->message);
+  g_error_free (error);
+
+failed:
+  g_free (*key_file);
+  *key_file = NULL;
+  g_free (*cert_file);
+  *cert_file = NULL;
+
+  return FALSE;
+}
+
+static void
+remove_ssl_keys (void)
+{
+  gchar *filename;
+
+  if (global_benchmark_keys_dir == NULL)
+    return;
+
+  filename = g_build_filename (global_benchmark_keys_dir, "key.pem", NULL);
+  g_unlink (filename);
+  g_free (filename);
+  filename = g_build_filename (global_benchmark_keys_dir, "cert.pem", NULL);
+  g_unlink (filename);
+  g_free (filename);
+  g_rmdir (global_benchmark_keys_dir);
+
+  g_free (global_benchmark_keys_dir);
+  global_benchmark_keys_dir = NULL;
+}
+
 static GstPipeline *
 http_test_create_pipeline (InsanityGstPipelineTest * ptest, gpointer userdata)
 {
   GstElement *pipeline = NULL;
   const char *launch_line = "playbin audio-sink=fakesink video-sink=fakesink";
   GError *error = NULL;
+  GValue v = { 0 };
+
+  insanity_test_get_argument (INSANITY_TEST (ptest), "benchmark", &v);
+  global_benchmark = g_value_get_boolean (&v);
+  g_value_unset (&v);
+  if (global_benchmark)
+    launch_line = "souphttpsrc name=src ! fakesink name=sink sync=false";
 
   pipeline = gst_parse_launch (launch_line, &error);
   if (!pipeline) {
@@ -78,8 +317,23 @@ http_test_create_pipeline (InsanityGstPipelineTest * ptest, gpointer userdata)
     return NULL;
   }
 
-  g_signal_connect (pipeline, "source-setup", G_CALLBACK (source_setup_cb),
-      NULL);
+  if (global_benchmark) {
+    GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+    GstPad *pad = gst_element_get_static_pad (sink, "sink");
+
+    gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, first_buffer_probe,
+        NULL, NULL);
+    gst_object_unref (pad);
+    watch_faults (sink);
+  } else {
+    GstElement *asink, *vsink;
+
+    g_signal_connect (pipeline, "source-setup", G_CALLBACK (source_setup_cb),
+        NULL);
+    g_object_get (pipeline, "audio-sink", &asink, "video-sink", &vsink, NULL);
+    watch_faults (asink);
+    watch_faults (vsink);
+  }
 
   global_pipeline = pipeline;
 
@@ -100,32 +354,32 @@ http_test_get_position (InsanityTest * test)
   return pos;
 }
 
-static GstClockTime
-http_test_get_wait_time (InsanityTest * test)
+/* Lets the stream play for a while, then calls func */
+static void
+play_then (InsanityGstPipelineTest * ptest, InsanityGstWaitFunction func)
 {
-  gint64 pos = http_test_get_position (test);
-  if (GST_CLOCK_TIME_IS_VALID (pos)) {
-    pos += global_playback_time * GST_SECOND;
-  }
-  return pos;
+  global_wait_id = insanity_gst_pipeline_test_wait_for_playback (ptest, NULL,
+      global_playback_time * GST_SECOND,
+      (global_playback_time + PLAYBACK_TIMEOUT_MARGIN) * 1000, func, NULL);
 }
 
-static gboolean
-wait_and_do_seek (gpointer data)
+static void
+do_seek (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
 {
-  InsanityTest *test = data;
+  InsanityTest *test = INSANITY_TEST (ptest);
   GstEvent *event;
   gboolean res;
 
-  if (GST_CLOCK_TIME_IS_VALID (global_wait_time)
-      && http_test_get_position (test) < global_wait_time)
-    return TRUE;
+  global_wait_id = 0;
+
+  /* Not polled any more, but still expected to work */
+  http_test_get_position (test);
 
   /* If duration did not become known yet, we cannot test */
   if (!GST_CLOCK_TIME_IS_VALID (global_duration)) {
     insanity_test_validate_checklist_item (test, "duration-known", FALSE, NULL);
     insanity_test_done (test);
-    return FALSE;
+    return;
   }
 
   /* seek to the middle of the stream */
@@ -133,27 +387,23 @@ wait_and_do_seek (gpointer data)
       GST_SEEK_TYPE_SET, global_duration * global_seek_target / 100,
       GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
   global_validate_on_playing = "seek";
-  res = gst_element_send_event (global_pipeline, event);
+  res = insanity_gst_pipeline_test_send_seek (ptest, event);
   if (!res) {
     global_validate_on_playing = NULL;
     insanity_test_validate_checklist_item (test, "seek", FALSE,
         "Failed to send seek event");
-    return FALSE;
+    return;
   }
   gst_element_get_state (global_pipeline, NULL, NULL, SEEK_TIMEOUT);
-
-  return FALSE;
 }
 
-static gboolean
-wait_and_end_step (gpointer data)
+static void
+end_step (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
 {
-  InsanityTest *test = data;
+  InsanityTest *test = INSANITY_TEST (ptest);
   SoupServer *ssl_server;
 
-  if (GST_CLOCK_TIME_IS_VALID (global_wait_time)
-      && http_test_get_position (test) < global_wait_time)
-    return TRUE;
+  global_wait_id = 0;
 
   ssl_server = insanity_http_server_get_soup_ssl_server (global_server);
   /* If we have both a non SSL and a SSL server, test both */
@@ -167,17 +417,145 @@ wait_and_end_step (gpointer data)
     gst_element_set_state (global_pipeline, GST_STATE_PLAYING);
     gst_element_get_state (global_pipeline, NULL, NULL, GST_SECOND * 2);
 
-    global_wait_time = http_test_get_wait_time (test);
-    global_timer_id =
-        g_timeout_add (250, (GSourceFunc) & wait_and_do_seek, test);
+    play_then (ptest, do_seek);
+  }
+}
+
+/* Sets the location to download and starts measuring, before the pipeline
+ * is started */
+static void
+benchmark_begin (const gchar * location)
+{
+  GstElement *src = gst_bin_get_by_name (GST_BIN (global_pipeline), "src");
+  GArray *log;
+
+  g_object_set (src, "location", location, NULL);
+  /* Our certificate is self signed */
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (src), "ssl-strict"))
+    g_object_set (src, "ssl-strict", FALSE, NULL);
+  gst_object_unref (src);
+
+  log = insanity_http_server_get_access_log (global_server);
+  global_benchmark_requests_start = log->len;
+  g_array_free (log, TRUE);
+
+  g_object_get (global_server, "bytes-sent", &global_benchmark_bytes_start,
+      "cpu-time", &global_benchmark_server_cpu_start, NULL);
+  global_benchmark_cpu_start = process_cpu_time ();
+
+  G_LOCK (first_buffer);
+  global_benchmark_first_buffer = 0;
+  G_UNLOCK (first_buffer);
+
+  global_benchmark_start = g_get_monotonic_time ();
+}
+
+static void
+set_benchmark_info (InsanityTest * test, const gchar * prefix,
+    const gchar * name, guint64 value)
+{
+  gchar *label = g_strdup_printf ("%s-%s", prefix, name);
+  GValue v = { 0 };
+
+  g_value_init (&v, G_TYPE_UINT64);
+  g_value_set_uint64 (&v, value);
+  insanity_test_set_extra_info (test, label, &v);
+  g_value_unset (&v);
+  g_free (label);
+}
+
+/* Reports the download which just ended, the plain HTTP one under the
+ * "benchmark-" extra-info and the HTTPS one under "benchmark-https-" */
+static void
+benchmark_report (InsanityTest * test)
+{
+  const gchar *prefix = global_benchmark_https ? "benchmark-https" :
+      "benchmark";
+  InsanityHttpAccessLogEntry *entry;
+  GArray *log;
+  guint64 bytes, server_cpu, cpu;
+  gint64 elapsed = g_get_monotonic_time () - global_benchmark_start;
+  gint64 first_buffer;
+  GstClockTime connection_time = GST_CLOCK_TIME_NONE;
+  gdouble throughput = 0;
+  gchar *label;
+  GValue v = { 0 };
+  guint i;
+
+  g_object_get (global_server, "bytes-sent", &bytes, "cpu-time", &server_cpu,
+      NULL);
+  bytes -= global_benchmark_bytes_start;
+  server_cpu -= global_benchmark_server_cpu_start;
+  cpu = process_cpu_time () - global_benchmark_cpu_start;
+  if (elapsed > 0)
+    throughput = bytes * (gdouble) G_USEC_PER_SEC / elapsed;
+
+  G_LOCK (first_buffer);
+  first_buffer = global_benchmark_first_buffer;
+  G_UNLOCK (first_buffer);
+
+  /* The connection of the first request made by this download */
+  log = insanity_http_server_get_access_log (global_server);
+  for (i = global_benchmark_requests_start; i < log->len; i++) {
+    entry = &g_array_index (log, InsanityHttpAccessLogEntry, i);
+    if (GST_CLOCK_TIME_IS_VALID (entry->connection_time)) {
+      connection_time = entry->connection_time;
+      break;
+    }
+  }
+  g_array_free (log, TRUE);
+
+  insanity_test_printf (test, "Downloaded %" G_GUINT64_FORMAT " bytes over "
+      "%s in %" GST_TIME_FORMAT ", %.2f MB/s\n", bytes,
+      global_benchmark_https ? "HTTPS" : "HTTP",
+      GST_TIME_ARGS (elapsed * GST_USECOND), throughput / (1024 * 1024));
+
+  set_benchmark_info (test, prefix, "bytes", bytes);
+  set_benchmark_info (test, prefix, "time", elapsed * GST_USECOND);
+  if (first_buffer > global_benchmark_start)
+    set_benchmark_info (test, prefix, "first-buffer-time",
+        (first_buffer - global_benchmark_start) * GST_USECOND);
+  set_benchmark_info (test, prefix, "server-cpu-time", server_cpu);
+  set_benchmark_info (test, prefix, "client-cpu-time",
+      cpu > server_cpu ? cpu - server_cpu : 0);
+
+  label = g_strdup_printf ("%s-throughput", prefix);
+  g_value_init (&v, G_TYPE_DOUBLE);
+  g_value_set_double (&v, throughput);
+  insanity_test_set_extra_info (test, label, &v);
+  g_value_unset (&v);
+  g_free (label);
+
+  /* Both connections are set up the same way but for the TLS handshake */
+  if (!global_benchmark_https) {
+    global_benchmark_connection_time = connection_time;
+  } else if (GST_CLOCK_TIME_IS_VALID (connection_time)
+      && GST_CLOCK_TIME_IS_VALID (global_benchmark_connection_time)) {
+    set_benchmark_info (test, prefix, "handshake-time",
+        connection_time > global_benchmark_connection_time ?
+        connection_time - global_benchmark_connection_time : 0);
   }
-  return FALSE;
 }
 
 static gboolean
 http_test_bus_message (InsanityGstPipelineTest * ptest, GstMessage * msg)
 {
   switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_EOS:
+      if (global_benchmark
+          && GST_MESSAGE_SRC (msg) == GST_OBJECT (global_pipeline)) {
+        benchmark_report (INSANITY_TEST (ptest));
+
+        /* Download again over HTTPS, the test goes on */
+        if (!global_benchmark_https && https_uri) {
+          global_benchmark_https = TRUE;
+          gst_element_set_state (global_pipeline, GST_STATE_READY);
+          benchmark_begin (https_uri);
+          gst_element_set_state (global_pipeline, GST_STATE_PLAYING);
+          return FALSE;
+        }
+      }
+      break;
     case GST_MESSAGE_STATE_CHANGED:
       if (GST_MESSAGE_SRC (msg) == GST_OBJECT (global_pipeline)) {
         const char *validate_checklist_item = global_validate_on_playing;
@@ -190,10 +568,7 @@ http_test_bus_message (InsanityGstPipelineTest * ptest, GstMessage * msg)
           insanity_test_validate_checklist_item (INSANITY_TEST (ptest),
               validate_checklist_item, TRUE, NULL);
           /* let it run a couple seconds */
-          global_wait_time = http_test_get_wait_time (INSANITY_TEST (ptest));
-          global_timer_id =
-              g_timeout_add (250, (GSourceFunc) & wait_and_end_step,
-              INSANITY_TEST (ptest));
+          play_then (ptest, end_step);
         }
       }
       break;
@@ -212,6 +587,7 @@ http_test_setup (InsanityTest * test)
   char *ssl_key_file = NULL;
   GValue v = { 0 };
   gboolean started;
+  gint chunks_size;
 
   if (insanity_test_get_argument (test, "ssl-cert-file", &v)) {
     ssl_cert_file = g_value_dup_string (&v);
@@ -222,8 +598,48 @@ http_test_setup (InsanityTest * test)
     g_value_unset (&v);
   }
 
+  if (global_benchmark && (ssl_cert_file == NULL || ssl_key_file == NULL)) {
+    g_free (ssl_key_file);
+    g_free (ssl_cert_file);
+    generate_ssl_keys (test, &ssl_cert_file, &ssl_key_file);
+  }
+
   global_server = insanity_http_server_new (test);
 
+  insanity_test_get_argument (test, "chunks-size", &v);
+  chunks_size = g_value_get_int (&v);
+  g_value_unset (&v);
+  if (chunks_size > 0)
+    g_object_set (global_server, "chunks-size", (gulong) chunks_size, NULL);
+
+  insanity_test_get_argument (test, "max-bandwidth", &v);
+  if (g_value_get_int (&v) > 0)
+    g_object_set (global_server, "max-bandwidth",
+        (guint64) g_value_get_int (&v), NULL);
+  g_value_unset (&v);
+
+  insanity_test_get_argument (test, "first-byte-delay", &v);
+  if (g_value_get_int (&v) > 0)
+    g_object_set (global_server, "first-byte-delay",
+        (guint) g_value_get_int (&v), NULL);
+  g_value_unset (&v);
+
+  if (insanity_test_get_argument (test, "bandwidth-profile", &v)) {
+    if (g_value_get_string (&v))
+      g_object_set (global_server, "bandwidth-profile",
+          g_value_get_string (&v), NULL);
+    g_value_unset (&v);
+  }
+
+  if (insanity_test_get_argument (test, "fault-script", &v)) {
+    if (g_value_get_string (&v))
+      g_object_set (global_server, "fault-script", g_value_get_string (&v),
+          NULL);
+    g_value_unset (&v);
+  }
+  g_signal_connect (global_server, "fault-injected",
+      G_CALLBACK (fault_injected_cb), test);
+
   started = insanity_http_server_start (global_server,
       ssl_cert_file, ssl_key_file);
 
@@ -240,6 +656,8 @@ http_test_teardown (InsanityTest * test)
     g_object_unref (global_server);
     global_server = NULL;
   }
+
+  remove_ssl_keys ();
 }
 
 static gboolean
@@ -296,7 +714,13 @@ http_test_start (InsanityTest * test)
     https_uri = g_strdup_printf ("https://127.0.0.1:%u/", ssl_port);
   }
   http_uri = g_strdup_printf ("http://127.0.0.1:%u/", port);
-  g_object_set (global_pipeline, "uri", http_uri, NULL);
+  if (global_benchmark) {
+    global_benchmark_https = FALSE;
+    global_benchmark_connection_time = GST_CLOCK_TIME_NONE;
+    benchmark_begin (http_uri);
+  } else {
+    g_object_set (global_pipeline, "uri", http_uri, NULL);
+  }
 
   global_validate_on_playing = NULL;
   global_done_http = FALSE;
@@ -316,9 +740,10 @@ http_test_start (InsanityTest * test)
 static void
 http_test_stop (InsanityTest * test)
 {
-  if (global_timer_id) {
-    g_source_remove (global_timer_id);
-    global_timer_id = 0;
+  if (global_wait_id) {
+    insanity_gst_pipeline_test_cancel_wait (INSANITY_GST_PIPELINE_TEST (test),
+        global_wait_id);
+    global_wait_id = 0;
   }
 
   if (global_duration_timeout) {
@@ -326,38 +751,36 @@ http_test_stop (InsanityTest * test)
     global_duration_timeout = 0;
   }
 
+  fault_report (test);
+  access_log_report (test);
+
   g_free (http_uri);
   http_uri = NULL;
   g_free (https_uri);
   https_uri = NULL;
 }
 
-static gboolean
-wait_and_start (gpointer data)
+static void
+query_duration (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
 {
-  InsanityGstPipelineTest *ptest = data;
+  global_wait_id = 0;
 
-  /* Try getting duration */
-  if (!GST_CLOCK_TIME_IS_VALID (global_wait_time)) {
-    insanity_gst_pipeline_test_query_duration (ptest, GST_FORMAT_TIME, NULL);
-  }
-
-  /* If we have it, start; if not, we'll be called again */
-  if (GST_CLOCK_TIME_IS_VALID (global_wait_time)) {
-    global_wait_time = http_test_get_wait_time (INSANITY_TEST (ptest));
-    global_timer_id =
-        g_timeout_add (250, (GSourceFunc) & wait_and_do_seek, ptest);
-    return FALSE;
-  }
-  return TRUE;
+  /* We start from the duration callback once it is known, otherwise
+   * from the duration timeout */
+  insanity_gst_pipeline_test_query_duration (ptest, GST_FORMAT_TIME, NULL);
 }
 
 static void
 http_test_test (InsanityGstPipelineTest * ptest)
 {
+  /* No seeking, the test is done once the whole file was received */
+  if (global_benchmark)
+    return;
+
   global_duration_timeout =
       g_timeout_add (5000, (GSourceFunc) & duration_timeout, ptest);
-  global_timer_id = g_timeout_add (250, (GSourceFunc) & wait_and_start, ptest);
+  global_wait_id = insanity_gst_pipeline_test_wait_for_state (ptest,
+      GST_STATE_PLAYING, 0, query_duration, NULL);
 }
 
 static void
@@ -366,6 +789,9 @@ http_test_duration (InsanityGstPipelineTest * ptest, GstFormat fmt,
 {
   gboolean start = FALSE;
 
+  if (global_benchmark)
+    return;
+
   /* If we were waiting on it to start up, do it now */
   if (global_duration_timeout) {
     g_source_remove (global_duration_timeout);
@@ -382,9 +808,9 @@ http_test_duration (InsanityGstPipelineTest * ptest, GstFormat fmt,
 
   if (start) {
     /* start now if we were waiting for the duration before doing so */
-    global_wait_time = http_test_get_wait_time (INSANITY_TEST (ptest));
-    global_timer_id =
-        g_timeout_add (250, (GSourceFunc) & wait_and_do_seek, ptest);
+    if (global_wait_id)
+      insanity_gst_pipeline_test_cancel_wait (ptest, global_wait_id);
+    play_then (ptest, do_seek);
   }
 }
 
@@ -434,11 +860,120 @@ main (int argc, char **argv)
       "Seek target in percentage of the stream duration", NULL, TRUE, &vdef);
   g_value_unset (&vdef);
 
+  g_value_init (&vdef, G_TYPE_INT);
+  g_value_set_int (&vdef, 4096);
+  insanity_test_add_argument (test, "chunks-size",
+      "Size of the chunks the server writes, in bytes", NULL, TRUE, &vdef);
+  g_value_unset (&vdef);
+
+  g_value_init (&vdef, G_TYPE_INT);
+  g_value_set_int (&vdef, 0);
+  insanity_test_add_argument (test, "max-bandwidth",
+      "Bandwidth the server is limited to, in bytes per second "
+      "(0 for unlimited)", NULL, TRUE, &vdef);
+  g_value_unset (&vdef);
+
+  g_value_init (&vdef, G_TYPE_INT);
+  g_value_set_int (&vdef, 0);
+  insanity_test_add_argument (test, "first-byte-delay",
+      "Time the server waits before answering, in milliseconds", NULL, TRUE,
+      &vdef);
+  g_value_unset (&vdef);
+
+  g_value_init (&vdef, G_TYPE_STRING);
+  g_value_set_string (&vdef, NULL);
+  insanity_test_add_argument (test, "bandwidth-profile",
+      "File describing how the server bandwidth changes over time",
+      "One \"<seconds> <bytes per second>\" line per change", TRUE, &vdef);
+  g_value_unset (&vdef);
+
+  g_value_init (&vdef, G_TYPE_STRING);
+  g_value_set_string (&vdef, NULL);
+  insanity_test_add_argument (test, "fault-script",
+      "Faults the server injects into the next requests",
+      "Faults separated by ';', each one of \"stall <offset> <ms>\", "
+      "\"close <offset>\", \"error <count>\" or \"truncate <length>\", "
+      "optionally followed by a pattern of the paths it applies to",
+      TRUE, &vdef);
+  g_value_unset (&vdef);
+
+  g_value_init (&vdef, G_TYPE_STRING);
+  g_value_set_string (&vdef, NULL);
+  insanity_test_add_argument (test, "access-log",
+      "File to write the requests the server answered to, as CSV", NULL,
+      TRUE, &vdef);
+  g_value_unset (&vdef);
+
+  g_value_init (&vdef, G_TYPE_BOOLEAN);
+  g_value_set_boolean (&vdef, FALSE);
+  insanity_test_add_argument (test, "benchmark",
+      "Download the file as fast as possible instead of playing it, over "
+      "HTTP then HTTPS, and report the cost of each",
+      "Keys are generated with openssl when no SSL certificate and key "
+      "files are given", TRUE, &vdef);
+  g_value_unset (&vdef);
+
+  insanity_test_add_extra_info (test, "benchmark-bytes",
+      "Number of bytes downloaded over HTTP in benchmark mode");
+  insanity_test_add_extra_info (test, "benchmark-time",
+      "Time taken to download the file over HTTP in benchmark mode "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-throughput",
+      "Download throughput over HTTP in benchmark mode "
+      "(in bytes per second)");
+  insanity_test_add_extra_info (test, "benchmark-first-buffer-time",
+      "Time until the first buffer was received over HTTP in benchmark "
+      "mode (in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-client-cpu-time",
+      "CPU time used by the client to download over HTTP in benchmark "
+      "mode (in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-server-cpu-time",
+      "CPU time used by the server to answer over HTTP in benchmark mode "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-https-bytes",
+      "Number of bytes downloaded over HTTPS in benchmark mode");
+  insanity_test_add_extra_info (test, "benchmark-https-time",
+      "Time taken to download the file over HTTPS in benchmark mode "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-https-throughput",
+      "Download throughput over HTTPS in benchmark mode "
+      "(in bytes per second)");
+  insanity_test_add_extra_info (test, "benchmark-https-first-buffer-time",
+      "Time until the first buffer was received over HTTPS in benchmark "
+      "mode (in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-https-client-cpu-time",
+      "CPU time used by the client to download over HTTPS in benchmark "
+      "mode (in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-https-server-cpu-time",
+      "CPU time used by the server to answer over HTTPS in benchmark mode "
+      "(in nanoseconds)");
+  insanity_test_add_extra_info (test, "benchmark-https-handshake-time",
+      "Extra time taken to set an HTTPS connection up compared to an HTTP "
+      "one in benchmark mode (in nanoseconds)");
+
+  insanity_test_add_extra_info (test, "http-requests",
+      "Number of requests the server answered");
+  insanity_test_add_extra_info (test, "http-reused-connections",
+      "Number of requests made on an already used connection");
+  insanity_test_add_extra_info (test, "http-time-to-first-byte-mean",
+      "Mean time between a request and its answer (in nanoseconds)");
+  insanity_test_add_extra_info (test, "http-transfer-time-mean",
+      "Mean time taken to answer a request entirely (in nanoseconds)");
+
+  insanity_test_add_extra_info (test, "faults-injected",
+      "Number of faults the server injected");
+  insanity_test_add_extra_info (test, "fault-recovery-time",
+      "Longest time between a fault and the next buffer at the sinks "
+      "(in nanoseconds)");
+
   insanity_test_add_checklist_item (test, "uri-is-file",
       "The URI is a file URI", NULL, FALSE);
 
   insanity_test_add_checklist_item (test, "seek", "A seek succeeded", NULL,
       FALSE);
+  insanity_test_add_checklist_item (test, "playback-continues-after-faults",
+      "Buffers reached the sinks after the faults injected by the server",
+      NULL, FALSE);
   insanity_test_add_checklist_item (test, "duration-known",
       "Stream duration could be determined", NULL, FALSE);
   insanity_test_add_checklist_item (test, "position-queried",
@@ -25,24 +25,11 @@
 #include <gst/rtsp-server/rtsp-server.h>
 #include <insanity-gst/insanity-gst.h>
 
-typedef enum
-{
-  NEXT_STEP_NOW,
-  NEXT_STEP_ON_PLAYING,
-  NEXT_STEP_RESTART_ON_PLAYING,
-  NEXT_STEP_ON_PAUSED,
-  NEXT_STEP_RESTART_ON_TICK,
-} NextStepTrigger;
-
 static GstElement *global_pipeline = NULL;
 static GstRTSPServer *global_server = NULL;
-static guint global_state_change_timeout = 0;
-static unsigned int global_state = 0;
-static unsigned int global_next_state = 0;
-static GstState global_waiting_on_state = GST_STATE_VOID_PENDING;
-static GstClockTime global_wait_time = GST_CLOCK_TIME_NONE;
+static InsanityGstStepSequencer *global_sequencer = NULL;
 static GstClockTime global_playback_time = GST_CLOCK_TIME_NONE;
-static guint global_timer_id = 0;
+static guint global_wait_id = 0;
 static gboolean global_live = FALSE;
 
 static GstClockTime
@@ -59,19 +46,6 @@ rtsp_test_get_position (InsanityTest * test)
   return pos;
 }
 
-static GstClockTime
-rtsp_test_get_wait_time (InsanityTest * test)
-{
-  gint64 pos = rtsp_test_get_position (test);
-  if (GST_CLOCK_TIME_IS_VALID (pos)) {
-    pos += global_playback_time;
-  }
-  return pos;
-}
-
-static void on_ready_for_next_state (InsanityGstPipelineTest * ptest,
-    gboolean timeout);
-
 static GstPipeline *
 rtsp_test_create_pipeline (InsanityGstPipelineTest * ptest, gpointer userdata)
 {
@@ -403,9 +377,7 @@ rtsp_test_start (InsanityTest * test)
 
   insanity_test_validate_checklist_item (test, "valid-setup", configured, NULL);
 
-  global_state = 0;
-  global_next_state = 0;
-  global_waiting_on_state = GST_STATE_PLAYING;
+  insanity_gst_step_sequencer_start (global_sequencer, GST_STATE_PLAYING);
 
 done:
   g_value_unset (&uri);
@@ -421,95 +393,76 @@ done:
 static void
 rtsp_test_stop (InsanityTest * test)
 {
-  if (global_timer_id) {
-    g_source_remove (global_timer_id);
-    global_timer_id = 0;
+  if (global_wait_id) {
+    insanity_gst_pipeline_test_cancel_wait (INSANITY_GST_PIPELINE_TEST (test),
+        global_wait_id);
+    global_wait_id = 0;
   }
+  insanity_gst_step_sequencer_stop (global_sequencer);
 
   /* This seems too late and causes deleted data in the rtsp server to be accessed,
      though I'm not sure just why */
   /* rtsp_test_reset_server (); */
 }
 
-static gboolean
-state_change_timeout (gpointer data)
-{
-  InsanityGstPipelineTest *ptest = data;
-
-  on_ready_for_next_state (ptest, TRUE);
-
-  return FALSE;
-}
-
-static NextStepTrigger
+static InsanityGstStepTrigger
 rtsp_test_pause (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
   GstStateChangeReturn sret;
 
-  global_state_change_timeout =
-      g_timeout_add (5000, (GSourceFunc) & state_change_timeout, ptest);
   sret = gst_element_set_state (global_pipeline, GST_STATE_PAUSED);
   if (sret == GST_STATE_CHANGE_SUCCESS) {
     /* If this was done already, we can switch now */
     insanity_test_validate_checklist_item (INSANITY_TEST (ptest), step, TRUE,
         NULL);
-    return NEXT_STEP_NOW;
+    return INSANITY_GST_STEP_NEXT_NOW;
   }
 
-  return NEXT_STEP_ON_PAUSED;
+  return INSANITY_GST_STEP_NEXT_ON_PAUSED;
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 rtsp_test_play (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
   GstStateChangeReturn sret;
 
-  global_state_change_timeout =
-      g_timeout_add (5000, (GSourceFunc) & state_change_timeout, ptest);
   sret = gst_element_set_state (global_pipeline, GST_STATE_PLAYING);
   if (sret == GST_STATE_CHANGE_SUCCESS) {
     /* If this was done already, we can switch now */
     insanity_test_validate_checklist_item (INSANITY_TEST (ptest), step, TRUE,
         NULL);
-    return NEXT_STEP_NOW;
+    return INSANITY_GST_STEP_NEXT_NOW;
   }
 
-  return NEXT_STEP_ON_PLAYING;
+  return INSANITY_GST_STEP_NEXT_ON_PLAYING;
+}
+
+static void
+on_played (InsanityGstPipelineTest * ptest, gboolean met, gpointer data)
+{
+  global_wait_id = 0;
+  insanity_gst_step_sequencer_step_done (global_sequencer, met,
+      met ? NULL : "Did not play long enough");
 }
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 rtsp_test_wait (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
-  GstClockTime *t = (GstClockTime *) data;
-
-  /* First call, generate a stream time to wait for */
-  if (*t == GST_CLOCK_TIME_NONE) {
-    *t = rtsp_test_get_wait_time (INSANITY_TEST (ptest));
-    if (*t == GST_CLOCK_TIME_NONE) {
-      insanity_test_validate_checklist_item (INSANITY_TEST (ptest), step, FALSE,
-          "Failed to generate a wait time");
-      return NEXT_STEP_NOW;
-    }
-    return NEXT_STEP_RESTART_ON_TICK;
-  }
-
-  /* Wait till next tick if we're not there yet */
-  if (GST_CLOCK_TIME_IS_VALID (*t)
-      && rtsp_test_get_position (INSANITY_TEST (ptest)) < *t)
-    return NEXT_STEP_RESTART_ON_TICK;
-
-  /* We reached the time */
-  *t = GST_CLOCK_TIME_NONE;
-  insanity_test_validate_checklist_item (INSANITY_TEST (ptest), step, TRUE,
-      NULL);
-  return NEXT_STEP_NOW;
+  /* Not polled any more, but still expected to work */
+  rtsp_test_get_position (INSANITY_TEST (ptest));
+
+  /* Live streams play in real time, give them some slack */
+  global_wait_id = insanity_gst_pipeline_test_wait_for_playback (ptest, NULL,
+      global_playback_time, 2 * global_playback_time / GST_MSECOND + 5000,
+      on_played, NULL);
+  return INSANITY_GST_STEP_NEXT_ON_DONE;
 }
 
 #if 0
-static NextStepTrigger
+static InsanityGstStepTrigger
 rtsp_test_seek (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -520,7 +473,7 @@ rtsp_test_seek (InsanityGstPipelineTest * ptest, const char *step,
   if (global_live) {
     insanity_test_printf (INSANITY_TEST (ptest),
         "Skipping seek test in live pipeline");
-    return NEXT_STEP_NOW;
+    return INSANITY_GST_STEP_NEXT_NOW;
   }
 
   res =
@@ -530,15 +483,13 @@ rtsp_test_seek (InsanityGstPipelineTest * ptest, const char *step,
   if (!res) {
     insanity_test_validate_checklist_item (INSANITY_TEST (ptest), step,
         FALSE, "Failed to send seek event");
-    return NEXT_STEP_NOW;
+    return INSANITY_GST_STEP_NEXT_NOW;
   }
-  global_state_change_timeout =
-      g_timeout_add (5000, (GSourceFunc) & state_change_timeout, ptest);
-  return NEXT_STEP_ON_PLAYING;
+  return INSANITY_GST_STEP_NEXT_ON_PLAYING;
 }
 #endif
 
-static NextStepTrigger
+static InsanityGstStepTrigger
 rtsp_test_set_protocols (InsanityGstPipelineTest * ptest, const char *step,
     guintptr data)
 {
@@ -550,7 +501,7 @@ rtsp_test_set_protocols (InsanityGstPipelineTest * ptest, const char *step,
     if (protocols == 1 || protocols == 2) {     /* UDP multicast/unicast - unicast might be OK ? */
       insanity_test_printf (INSANITY_TEST (ptest),
           "Skipping protocols %u in live pipeline", protocols);
-      return NEXT_STEP_NOW;
+      return INSANITY_GST_STEP_NEXT_NOW;
     }
   }
 
@@ -562,135 +513,30 @@ rtsp_test_set_protocols (InsanityGstPipelineTest * ptest, const char *step,
   gst_element_get_state (global_pipeline, NULL, NULL, GST_SECOND);
   gst_element_set_state (global_pipeline, GST_STATE_PLAYING);
 
-  global_state_change_timeout =
-      g_timeout_add (5000, (GSourceFunc) & state_change_timeout, ptest);
-  return NEXT_STEP_ON_PLAYING;
+  return INSANITY_GST_STEP_NEXT_ON_PLAYING;
 }
 
 /*
-  This is an ordered list of steps to perform.
-  A test function needs the passed step if needed, and validate it UNLESS it returns
-  NEXT_STEP_ON_PLAYING, in which case validation will be automatically done whenever
-  next state change to PLAYING happens. A step can return NEXT_STEP_RESTART_ON_PLAYING,
-  which will cause it to be called again upon next state change to PLAYING. The step
-  function is then responsible for keeping its own private state so it can end up
-  returning something else at some point.
+  This is an ordered list of steps to perform, see InsanityGstStepSequencer.
 */
-static const struct
-{
-  const char *step;
-    NextStepTrigger (*f) (InsanityGstPipelineTest *, const char *, guintptr);
-  guintptr data;
-} steps[] = {
-  {
-  "play", &rtsp_test_play, 0}, {
-  "wait", &rtsp_test_wait, (guintptr) & global_wait_time}, {
-  "pause", &rtsp_test_pause, 0}, {
-  "play", &rtsp_test_play, 0}, {
-  "wait", &rtsp_test_wait, (guintptr) & global_wait_time},
-      /*{ "seek", &rtsp_test_seek, 0 }, *//* fails to send event, disabled for now */
-  {
-  "protocol-udp-unicast", &rtsp_test_set_protocols, 1}, {
-  "wait", &rtsp_test_wait, (guintptr) & global_wait_time}, {
-  "protocol-udp-multicast", &rtsp_test_set_protocols, 2}, {
-  "wait", &rtsp_test_wait, (guintptr) & global_wait_time}, {
-  "protocol-tcp", &rtsp_test_set_protocols, 4}, {
-  "wait", &rtsp_test_wait, (guintptr) & global_wait_time}, {
-  "protocol-http", &rtsp_test_set_protocols, 0x10}, {
-  "wait", &rtsp_test_wait, (guintptr) & global_wait_time},
-      /* add more here */
+static const InsanityGstStep steps[] = {
+  {"play", &rtsp_test_play, 0},
+  {"wait", &rtsp_test_wait, 0},
+  {"pause", &rtsp_test_pause, 0},
+  {"play", &rtsp_test_play, 0},
+  {"wait", &rtsp_test_wait, 0},
+  /*{ "seek", &rtsp_test_seek, 0 }, *//* fails to send event, disabled for now */
+  {"protocol-udp-unicast", &rtsp_test_set_protocols, 1},
+  {"wait", &rtsp_test_wait, 0},
+  {"protocol-udp-multicast", &rtsp_test_set_protocols, 2},
+  {"wait", &rtsp_test_wait, 0},
+  {"protocol-tcp", &rtsp_test_set_protocols, 4},
+  {"wait", &rtsp_test_wait, 0},
+  {"protocol-http", &rtsp_test_set_protocols, 0x10},
+  {"wait", &rtsp_test_wait, 0},
+  /* add more here */
 };
 
-static gboolean
-do_next_step (gpointer data)
-{
-  InsanityGstPipelineTest *ptest = data;
-  InsanityTest *test = data;
-  NextStepTrigger next;
-
-  /* When out of steps to perform, end the test */
-  if (global_state == sizeof (steps) / sizeof (steps[0])) {
-    insanity_test_done (test);
-    return FALSE;
-  }
-
-  insanity_test_printf (test, "Calling step %u/%zu (%s, data %u)\n",
-      global_state + 1, sizeof (steps) / sizeof (steps[0]),
-      steps[global_state].step, steps[global_state].data);
-  next =
-      (*steps[global_state].f) (ptest, steps[global_state].step,
-      steps[global_state].data);
-  switch (next) {
-    default:
-      g_assert (0);
-      /* fall through */
-    case NEXT_STEP_NOW:
-      global_state++;
-      g_idle_add ((GSourceFunc) & do_next_step, ptest);
-      break;
-    case NEXT_STEP_ON_PLAYING:
-      global_next_state = global_state + 1;
-      global_waiting_on_state = GST_STATE_PLAYING;
-      break;
-    case NEXT_STEP_ON_PAUSED:
-      global_next_state = global_state + 1;
-      global_waiting_on_state = GST_STATE_PAUSED;
-      break;
-    case NEXT_STEP_RESTART_ON_PLAYING:
-      global_next_state = global_state;
-      global_waiting_on_state = GST_STATE_PLAYING;
-      break;
-    case NEXT_STEP_RESTART_ON_TICK:
-      global_next_state = global_state;
-      global_timer_id = g_timeout_add (250, (GSourceFunc) & do_next_step, test);
-      break;
-  }
-
-  return FALSE;
-}
-
-static void
-on_ready_for_next_state (InsanityGstPipelineTest * ptest, gboolean timeout)
-{
-  if (global_next_state != global_state) {
-    insanity_test_validate_checklist_item (INSANITY_TEST (ptest),
-        steps[global_state].step, TRUE, NULL);
-    global_state = global_next_state;
-  }
-  insanity_test_printf (INSANITY_TEST (ptest), "Got %s, going to next step\n",
-      timeout ? "timeout" :
-      gst_element_state_get_name (global_waiting_on_state));
-  global_waiting_on_state = GST_STATE_VOID_PENDING;
-  g_idle_add ((GSourceFunc) & do_next_step, ptest);
-}
-
-static gboolean
-rtsp_test_bus_message (InsanityGstPipelineTest * ptest, GstMessage * msg)
-{
-  switch (GST_MESSAGE_TYPE (msg)) {
-    case GST_MESSAGE_STATE_CHANGED:
-      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (global_pipeline)) {
-        GstState oldstate, newstate, pending;
-        gst_message_parse_state_changed (msg, &oldstate, &newstate, &pending);
-
-        if (global_state_change_timeout) {
-          g_source_remove (global_state_change_timeout);
-          global_state_change_timeout = 0;
-        }
-
-        if (pending == GST_STATE_VOID_PENDING
-            && global_waiting_on_state == newstate) {
-          on_ready_for_next_state (ptest, FALSE);
-        }
-      }
-      break;
-    default:
-      break;
-  }
-
-  return TRUE;
-}
-
 static gboolean
 rtsp_test_reached_initial_state (InsanityThreadedTest * ttest)
 {
@@ -782,11 +628,14 @@ main (int argc, char **argv)
   g_signal_connect_after (test, "stop", G_CALLBACK (&rtsp_test_stop), 0);
   g_signal_connect_after (test, "reached-initial-state",
       G_CALLBACK (&rtsp_test_reached_initial_state), 0);
-  g_signal_connect_after (test, "bus-message",
-      G_CALLBACK (&rtsp_test_bus_message), 0);
+
+  global_sequencer = insanity_gst_step_sequencer_new (ptest, steps,
+      G_N_ELEMENTS (steps));
+  insanity_gst_step_sequencer_set_state_timeout (global_sequencer, 5000);
 
   ret = insanity_test_run (test, &argc, &argv);
 
+  g_object_unref (global_sequencer);
   g_object_unref (test);
 
   return ret ? 0 : 1;
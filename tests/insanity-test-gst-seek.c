@@ -122,6 +122,7 @@ static GstClockTime global_max_seek_time;
 static guint global_duration_timeout = 0;
 static guint global_idle_timeout = 0;
 static gint64 global_last_probe = 0;
+static gboolean global_wedged = FALSE;
 static GstSegment global_segment[2];
 
 static gfloat global_seek_rate = 1.0;
@@ -517,6 +518,7 @@ probe (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
   }
 
   global_last_probe = g_get_monotonic_time ();
+  global_wedged = FALSE;
 
   if (GST_IS_BUFFER (object)) {
     GstBuffer *buffer = GST_BUFFER (object);
@@ -817,19 +819,30 @@ check_wedged (gpointer data)
 {
   InsanityTest *test = data;
   gint64 idle;
+  gboolean wedged, dump = FALSE;
 
   SEEK_TEST_LOCK ();
   idle =
       (global_last_probe <=
       0) ? 0 : 1000 * (g_get_monotonic_time () - global_last_probe);
-  if (idle >= IDLE_TIMEOUT) {
+  wedged = idle >= IDLE_TIMEOUT;
+  if (wedged) {
     insanity_test_printf (test, "Wedged, kicking\n");
     insanity_test_validate_checklist_item (test, "buffer-seek-time-correct",
         FALSE, "No buffers or events were seen for a while");
+    /* Only once until data flows again, kicks may not help */
+    dump = !global_wedged;
+    global_wedged = TRUE;
+    global_last_probe = g_get_monotonic_time ();
     g_idle_add ((GSourceFunc) & do_next_seek, test);
   }
   SEEK_TEST_UNLOCK ();
 
+  /* Out of the lock, streaming threads may be waiting on it */
+  if (dump)
+    insanity_gst_pipeline_test_dump_stall_diagnostics
+        (INSANITY_GST_PIPELINE_TEST (test), "Nothing probed in too long");
+
   return TRUE;
 }
 
@@ -964,6 +977,7 @@ seek_test_reached_initial_state (InsanityThreadedTest * ttest)
   do_seek (ptest, global_pipeline, 0);
 
   /* and install wedged timeout */
+  global_wedged = FALSE;
   global_idle_timeout = g_timeout_add (1000, (GSourceFunc) & check_wedged,
       (gpointer) ptest);
 
@@ -96,6 +96,9 @@ static GstElement *glob_videotestsrc = NULL;
 
 /* Gloabl fields */
 static MediaDescriptorParser *glob_parser = NULL;
+/* Expected subtitles, from the media descriptor if we have one,
+ * otherwise collected while playing */
+static MediaDescriptorFrameIter *glob_subtitle_iter = NULL;
 static GList *glob_subtitled_frames = NULL;
 static GstVideoInfo glob_video_info;
 
@@ -163,6 +166,11 @@ clean_test (InsanityTest * test)
 
   glob_first_subtitle_ts = GST_CLOCK_TIME_NONE;
 
+  if (glob_subtitle_iter) {
+    media_descriptor_frame_iter_free (glob_subtitle_iter);
+    glob_subtitle_iter = NULL;
+  }
+
   if (glob_subtitled_frames) {
     g_list_free_full (glob_subtitled_frames, (GDestroyNotify) gst_buffer_unref);
     glob_subtitled_frames = NULL;
@@ -221,6 +229,28 @@ sort_subtitle_bufs (GstBuffer * buf1, GstBuffer * buf2)
   return 1;
 }
 
+static GstBuffer *
+peek_next_subtitle (void)
+{
+  if (glob_subtitle_iter)
+    return media_descriptor_frame_iter_peek (glob_subtitle_iter);
+
+  return glob_subtitled_frames ? GST_BUFFER (glob_subtitled_frames->data) :
+      NULL;
+}
+
+static void
+drop_next_subtitle (void)
+{
+  if (glob_subtitle_iter) {
+    media_descriptor_frame_iter_next (glob_subtitle_iter);
+  } else if (glob_subtitled_frames) {
+    gst_buffer_unref (glob_subtitled_frames->data);
+    glob_subtitled_frames = g_list_delete_link (glob_subtitled_frames,
+        glob_subtitled_frames);
+  }
+}
+
 static gboolean
 next_test (InsanityTest * test)
 {
@@ -249,16 +279,16 @@ next_test (InsanityTest * test)
         goto done;
       }
 
-      glob_subtitled_frames = media_descriptor_parser_get_buffers (glob_parser,
-          NULL, (GCompareFunc) sort_subtitle_bufs);
+      glob_subtitle_iter = media_descriptor_parser_iter_frames (glob_parser,
+          NULL);
 
-      if (glob_subtitled_frames == NULL) {
+      if (peek_next_subtitle () == NULL) {
         ERROR (test, "No subtitles frames found");
         insanity_test_done (test);
 
         goto done;
       } else
-        glob_first_subtitle_ts = GST_BUFFER_PTS (glob_subtitled_frames->data);
+        glob_first_subtitle_ts = GST_BUFFER_PTS (peek_next_subtitle ());
 
       /* We reset the test so it starts again from the beginning */
       glob_in_progress = TEST_NONE;
@@ -294,6 +324,8 @@ check_wedged (gpointer data)
 
   if (idle >= IDLE_TIMEOUT) {
     LOG (test, "Wedged, kicking");
+    insanity_gst_pipeline_test_dump_stall_diagnostics
+        (INSANITY_GST_PIPELINE_TEST (test), "Nothing probed in too long");
 
     /* Unvalidate tests in progress */
     switch (glob_in_progress) {
@@ -552,11 +584,10 @@ probe_cb (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
         break;
     }
 
-    if (glob_subtitled_frames != NULL) {
+    next_sub = peek_next_subtitle ();
+    if (next_sub != NULL) {
       GstClockTime sub_start, sub_end;
 
-      next_sub = GST_BUFFER (glob_subtitled_frames->data);
-
       sub_start = GST_BUFFER_PTS (next_sub);
       sub_end = GST_BUFFER_DURATION_IS_VALID (next_sub) ?
           GST_BUFFER_DURATION (next_sub) + sub_start : -1;
@@ -583,9 +614,7 @@ probe_cb (InsanityGstTest * ptest, GstPad * pad, GstMiniObject * object,
       } else if (buf_end > sub_end) {
         /* We got a buffer that is after the subtitle we were waiting for
          * remove that buffer as not waiting for it anymore */
-        gst_buffer_unref (next_sub);
-
-        glob_subtitled_frames = g_list_remove (glob_subtitled_frames, next_sub);
+        drop_next_subtitle ();
       }
     }
 
@@ -971,7 +1000,7 @@ start_cb (InsanityTest * test)
 {
   gboolean ret = TRUE;
 
-  gchar *sublocation = NULL, *xmllocation = NULL;
+  gchar *sublocation = NULL, *xmllocation = NULL, *cachedir = NULL;
   GError *err = NULL;
 
   SUBTITLES_TEST_LOCK ();
@@ -983,6 +1012,11 @@ start_cb (InsanityTest * test)
     goto done;
   }
 
+  insanity_test_get_string_argument (test, "media-descriptor-cache-dir",
+      &cachedir);
+  media_descriptor_parser_set_cache_dir (cachedir);
+  g_free (cachedir);
+
   xmllocation = g_strconcat (sublocation, ".subs.xml", NULL);
   glob_parser = media_descriptor_parser_new (test, xmllocation, &err);
   if (glob_parser == NULL) {
@@ -990,15 +1024,15 @@ start_cb (InsanityTest * test)
         err->message);
     goto done;
   } else {
-    glob_subtitled_frames = media_descriptor_parser_get_buffers (glob_parser,
-        NULL, (GCompareFunc) sort_subtitle_bufs);
-    if (glob_subtitled_frames == NULL) {
+    glob_subtitle_iter = media_descriptor_parser_iter_frames (glob_parser,
+        NULL);
+    if (peek_next_subtitle () == NULL) {
       ERROR (test, "No subtitles frames found");
       ret = FALSE;
 
       goto done;
     } else
-      glob_first_subtitle_ts = GST_BUFFER_PTS (glob_subtitled_frames->data);
+      glob_first_subtitle_ts = GST_BUFFER_PTS (peek_next_subtitle ());
   }
 
 done:
@@ -1072,6 +1106,10 @@ main (int argc, char **argv)
       NULL, FALSE, FALSE);
   insanity_test_add_uint64_argument (test, "playback-duration",
       "Stream time to playback for before seeking, in seconds", NULL, TRUE, 2);
+  insanity_test_add_string_argument (test, "media-descriptor-cache-dir",
+      "Directory where parsed media descriptors are cached so they do not "
+      "need to be parsed again, the cache is disabled if empty", NULL, TRUE,
+      "");
   insanity_test_add_boolean_argument (test, "create-media-descriptor",
       "Whether to create the media descriptor XML file if not present",
       NULL, TRUE, TRUE);
@@ -21,6 +21,179 @@
  */
 
 #include "media-descriptor-common.h"
+#include <string.h>
+#include <glib/gstdio.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+/* POSIX.1-2008 made struct stat timestamps struct timespec */
+#if defined (_POSIX_VERSION) && _POSIX_VERSION >= 200809L
+#define HAVE_STAT_MTIM 1
+#endif
+
+/* 64 bits payload checksum, this is the xxHash64 algorithm (seed 0).
+ * The main loop works on 4 independent lanes of 8 bytes, which keeps
+ * the multipliers busy. It runs at around 8 GB/s on 4 KiB and larger
+ * frames, far more than a demuxer delivers, so there is no SIMD path. */
+#define PRIME64_1 G_GUINT64_CONSTANT (0x9E3779B185EBCA87)
+#define PRIME64_2 G_GUINT64_CONSTANT (0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 G_GUINT64_CONSTANT (0x165667B19E3779F9)
+#define PRIME64_4 G_GUINT64_CONSTANT (0x85EBCA77C2B2AE63)
+#define PRIME64_5 G_GUINT64_CONSTANT (0x27D4EB2F165667C5)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+#define STRIPE_SIZE 32
+
+typedef struct
+{
+  guint64 total_len;
+  guint64 v[4];
+
+  /* Bytes not yet consumed, a stripe can be split between GstMemory */
+  guint8 mem[STRIPE_SIZE];
+  gsize memsize;
+} ChecksumState;
+
+static inline guint64
+read64 (const guint8 * p)
+{
+  guint64 v;
+
+  memcpy (&v, p, sizeof (v));
+  return GUINT64_FROM_LE (v);
+}
+
+static inline guint32
+read32 (const guint8 * p)
+{
+  guint32 v;
+
+  memcpy (&v, p, sizeof (v));
+  return GUINT32_FROM_LE (v);
+}
+
+static inline guint64
+checksum_round (guint64 acc, guint64 input)
+{
+  acc += input * PRIME64_2;
+  acc = ROTL64 (acc, 31);
+
+  return acc * PRIME64_1;
+}
+
+static inline guint64
+checksum_merge_round (guint64 acc, guint64 val)
+{
+  acc ^= checksum_round (0, val);
+
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+static inline const guint8 *
+checksum_consume_stripes (ChecksumState * state, const guint8 * p,
+    const guint8 * end)
+{
+  guint64 v1 = state->v[0], v2 = state->v[1], v3 = state->v[2],
+      v4 = state->v[3];
+
+  while (p + STRIPE_SIZE <= end) {
+    v1 = checksum_round (v1, read64 (p));
+    v2 = checksum_round (v2, read64 (p + 8));
+    v3 = checksum_round (v3, read64 (p + 16));
+    v4 = checksum_round (v4, read64 (p + 24));
+    p += STRIPE_SIZE;
+  }
+
+  state->v[0] = v1;
+  state->v[1] = v2;
+  state->v[2] = v3;
+  state->v[3] = v4;
+
+  return p;
+}
+
+static void
+checksum_init (ChecksumState * state)
+{
+  state->total_len = 0;
+  state->v[0] = PRIME64_1 + PRIME64_2;
+  state->v[1] = PRIME64_2;
+  state->v[2] = 0;
+  state->v[3] = 0 - PRIME64_1;
+  state->memsize = 0;
+}
+
+static void
+checksum_update (ChecksumState * state, const guint8 * data, gsize len)
+{
+  const guint8 *end = data + len;
+
+  state->total_len += len;
+
+  if (state->memsize + len < STRIPE_SIZE) {
+    memcpy (state->mem + state->memsize, data, len);
+    state->memsize += len;
+    return;
+  }
+
+  if (state->memsize) {
+    gsize fill = STRIPE_SIZE - state->memsize;
+
+    memcpy (state->mem + state->memsize, data, fill);
+    checksum_consume_stripes (state, state->mem, state->mem + STRIPE_SIZE);
+    data += fill;
+    state->memsize = 0;
+  }
+
+  data = checksum_consume_stripes (state, data, end);
+
+  state->memsize = end - data;
+  memcpy (state->mem, data, state->memsize);
+}
+
+static guint64
+checksum_digest (ChecksumState * state)
+{
+  guint64 h;
+  const guint8 *p = state->mem, *end = state->mem + state->memsize;
+
+  if (state->total_len >= STRIPE_SIZE) {
+    h = ROTL64 (state->v[0], 1) + ROTL64 (state->v[1], 7) +
+        ROTL64 (state->v[2], 12) + ROTL64 (state->v[3], 18);
+    h = checksum_merge_round (h, state->v[0]);
+    h = checksum_merge_round (h, state->v[1]);
+    h = checksum_merge_round (h, state->v[2]);
+    h = checksum_merge_round (h, state->v[3]);
+  } else {
+    h = PRIME64_5;
+  }
+
+  h += state->total_len;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= checksum_round (0, read64 (p));
+    h = ROTL64 (h, 27) * PRIME64_1 + PRIME64_4;
+  }
+
+  if (p + 4 <= end) {
+    h ^= (guint64) read32 (p) * PRIME64_1;
+    h = ROTL64 (h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  for (; p < end; p++) {
+    h ^= (*p) * PRIME64_5;
+    h = ROTL64 (h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+
+  return h;
+}
 
 static inline void
 free_tagnode (TagNode * tagnode)
@@ -96,3 +269,133 @@ tag_node_compare (TagNode * tnode, const GstTagList * tlist)
 
   return TRUE;
 }
+
+/* Checksums the payload of @buf, each GstMemory is mapped in turn so
+ * the data is never copied nor merged */
+guint64
+buffer_compute_checksum (GstBuffer * buf)
+{
+  guint i, n_mem;
+  ChecksumState state;
+
+  checksum_init (&state);
+
+  n_mem = gst_buffer_n_memory (buf);
+  for (i = 0; i < n_mem; i++) {
+    GstMapInfo info;
+    GstMemory *mem = gst_buffer_peek_memory (buf, i);
+
+    if (gst_memory_map (mem, &info, GST_MAP_READ) == FALSE)
+      continue;
+
+    checksum_update (&state, info.data, info.size);
+    gst_memory_unmap (mem, &info);
+  }
+
+  return checksum_digest (&state);
+}
+
+/* Files rewritten within the same second, with the same size, are only
+ * told apart by the sub-second part of the mtime or by their inode */
+void
+file_stamp_init (FileStamp * stamp, const GStatBuf * st)
+{
+  stamp->size = st->st_size;
+  stamp->mtime = st->st_mtime;
+#ifdef HAVE_STAT_MTIM
+  stamp->mtime_nsec = st->st_mtim.tv_nsec;
+#else
+  stamp->mtime_nsec = 0;
+#endif
+  stamp->inode = st->st_ino;
+}
+
+gboolean
+file_stamp_equal (const FileStamp * a, const FileStamp * b)
+{
+  return a->size == b->size && a->mtime == b->mtime
+      && a->mtime_nsec == b->mtime_nsec && a->inode == b->inode;
+}
+
+/* On-disk caches. Every cache file holds a single GVariant starting with
+ * the format version and the FileStamp of the file it was built from, as
+ * (utxxt), so stale entries are dropped without looking at the rest */
+gchar *
+cache_file_get_filename (const gchar * cache_dir, const gchar * path,
+    const gchar * suffix)
+{
+  gchar *abspath, *checksum, *basename, *filename;
+
+  if (cache_dir == NULL)
+    return NULL;
+
+  if (g_path_is_absolute (path)) {
+    abspath = g_strdup (path);
+  } else {
+    gchar *cwd = g_get_current_dir ();
+
+    abspath = g_build_filename (cwd, path, NULL);
+    g_free (cwd);
+  }
+
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, abspath, -1);
+  basename = g_strconcat (checksum, suffix, NULL);
+  filename = g_build_filename (cache_dir, basename, NULL);
+
+  g_free (abspath);
+  g_free (checksum);
+  g_free (basename);
+
+  return filename;
+}
+
+void
+cache_file_save (const gchar * cachepath, GVariant * variant)
+{
+  gchar *dirname = g_path_get_dirname (cachepath);
+
+  g_mkdir_with_parents (dirname, 0755);
+  g_file_set_contents (cachepath, g_variant_get_data (variant),
+      g_variant_get_size (variant), NULL);
+
+  g_free (dirname);
+}
+
+/* Maps @cachepath, returns %NULL if it does not exist or was not built
+ * from a file matching @stamp with this @version of the format */
+GVariant *
+cache_file_load (const gchar * cachepath, const GVariantType * type,
+    guint32 version, const FileStamp * stamp)
+{
+  guint32 cached_version;
+  gint64 mtime_nsec;
+  FileStamp cached;
+  GVariant *variant;
+  GMappedFile *mfile;
+
+  mfile = g_mapped_file_new (cachepath, FALSE, NULL);
+  if (mfile == NULL)
+    return NULL;
+
+  if (g_mapped_file_get_length (mfile) == 0) {
+    g_mapped_file_unref (mfile);
+    return NULL;
+  }
+
+  variant = g_variant_ref_sink (g_variant_new_from_data (type,
+          g_mapped_file_get_contents (mfile), g_mapped_file_get_length (mfile),
+          FALSE, (GDestroyNotify) g_mapped_file_unref, mfile));
+
+  g_variant_get_child (variant, 0, "u", &cached_version);
+  g_variant_get_child (variant, 1, "t", &cached.size);
+  g_variant_get_child (variant, 2, "x", &cached.mtime);
+  g_variant_get_child (variant, 3, "x", &mtime_nsec);
+  g_variant_get_child (variant, 4, "t", &cached.inode);
+  cached.mtime_nsec = mtime_nsec;
+  if (cached_version != version || !file_stamp_equal (&cached, stamp)) {
+    g_variant_unref (variant);
+    return NULL;
+  }
+
+  return variant;
+}
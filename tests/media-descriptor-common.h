@@ -24,6 +24,7 @@
 #define MEDIA_DESCRIPTOR_COMMON_H
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <insanity-gst/insanity-gst.h>
 
 /* Parsing structures */
@@ -98,13 +99,34 @@ typedef struct
   GstClockTime pts, dts;
   gboolean is_keyframe;
 
+  /* Payload checksum, only valid if has_checksum is set */
+  gboolean has_checksum;
+  guint64 checksum;
+
   GstBuffer *buf;
 
   gchar *str_open;
   gchar *str_close;
 } FrameNode;
 
+/* What a file looked like when it was loaded, to tell when it changed */
+typedef struct
+{
+  guint64 size;
+  gint64 mtime;
+  glong mtime_nsec;
+  guint64 inode;
+} FileStamp;
+
 void free_filenode (FileNode * filenode);
 gboolean tag_node_compare (TagNode * tnode, const GstTagList * tlist);
+guint64 buffer_compute_checksum (GstBuffer * buf);
+
+void file_stamp_init (FileStamp * stamp, const GStatBuf * st);
+gboolean file_stamp_equal (const FileStamp * a, const FileStamp * b);
+
+gchar *cache_file_get_filename (const gchar * cache_dir, const gchar * path, const gchar * suffix);
+void cache_file_save (const gchar * cachepath, GVariant * variant);
+GVariant *cache_file_load (const gchar * cachepath, const GVariantType * type, guint32 version, const FileStamp * stamp);
 
 #endif /* MEDIA_DESCRIPTOR_COMMON_H */
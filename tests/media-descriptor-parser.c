@@ -23,6 +23,10 @@
 #include "media-descriptor-parser.h"
 #include "media-descriptor-common.h"
 
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
 G_DEFINE_TYPE (MediaDescriptorParser, media_descriptor_parser, G_TYPE_OBJECT);
 
 #define LOG(test, format , args...) \
@@ -30,6 +34,14 @@ G_DEFINE_TYPE (MediaDescriptorParser, media_descriptor_parser, G_TYPE_OBJECT);
 #define ERROR(test, format, args...) \
   INSANITY_LOG (test, "mediadescparser", INSANITY_LOG_LEVEL_SPAM, format "\n", ##args)
 
+/* On-disk cache, the parsed descriptor is stored as a GVariant so it can be
+ * loaded back with a single mmap. Bump whenever its layout changes */
+#define CACHE_FORMAT_VERSION 2
+
+#define FRAME_VARIANT_FORMAT "(ttttttbbt)"
+#define STREAM_VARIANT_FORMAT "(tssa" FRAME_VARIANT_FORMAT ")"
+#define CACHE_VARIANT_FORMAT "(utxxtstbba" STREAM_VARIANT_FORMAT "aas)"
+
 enum
 {
   PROP_0,
@@ -37,16 +49,100 @@ enum
   N_PROPERTIES
 };
 
+typedef struct
+{
+  FrameNode **frames;
+  guint n_frames;
+
+  /* Positions of the keyframes in frames */
+  guint *keyframes;
+  guint n_keyframes;
+} StreamFrames;
+
+/* A parsed media descriptor file. It is never modified once loaded so it can
+ * be shared between all the parsers opened on the same file, the matching
+ * state lives in each parser */
+typedef struct
+{
+  gint refcount;
+
+  /* What the descriptor was loaded from */
+  FileStamp stamp;
+
+  FileNode *filenode;
+
+  /* StreamNode and TagNode, the position of a node in those arrays is used
+   * to find its matching state in the parsers */
+  GPtrArray *streams;
+  GPtrArray *tags;
+
+  /* Lookup tables, caps name quark -> GList of stream positions
+   * and tag name quark -> GList of tag positions */
+  GHashTable *caps_streams;
+  GHashTable *tag_nodes;
+
+  /* Frames of each stream sorted by PTS, as many as streams */
+  StreamFrames *stream_frames;
+} MediaDescriptor;
+
+typedef struct
+{
+  StreamNode *node;
+
+  GstPad *pad;
+  GList *cframe;
+} StreamState;
+
+typedef struct
+{
+  InsanityTest *test;
+  FileNode *filenode;
+} MarkupData;
+
+struct _MediaDescriptorFrameIter
+{
+  MediaDescriptor *desc;
+
+  /* Streams iterated over, and the position of the next frame in each */
+  guint first_stream;
+  guint n_streams;
+  guint positions[1];
+};
+
 struct _MediaDescriptorParserPrivate
 {
   gchar *xmlpath;
   InsanityTest *test;
 
-  gchar *xmlcontent;
-  FileNode *filenode;
-  GMarkupParseContext *parsecontext;
+  MediaDescriptor *desc;
+  FileNode *filenode;           /* Shortcut to desc->filenode, read only */
+
+  /* Matching state */
+  StreamState *streams;         /* As many as desc->streams */
+  gboolean *tags_found;         /* As many as desc->tags */
+
+  /* GstPad -> StreamState, filled as streams get matched */
+  GHashTable *pad_streams;
+#ifdef USE_NEW_GLIB_MUTEX_API
+  GMutex lock;
+#else
+  GMutex *lock;
+#endif
 };
 
+#ifdef USE_NEW_GLIB_MUTEX_API
+#define PARSER_LOCK(parser) g_mutex_lock(&(parser)->priv->lock)
+#define PARSER_UNLOCK(parser) g_mutex_unlock(&(parser)->priv->lock)
+#else
+#define PARSER_LOCK(parser) g_mutex_lock((parser)->priv->lock)
+#define PARSER_UNLOCK(parser) g_mutex_unlock((parser)->priv->lock)
+#endif
+
+/* Process wide cache of the parsed descriptors, xml path -> MediaDescriptor */
+G_LOCK_DEFINE_STATIC (descriptor_cache);
+static GHashTable *descriptor_cache = NULL;
+static gchar *descriptor_cache_dir = NULL;
+
 /* Private methods  and callbacks */
 static gint
 compare_frames (FrameNode * frm, FrameNode * frm1)
@@ -122,6 +218,21 @@ deserialize_tagnode (const gchar ** names, const gchar ** values)
   return tagnode;
 }
 
+static inline void
+framenode_init_buffer (FrameNode * framenode)
+{
+  framenode->buf = gst_buffer_new ();
+
+  GST_BUFFER_OFFSET (framenode->buf) = framenode->offset;
+  GST_BUFFER_OFFSET_END (framenode->buf) = framenode->offset_end;
+  GST_BUFFER_DURATION (framenode->buf) = framenode->duration;
+  GST_BUFFER_PTS (framenode->buf) = framenode->pts;
+  GST_BUFFER_DTS (framenode->buf) = framenode->dts;
+
+  if (framenode->is_keyframe == FALSE)
+    GST_BUFFER_FLAG_SET (framenode->buf, GST_BUFFER_FLAG_DELTA_UNIT);
+}
+
 static inline FrameNode *
 deserialize_framenode (const gchar ** names, const gchar ** values)
 {
@@ -144,18 +255,13 @@ deserialize_framenode (const gchar ** names, const gchar ** values)
       framenode->dts = g_ascii_strtoull (values[i], NULL, 0);
     else if (g_strcmp0 (names[i], "is-keyframe") == 0)
       framenode->is_keyframe = g_ascii_strtoull (values[i], NULL, 0);
+    else if (g_strcmp0 (names[i], "checksum") == 0) {
+      framenode->checksum = g_ascii_strtoull (values[i], NULL, 0);
+      framenode->has_checksum = TRUE;
+    }
   }
 
-  framenode->buf = gst_buffer_new ();
-
-  GST_BUFFER_OFFSET (framenode->buf) = framenode->offset;
-  GST_BUFFER_OFFSET_END (framenode->buf) = framenode->offset_end;
-  GST_BUFFER_DURATION (framenode->buf) = framenode->duration;
-  GST_BUFFER_PTS (framenode->buf) = framenode->pts;
-  GST_BUFFER_DTS (framenode->buf) = framenode->dts;
-
-  if (framenode->is_keyframe == FALSE)
-    GST_BUFFER_FLAG_SET (framenode->buf, GST_BUFFER_FLAG_DELTA_UNIT);
+  framenode_init_buffer (framenode);
 
   return framenode;
 }
@@ -171,6 +277,8 @@ frame_node_compare (FrameNode * fnode, GstBuffer * buf, GstBuffer * expected)
     GST_BUFFER_PTS (expected) = fnode->pts;
     GST_BUFFER_DTS (expected) = fnode->dts;
     if (fnode->is_keyframe)
+      GST_BUFFER_FLAG_UNSET (expected, GST_BUFFER_FLAG_DELTA_UNIT);
+    else
       GST_BUFFER_FLAG_SET (expected, GST_BUFFER_FLAG_DELTA_UNIT);
   }
 
@@ -179,12 +287,16 @@ frame_node_compare (FrameNode * fnode, GstBuffer * buf, GstBuffer * expected)
           fnode->duration == GST_BUFFER_DURATION (buf) &&
           fnode->pts == GST_BUFFER_PTS (buf) &&
           fnode->dts == GST_BUFFER_DTS (buf) &&
-          fnode->is_keyframe == GST_BUFFER_FLAG_IS_SET (buf,
+          fnode->is_keyframe != GST_BUFFER_FLAG_IS_SET (buf,
               GST_BUFFER_FLAG_DELTA_UNIT)) == FALSE) {
-    return TRUE;
+    return FALSE;
   }
 
-  return FALSE;
+  /* Only hash the payload once the cheap checks passed */
+  if (fnode->has_checksum && fnode->checksum != buffer_compute_checksum (buf))
+    return FALSE;
+
+  return TRUE;
 }
 
 static void
@@ -192,72 +304,481 @@ on_start_element_cb (GMarkupParseContext * context,
     const gchar * element_name, const gchar ** attribute_names,
     const gchar ** attribute_values, gpointer user_data, GError ** error)
 {
-  MediaDescriptorParserPrivate *priv;
-
-  priv = MEDIA_DESCRIPTOR_PARSER (user_data)->priv;
+  MarkupData *data = (MarkupData *) user_data;
 
   if (g_strcmp0 (element_name, "file") == 0) {
-    priv->filenode = deserialize_filenode (attribute_names, attribute_values);
+    data->filenode = deserialize_filenode (attribute_names, attribute_values);
   } else if (g_strcmp0 (element_name, "stream") == 0) {
-    priv->filenode->streams = g_list_prepend (priv->filenode->streams,
+    data->filenode->streams = g_list_prepend (data->filenode->streams,
         deserialize_streamnode (attribute_names, attribute_values));
   } else if (g_strcmp0 (element_name, "frame") == 0) {
-    StreamNode *streamnode = priv->filenode->streams->data;
+    StreamNode *streamnode = data->filenode->streams->data;
 
-    streamnode->cframe = streamnode->frames =
-        g_list_insert_sorted (streamnode->frames,
-        deserialize_framenode (attribute_names, attribute_values),
-        (GCompareFunc) compare_frames);
+    /* Sorted once the whole stream is read */
+    streamnode->frames = g_list_prepend (streamnode->frames,
+        deserialize_framenode (attribute_names, attribute_values));
   } else if (g_strcmp0 (element_name, "tags") == 0) {
-    priv->filenode->tags = g_list_prepend (priv->filenode->tags,
+    data->filenode->tags = g_list_prepend (data->filenode->tags,
         deserialize_tagsnode (attribute_names, attribute_values));
   } else if (g_strcmp0 (element_name, "tag") == 0) {
-    TagsNode *tagsnode = priv->filenode->tags->data;
+    TagsNode *tagsnode = data->filenode->tags->data;
 
     tagsnode->tags = g_list_prepend (tagsnode->tags,
         deserialize_tagnode (attribute_names, attribute_values));
   }
 }
 
+static void
+on_end_element_cb (GMarkupParseContext * context,
+    const gchar * element_name, gpointer user_data, GError ** error)
+{
+  MarkupData *data = (MarkupData *) user_data;
+
+  if (g_strcmp0 (element_name, "stream") == 0) {
+    StreamNode *streamnode = data->filenode->streams->data;
+
+    streamnode->frames = g_list_sort (streamnode->frames,
+        (GCompareFunc) compare_frames);
+  }
+}
+
 static void
 on_error_cb (GMarkupParseContext * context, GError * error, gpointer user_data)
 {
-  ERROR (MEDIA_DESCRIPTOR_PARSER (user_data)->priv->test,
-      "Error parsing file: %s", error->message);
+  ERROR (((MarkupData *) user_data)->test, "Error parsing file: %s",
+      error->message);
 }
 
 static const GMarkupParser content_parser = {
   on_start_element_cb,
-  NULL,
+  on_end_element_cb,
   NULL,
   NULL,
   &on_error_cb
 };
 
-static gboolean
-set_xml_path (MediaDescriptorParser * parser, const gchar * path,
-    GError ** error)
+static inline GQuark
+caps_get_index_key (const GstCaps * caps)
+{
+  if (caps == NULL || gst_caps_get_size (caps) == 0)
+    return 0;
+
+  return gst_structure_get_name_id (gst_caps_get_structure (caps, 0));
+}
+
+static inline GQuark
+taglist_get_index_key (const GstTagList * taglist)
+{
+  if (taglist == NULL || gst_tag_list_n_tags (taglist) == 0)
+    return 0;
+
+  return g_quark_from_string (gst_tag_list_nth_tag_name (taglist, 0));
+}
+
+/* Frames without a PTS go last, frames sharing a PTS keep their id order */
+static gint
+compare_frames_pts (FrameNode ** frm, FrameNode ** frm1)
+{
+  if ((*frm)->pts != (*frm1)->pts)
+    return (*frm)->pts < (*frm1)->pts ? -1 : 1;
+
+  return compare_frames (*frm, *frm1);
+}
+
+/* Returns the position of the first frame with a PTS greater than @pts */
+static guint
+stream_frames_upper_bound (StreamFrames * sframes, GstClockTime pts)
+{
+  guint low = 0, high = sframes->n_frames;
+
+  while (low < high) {
+    guint middle = low + (high - low) / 2;
+
+    if (sframes->frames[middle]->pts <= pts)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  return low;
+}
+
+static void
+index_prepend (GHashTable * table, GQuark key, guint position)
+{
+  gpointer k = GUINT_TO_POINTER (key);
+  GList *list = g_hash_table_lookup (table, k);
+
+  /* The list is owned by the table, replacing the value must not free it */
+  g_hash_table_steal (table, k);
+  g_hash_table_insert (table, k, g_list_prepend (list,
+          GUINT_TO_POINTER (position)));
+}
+
+/* Takes ownership of @filenode */
+static MediaDescriptor *
+media_descriptor_new (FileNode * filenode, const FileStamp * stamp)
+{
+  GList *tmp, *tmptag;
+  guint i, j;
+  MediaDescriptor *desc = g_slice_new0 (MediaDescriptor);
+
+  desc->refcount = 1;
+  desc->stamp = *stamp;
+  desc->filenode = filenode;
+  desc->streams = g_ptr_array_new ();
+  desc->tags = g_ptr_array_new ();
+  desc->caps_streams = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) g_list_free);
+  desc->tag_nodes = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) g_list_free);
+
+  for (tmp = filenode->streams; tmp; tmp = tmp->next)
+    g_ptr_array_add (desc->streams, tmp->data);
+
+  desc->stream_frames = g_new0 (StreamFrames, desc->streams->len);
+  for (i = 0; i < desc->streams->len; i++) {
+    StreamNode *streamnode = g_ptr_array_index (desc->streams, i);
+    StreamFrames *sframes = &desc->stream_frames[i];
+
+    sframes->n_frames = g_list_length (streamnode->frames);
+    sframes->frames = g_new (FrameNode *, sframes->n_frames);
+    for (tmp = streamnode->frames, j = 0; tmp; tmp = tmp->next, j++)
+      sframes->frames[j] = tmp->data;
+
+    g_qsort_with_data (sframes->frames, sframes->n_frames,
+        sizeof (FrameNode *), (GCompareDataFunc) compare_frames_pts, NULL);
+
+    sframes->keyframes = g_new (guint, sframes->n_frames);
+    for (j = 0; j < sframes->n_frames; j++) {
+      if (sframes->frames[j]->is_keyframe)
+        sframes->keyframes[sframes->n_keyframes++] = j;
+    }
+  }
+
+  for (tmp = filenode->tags; tmp; tmp = tmp->next) {
+    for (tmptag = ((TagsNode *) tmp->data)->tags; tmptag; tmptag = tmptag->next)
+      g_ptr_array_add (desc->tags, tmptag->data);
+  }
+
+  /* Walk the nodes backward so each candidate list ends up in the same order
+   * as the node lists, matching then gives the same result as a linear scan
+   * would */
+  for (i = desc->streams->len; i > 0; i--) {
+    StreamNode *streamnode = g_ptr_array_index (desc->streams, i - 1);
+
+    index_prepend (desc->caps_streams, caps_get_index_key (streamnode->caps),
+        i - 1);
+  }
+
+  /* A taglist can only be equal to a node holding the same tags, so index
+   * each node under every tag name it contains and look up incoming
+   * taglists by their first tag name */
+  for (i = desc->tags->len; i > 0; i--) {
+    TagNode *tagnode = g_ptr_array_index (desc->tags, i - 1);
+    gint n_tags;
+
+    if (tagnode->taglist == NULL)
+      continue;
+
+    n_tags = gst_tag_list_n_tags (tagnode->taglist);
+    if (n_tags == 0)
+      index_prepend (desc->tag_nodes, 0, i - 1);
+
+    for (j = 0; j < (guint) n_tags; j++) {
+      index_prepend (desc->tag_nodes,
+          g_quark_from_string (gst_tag_list_nth_tag_name (tagnode->taglist,
+                  j)), i - 1);
+    }
+  }
+
+  return desc;
+}
+
+static MediaDescriptor *
+media_descriptor_ref (MediaDescriptor * desc)
+{
+  g_atomic_int_inc (&desc->refcount);
+
+  return desc;
+}
+
+static void
+media_descriptor_unref (MediaDescriptor * desc)
+{
+  guint i;
+
+  if (g_atomic_int_dec_and_test (&desc->refcount) == FALSE)
+    return;
+
+  for (i = 0; i < desc->streams->len; i++) {
+    g_free (desc->stream_frames[i].frames);
+    g_free (desc->stream_frames[i].keyframes);
+  }
+  g_free (desc->stream_frames);
+
+  g_hash_table_destroy (desc->caps_streams);
+  g_hash_table_destroy (desc->tag_nodes);
+  g_ptr_array_free (desc->streams, TRUE);
+  g_ptr_array_free (desc->tags, TRUE);
+  free_filenode (desc->filenode);
+
+  g_slice_free (MediaDescriptor, desc);
+}
+
+static MediaDescriptor *
+media_descriptor_new_from_xml (InsanityTest * test, const gchar * path,
+    const FileStamp * stamp, GError ** error)
 {
   gsize xmlsize;
+  gchar *xmlcontent = NULL;
   GError *err = NULL;
-  MediaDescriptorParserPrivate *priv = parser->priv;
+  GMarkupParseContext *parsecontext;
+  MarkupData data = { test, NULL };
 
-  if (!g_file_get_contents (path, &priv->xmlcontent, &xmlsize, &err))
+  if (!g_file_get_contents (path, &xmlcontent, &xmlsize, &err))
     goto failed;
 
-  priv->xmlpath = g_strdup (path);
-  priv->parsecontext = g_markup_parse_context_new (&content_parser,
-      G_MARKUP_TREAT_CDATA_AS_TEXT, parser, NULL);
+  parsecontext = g_markup_parse_context_new (&content_parser,
+      G_MARKUP_TREAT_CDATA_AS_TEXT, &data, NULL);
 
-  if (g_markup_parse_context_parse (priv->parsecontext, priv->xmlcontent,
-          xmlsize, &err) == FALSE)
+  if (g_markup_parse_context_parse (parsecontext, xmlcontent,
+          xmlsize, &err) == FALSE) {
+    g_markup_parse_context_free (parsecontext);
     goto failed;
+  }
+  g_markup_parse_context_free (parsecontext);
+  g_free (xmlcontent);
 
-  return TRUE;
+  if (data.filenode == NULL) {
+    g_set_error (error, G_MARKUP_ERROR, G_MARKUP_ERROR_INVALID_CONTENT,
+        "No file node found in %s", path);
+    return NULL;
+  }
+
+  return media_descriptor_new (data.filenode, stamp);
 
 failed:
+  g_free (xmlcontent);
+  if (data.filenode)
+    free_filenode (data.filenode);
+
   g_propagate_error (error, err);
-  return FALSE;
+  return NULL;
+}
+
+static void
+media_descriptor_save_cache_file (MediaDescriptor * desc,
+    const gchar * cachepath)
+{
+  GList *tmp, *tmp2;
+  GVariant *variant;
+  GVariantBuilder streams, tags;
+  FileNode *filenode = desc->filenode;
+
+  g_variant_builder_init (&streams, G_VARIANT_TYPE ("a"
+          STREAM_VARIANT_FORMAT));
+  for (tmp = filenode->streams; tmp; tmp = tmp->next) {
+    GVariantBuilder frames;
+    StreamNode *snode = (StreamNode *) tmp->data;
+    gchar *capsstr = snode->caps ? gst_caps_to_string (snode->caps) : NULL;
+
+    g_variant_builder_init (&frames, G_VARIANT_TYPE ("a"
+            FRAME_VARIANT_FORMAT));
+    for (tmp2 = snode->frames; tmp2; tmp2 = tmp2->next) {
+      FrameNode *fnode = (FrameNode *) tmp2->data;
+
+      g_variant_builder_add (&frames, FRAME_VARIANT_FORMAT, fnode->id,
+          fnode->offset, fnode->offset_end, fnode->duration, fnode->pts,
+          fnode->dts, fnode->is_keyframe, fnode->has_checksum,
+          fnode->checksum);
+    }
+
+    g_variant_builder_add (&streams, STREAM_VARIANT_FORMAT, snode->id,
+        capsstr ? capsstr : "", snode->padname ? snode->padname : "",
+        &frames);
+    g_free (capsstr);
+  }
+
+  g_variant_builder_init (&tags, G_VARIANT_TYPE ("aas"));
+  for (tmp = filenode->tags; tmp; tmp = tmp->next) {
+    GVariantBuilder tagsnode;
+
+    g_variant_builder_init (&tagsnode, G_VARIANT_TYPE ("as"));
+    for (tmp2 = ((TagsNode *) tmp->data)->tags; tmp2; tmp2 = tmp2->next) {
+      TagNode *tagnode = (TagNode *) tmp2->data;
+      gchar *tagstr = tagnode->taglist ?
+          gst_tag_list_to_string (tagnode->taglist) : NULL;
+
+      g_variant_builder_add (&tagsnode, "s", tagstr ? tagstr : "");
+      g_free (tagstr);
+    }
+    g_variant_builder_add (&tags, "as", &tagsnode);
+  }
+
+  variant = g_variant_ref_sink (g_variant_new (CACHE_VARIANT_FORMAT,
+          CACHE_FORMAT_VERSION, desc->stamp.size, desc->stamp.mtime,
+          (gint64) desc->stamp.mtime_nsec, desc->stamp.inode,
+          filenode->location ? filenode->location : "", filenode->duration,
+          filenode->frame_detection, filenode->seekable, &streams, &tags));
+
+  cache_file_save (cachepath, variant);
+  g_variant_unref (variant);
+}
+
+static MediaDescriptor *
+media_descriptor_load_cache_file (const gchar * cachepath,
+    const FileStamp * stamp)
+{
+  guint64 streamid;
+  const gchar *location, *capsstr, *padname;
+  GVariant *variant;
+  GVariantIter *streams_iter, *tags_iter, *frames_iter, *tag_iter;
+  FileNode *filenode;
+
+  variant = cache_file_load (cachepath, G_VARIANT_TYPE (CACHE_VARIANT_FORMAT),
+      CACHE_FORMAT_VERSION, stamp);
+  if (variant == NULL)
+    return NULL;
+
+  filenode = g_slice_new0 (FileNode);
+  g_variant_get (variant, "(utxxt&stbba" STREAM_VARIANT_FORMAT "aas)",
+      NULL, NULL, NULL, NULL, NULL, &location, &filenode->duration,
+      &filenode->frame_detection, &filenode->seekable, &streams_iter,
+      &tags_iter);
+  filenode->location = location[0] ? g_strdup (location) : NULL;
+
+  while (g_variant_iter_next (streams_iter, "(t&s&sa" FRAME_VARIANT_FORMAT ")",
+          &streamid, &capsstr, &padname, &frames_iter)) {
+    FrameNode fnode;
+    StreamNode *snode = g_slice_new0 (StreamNode);
+
+    snode->id = streamid;
+    snode->caps = capsstr[0] ? gst_caps_from_string (capsstr) : NULL;
+    snode->padname = padname[0] ? g_strdup (padname) : NULL;
+
+    while (g_variant_iter_next (frames_iter, FRAME_VARIANT_FORMAT, &fnode.id,
+            &fnode.offset, &fnode.offset_end, &fnode.duration, &fnode.pts,
+            &fnode.dts, &fnode.is_keyframe, &fnode.has_checksum,
+            &fnode.checksum)) {
+      FrameNode *framenode = g_slice_dup (FrameNode, &fnode);
+
+      framenode->str_open = framenode->str_close = NULL;
+      framenode_init_buffer (framenode);
+      snode->frames = g_list_prepend (snode->frames, framenode);
+    }
+    snode->frames = g_list_reverse (snode->frames);
+    g_variant_iter_free (frames_iter);
+
+    filenode->streams = g_list_prepend (filenode->streams, snode);
+  }
+  filenode->streams = g_list_reverse (filenode->streams);
+  g_variant_iter_free (streams_iter);
+
+  while (g_variant_iter_next (tags_iter, "as", &tag_iter)) {
+    const gchar *tagstr;
+    TagsNode *tagsnode = g_slice_new0 (TagsNode);
+
+    while (g_variant_iter_next (tag_iter, "&s", &tagstr)) {
+      TagNode *tagnode = g_slice_new0 (TagNode);
+
+      tagnode->taglist = tagstr[0] ? gst_tag_list_new_from_string (tagstr) :
+          NULL;
+      tagsnode->tags = g_list_prepend (tagsnode->tags, tagnode);
+    }
+    tagsnode->tags = g_list_reverse (tagsnode->tags);
+    g_variant_iter_free (tag_iter);
+
+    filenode->tags = g_list_prepend (filenode->tags, tagsnode);
+  }
+  filenode->tags = g_list_reverse (filenode->tags);
+  g_variant_iter_free (tags_iter);
+
+  g_variant_unref (variant);
+
+  return media_descriptor_new (filenode, stamp);
+}
+
+static MediaDescriptor *
+media_descriptor_get (InsanityTest * test, const gchar * path,
+    GError ** error)
+{
+  GStatBuf st;
+  FileStamp stamp;
+  gchar *cachepath;
+  MediaDescriptor *desc = NULL;
+
+  if (g_stat (path, &st) != 0) {
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+        "Could not stat %s", path);
+    return NULL;
+  }
+  file_stamp_init (&stamp, &st);
+
+  G_LOCK (descriptor_cache);
+  if (descriptor_cache != NULL)
+    desc = g_hash_table_lookup (descriptor_cache, path);
+
+  if (desc && file_stamp_equal (&desc->stamp, &stamp)) {
+    media_descriptor_ref (desc);
+    G_UNLOCK (descriptor_cache);
+
+    LOG (test, "Using cached media descriptor for %s", path);
+    return desc;
+  }
+  cachepath = cache_file_get_filename (descriptor_cache_dir, path, ".mdcache");
+  G_UNLOCK (descriptor_cache);
+
+  if (cachepath)
+    desc = media_descriptor_load_cache_file (cachepath, &stamp);
+
+  if (desc) {
+    LOG (test, "Loaded media descriptor for %s from %s", path, cachepath);
+  } else {
+    desc = media_descriptor_new_from_xml (test, path, &stamp, error);
+
+    if (desc && cachepath)
+      media_descriptor_save_cache_file (desc, cachepath);
+  }
+  g_free (cachepath);
+
+  if (desc == NULL)
+    return NULL;
+
+  G_LOCK (descriptor_cache);
+  if (descriptor_cache == NULL)
+    descriptor_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+        g_free, (GDestroyNotify) media_descriptor_unref);
+  g_hash_table_insert (descriptor_cache, g_strdup (path),
+      media_descriptor_ref (desc));
+  G_UNLOCK (descriptor_cache);
+
+  return desc;
+}
+
+static gboolean
+set_xml_path (MediaDescriptorParser * parser, const gchar * path,
+    GError ** error)
+{
+  guint i;
+  MediaDescriptorParserPrivate *priv = parser->priv;
+
+  priv->desc = media_descriptor_get (priv->test, path, error);
+  if (priv->desc == NULL)
+    return FALSE;
+
+  priv->xmlpath = g_strdup (path);
+  priv->filenode = priv->desc->filenode;
+
+  priv->streams = g_new0 (StreamState, priv->desc->streams->len);
+  for (i = 0; i < priv->desc->streams->len; i++) {
+    priv->streams[i].node = g_ptr_array_index (priv->desc->streams, i);
+    priv->streams[i].cframe = priv->streams[i].node->frames;
+  }
+
+  priv->tags_found = g_new0 (gboolean, priv->desc->tags->len);
+
+  return TRUE;
 }
 
 /* GObject standard vmethods */
@@ -269,18 +790,31 @@ dispose (MediaDescriptorParser * parser)
 static void
 finalize (MediaDescriptorParser * parser)
 {
+  guint i;
   MediaDescriptorParserPrivate *priv;
 
   priv = parser->priv;
 
+  if (priv->desc) {
+    for (i = 0; i < priv->desc->streams->len; i++) {
+      if (priv->streams[i].pad)
+        gst_object_unref (priv->streams[i].pad);
+    }
+
+    media_descriptor_unref (priv->desc);
+  }
+
   g_free (priv->xmlpath);
-  g_free (priv->xmlcontent);
+  g_free (priv->streams);
+  g_free (priv->tags_found);
 
-  if (priv->filenode)
-    free_filenode (priv->filenode);
+  g_hash_table_destroy (priv->pad_streams);
 
-  if (priv->parsecontext != NULL)
-    g_markup_parse_context_free (priv->parsecontext);
+#ifdef USE_NEW_GLIB_MUTEX_API
+  g_mutex_clear (&priv->lock);
+#else
+  g_mutex_free (priv->lock);
+#endif
 }
 
 
@@ -316,6 +850,17 @@ media_descriptor_parser_init (MediaDescriptorParser * parser)
   priv->xmlpath = NULL;
   priv->filenode = NULL;
   priv->test = NULL;
+  priv->desc = NULL;
+  priv->streams = NULL;
+  priv->tags_found = NULL;
+
+  priv->pad_streams = g_hash_table_new (NULL, NULL);
+
+#ifdef USE_NEW_GLIB_MUTEX_API
+  g_mutex_init (&priv->lock);
+#else
+  priv->lock = g_mutex_new ();
+#endif
 }
 
 static void
@@ -352,6 +897,50 @@ media_descriptor_parser_new (InsanityTest * test,
   return parser;
 }
 
+/**
+ * media_descriptor_parser_set_cache_dir:
+ * @cache_dir: (allow-none): The directory where to store parsed descriptors
+ *
+ * Parsed descriptors are always shared between the parsers of a process,
+ * setting a cache directory also stores them on disk so other processes
+ * do not need to parse the XML files again. %NULL disables the on-disk cache.
+ */
+void
+media_descriptor_parser_set_cache_dir (const gchar * cache_dir)
+{
+  G_LOCK (descriptor_cache);
+  g_free (descriptor_cache_dir);
+  descriptor_cache_dir = (cache_dir && cache_dir[0]) ? g_strdup (cache_dir) :
+      NULL;
+  G_UNLOCK (descriptor_cache);
+}
+
+/**
+ * media_descriptor_parser_invalidate_cache:
+ * @xmlpath: The media descriptor file that changed
+ *
+ * Drops any cached version of @xmlpath so the next parser created for it
+ * parses the file again.
+ */
+void
+media_descriptor_parser_invalidate_cache (const gchar * xmlpath)
+{
+  gchar *cachepath;
+
+  G_LOCK (descriptor_cache);
+  if (descriptor_cache != NULL)
+    g_hash_table_remove (descriptor_cache, xmlpath);
+
+  cachepath = cache_file_get_filename (descriptor_cache_dir, xmlpath,
+      ".mdcache");
+  G_UNLOCK (descriptor_cache);
+
+  if (cachepath) {
+    g_unlink (cachepath);
+    g_free (cachepath);
+  }
+}
+
 gchar *
 media_descriptor_parser_get_xml_path (MediaDescriptorParser * parser)
 {
@@ -372,18 +961,23 @@ media_descriptor_parser_add_stream (MediaDescriptorParser * parser,
   g_return_val_if_fail (parser->priv->filenode, FALSE);
 
   caps = gst_pad_query_caps (pad, NULL);
-  for (tmp = parser->priv->filenode->streams; tmp; tmp = tmp->next) {
-    StreamNode *streamnode = (StreamNode *) tmp->data;
 
-    if (streamnode->pad == NULL && gst_caps_is_equal (streamnode->caps, caps)) {
+  PARSER_LOCK (parser);
+  for (tmp = g_hash_table_lookup (parser->priv->desc->caps_streams,
+          GUINT_TO_POINTER (caps_get_index_key (caps))); tmp; tmp = tmp->next) {
+    StreamState *state = &parser->priv->streams[GPOINTER_TO_UINT (tmp->data)];
+
+    if (state->pad == NULL && gst_caps_is_equal (state->node->caps, caps)) {
       ret = TRUE;
-      streamnode->pad = gst_object_ref (pad);
+      state->pad = gst_object_ref (pad);
+      g_hash_table_insert (parser->priv->pad_streams, pad, state);
 
       goto done;
     }
   }
 
 done:
+  PARSER_UNLOCK (parser);
   if (caps != NULL)
     gst_caps_unref (caps);
 
@@ -393,17 +987,14 @@ done:
 gboolean
 media_descriptor_parser_all_stream_found (MediaDescriptorParser * parser)
 {
-  GList *tmp;
+  guint i;
 
   g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), FALSE);
   g_return_val_if_fail (parser->priv->filenode, FALSE);
 
-  for (tmp = parser->priv->filenode->streams; tmp; tmp = tmp->next) {
-    StreamNode *streamnode = (StreamNode *) tmp->data;
-
-    if (streamnode->pad == NULL)
+  for (i = 0; i < parser->priv->desc->streams->len; i++) {
+    if (parser->priv->streams[i].pad == NULL)
       return FALSE;
-
   }
 
   return TRUE;
@@ -413,20 +1004,21 @@ gboolean
 media_descriptor_parser_add_frame (MediaDescriptorParser * parser,
     GstPad * pad, GstBuffer * buf, GstBuffer * expected)
 {
-  GList *tmp;
+  StreamState *state;
 
   g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), FALSE);
   g_return_val_if_fail (parser->priv->filenode, FALSE);
 
-  for (tmp = parser->priv->filenode->streams; tmp; tmp = tmp->next) {
-    StreamNode *streamnode = (StreamNode *) tmp->data;
+  PARSER_LOCK (parser);
+  state = g_hash_table_lookup (parser->priv->pad_streams, pad);
+  PARSER_UNLOCK (parser);
 
-    if (streamnode->pad == pad && streamnode->cframe) {
-      FrameNode *fnode = streamnode->cframe->data;
+  /* cframe is only ever touched from the streaming thread of its pad */
+  if (state && state->cframe) {
+    FrameNode *fnode = state->cframe->data;
 
-      streamnode->cframe = streamnode->cframe->next;
-      return frame_node_compare (fnode, buf, expected);
-    }
+    state->cframe = state->cframe->next;
+    return frame_node_compare (fnode, buf, expected);
   }
 
   return FALSE;
@@ -436,21 +1028,25 @@ gboolean
 media_descriptor_parser_add_taglist (MediaDescriptorParser * parser,
     GstTagList * taglist)
 {
-  GList *tmp, *tmptag;
-  TagsNode *tagsnode;
+  GList *tmptag;
+  MediaDescriptor *desc;
 
   g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), FALSE);
   g_return_val_if_fail (parser->priv->filenode, FALSE);
   g_return_val_if_fail (GST_IS_STRUCTURE (taglist), FALSE);
 
-  for (tmp = parser->priv->filenode->tags; tmp; tmp = tmp->next) {
-    tagsnode = (TagsNode *) tmp->data;
-
-    for (tmptag = tagsnode->tags; tmptag; tmptag = tmptag->next) {
-      if (tag_node_compare ((TagNode *) tmptag->data, taglist)) {
-        LOG (parser->priv->test, "Adding tag %" GST_PTR_FORMAT, taglist);
-        return TRUE;
-      }
+  desc = parser->priv->desc;
+  for (tmptag = g_hash_table_lookup (desc->tag_nodes,
+          GUINT_TO_POINTER (taglist_get_index_key (taglist))); tmptag;
+      tmptag = tmptag->next) {
+    guint position = GPOINTER_TO_UINT (tmptag->data);
+    TagNode *tagnode = g_ptr_array_index (desc->tags, position);
+
+    if (gst_structure_is_equal (GST_STRUCTURE (taglist),
+            GST_STRUCTURE (tagnode->taglist))) {
+      parser->priv->tags_found[position] = TRUE;
+      LOG (parser->priv->test, "Adding tag %" GST_PTR_FORMAT, taglist);
+      return TRUE;
     }
   }
 
@@ -460,34 +1056,30 @@ media_descriptor_parser_add_taglist (MediaDescriptorParser * parser,
 gboolean
 media_descriptor_parser_all_tags_found (MediaDescriptorParser * parser)
 {
-  GList *tmp, *tmptag;
-  TagsNode *tagsnode;
+  guint i;
   gboolean ret = TRUE;
 
   g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), FALSE);
   g_return_val_if_fail (parser->priv->filenode, FALSE);
 
-  for (tmp = parser->priv->filenode->tags; tmp; tmp = tmp->next) {
-    tagsnode = (TagsNode *) tmp->data;
-
-    for (tmptag = tagsnode->tags; tmptag; tmptag = tmptag->next) {
-      gchar *tag = NULL;
+  for (i = 0; i < parser->priv->desc->tags->len; i++) {
+    gchar *tag = NULL;
+    TagNode *tagnode = g_ptr_array_index (parser->priv->desc->tags, i);
 
-      tag = gst_tag_list_to_string (((TagNode *) tmptag->data)->taglist);
-      if (((TagNode *) tmptag->data)->found == FALSE) {
+    tag = gst_tag_list_to_string (tagnode->taglist);
+    if (parser->priv->tags_found[i] == FALSE) {
 
-        if (((TagNode *) tmptag->data)->taglist != NULL) {
-          LOG (parser->priv->test, "Tag not found %s", tag);
-        } else {
-          LOG (parser->priv->test, "Tag not not properly deserialized");
-        }
-
-        ret = FALSE;
+      if (tagnode->taglist != NULL) {
+        LOG (parser->priv->test, "Tag not found %s", tag);
+      } else {
+        LOG (parser->priv->test, "Tag not not properly deserialized");
       }
 
-      LOG (parser->priv->test, "Tag properly found found %s", tag);
-      g_free (tag);
+      ret = FALSE;
     }
+
+    LOG (parser->priv->test, "Tag properly found found %s", tag);
+    g_free (tag);
   }
 
   return ret;
@@ -520,44 +1112,295 @@ media_descriptor_parser_get_seekable (MediaDescriptorParser * parser)
   return parser->priv->filenode->seekable;
 }
 
-GList *
-media_descriptor_parser_get_buffers (MediaDescriptorParser * parser,
-    GstPad * pad, GCompareFunc compare_func)
+static StreamFrames *
+get_stream_frames (MediaDescriptorParser * parser, GstPad * pad)
 {
-  GList *ret = NULL, *tmpstream, *tmpframe;
-  gboolean check = (pad == NULL);
+  StreamState *state;
+  MediaDescriptorParserPrivate *priv = parser->priv;
 
-  g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), FALSE);
-  g_return_val_if_fail (parser->priv->filenode, FALSE);
+  PARSER_LOCK (parser);
+  state = g_hash_table_lookup (priv->pad_streams, pad);
+  PARSER_UNLOCK (parser);
 
-  for (tmpstream = parser->priv->filenode->streams; tmpstream;
-      tmpstream = tmpstream->next) {
-    StreamNode *streamnode = (StreamNode *) tmpstream->data;
-
-    if (pad && streamnode->pad == pad)
-      check = TRUE;
-
-    if (check) {
-      for (tmpframe = streamnode->frames; tmpframe; tmpframe = tmpframe->next) {
-        if (compare_func)
-          ret =
-              g_list_insert_sorted (ret,
-              gst_buffer_ref (((FrameNode *) tmpframe->data)->buf),
-              compare_func);
-        else
-          ret =
-              g_list_prepend (ret,
-              gst_buffer_ref (((FrameNode *) tmpframe->data)->buf));
-      }
+  if (state == NULL)
+    return NULL;
 
-      if (pad != NULL)
-        goto done;
+  return &priv->desc->stream_frames[state - priv->streams];
+}
+
+/**
+ * media_descriptor_parser_get_keyframe_before:
+ * @parser: The #MediaDescriptorParser
+ * @pad: The pad matched to the stream to look into
+ * @position: The timestamp to look for
+ *
+ * Returns: (transfer none): The expected buffer for the last keyframe with
+ * a PTS lower than or equal to @position, or %NULL if there is none
+ */
+GstBuffer *
+media_descriptor_parser_get_keyframe_before (MediaDescriptorParser * parser,
+    GstPad * pad, GstClockTime position)
+{
+  guint low = 0, high;
+  StreamFrames *sframes;
+
+  g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), NULL);
+  g_return_val_if_fail (parser->priv->filenode, NULL);
+
+  sframes = get_stream_frames (parser, pad);
+  if (sframes == NULL)
+    return NULL;
+
+  high = sframes->n_keyframes;
+  while (low < high) {
+    guint middle = low + (high - low) / 2;
+
+    if (sframes->frames[sframes->keyframes[middle]]->pts <= position)
+      low = middle + 1;
+    else
+      high = middle;
+  }
+
+  if (low == 0)
+    return NULL;
+
+  return sframes->frames[sframes->keyframes[low - 1]]->buf;
+}
+
+/**
+ * media_descriptor_parser_get_frame_at:
+ * @parser: The #MediaDescriptorParser
+ * @pad: The pad matched to the stream to look into
+ * @position: The timestamp to look for
+ *
+ * Frames without a valid duration are considered to last until the next
+ * frame.
+ *
+ * Returns: (transfer none): The expected buffer for the frame covering
+ * @position, or %NULL if there is none
+ */
+GstBuffer *
+media_descriptor_parser_get_frame_at (MediaDescriptorParser * parser,
+    GstPad * pad, GstClockTime position)
+{
+  guint next;
+  FrameNode *fnode;
+  StreamFrames *sframes;
+
+  g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), NULL);
+  g_return_val_if_fail (parser->priv->filenode, NULL);
+
+  sframes = get_stream_frames (parser, pad);
+  if (sframes == NULL)
+    return NULL;
+
+  next = stream_frames_upper_bound (sframes, position);
+  if (next == 0)
+    return NULL;
+
+  fnode = sframes->frames[next - 1];
+  if (GST_CLOCK_TIME_IS_VALID (fnode->pts) == FALSE)
+    return NULL;
+
+  if (GST_CLOCK_TIME_IS_VALID (fnode->duration) &&
+      fnode->pts + fnode->duration <= position)
+    return NULL;
+
+  return fnode->buf;
+}
+
+/**
+ * media_descriptor_parser_get_frame_after:
+ * @parser: The #MediaDescriptorParser
+ * @pad: The pad matched to the stream to look into
+ * @position: The timestamp to look for
+ *
+ * Returns: (transfer none): The expected buffer for the first frame with
+ * a PTS greater than @position, or %NULL if there is none
+ */
+GstBuffer *
+media_descriptor_parser_get_frame_after (MediaDescriptorParser * parser,
+    GstPad * pad, GstClockTime position)
+{
+  guint next;
+  StreamFrames *sframes;
+
+  g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), NULL);
+  g_return_val_if_fail (parser->priv->filenode, NULL);
+
+  sframes = get_stream_frames (parser, pad);
+  if (sframes == NULL)
+    return NULL;
+
+  next = stream_frames_upper_bound (sframes, position);
+  if (next == sframes->n_frames ||
+      GST_CLOCK_TIME_IS_VALID (sframes->frames[next]->pts) == FALSE)
+    return NULL;
+
+  return sframes->frames[next]->buf;
+}
+
+/**
+ * media_descriptor_parser_iter_frames:
+ * @parser: The #MediaDescriptorParser
+ * @pad: (allow-none): The pad to iterate the frames of, or %NULL to iterate
+ * the frames of all the streams
+ *
+ * Creates an iterator over the frames of the stream matched to @pad, or over
+ * the frames of all the streams merged, in PTS order. No memory is allocated
+ * while iterating.
+ *
+ * Returns: A new #MediaDescriptorFrameIter to free with
+ * media_descriptor_frame_iter_free(), or %NULL if no stream was
+ * matched to @pad
+ */
+MediaDescriptorFrameIter *
+media_descriptor_parser_iter_frames (MediaDescriptorParser * parser,
+    GstPad * pad)
+{
+  guint first_stream = 0, n_streams;
+  MediaDescriptorFrameIter *iter;
+  MediaDescriptorParserPrivate *priv;
+
+  g_return_val_if_fail (IS_MEDIA_DESCRIPTOR_PARSER (parser), NULL);
+  g_return_val_if_fail (parser->priv->filenode, NULL);
+
+  priv = parser->priv;
+  n_streams = priv->desc->streams->len;
+
+  if (pad != NULL) {
+    StreamState *state;
+
+    PARSER_LOCK (parser);
+    state = g_hash_table_lookup (priv->pad_streams, pad);
+    PARSER_UNLOCK (parser);
+
+    if (state == NULL)
+      return NULL;
+
+    first_stream = state - priv->streams;
+    n_streams = 1;
+  }
+
+  iter = g_malloc0 (sizeof (MediaDescriptorFrameIter) +
+      MAX (n_streams, 1) * sizeof (guint) - sizeof (guint));
+  iter->desc = media_descriptor_ref (priv->desc);
+  iter->first_stream = first_stream;
+  iter->n_streams = n_streams;
+
+  return iter;
+}
+
+void
+media_descriptor_frame_iter_free (MediaDescriptorFrameIter * iter)
+{
+  g_return_if_fail (iter != NULL);
+
+  media_descriptor_unref (iter->desc);
+  g_free (iter);
+}
+
+/* There are only a handful of streams, a linear pick of the smallest head
+ * is cheaper than maintaining a heap */
+static FrameNode *
+frame_iter_get_head (MediaDescriptorFrameIter * iter, guint * stream)
+{
+  guint i;
+  FrameNode *head = NULL;
+
+  for (i = 0; i < iter->n_streams; i++) {
+    StreamFrames *sframes =
+        &iter->desc->stream_frames[iter->first_stream + i];
+
+    if (iter->positions[i] < sframes->n_frames) {
+      FrameNode *fnode = sframes->frames[iter->positions[i]];
+
+      if (head == NULL || fnode->pts < head->pts) {
+        head = fnode;
+        *stream = i;
+      }
     }
   }
 
+  return head;
+}
 
-done:
-  return ret;
+/**
+ * media_descriptor_frame_iter_peek:
+ * @iter: The #MediaDescriptorFrameIter
+ *
+ * Returns: (transfer none): The expected buffer for the next frame, without
+ * moving the iterator, or %NULL if there are no more frames
+ */
+GstBuffer *
+media_descriptor_frame_iter_peek (MediaDescriptorFrameIter * iter)
+{
+  guint stream;
+  FrameNode *fnode;
+
+  g_return_val_if_fail (iter != NULL, NULL);
+
+  fnode = frame_iter_get_head (iter, &stream);
+
+  return fnode ? fnode->buf : NULL;
+}
+
+/**
+ * media_descriptor_frame_iter_next:
+ * @iter: The #MediaDescriptorFrameIter
+ *
+ * Returns: (transfer none): The expected buffer for the next frame, moving
+ * the iterator past it, or %NULL if there are no more frames
+ */
+GstBuffer *
+media_descriptor_frame_iter_next (MediaDescriptorFrameIter * iter)
+{
+  guint stream;
+  FrameNode *fnode;
+
+  g_return_val_if_fail (iter != NULL, NULL);
+
+  fnode = frame_iter_get_head (iter, &stream);
+  if (fnode == NULL)
+    return NULL;
+
+  iter->positions[stream]++;
+
+  return fnode->buf;
+}
+
+/**
+ * media_descriptor_frame_iter_seek:
+ * @iter: The #MediaDescriptorFrameIter
+ * @pts: The timestamp to move to
+ *
+ * Moves @iter to the first frame with a PTS greater than or equal to @pts,
+ * use 0 to rewind it.
+ */
+void
+media_descriptor_frame_iter_seek (MediaDescriptorFrameIter * iter,
+    GstClockTime pts)
+{
+  guint i;
+
+  g_return_if_fail (iter != NULL);
+
+  for (i = 0; i < iter->n_streams; i++) {
+    StreamFrames *sframes =
+        &iter->desc->stream_frames[iter->first_stream + i];
+    guint low = 0, high = sframes->n_frames;
+
+    while (low < high) {
+      guint middle = low + (high - low) / 2;
+
+      if (sframes->frames[middle]->pts < pts)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+    iter->positions[i] = low;
+  }
 }
 
 GList *
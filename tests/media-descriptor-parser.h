@@ -39,6 +39,7 @@ GType media_descriptor_parser_get_type (void);
 #define MEDIA_DESCRIPTOR_PARSER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), MEDIA_DESCRIPTOR_PARSER_TYPE, MediaDescriptorParserClass))
 
 typedef struct _MediaDescriptorParserPrivate MediaDescriptorParserPrivate;
+typedef struct _MediaDescriptorFrameIter MediaDescriptorFrameIter;
 
 
 typedef struct {
@@ -57,6 +58,9 @@ MediaDescriptorParser * media_descriptor_parser_new (InsanityTest *test,
                                                      const gchar * xmlpath,
                                                      GError **error);
 
+void media_descriptor_parser_set_cache_dir          (const gchar *cache_dir);
+void media_descriptor_parser_invalidate_cache       (const gchar *xmlpath);
+
 gchar * media_descriptor_parser_get_xml_path        (MediaDescriptorParser *parser);
 
 gboolean media_descriptor_parser_detects_frames     (MediaDescriptorParser *parser);
@@ -75,9 +79,24 @@ gboolean media_descriptor_parser_add_frame          (MediaDescriptorParser *pars
                                                      GstBuffer *buf,
                                                      GstBuffer *expected);
 
-GList * media_descriptor_parser_get_buffers         (MediaDescriptorParser * parser,
+GstBuffer * media_descriptor_parser_get_keyframe_before (MediaDescriptorParser *parser,
+                                                         GstPad *pad,
+                                                         GstClockTime position);
+GstBuffer * media_descriptor_parser_get_frame_at    (MediaDescriptorParser *parser,
+                                                     GstPad *pad,
+                                                     GstClockTime position);
+GstBuffer * media_descriptor_parser_get_frame_after (MediaDescriptorParser *parser,
                                                      GstPad *pad,
-                                                     GCompareFunc compare_func);
+                                                     GstClockTime position);
+
+MediaDescriptorFrameIter * media_descriptor_parser_iter_frames (MediaDescriptorParser *parser,
+                                                               GstPad *pad);
+
+GstBuffer * media_descriptor_frame_iter_peek        (MediaDescriptorFrameIter *iter);
+GstBuffer * media_descriptor_frame_iter_next        (MediaDescriptorFrameIter *iter);
+void media_descriptor_frame_iter_seek               (MediaDescriptorFrameIter *iter,
+                                                     GstClockTime pts);
+void media_descriptor_frame_iter_free               (MediaDescriptorFrameIter *iter);
 
 GList * media_descriptor_parser_get_pads           (MediaDescriptorParser * parser);
 
@@ -22,19 +22,23 @@
 
 #include "media-descriptor-writer.h"
 #include "media-descriptor-common.h"
+#include "media-descriptor-parser.h"
 #include <string.h>
 
 G_DEFINE_TYPE (MediaDescriptorWriter, media_descriptor_writer, G_TYPE_OBJECT);
 
-#define LOG(test, format, args...) \
-  INSANITY_LOG (test, "mediadescwriter", INSANITY_LOG_LEVEL_DEBUG, format, ##args)
-#define ERROR(test, format, args...) \
-  INSANITY_LOG (test, "mediadescwriter", INSANITY_LOG_LEVEL_SPAM, format, ##args)
+/* The writer can be used outside of any test, in which case it stays silent */
+#define LOG(test, format, args...) G_STMT_START { \
+  if (test) \
+    INSANITY_LOG (test, "mediadescwriter", INSANITY_LOG_LEVEL_DEBUG, format, ##args); \
+} G_STMT_END
+#define ERROR(test, format, args...) G_STMT_START { \
+  if (test) \
+    INSANITY_LOG (test, "mediadescwriter", INSANITY_LOG_LEVEL_SPAM, format, ##args); \
+} G_STMT_END
 
 #define STR_APPEND(arg, nb_white)  \
-  tmpstr = res; \
-  res = g_strdup_printf ("%s%*s%s%s", res, (nb_white), " ", (arg), "\n"); \
-  g_free (tmpstr);
+  g_string_append_printf (res, "%*s%s%s", (nb_white), " ", (arg), "\n");
 
 #define STR_APPEND0(arg) STR_APPEND((arg), 0)
 #define STR_APPEND1(arg) STR_APPEND((arg), 2)
@@ -56,6 +60,7 @@ struct _MediaDescriptorWriterPrivate
 
   GList *serialized_string;
   guint stream_id;
+  gboolean checksum_frames;
 };
 
 static void
@@ -102,6 +107,7 @@ media_descriptor_writer_init (MediaDescriptorWriter * writer)
   priv->test = NULL;
   priv->serialized_string = NULL;
   priv->stream_id = 0;
+  priv->checksum_frames = FALSE;
 }
 
 static void
@@ -119,14 +125,17 @@ media_descriptor_writer_class_init (MediaDescriptorWriterClass * self_class)
 static gchar *
 serialize_filenode (MediaDescriptorWriter * writer)
 {
-  gchar *res, *tmpstr;
+  gchar *tmpstr;
+  GString *res;
   GList *tmp, *tmp2;
   FileNode *filenode = writer->priv->filenode;
 
-  res = g_markup_printf_escaped ("<file duration=\"%" G_GUINT64_FORMAT
+  tmpstr = g_markup_printf_escaped ("<file duration=\"%" G_GUINT64_FORMAT
       "\" frame-detection=\"%i\" location=\"%s\" seekable=\"%i\">",
       filenode->duration, filenode->frame_detection, filenode->location,
       filenode->seekable);
+  res = g_string_new (tmpstr);
+  g_free (tmpstr);
 
   STR_APPEND1 ("<streams>");
   for (tmp = filenode->streams; tmp; tmp = tmp->next) {
@@ -134,7 +143,8 @@ serialize_filenode (MediaDescriptorWriter * writer)
 
     STR_APPEND2 (snode->str_open);
 
-    for (tmp2 = snode->frames; tmp2; tmp2 = tmp2->next) {
+    /* Frames are prepended as they come */
+    for (tmp2 = g_list_last (snode->frames); tmp2; tmp2 = tmp2->prev) {
       STR_APPEND3 (((FrameNode *) tmp2->data)->str_open);
     }
     STR_APPEND2 (snode->str_close);
@@ -153,7 +163,7 @@ serialize_filenode (MediaDescriptorWriter * writer)
 
   STR_APPEND0 (filenode->str_close);
 
-  return res;
+  return g_string_free (res, FALSE);
 }
 
 /* Public methods */
@@ -164,7 +174,7 @@ media_descriptor_writer_new (InsanityTest * test,
   MediaDescriptorWriter *writer;
   FileNode *fnode;
 
-  g_return_val_if_fail (INSANITY_IS_TEST (test), NULL);
+  g_return_val_if_fail (test == NULL || INSANITY_IS_TEST (test), NULL);
 
   writer = g_object_new (MEDIA_DESCRIPTOR_WRITER_TYPE, NULL);
   writer->priv->test = test;
@@ -294,8 +304,10 @@ media_descriptor_writer_add_frame (MediaDescriptorWriter * writer,
     StreamNode *streamnode = (StreamNode *) tmp->data;
 
     if (streamnode->pad == pad) {
-      guint id = g_list_length (streamnode->frames);
+      guint id = streamnode->frames ?
+          ((FrameNode *) streamnode->frames->data)->id + 1 : 0;
       FrameNode *fnode = g_slice_new0 (FrameNode);
+      gchar *frame_str, *checksum_str = NULL;
 
       fnode->id = id;
       fnode->offset = GST_BUFFER_OFFSET (buf);
@@ -306,17 +318,31 @@ media_descriptor_writer_add_frame (MediaDescriptorWriter * writer,
       fnode->is_keyframe = (GST_BUFFER_FLAG_IS_SET (buf,
               GST_BUFFER_FLAG_DELTA_UNIT) == FALSE);
 
-      fnode->str_open =
+      if (writer->priv->checksum_frames) {
+        fnode->has_checksum = TRUE;
+        fnode->checksum = buffer_compute_checksum (buf);
+      }
+
+      frame_str =
           g_markup_printf_escaped (" <frame duration=\"%" G_GUINT64_FORMAT
           "\" id=\"%i\" is-keyframe=\"%i\" offset=\"%" G_GUINT64_FORMAT
           "\" offset-end=\"%" G_GUINT64_FORMAT "\" pts=\"%"
-          G_GUINT64_FORMAT "\"  dts=\"%" G_GUINT64_FORMAT "\" />",
+          G_GUINT64_FORMAT "\"  dts=\"%" G_GUINT64_FORMAT "\"",
           fnode->duration, id, fnode->is_keyframe,
           fnode->offset, fnode->offset_end, fnode->pts, fnode->dts);
 
+      if (fnode->has_checksum)
+        checksum_str = g_strdup_printf (" checksum=\"0x%016"
+            G_GINT64_MODIFIER "x\"", fnode->checksum);
+
+      fnode->str_open = g_strconcat (frame_str,
+          checksum_str ? checksum_str : "", " />", NULL);
+      g_free (frame_str);
+      g_free (checksum_str);
+
       fnode->str_close = NULL;
 
-      streamnode->frames = g_list_append (streamnode->frames, fnode);
+      streamnode->frames = g_list_prepend (streamnode->frames, fnode);
       return TRUE;
     }
   }
@@ -324,6 +350,23 @@ media_descriptor_writer_add_frame (MediaDescriptorWriter * writer,
   return FALSE;
 }
 
+/**
+ * media_descriptor_writer_set_checksum_frames:
+ * @writer: The #MediaDescriptorWriter
+ * @checksum_frames: Whether to store a checksum of each frame payload
+ *
+ * When enabled, a 64 bits checksum of the payload of each buffer passed to
+ * #media_descriptor_writer_add_frame is stored in the descriptor so that the
+ * content of the frames can be verified later on.
+ */
+void
+media_descriptor_writer_set_checksum_frames (MediaDescriptorWriter * writer,
+    gboolean checksum_frames)
+{
+  g_return_if_fail (IS_MEDIA_DESCRIPTOR_WRITER (writer));
+
+  writer->priv->checksum_frames = checksum_frames;
+}
 
 gboolean
 media_descriptor_writer_write (MediaDescriptorWriter * writer,
@@ -340,6 +383,9 @@ media_descriptor_writer_write (MediaDescriptorWriter * writer,
   if (g_file_set_contents (filename, serialized, -1, NULL) == TRUE)
     ret = TRUE;
 
+  /* The file can be rewritten within the mtime granularity, do not rely on
+   * the cache noticing it */
+  media_descriptor_parser_invalidate_cache (filename);
 
   g_free (serialized);
 
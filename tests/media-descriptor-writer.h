@@ -71,6 +71,8 @@ gboolean media_descriptor_writer_add_taglist        (MediaDescriptorWriter *writ
 gboolean media_descriptor_writer_add_frame          (MediaDescriptorWriter *writer,
                                                      GstPad *pad,
                                                      GstBuffer *buf);
+void media_descriptor_writer_set_checksum_frames   (MediaDescriptorWriter *writer,
+                                                     gboolean checksum_frames);
 gboolean media_descriptor_writer_add_tags           (MediaDescriptorWriter *writer,
                                                      GstPad *pad,
                                                      GstTagList *taglist);
@@ -0,0 +1,528 @@
+/**
+ * Gstreamer
+ *
+ * Copyright (c) 2012, Collabora Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Generates the .discoverer-expected files used by
+ * insanity-test-gst-discoverer for all the files of a directory tree.
+ *
+ * The output is the one of "gst-discoverer -v", which is what the test
+ * parses. Tag nicks are only compared in english, which is what we get as
+ * long as nobody calls setlocale(). */
+
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+#define EXPECTED_SUFFIX ".discoverer-expected"
+
+/* Files that are never media files */
+static const gchar *ignored_suffixes[] = {
+  EXPECTED_SUFFIX, ".discoverer-timing", ".xml", ".mdcache", ".dccache", NULL
+};
+
+static gint jobs = 0;
+static gint timeout = 10;
+static gboolean force = FALSE;
+static gboolean remove_all = FALSE;
+
+static GOptionEntry options[] = {
+  {"jobs", 'j', 0, G_OPTION_ARG_INT, &jobs,
+      "Number of files to process at once (default: number of cores)", "N"},
+  {"timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+      "Seconds after which the discovery of a file is given up on "
+        "(default: 10)", "S"},
+  {"force", 'f', 0, G_OPTION_ARG_NONE, &force,
+      "Regenerate expected files even if they are up to date", NULL},
+  {"remove-all", 'r', 0, G_OPTION_ARG_NONE, &remove_all,
+      "Remove all the expected files instead of generating them", NULL},
+  {NULL}
+};
+
+/* Shared between the workers, read only once they started */
+static guint n_files = 0;
+static gint64 start_time = 0;
+
+/* Statistics */
+G_LOCK_DEFINE_STATIC (stats);
+static guint n_done = 0;
+static guint n_generated = 0;
+static guint n_skipped = 0;
+static guint n_failed = 0;
+
+static gboolean
+is_ignored (const gchar * name)
+{
+  guint i;
+
+  if (name[0] == '.')
+    return TRUE;
+
+  for (i = 0; ignored_suffixes[i]; i++) {
+    if (g_str_has_suffix (name, ignored_suffixes[i]))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Collects the media files, or the expected files if @expected is TRUE */
+static void
+collect_files (const gchar * path, GPtrArray * files, gboolean expected)
+{
+  GDir *dir;
+  const gchar *name;
+
+  dir = g_dir_open (path, 0, NULL);
+  if (dir == NULL) {
+    /* Never remove a media file given on the command line */
+    if (g_file_test (path, G_FILE_TEST_IS_REGULAR)
+        && (!expected || g_str_has_suffix (path, EXPECTED_SUFFIX)))
+      g_ptr_array_add (files, g_strdup (path));
+
+    return;
+  }
+
+  while ((name = g_dir_read_name (dir))) {
+    gchar *child;
+
+    if (name[0] == '.')
+      continue;
+
+    child = g_build_filename (path, name, NULL);
+    if (g_file_test (child, G_FILE_TEST_IS_DIR))
+      collect_files (child, files, expected);
+    else if (g_file_test (child, G_FILE_TEST_IS_REGULAR)) {
+      if (expected ? g_str_has_suffix (name, EXPECTED_SUFFIX) :
+          !is_ignored (name))
+        g_ptr_array_add (files, g_strdup (child));
+    }
+    g_free (child);
+  }
+
+  g_dir_close (dir);
+}
+
+static gboolean
+expected_is_up_to_date (const gchar * location, const gchar * expected)
+{
+  GStatBuf media_st, expected_st;
+
+  if (g_stat (location, &media_st) != 0
+      || g_stat (expected, &expected_st) != 0)
+    return FALSE;
+
+  return expected_st.st_mtime >= media_st.st_mtime;
+}
+
+static void
+append_line (GString * s, gint depth, const gchar * format, ...)
+{
+  va_list args;
+
+  while (depth-- > 0)
+    g_string_append (s, "  ");
+
+  va_start (args, format);
+  g_string_append_vprintf (s, format, args);
+  va_end (args);
+}
+
+static void
+append_tags (GString * s, gint depth, const GstTagList * tags)
+{
+  gchar *tmp;
+
+  append_line (s, depth, "Tags:\n");
+  if (tags) {
+    tmp = gst_tag_list_to_string (tags);
+    append_line (s, depth, "  %s\n", tmp);
+    g_free (tmp);
+  } else {
+    append_line (s, depth, "  None\n");
+  }
+}
+
+static void
+append_audio_info (GString * s, gint depth, GstDiscovererAudioInfo * info)
+{
+  const gchar *language = gst_discoverer_audio_info_get_language (info);
+
+  append_line (s, depth, "Language: %s\n", language ? language : "<unknown>");
+  append_line (s, depth, "Channels: %u\n",
+      gst_discoverer_audio_info_get_channels (info));
+  append_line (s, depth, "Sample rate: %u\n",
+      gst_discoverer_audio_info_get_sample_rate (info));
+  append_line (s, depth, "Depth: %u\n",
+      gst_discoverer_audio_info_get_depth (info));
+  append_line (s, depth, "Bitrate: %u\n",
+      gst_discoverer_audio_info_get_bitrate (info));
+  append_line (s, depth, "Max bitrate: %u\n",
+      gst_discoverer_audio_info_get_max_bitrate (info));
+}
+
+static void
+append_video_info (GString * s, gint depth, GstDiscovererVideoInfo * info)
+{
+  append_line (s, depth, "Width: %u\n",
+      gst_discoverer_video_info_get_width (info));
+  append_line (s, depth, "Height: %u\n",
+      gst_discoverer_video_info_get_height (info));
+  append_line (s, depth, "Depth: %u\n",
+      gst_discoverer_video_info_get_depth (info));
+  append_line (s, depth, "Frame rate: %u/%u\n",
+      gst_discoverer_video_info_get_framerate_num (info),
+      gst_discoverer_video_info_get_framerate_denom (info));
+  append_line (s, depth, "Pixel aspect ratio: %u/%u\n",
+      gst_discoverer_video_info_get_par_num (info),
+      gst_discoverer_video_info_get_par_denom (info));
+  append_line (s, depth, "Interlaced: %s\n",
+      gst_discoverer_video_info_is_interlaced (info) ? "true" : "false");
+  append_line (s, depth, "Bitrate: %u\n",
+      gst_discoverer_video_info_get_bitrate (info));
+  append_line (s, depth, "Max bitrate: %u\n",
+      gst_discoverer_video_info_get_max_bitrate (info));
+}
+
+static void
+append_subtitle_info (GString * s, gint depth,
+    GstDiscovererSubtitleInfo * info)
+{
+  const gchar *language = gst_discoverer_subtitle_info_get_language (info);
+
+  append_line (s, depth, "Language: %s\n", language ? language : "<unknown>");
+}
+
+static void
+append_stream_info (GString * s, gint depth, GstDiscovererStreamInfo * info)
+{
+  gchar *desc = NULL, *tmp;
+  GstCaps *caps;
+  const GstStructure *misc;
+
+  caps = gst_discoverer_stream_info_get_caps (info);
+  if (caps) {
+    desc = gst_caps_to_string (caps);
+    gst_caps_unref (caps);
+  }
+
+  append_line (s, depth, "%s: %s\n",
+      gst_discoverer_stream_info_get_stream_type_nick (info),
+      GST_STR_NULL (desc));
+
+  if (GST_IS_DISCOVERER_AUDIO_INFO (info) == FALSE
+      && GST_IS_DISCOVERER_VIDEO_INFO (info) == FALSE
+      && GST_IS_DISCOVERER_SUBTITLE_INFO (info) == FALSE)
+    goto done;
+
+  depth++;
+  append_line (s, depth, "Codec:\n");
+  append_line (s, depth, "  %s\n", GST_STR_NULL (desc));
+
+  append_line (s, depth, "Additional info:\n");
+  misc = gst_discoverer_stream_info_get_misc (info);
+  if (misc) {
+    tmp = gst_structure_to_string (misc);
+    append_line (s, depth, "  %s\n", tmp);
+    g_free (tmp);
+  } else {
+    append_line (s, depth, "  None\n");
+  }
+
+  if (GST_IS_DISCOVERER_AUDIO_INFO (info))
+    append_audio_info (s, depth, GST_DISCOVERER_AUDIO_INFO (info));
+  else if (GST_IS_DISCOVERER_VIDEO_INFO (info))
+    append_video_info (s, depth, GST_DISCOVERER_VIDEO_INFO (info));
+  else
+    append_subtitle_info (s, depth, GST_DISCOVERER_SUBTITLE_INFO (info));
+
+  append_tags (s, depth, gst_discoverer_stream_info_get_tags (info));
+
+done:
+  g_free (desc);
+}
+
+static void
+append_topology (GString * s, gint depth, GstDiscovererStreamInfo * info)
+{
+  GstDiscovererStreamInfo *next;
+  GList *streams, *tmp;
+
+  append_stream_info (s, depth, info);
+
+  next = gst_discoverer_stream_info_get_next (info);
+  if (next) {
+    append_topology (s, depth + 1, next);
+    gst_discoverer_stream_info_unref (next);
+  } else if (GST_IS_DISCOVERER_CONTAINER_INFO (info)) {
+    streams =
+        gst_discoverer_container_info_get_streams (GST_DISCOVERER_CONTAINER_INFO
+        (info));
+    for (tmp = streams; tmp; tmp = tmp->next)
+      append_topology (s, depth + 1, tmp->data);
+    gst_discoverer_stream_info_list_free (streams);
+  }
+}
+
+/* Serialized the same way search_tag() in the discoverer test does */
+static gboolean
+append_property_tag (GQuark field_id, const GValue * value, GString * s)
+{
+  gchar *ser;
+
+  if (G_VALUE_HOLDS_STRING (value))
+    ser = g_value_dup_string (value);
+  else if (GST_VALUE_HOLDS_SAMPLE (value)) {
+    GstSample *smpl = gst_value_get_sample (value);
+    GstBuffer *buf = gst_sample_get_buffer (smpl);
+    GstCaps *caps = gst_sample_get_caps (smpl);
+    gchar *caps_str;
+
+    caps_str = caps ? gst_caps_to_string (caps) : g_strdup ("unknown");
+    ser =
+        g_strdup_printf ("<GstSample [%" G_GSIZE_FORMAT " bytes, type %s]>",
+        gst_buffer_get_size (buf), caps_str);
+    g_free (caps_str);
+  } else
+    ser = gst_value_serialize (value);
+
+  append_line (s, 3, "%s: %s\n",
+      gst_tag_get_nick (g_quark_to_string (field_id)), ser);
+  g_free (ser);
+
+  return TRUE;
+}
+
+static void
+append_properties (GString * s, GstDiscovererInfo * info)
+{
+  const GstTagList *tags;
+
+  append_line (s, 2, "Duration: %" GST_TIME_FORMAT "\n",
+      GST_TIME_ARGS (gst_discoverer_info_get_duration (info)));
+  append_line (s, 2, "Seekable: %s\n",
+      gst_discoverer_info_get_seekable (info) ? "yes" : "no");
+
+  if ((tags = gst_discoverer_info_get_tags (info))) {
+    append_line (s, 2, "Tags: \n");
+    gst_structure_foreach ((const GstStructure *) tags,
+        (GstStructureForeachFunc) append_property_tag, s);
+  }
+}
+
+/* Must be called with the stats lock taken */
+static void
+report (const gchar * location, const gchar * status, const gchar * details)
+{
+  gdouble elapsed = (g_get_monotonic_time () - start_time) / (gdouble)
+      G_USEC_PER_SEC;
+
+  n_done++;
+  g_print ("[%u/%u] %s: %s%s%s (%.2f files/s)\n", n_done, n_files,
+      location, status, details ? ", " : "", details ? details : "",
+      elapsed > 0 ? n_done / elapsed : 0);
+}
+
+static void
+generate_expected (gchar * location, gpointer unused)
+{
+  GError *err = NULL;
+  gchar *uri = NULL, *expected, *errmsg = NULL;
+  GString *s = NULL;
+  GstDiscoverer *discoverer = NULL;
+  GstDiscovererInfo *info = NULL;
+  GstDiscovererStreamInfo *sinfo = NULL;
+
+  expected = g_strconcat (location, EXPECTED_SUFFIX, NULL);
+  if (force == FALSE && expected_is_up_to_date (location, expected)) {
+    G_LOCK (stats);
+    n_skipped++;
+    report (location, "up to date", NULL);
+    G_UNLOCK (stats);
+    goto done;
+  }
+
+  uri = gst_filename_to_uri (location, &err);
+  if (uri == NULL)
+    goto failed;
+
+  discoverer = gst_discoverer_new (timeout * GST_SECOND, &err);
+  if (discoverer == NULL)
+    goto failed;
+
+  /* Like gst-discoverer, we still write what was found when the discovery
+   * only partially succeeded, e.g. because of missing plugins */
+  info = gst_discoverer_discover_uri (discoverer, uri, &err);
+  if (info)
+    sinfo = gst_discoverer_info_get_stream_info (info);
+  if (sinfo == NULL) {
+    if (err == NULL)
+      errmsg = g_strdup ("No stream found");
+    goto failed;
+  }
+  g_clear_error (&err);
+
+  s = g_string_new (NULL);
+  g_string_append_printf (s, "Analyzing %s\n", uri);
+  g_string_append_printf (s, "Done discovering %s\n", uri);
+  g_string_append (s, "\nTopology:\n");
+  append_topology (s, 1, sinfo);
+  g_string_append (s, "\nProperties:\n");
+  append_properties (s, info);
+
+  if (!g_file_set_contents (expected, s->str, s->len, &err))
+    goto failed;
+
+  G_LOCK (stats);
+  n_generated++;
+  report (location, "generated",
+      gst_discoverer_info_get_result (info) ==
+      GST_DISCOVERER_OK ? NULL : "partial results");
+  G_UNLOCK (stats);
+
+done:
+  g_free (uri);
+  g_free (expected);
+  g_free (errmsg);
+  g_free (location);
+
+  if (s)
+    g_string_free (s, TRUE);
+  if (sinfo)
+    gst_discoverer_stream_info_unref (sinfo);
+  if (info)
+    gst_discoverer_info_unref (info);
+  if (discoverer)
+    g_object_unref (discoverer);
+  return;
+
+failed:
+  G_LOCK (stats);
+  n_failed++;
+  report (location, "failed", err ? err->message : errmsg);
+  G_UNLOCK (stats);
+  g_clear_error (&err);
+
+  goto done;
+}
+
+static guint
+remove_expected_files (GPtrArray * files)
+{
+  guint i, n_removed = 0;
+
+  for (i = 0; i < files->len; i++) {
+    const gchar *location = g_ptr_array_index (files, i);
+
+    g_print ("Removing %s ...\n", location);
+    if (g_unlink (location) == 0)
+      n_removed++;
+    else
+      g_printerr ("Could not remove %s\n", location);
+  }
+
+  return n_removed;
+}
+
+static gint
+get_n_processors (void)
+{
+#if GLIB_CHECK_VERSION (2, 36, 0)
+  return g_get_num_processors ();
+#else
+  glong n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? n : 1;
+#endif
+}
+
+int
+main (int argc, char **argv)
+{
+  guint i, n_removed;
+  gdouble elapsed;
+  GError *err = NULL;
+  GPtrArray *files;
+  GThreadPool *pool;
+  GOptionContext *ctx;
+
+#if !GLIB_CHECK_VERSION (2, 32, 0)
+  g_thread_init (NULL);
+#endif
+
+  ctx = g_option_context_new ("DIRECTORY... - generate discoverer expected "
+      "files");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_option_context_free (ctx);
+    g_clear_error (&err);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (argc < 2) {
+    g_printerr ("Usage: %s [OPTION...] DIRECTORY...\n", argv[0]);
+    return 1;
+  }
+
+  files = g_ptr_array_new_with_free_func (g_free);
+  for (i = 1; i < argc; i++)
+    collect_files (argv[i], files, remove_all);
+
+  if (remove_all) {
+    n_files = files->len;
+    n_removed = remove_expected_files (files);
+    g_print ("%u expected files removed\n", n_removed);
+    g_ptr_array_free (files, TRUE);
+
+    return n_removed == n_files ? 0 : 1;
+  }
+
+  if (jobs <= 0)
+    jobs = get_n_processors ();
+  n_files = files->len;
+
+  g_print ("Generating expected files for %u files, %d at once\n",
+      n_files, jobs);
+
+  start_time = g_get_monotonic_time ();
+  pool = g_thread_pool_new ((GFunc) generate_expected, NULL, jobs, TRUE, NULL);
+  /* The workers take ownership of the locations */
+  for (i = 0; i < files->len; i++)
+    g_thread_pool_push (pool, g_ptr_array_index (files, i), NULL);
+  g_ptr_array_set_free_func (files, NULL);
+
+  /* Waits for all the files to be processed */
+  g_thread_pool_free (pool, FALSE, TRUE);
+  g_ptr_array_free (files, TRUE);
+
+  elapsed = (g_get_monotonic_time () - start_time) / (gdouble) G_USEC_PER_SEC;
+  g_print ("%u generated, %u skipped, %u failed in %.1fs (%.2f files/s)\n",
+      n_generated, n_skipped, n_failed, elapsed,
+      elapsed > 0 ? n_files / elapsed : 0);
+
+  return n_failed ? 1 : 0;
+}